@@ -1,4 +1,3 @@
-#define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
 #include "esp_log.h"
 #define LOG_TAG "BMP280 I2C:"
 
@@ -9,6 +8,13 @@
 #define I2C_ACK 0x0
 #define I2C_NACK 0x1
 
+static bmp_tap_t _tap;
+
+void bmp_set_tap(bmp_tap_t tap)
+{
+	_tap = tap;
+}
+
 int8_t read_i2c_registers(uint8_t i2c_addr, uint8_t register_id, uint8_t *data, uint16_t length)
 {
 	i2c_cmd_handle_t cmd;
@@ -32,6 +38,9 @@ int8_t read_i2c_registers(uint8_t i2c_addr, uint8_t register_id, uint8_t *data,
 	ret = i2c_master_cmd_begin(I2C_NUM_0, cmd, 1000 / portTICK_RATE_MS);
 	i2c_cmd_link_delete(cmd);
 
+	if (_tap)
+		_tap(0, register_id, data, length, ret);
+
 	return ret;
 }
 
@@ -62,6 +71,9 @@ int8_t write_i2c_registers(uint8_t i2c_addr, uint8_t register_id, uint8_t *data,
 	ret = i2c_master_cmd_begin(I2C_NUM_0, cmd, 1000 / portTICK_RATE_MS);
 	i2c_cmd_link_delete(cmd);
 
+	if (_tap)
+		_tap(1, register_id, data, length, ret);
+
 	return ret;
 }
 
@@ -76,6 +88,8 @@ int bmp_init(int sda_pin, int scl_pin, int i2c_num)
 
 	bmp.delay_ms = delay_ms;
 	bmp.dev_id = BMP280_I2C_ADDRESS;
+	/* without it the API masks register addresses for SPI writes */
+	bmp.intf = BMP280_I2C_INTF;
 	bmp.read = read_i2c_registers;
 	bmp.write = write_i2c_registers;
 
@@ -120,6 +134,9 @@ int bmp_init(int sda_pin, int scl_pin, int i2c_num)
 		return ESP_FAIL;
 	}
 
+	/* the data registers hold BMP_RAW_SKIPPED until the first conversion, maximum is typical + 15% */
+	delay_ms(bmp280_compute_meas_time(&bmp) * 115 / 100 + 1);
+
 	return ESP_OK;
 }
 
@@ -129,8 +146,14 @@ int bmp_fill_values(bmp_values_t *values)
 
 	if (bmp280_get_uncomp_data(&ucomp_data, &bmp) != 0)
 	{
-		ESP_LOGE(LOG_TAG, "unable to read raw data, panic");
-		return ESP_FAIL;
+		ESP_LOGE(LOG_TAG, "unable to read raw data");
+		return ESP_ERR_TIMEOUT;
+	}
+
+	if (ucomp_data.uncomp_temp == BMP_RAW_SKIPPED || ucomp_data.uncomp_press == BMP_RAW_SKIPPED)
+	{
+		ESP_LOGW(LOG_TAG, "no conversion in the data registers yet");
+		return ESP_ERR_NOT_FINISHED;
 	}
 
 	bmp280_get_comp_temp_double(&(values->temp), ucomp_data.uncomp_temp, &bmp);
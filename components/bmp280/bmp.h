@@ -13,8 +13,24 @@ typedef struct
 	double pres;
 } bmp_values_t;
 
+/*
+Raw register tap for field captures: called after every register read
+(tx = 0) and write (tx = 1) with the result of the I2C transaction.
+*/
+typedef void (*bmp_tap_t)(int tx, uint8_t reg, const uint8_t *data, int length, int result);
+
+void bmp_set_tap(bmp_tap_t tap);
+
+/* raw value of the data registers after a reset and of a skipped measurement */
+#define BMP_RAW_SKIPPED 0x80000
+
+// switches to normal mode and waits for the first conversion
 int bmp_init(int sda_pin, int scl_pin, int i2c_num);
 
+/*
+Reads and compensates the latest conversion. ESP_ERR_NOT_FINISHED if there
+is none yet, the registers still hold BMP_RAW_SKIPPED.
+*/
 int bmp_fill_values(bmp_values_t *values);
 
 #endif // _BMP_H
\ No newline at end of file
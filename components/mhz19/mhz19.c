@@ -1,14 +1,19 @@
-#define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
 #include "esp_log.h"
 #define LOG_TAG "MH-Z19:"
 
+#include <string.h>
+
 #include "mhz19.h"
 
 #define CO2_MAX_FAILS 20
 
 #define BUF_SIZE UART_FIFO_LEN * 2
 
-int _uart_num;
+static int _uart_num;
+
+static mhz19_tap_t _tap;
+
+static mhz19_trace_t _trace;
 
 static char cmd_co2_read[] = {
     0xFF,
@@ -22,7 +27,7 @@ static char cmd_co2_read[] = {
     0x79,
 };
 
-uint8_t mhz_checksum(uint8_t *packet)
+uint8_t mhz_checksum(const uint8_t *packet)
 {
 	uint8_t i;
 	unsigned char checksum = 0;
@@ -35,6 +40,16 @@ uint8_t mhz_checksum(uint8_t *packet)
 	return checksum;
 }
 
+void mhz19_set_tap(mhz19_tap_t tap)
+{
+	_tap = tap;
+}
+
+void mhz19_set_trace(mhz19_trace_t trace)
+{
+	_trace = trace;
+}
+
 int mhz19_init(int pin_tx, int pin_rx, int uart_num)
 {
 	uart_config_t co2_config = {
@@ -56,17 +71,88 @@ int mhz19_init(int pin_tx, int pin_rx, int uart_num)
 	return ESP_OK;
 }
 
-int mhz19_fill_values(mhz19_values_t *values)
+int mhz19_decode(const uint8_t *data, int length, mhz19_values_t *values, int *start)
 {
-	int8_t res;
-	uint8_t checksum;
+	const uint8_t *frame;
+	int i;
 
-	uint8_t data[9];
-	uint8_t count = 0;
+	for (i = 0; i + 1 < length; i++)
+	{
+		if (data[i] == 0xFF && data[i + 1] == 0x86)
+			break;
+	}
 
+	/* a 0xFF in the last byte may still be the start of a frame */
+	if (i + 1 >= length && (i >= length || data[i] != 0xFF))
+		i = length;
+
+	*start = i;
+
+	if (length - i < MHZ19_FRAME_LEN)
+		return ESP_ERR_INVALID_SIZE;
+
+	frame = data + i;
+
+	if (mhz_checksum(frame) != frame[8])
+		return ESP_ERR_INVALID_CRC;
+
+	values->ppm = (uint16_t)((uint16_t)frame[2] << 8 | (uint16_t)frame[3]);
+
+	return ESP_OK;
+}
+
+static int mhz19_read(uint8_t *data, int length, int first)
+{
+	/*
+	Reads up to `length` bytes, giving up after CO2_MAX_FAILS reads without
+	data. Returns the number of bytes read. `first` is set for the start of
+	an answer, whose first byte is reported to the trace hook.
+	*/
+
+	int count = 0;
+	int read;
 	uint8_t fails_count = 0;
 
+	while (count < length)
+	{
+		int wanted = _trace && first && !count ? 1 : length - count;
+
+		read = uart_read_bytes(_uart_num, data + count, wanted, 200 / portTICK_PERIOD_MS);
+
+		if (read <= 0)
+		{
+			if (++fails_count > CO2_MAX_FAILS)
+			{
+				ESP_LOGW(LOG_TAG, "unable to read from co2 sensor");
+				break;
+			}
+			continue;
+		}
+
+		if (_tap)
+			_tap(0, data + count, read);
+		if (_trace && first && !count)
+			_trace(MHZ19_TRACE_FIRST_BYTE);
+		count += read;
+	}
+
+	return count;
+}
+
+int mhz19_fill_values(mhz19_values_t *values)
+{
+	int res;
+	uint8_t data[MHZ19_FRAME_LEN];
+	int count;
+	int start;
+
+	values->ppm = 0;
+
 	uart_flush(_uart_num);
+	if (_trace)
+		_trace(MHZ19_TRACE_COMMAND);
+	if (_tap)
+		_tap(1, (const uint8_t *)cmd_co2_read, sizeof(cmd_co2_read));
 	res = uart_write_bytes(_uart_num, (const char *)cmd_co2_read, sizeof(cmd_co2_read));
 
 	if (res < 0)
@@ -75,35 +161,29 @@ int mhz19_fill_values(mhz19_values_t *values)
 		return ESP_FAIL;
 	}
 
-	while (count < sizeof(data))
-	{
-		count = uart_read_bytes(_uart_num, data + count, sizeof(data) - count, 200 / portTICK_PERIOD_MS);
-		if (count <= 0)
-		{
-			fails_count++;
-		}
+	count = mhz19_read(data, sizeof(data), 1);
+	res = mhz19_decode(data, count, values, &start);
 
-		if (fails_count > CO2_MAX_FAILS)
-		{
-			ESP_LOGW(LOG_TAG, "unable to read from co2 sensor");
-			break;
-		}
+	if (res == ESP_ERR_INVALID_SIZE && start > 0 && count == sizeof(data))
+	{
+		/* the frame started after some noise, read the rest of it */
+		count -= start;
+		memmove(data, data + start, count);
+		count += mhz19_read(data + count, sizeof(data) - count, 0);
+		res = mhz19_decode(data, count, values, &start);
 	}
 
-	checksum = mhz_checksum(data);
-
-	ESP_LOGV(LOG_TAG, "received_checksum is 0x%x", data[8]);
-	ESP_LOGV(LOG_TAG, "Calculated CRC 0x%x", checksum);
+	if (_trace && count == sizeof(data))
+		_trace(MHZ19_TRACE_FRAME);
 
-	if (checksum == data[8])
-	{
-		values->ppm = (uint16_t)((uint16_t)data[2] << 8 | (uint16_t)data[3]);
-	}
-	else
+	switch (res)
 	{
-		values->ppm = 0;
+	case ESP_OK:
+		return ESP_OK;
+	case ESP_ERR_INVALID_SIZE:
+		return ESP_ERR_TIMEOUT;
+	default:
 		ESP_LOGW(LOG_TAG, "wrong checksum");
+		return res;
 	}
-
-	return ESP_OK;
 }
\ No newline at end of file
@@ -1,12 +1,49 @@
 #include "driver/gpio.h"
 #include "driver/uart.h"
 
+#define MHZ19_FRAME_LEN 9
+
 typedef struct
 {
 	uint16_t ppm;
 
 } mhz19_values_t;
 
+/*
+Raw byte tap for field captures: called with every command sent (tx = 1)
+and every chunk read from the sensor (tx = 0).
+*/
+typedef void (*mhz19_tap_t)(int tx, const uint8_t *data, int length);
+
+void mhz19_set_tap(mhz19_tap_t tap);
+
+/*
+Latency trace hook, called by mhz19_fill_values() when the read command is
+written, when the first byte of the answer arrives and when the frame is
+complete. With a hook set the first byte is read on its own.
+*/
+typedef enum
+{
+	MHZ19_TRACE_COMMAND,
+	MHZ19_TRACE_FIRST_BYTE,
+	MHZ19_TRACE_FRAME,
+} mhz19_trace_point_t;
+
+typedef void (*mhz19_trace_t)(mhz19_trace_point_t point);
+
+void mhz19_set_trace(mhz19_trace_t trace);
+
 int mhz19_init(int pin_tx, int pin_rx, int uart_num);
 
-int mhz19_fill_values(mhz19_values_t *values);
\ No newline at end of file
+int mhz19_fill_values(mhz19_values_t *values);
+
+/* checksum byte of a 9 byte packet, over bytes 1 to 7 */
+uint8_t mhz_checksum(const uint8_t *packet);
+
+/*
+Decodes the answer to the read command starting at the first 0xFF 0x86 in
+`data`. `start` is set to the offset of the frame, or of where one could
+still begin. Returns ESP_OK, ESP_ERR_INVALID_SIZE if the frame is incomplete
+and ESP_ERR_INVALID_CRC for a wrong checksum.
+*/
+int mhz19_decode(const uint8_t *data, int length, mhz19_values_t *values, int *start);
\ No newline at end of file
@@ -1,7 +1,8 @@
-#define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
 #include "esp_log.h"
 #define LOG_TAG "PMS7003:"
 
+#include <string.h>
+
 #include "pms7003.h"
 
 #define DUST_RX_BUF_SIZE UART_FIFO_LEN * 2
@@ -27,9 +28,33 @@ static char cmd_pms_read[] = {0x42,
 
 // 0x42 + 0x4D + 0xE2 + 0x00 + 0x00 + 0x01 = 0x171 = 0x1 << 8 + 0x71
 
-int _uart_num;
+static char cmd_pms_sleep[] = {0x42,
+			       0x4D,
+			       0xE4,
+			       0x00,
+			       0x00,
+			       0x01,
+			       0x73};
+
+// 0x42 + 0x4D + 0xE4 + 0x00 + 0x00 = 0x173 = 0x1 << 8 + 0x73
+
+static char cmd_pms_wakeup[] = {0x42,
+				0x4D,
+				0xE4,
+				0x00,
+				0x01,
+				0x01,
+				0x74};
+
+// 0x42 + 0x4D + 0xE4 + 0x00 + 0x01 = 0x174 = 0x1 << 8 + 0x74
+
+static int _uart_num;
 
-uint16_t pms_checksum(uint8_t *buffer, uint8_t length)
+static pms_tap_t _tap;
+
+static pms_trace_t _trace;
+
+uint16_t pms_checksum(const uint8_t *buffer, uint8_t length)
 {
 	uint8_t i;
 	uint16_t result = 0;
@@ -42,6 +67,24 @@ uint16_t pms_checksum(uint8_t *buffer, uint8_t length)
 	return result;
 }
 
+void pms_set_tap(pms_tap_t tap)
+{
+	_tap = tap;
+}
+
+void pms_set_trace(pms_trace_t trace)
+{
+	_trace = trace;
+}
+
+static int pms_write(const char *cmd, int length)
+{
+	if (_tap)
+		_tap(1, (const uint8_t *)cmd, length);
+
+	return uart_write_bytes(_uart_num, cmd, length);
+}
+
 int pms_init(int pin_tx, int pin_rx, int uart_num)
 {
 	uart_config_t dust_config = {
@@ -66,67 +109,166 @@ int pms_init(int pin_tx, int pin_rx, int uart_num)
 
 int pms_set_passive_mode()
 {
-	uart_write_bytes(_uart_num, (const char *)cmd_pms_set_passive_mode, sizeof(cmd_pms_set_passive_mode));
+	pms_write((const char *)cmd_pms_set_passive_mode, sizeof(cmd_pms_set_passive_mode));
 
 	return ESP_OK;
 }
 
-int pms_fill_values(pms_values_t *values)
+int pms_sleep()
 {
-	int8_t res;
-	uint8_t data[32];
-	uint8_t count = 0;
+	/*
+	Stops the fan and the laser. The sensor does not answer read requests
+	until pms_wakeup() is sent.
+	*/
 
-	uint8_t fails_count = 0;
+	if (pms_write((const char *)cmd_pms_sleep, sizeof(cmd_pms_sleep)) < 0)
+	{
+		ESP_LOGE(LOG_TAG, "can't send sleep command to dust sensor");
+		return ESP_FAIL;
+	}
 
-	uint16_t received_checksum;
-	uint16_t calculated_checksum;
+	return ESP_OK;
+}
 
-	uart_flush(_uart_num);
-	res = uart_write_bytes(_uart_num, (const char *)cmd_pms_read, sizeof(cmd_pms_read));
+int pms_wakeup()
+{
+	/*
+	The fan needs about 30 seconds after wakeup before readings are stable,
+	see PMS_WARMUP_DELAY. The sensor may come back in active mode, so passive
+	mode has to be set again by the caller.
+	*/
 
-	if (res < 0)
+	if (pms_write((const char *)cmd_pms_wakeup, sizeof(cmd_pms_wakeup)) < 0)
 	{
-		ESP_LOGE(LOG_TAG, "can't write to dust sensor, panic");
+		ESP_LOGE(LOG_TAG, "can't send wakeup command to dust sensor");
 		return ESP_FAIL;
 	}
 
-	count = 0;
+	return ESP_OK;
+}
 
-	while (count < sizeof(data))
+int pms_decode(const uint8_t *data, int length, pms_values_t *values, int *start)
+{
+	const uint8_t *frame;
+	uint16_t received_checksum;
+	int i;
+
+	/*
+	Answers to commands have the same start bytes but a different length,
+	they are skipped like noise.
+	*/
+	for (i = 0; i + 1 < length; i++)
 	{
-		count = uart_read_bytes(_uart_num, data + count, sizeof(data) - count, 200 / portTICK_PERIOD_MS);
-		ESP_LOGV(LOG_TAG, "read %i bytes", count);
-		if (count <= 0)
-		{
-			fails_count++;
-		}
+		if (data[i] != 0x42 || data[i + 1] != 0x4D)
+			continue;
+		if (i + 3 >= length || ((data[i + 2] << 8) | data[i + 3]) == PMS_FRAME_LEN - 4)
+			break;
+	}
+
+	/* a 0x42 in the last byte may still be the start of a frame */
+	if (i + 1 >= length && (i >= length || data[i] != 0x42))
+		i = length;
+
+	*start = i;
+
+	if (length - i < PMS_FRAME_LEN)
+		return ESP_ERR_INVALID_SIZE;
+
+	frame = data + i;
+
+	received_checksum = (frame[30] << 8) + frame[31];
+	if (received_checksum != pms_checksum(frame, 30))
+		return ESP_ERR_INVALID_CRC;
+
+	values->pm25 = (frame[12] << 8) + frame[13];
+	values->pm100 = (frame[14] << 8) + frame[15];
+
+	return ESP_OK;
+}
+
+static int pms_read(uint8_t *data, int length, int first)
+{
+	/*
+	Reads up to `length` bytes, giving up after PMS_MAX_FAILS reads without
+	data. Returns the number of bytes read. `first` is set for the start of
+	an answer, whose first byte is reported to the trace hook.
+	*/
+
+	int count = 0;
+	int read;
+	uint8_t fails_count = 0;
 
-		if (fails_count > PMS_MAX_FAILS)
+	while (count < length)
+	{
+		int wanted = _trace && first && !count ? 1 : length - count;
+
+		read = uart_read_bytes(_uart_num, data + count, wanted, 200 / portTICK_PERIOD_MS);
+		ESP_LOGV(LOG_TAG, "read %i bytes", read);
+
+		if (read <= 0)
 		{
-			ESP_LOGW(LOG_TAG, "unable to read from dust sensor");
-			break;
+			if (++fails_count > PMS_MAX_FAILS)
+			{
+				ESP_LOGW(LOG_TAG, "unable to read from dust sensor");
+				break;
+			}
+			continue;
 		}
+
+		if (_tap)
+			_tap(0, data + count, read);
+		if (_trace && first && !count)
+			_trace(PMS_TRACE_FIRST_BYTE);
+		count += read;
 	}
 
-	received_checksum = (data[30] << 8) + data[31];
-	calculated_checksum = pms_checksum(data, 30);
+	return count;
+}
+
+int pms_fill_values(pms_values_t *values)
+{
+	int res;
+	uint8_t data[PMS_FRAME_LEN];
+	int count;
+	int start;
 
-	ESP_LOGV(LOG_TAG, "received_checksum is 0x%x", received_checksum);
-	ESP_LOGV(LOG_TAG, "Calculated CRC 0x%x", calculated_checksum);
+	values->pm25 = 0;
+	values->pm100 = 0;
 
-	if (received_checksum == calculated_checksum)
+	uart_flush(_uart_num);
+	if (_trace)
+		_trace(PMS_TRACE_COMMAND);
+	res = pms_write((const char *)cmd_pms_read, sizeof(cmd_pms_read));
+
+	if (res < 0)
 	{
+		ESP_LOGE(LOG_TAG, "can't write to dust sensor, panic");
+		return ESP_FAIL;
+	}
 
-		values->pm25 = (data[12] << 8) + data[13];
-		values->pm100 = (data[14] << 8) + data[15];
+	count = pms_read(data, sizeof(data), 1);
+	res = pms_decode(data, count, values, &start);
+
+	if (res == ESP_ERR_INVALID_SIZE && start > 0 && count == sizeof(data))
+	{
+		/* the frame started after some noise, read the rest of it */
+		count -= start;
+		memmove(data, data + start, count);
+		count += pms_read(data + count, sizeof(data) - count, 0);
+		res = pms_decode(data, count, values, &start);
 	}
-	else
+
+	if (_trace && count == sizeof(data))
+		_trace(PMS_TRACE_FRAME);
+
+	switch (res)
 	{
-		values->pm25 = 0;
-		values->pm100 = 0;
+	case ESP_OK:
+		return ESP_OK;
+	case ESP_ERR_INVALID_SIZE:
+		return ESP_ERR_TIMEOUT;
+	default:
 		ESP_LOGW(LOG_TAG, "wrong checksum");
+		return res;
 	}
-
-	return ESP_OK;
 }
\ No newline at end of file
@@ -9,16 +9,60 @@
 
 #define PMS_MAX_FAILS 100
 
+#define PMS_WARMUP_DELAY 30000 // milliseconds, from the datasheet
+
+#define PMS_FRAME_LEN 32
+
 typedef struct
 {
 	uint16_t pm25;
 	uint16_t pm100;
 } pms_values_t;
 
+/*
+Raw byte tap for field captures: called with every command sent (tx = 1)
+and every chunk read from the sensor (tx = 0).
+*/
+typedef void (*pms_tap_t)(int tx, const uint8_t *data, int length);
+
+void pms_set_tap(pms_tap_t tap);
+
+/*
+Latency trace hook, called by pms_fill_values() when the read command is
+written, when the first byte of the answer arrives and when the frame is
+complete. With a hook set the first byte is read on its own.
+*/
+typedef enum
+{
+	PMS_TRACE_COMMAND,
+	PMS_TRACE_FIRST_BYTE,
+	PMS_TRACE_FRAME,
+} pms_trace_point_t;
+
+typedef void (*pms_trace_t)(pms_trace_point_t point);
+
+void pms_set_trace(pms_trace_t trace);
+
 int pms_set_passive_mode();
 
+int pms_sleep();
+
+int pms_wakeup();
+
 int pms_init(int pin_tx, int pin_rx, int uart_num);
 
 int pms_fill_values(pms_values_t *values);
 
+/* sum of the first `length` bytes of a frame */
+uint16_t pms_checksum(const uint8_t *buffer, uint8_t length);
+
+/*
+Decodes the first data frame in `data`, bytes before it are noise, command
+answers or the tail of an older frame. `start` is set to the offset of the
+frame, or of where one could still begin. Returns ESP_OK,
+ESP_ERR_INVALID_SIZE if the frame is incomplete and ESP_ERR_INVALID_CRC for
+a wrong checksum.
+*/
+int pms_decode(const uint8_t *data, int length, pms_values_t *values, int *start);
+
 #endif // _PMS7003_H
\ No newline at end of file
@@ -0,0 +1,500 @@
+/*
+Microbenchmarks of the per-cycle hot paths: frame checksums and decoding,
+BMP280 compensation in all three arithmetic variants, formatting of an MQTT
+update and semaphore round trips through the shim. Results go to stdout as
+JSON, one entry per benchmark with nanoseconds per operation over several
+repeats; compare the medians between builds.
+
+    bench [--filter SUBSTRING] [--repeats N] [--min-ms N]
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/utsname.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_event.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+
+#include "shim.h"
+
+#include "dust_sensor.h"
+
+#include "bmp280.h"
+
+#define BENCH_MAX_REPEATS 101
+
+#ifndef BENCH_BUILD_TYPE
+#define BENCH_BUILD_TYPE "unknown"
+#endif
+
+typedef struct
+{
+    const char *name;
+    const char *op; // what one operation is
+    void (*run)(uint32_t iterations);
+} bench_t;
+
+// results go here so the compiler keeps the work
+static volatile uint32_t sink;
+
+static const char *filter;
+static int repeats = 9;
+static uint64_t min_time = 50000000; // ns per repeat
+
+/* Frames */
+
+// checksum left out, pms_resync gets a copy with it
+static const uint8_t pms_frame[32] = {
+    0x42, 0x4D, 0x00, 0x1C, 0x00, 0x08, 0x00, 0x0C, 0x00, 0x14, 0x00, 0x08, 0x00, 0x0C, 0x00, 0x14,
+    0x05, 0xDC, 0x01, 0xF4, 0x00, 0x64, 0x00, 0x0A, 0x00, 0x02, 0x00, 0x01, 0x97, 0x00, 0x00, 0x00,
+};
+
+// noise and a mode change answer in front of the frame, as after switching to passive mode
+static uint8_t pms_resync[48];
+
+static uint8_t co2_frame[9] = {0xFF, 0x86, 0x02, 0x8A, 0x40, 0x00, 0x00, 0x00, 0x00};
+
+static void frames_init(void)
+{
+    static const uint8_t ack[8] = {0x00, 0x42, 0x4D, 0x00, 0x04, 0xE1, 0x00, 0x01};
+    uint16_t checksum = pms_checksum(pms_frame, 30);
+    uint8_t *frame = pms_resync + sizeof(ack) + 8;
+
+    memcpy(pms_resync, ack, sizeof(ack));
+    memset(pms_resync + sizeof(ack), 0x5A, 8);
+    memcpy(frame, pms_frame, 32);
+    frame[30] = checksum >> 8;
+    frame[31] = checksum & 0xff;
+    pms_resync[sizeof(ack) + 7] = 0x42; // a false start
+    co2_frame[8] = mhz_checksum(co2_frame);
+}
+
+static void bench_pms_checksum(uint32_t iterations)
+{
+    uint32_t sum = 0;
+
+    for (uint32_t i = 0; i < iterations; i++)
+        sum += pms_checksum(pms_frame, 30);
+
+    sink = sum;
+}
+
+static void bench_mhz_checksum(uint32_t iterations)
+{
+    uint32_t sum = 0;
+
+    for (uint32_t i = 0; i < iterations; i++)
+        sum += mhz_checksum(co2_frame);
+
+    sink = sum;
+}
+
+static void bench_pms_decode(uint32_t iterations)
+{
+    const uint8_t *frame = pms_resync + 16;
+    pms_values_t values;
+    uint32_t sum = 0;
+    int start;
+
+    for (uint32_t i = 0; i < iterations; i++)
+        sum += pms_decode(frame, 32, &values, &start) + values.pm25;
+
+    sink = sum;
+}
+
+static void bench_pms_decode_resync(uint32_t iterations)
+{
+    pms_values_t values;
+    uint32_t sum = 0;
+    int start;
+
+    for (uint32_t i = 0; i < iterations; i++)
+        sum += pms_decode(pms_resync, sizeof(pms_resync), &values, &start) + start;
+
+    sink = sum;
+}
+
+static void bench_mhz19_decode(uint32_t iterations)
+{
+    mhz19_values_t values;
+    uint32_t sum = 0;
+    int start;
+
+    for (uint32_t i = 0; i < iterations; i++)
+        sum += mhz19_decode(co2_frame, sizeof(co2_frame), &values, &start) + values.ppm;
+
+    sink = sum;
+}
+
+/* BMP280 compensation, with the sample calibration of the datasheet */
+
+static int8_t bmp_dummy_io(uint8_t dev_id, uint8_t reg_addr, uint8_t *data, uint16_t len)
+{
+    return BMP280_OK;
+}
+
+static void bmp_dummy_delay(uint32_t period)
+{
+}
+
+static struct bmp280_dev bmp_dev = {
+    .read = bmp_dummy_io,
+    .write = bmp_dummy_io,
+    .delay_ms = bmp_dummy_delay,
+    .calib_param = {
+        .dig_t1 = 27504, .dig_t2 = 26435, .dig_t3 = -1000,
+        .dig_p1 = 36477, .dig_p2 = -10685, .dig_p3 = 3024, .dig_p4 = 2855, .dig_p5 = 140,
+        .dig_p6 = -7, .dig_p7 = 15500, .dig_p8 = -14600, .dig_p9 = 6000,
+    },
+};
+
+// the datasheet example, 25.08 C and 100653 Pa, varied so nothing is folded
+static const int32_t bmp_raw_temp = 519888;
+static const uint32_t bmp_raw_pres = 415148;
+
+static void bench_bmp280_temp_double(uint32_t iterations)
+{
+    double temp, sum = 0;
+
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        bmp280_get_comp_temp_double(&temp, bmp_raw_temp + (i & 15), &bmp_dev);
+        sum += temp;
+    }
+
+    sink = sum;
+}
+
+static void bench_bmp280_temp_32bit(uint32_t iterations)
+{
+    int32_t temp, sum = 0;
+
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        bmp280_get_comp_temp_32bit(&temp, bmp_raw_temp + (i & 15), &bmp_dev);
+        sum += temp;
+    }
+
+    sink = sum;
+}
+
+static void bench_bmp280_pres_double(uint32_t iterations)
+{
+    double pres, sum = 0;
+
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        bmp280_get_comp_pres_double(&pres, bmp_raw_pres + (i & 15), &bmp_dev);
+        sum += pres;
+    }
+
+    sink = sum;
+}
+
+static void bench_bmp280_pres_32bit(uint32_t iterations)
+{
+    uint32_t pres, sum = 0;
+
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        bmp280_get_comp_pres_32bit(&pres, bmp_raw_pres + (i & 15), &bmp_dev);
+        sum += pres;
+    }
+
+    sink = sum;
+}
+
+static void bench_bmp280_pres_64bit(uint32_t iterations)
+{
+    uint32_t pres, sum = 0;
+
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        bmp280_get_comp_pres_64bit(&pres, bmp_raw_pres + (i & 15), &bmp_dev);
+        sum += pres;
+    }
+
+    sink = sum;
+}
+
+/* MQTT update and semaphores, in a shim task */
+
+static esp_mqtt_client_handle_t client;
+static uint32_t published;
+static SemaphoreHandle_t ping;
+static SemaphoreHandle_t pong;
+
+static int count_connect(void *ctx, esp_mqtt_client_handle_t client, const esp_mqtt_client_config_t *config)
+{
+    return ESP_OK;
+}
+
+static void count_disconnect(void *ctx, esp_mqtt_client_handle_t client)
+{
+}
+
+static int count_publish(void *ctx, esp_mqtt_client_handle_t client, const char *topic, const char *data, int len,
+                         int qos, int retain)
+{
+    published++;
+
+    return ESP_OK;
+}
+
+static int count_subscribe(void *ctx, esp_mqtt_client_handle_t client, const char *topic, int qos)
+{
+    return ESP_OK;
+}
+
+static void filtered_init(filter_output_t *output, float value)
+{
+    output->count = 100;
+    output->ema = value;
+    output->median = value;
+    output->mean = value;
+    output->stddev = value / 20;
+    output->min = value * 0.9;
+    output->max = value * 1.1;
+}
+
+static void values_init(void)
+{
+    int64_t now = esp_timer_get_time();
+
+    dust_values.pm25 = 12;
+    dust_values.pm100 = 20;
+    dust_values.frames = 5;
+    filtered_init(&dust_values.pm25_filtered, 12);
+    filtered_init(&dust_values.pm100_filtered, 20);
+    dust_values.pm25_1h = dust_values.pm25_24h = 11.5;
+    dust_values.pm100_1h = dust_values.pm100_24h = 19.5;
+    dust_values.aqi = 50;
+    dust_values.aqi_hours = 24;
+    dust_values.caqi = 20;
+    dust_values.status = SAMPLE_VALID;
+    dust_values.timestamp = now;
+
+    co2_values.ppm = 650;
+    co2_values.frames = 1;
+    filtered_init(&co2_values.ppm_filtered, 650);
+    co2_values.ach = 0.75;
+    co2_values.status = SAMPLE_VALID;
+    co2_values.timestamp = now;
+
+    bmp_values.pres = 101325;
+    bmp_values.temp = 22.5;
+    filtered_init(&bmp_values.pres_filtered, 101325);
+    filtered_init(&bmp_values.temp_filtered, 22.5);
+    bmp_values.pres_sea = 101325;
+    bmp_values.status = SAMPLE_VALID;
+    bmp_values.timestamp = now;
+}
+
+static void bench_mqtt_update(uint32_t iterations)
+{
+    // the clock stands still while the benchmark runs, samples stay valid
+    for (uint32_t i = 0; i < iterations; i++)
+        mqtt_send_update(client, MQTT_TOPIC_PREFIX);
+}
+
+static void bench_semaphore_take_give(uint32_t iterations)
+{
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        xSemaphoreTake(dust_values.lock, SEMAPHORE_TIMEOUT / portTICK_PERIOD_MS);
+        xSemaphoreGive(dust_values.lock);
+    }
+}
+
+static void pong_task(void *arg)
+{
+    for (;;)
+    {
+        xSemaphoreTake(ping, portMAX_DELAY);
+        xSemaphoreGive(pong);
+    }
+}
+
+static void bench_semaphore_ping_pong(uint32_t iterations)
+{
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        xSemaphoreGive(ping);
+        xSemaphoreTake(pong, portMAX_DELAY);
+    }
+}
+
+static const bench_t benchmarks[] = {
+    {"pms_checksum", "30 byte frame", bench_pms_checksum},
+    {"mhz_checksum", "9 byte frame", bench_mhz_checksum},
+    {"pms_decode", "frame at offset 0", bench_pms_decode},
+    {"pms_decode_resync", "frame after an ack and noise", bench_pms_decode_resync},
+    {"mhz19_decode", "frame at offset 0", bench_mhz19_decode},
+    {"bmp280_comp_temp_double", "sample", bench_bmp280_temp_double},
+    {"bmp280_comp_temp_32bit", "sample", bench_bmp280_temp_32bit},
+    {"bmp280_comp_pres_double", "sample", bench_bmp280_pres_double},
+    {"bmp280_comp_pres_32bit", "sample", bench_bmp280_pres_32bit},
+    {"bmp280_comp_pres_64bit", "sample", bench_bmp280_pres_64bit},
+    {"mqtt_send_update", "update of all sensors", bench_mqtt_update},
+    {"semaphore_take_give", "uncontended take and give", bench_semaphore_take_give},
+    {"semaphore_ping_pong", "round trip between two tasks", bench_semaphore_ping_pong},
+};
+
+/* Driver */
+
+static uint64_t host_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void run_benchmark(const bench_t *bench, bool first)
+{
+    double ns[BENCH_MAX_REPEATS];
+    uint32_t iterations = 1;
+    uint64_t elapsed;
+    double mean = 0;
+
+    // enough iterations for min_time per repeat, this also warms the caches
+    for (;;)
+    {
+        uint64_t start = host_ns();
+
+        bench->run(iterations);
+        elapsed = host_ns() - start;
+        if (elapsed >= min_time || iterations >= 1u << 30)
+            break;
+        iterations = elapsed ? iterations * fmin(fmax(2.0 * min_time / elapsed, 2), 100) : iterations * 100;
+    }
+
+    for (int i = 0; i < repeats; i++)
+    {
+        uint64_t start = host_ns();
+
+        bench->run(iterations);
+        ns[i] = (double)(host_ns() - start) / iterations;
+        mean += ns[i] / repeats;
+    }
+    qsort(ns, repeats, sizeof(double), compare_double);
+
+    printf("%s\n    {\"name\": \"%s\", \"op\": \"%s\", \"iterations\": %u, \"repeats\": %d, "
+           "\"ns_per_op\": {\"min\": %.3f, \"median\": %.3f, \"mean\": %.3f, \"max\": %.3f}}",
+           first ? "" : ",", bench->name, bench->op, iterations, repeats, ns[0], ns[repeats / 2], mean,
+           ns[repeats - 1]);
+}
+
+static void bench_task(void *arg)
+{
+    static const shim_mqtt_broker_t count_broker = {
+        .connect = count_connect,
+        .disconnect = count_disconnect,
+        .publish = count_publish,
+        .subscribe = count_subscribe,
+    };
+    esp_mqtt_client_config_t config = {.uri = MQTT_BROKER_URL};
+    wifi_init_config_t wifi_config = WIFI_INIT_CONFIG_DEFAULT();
+    struct utsname host;
+    uint32_t updates_published;
+    bool first = true;
+
+    esp_event_loop_create_default();
+    esp_wifi_init(&wifi_config);
+    esp_wifi_start();
+    esp_wifi_connect();
+
+    shim_mqtt_set_broker(&count_broker);
+    client = esp_mqtt_client_init(&config);
+    vTaskDelay(1000 / portTICK_PERIOD_MS);
+    esp_mqtt_client_start(client);
+    vTaskDelay(1000 / portTICK_PERIOD_MS);
+
+    // stale checks read the periods from the runtime configuration
+    eg_app_status = xEventGroupCreate();
+    config_init();
+
+    dust_values.lock = xSemaphoreCreateBinary();
+    co2_values.lock = xSemaphoreCreateBinary();
+    bmp_values.lock = xSemaphoreCreateBinary();
+    xSemaphoreGive(dust_values.lock);
+    xSemaphoreGive(co2_values.lock);
+    xSemaphoreGive(bmp_values.lock);
+    values_init();
+
+    ping = xSemaphoreCreateBinary();
+    pong = xSemaphoreCreateBinary();
+    xTaskCreate(pong_task, "pong", 2048, NULL, 10, NULL);
+
+    frames_init();
+
+    // one update, to check that every value goes out
+    published = 0;
+    mqtt_send_update(client, MQTT_TOPIC_PREFIX);
+    updates_published = published;
+
+    uname(&host);
+    printf("{\n  \"schema\": 1,\n  \"host\": \"%s %s\",\n  \"compiler\": \"%s\",\n  \"build_type\": \"%s\",\n"
+           "  \"messages_per_update\": %u,\n  \"benchmarks\": [",
+           host.sysname, host.machine, __VERSION__, BENCH_BUILD_TYPE, updates_published);
+
+    for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++)
+    {
+        if (filter && !strstr(benchmarks[i].name, filter))
+            continue;
+
+        run_benchmark(&benchmarks[i], first);
+        first = false;
+        fflush(stdout);
+    }
+
+    printf("\n  ]\n}\n");
+    exit(0);
+}
+
+int main(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--filter") && i + 1 < argc)
+            filter = argv[++i];
+        else if (!strcmp(argv[i], "--repeats") && i + 1 < argc)
+            repeats = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--min-ms") && i + 1 < argc)
+            min_time = strtoull(argv[++i], NULL, 10) * 1000000;
+        else
+        {
+            fprintf(stderr, "usage: %s [--filter SUBSTRING] [--repeats N] [--min-ms N]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (repeats < 1 || repeats > BENCH_MAX_REPEATS)
+    {
+        fprintf(stderr, "--repeats: 1 to %d\n", BENCH_MAX_REPEATS);
+        return 1;
+    }
+
+    shim_log_limit(1);
+    shim_init(SHIM_CLOCK_VIRTUAL);
+    xTaskCreate(bench_task, "bench", 8192, NULL, 10, NULL);
+    shim_run(0);
+
+    return 0;
+}
@@ -0,0 +1,239 @@
+/*
+Fleet load test: the firmware runs once with simulated sensors, and N
+virtual devices publish its values with the firmware's sendMQTTupdate()
+code, each with its own MQTT connection and topic prefix, to a real broker.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/uart.h"
+#include "driver/i2c.h"
+
+#include "shim.h"
+
+#include "dust_sensor.h"
+
+#include "bmp280_sim.h"
+#include "mhz19_sim.h"
+#include "pms7003_sim.h"
+
+#define FLEET_MAX_DEVICES 1024
+
+void app_main();
+
+typedef struct
+{
+    int index;
+    char prefix[64];
+    char client_id[32];
+    esp_mqtt_client_handle_t client;
+    uint32_t connects;
+    uint32_t updates;
+} device_t;
+
+static device_t *devices;
+static int device_count = 100;
+static const char *broker_uri = "mqtt://localhost:1883";
+static const char *prefix = "fleet";
+
+static uint64_t storm_at;
+static uint64_t storm_start;
+static uint64_t storm_end;
+static int storm_pending;
+
+static pms_sim_t pms;
+static mhz19_sim_t co2;
+static bmp280_sim_t bmp280;
+
+static void attach_sensors(void)
+{
+    static const double pms_defaults[] = {12, 20, 8};
+    static const double co2_defaults[] = {650, 24};
+    static const double bmp_defaults[] = {22.5, 101325};
+    static const sim_timing_t timing = {.baud = 9600, .latency = 10000};
+    static sim_trace_t pms_trace, co2_trace, bmp_trace;
+
+    trace_init_constant(&pms_trace, pms_defaults, 3);
+    trace_init_constant(&co2_trace, co2_defaults, 2);
+    trace_init_constant(&bmp_trace, bmp_defaults, 2);
+
+    pms_sim_init(&pms, &pms_trace);
+    mhz19_sim_init(&co2, &co2_trace);
+    bmp280_sim_init(&bmp280, &bmp_trace);
+
+    sim_uart_attach(UART_NUM_2, &pms.base, &timing);
+    sim_uart_attach(UART_NUM_1, &co2.base, &timing);
+    bmp280_sim_attach(&bmp280, I2C_NUM_0);
+}
+
+static void device_event(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
+{
+    device_t *device = handler_args;
+
+    if (event_id != MQTT_EVENT_CONNECTED)
+        return;
+
+    device->connects++;
+    if (storm_start && device->connects > 1 && storm_pending)
+    {
+        storm_pending--;
+        storm_end = shim_now();
+    }
+}
+
+static void device_task(void *arg)
+{
+    device_t *device = arg;
+    esp_mqtt_client_config_t config = {
+        .uri = broker_uri,
+        .client_id = device->client_id,
+    };
+
+    device->client = esp_mqtt_client_init(&config);
+    esp_mqtt_client_register_event(device->client, ESP_EVENT_ANY_ID, device_event, device);
+
+    xEventGroupWaitBits(eg_app_status, WIFI_CONNECTED_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+    esp_mqtt_client_start(device->client);
+
+    // devices are not in step, spread them over the update period
+    vTaskDelay((uint64_t)adaptive_mqtt_period() * device->index / device_count / portTICK_PERIOD_MS);
+
+    for (;;)
+    {
+        // publishes fail while disconnected, like the firmware's do
+        mqtt_send_update(device->client, device->prefix);
+        device->updates++;
+        // the firmware's period, mqtt_delay at runtime or shorter with adaptive sampling
+        vTaskDelay(adaptive_mqtt_period() / portTICK_PERIOD_MS);
+    }
+}
+
+static void storm_task(void *arg)
+{
+    /*
+    The broker restarts: every device loses its connection at once and
+    reconnects after the esp-mqtt reconnect timeout.
+    */
+
+    vTaskDelay(storm_at / 1000 / portTICK_PERIOD_MS);
+
+    storm_start = shim_now();
+    storm_pending = device_count;
+    for (int i = 0; i < device_count; i++)
+    {
+        if (devices[i].client)
+            shim_mqtt_drop(devices[i].client);
+    }
+
+    vTaskDelete(NULL);
+}
+
+static void main_task(void *arg)
+{
+    app_main();
+
+    for (int i = 0; i < device_count; i++)
+    {
+        char name[24];
+
+        devices[i].index = i;
+        snprintf(devices[i].prefix, sizeof(devices[i].prefix), "%s/%d", prefix, i);
+        snprintf(devices[i].client_id, sizeof(devices[i].client_id), "fleet-%d-%d", getpid(), i);
+        snprintf(name, sizeof(name), "device%d", i);
+        xTaskCreate(device_task, name, 4096, &devices[i], 10, NULL);
+    }
+
+    if (storm_at)
+        xTaskCreate(storm_task, "storm", 2048, NULL, 10, NULL);
+
+    vTaskDelete(NULL);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [--broker URI] [--devices N] [--prefix TOPIC] [--seconds N]\n"
+            "          [--storm-at SECONDS] [--no-monitor] [--log-level N] [--report]\n",
+            name);
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t seconds = 60;
+    bool monitor = true;
+    bool report = false;
+    uint32_t updates = 0;
+    char filter[80];
+
+    shim_log_limit(1);
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--broker") && i + 1 < argc)
+            broker_uri = argv[++i];
+        else if (!strcmp(argv[i], "--devices") && i + 1 < argc)
+            device_count = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--prefix") && i + 1 < argc)
+            prefix = argv[++i];
+        else if (!strcmp(argv[i], "--seconds") && i + 1 < argc)
+            seconds = strtoull(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--storm-at") && i + 1 < argc)
+            storm_at = strtoull(argv[++i], NULL, 10) * 1000000;
+        else if (!strcmp(argv[i], "--no-monitor"))
+            monitor = false;
+        else if (!strcmp(argv[i], "--log-level") && i + 1 < argc)
+            shim_log_limit(atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--report"))
+            report = true;
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (device_count < 1 || device_count > FLEET_MAX_DEVICES)
+    {
+        fprintf(stderr, "--devices: 1 to %d\n", FLEET_MAX_DEVICES);
+        return 1;
+    }
+    devices = calloc(device_count, sizeof(device_t));
+
+    shim_init(SHIM_CLOCK_REAL);
+    if (shim_mqtt_socket_init(broker_uri))
+    {
+        fprintf(stderr, "cannot resolve %s\n", broker_uri);
+        return 1;
+    }
+    snprintf(filter, sizeof(filter), "%s/#", prefix);
+    if (monitor && shim_mqtt_socket_monitor(filter))
+    {
+        fprintf(stderr, "cannot connect to %s\n", broker_uri);
+        return 1;
+    }
+
+    attach_sensors();
+    xTaskCreate(main_task, "main", 3584, NULL, 1, NULL);
+
+    shim_run(seconds * 1000000);
+
+    for (int i = 0; i < device_count; i++)
+        updates += devices[i].updates;
+
+    fprintf(stderr, "fleet: %d devices, %u updates in %llu s\n", device_count, updates,
+            (unsigned long long)seconds);
+    shim_mqtt_socket_report(stderr);
+    if (storm_start)
+        fprintf(stderr, "reconnect storm at %.1f s: %d of %d devices back, last after %.1f s\n",
+                storm_start / 1e6, device_count - storm_pending, device_count,
+                storm_end > storm_start ? (storm_end - storm_start) / 1e6 : 0.0);
+    if (report)
+        shim_report(stderr);
+
+    return 0;
+}
@@ -0,0 +1,30 @@
+#include <stdlib.h>
+
+#include "mhz19.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    mhz19_values_t values = {0};
+    int start = -1;
+    int res;
+
+    if (size > 4096)
+        return 0;
+
+    res = mhz19_decode(data, size, &values, &start);
+
+    if (start < 0 || start > (int)size)
+        abort();
+
+    if (res == ESP_OK && (size - start < MHZ19_FRAME_LEN || data[start] != 0xFF || data[start + 1] != 0x86))
+        abort();
+
+    // values are only touched for a good frame
+    if (res != ESP_OK && values.ppm)
+        abort();
+
+    if (res != ESP_OK && res != ESP_ERR_INVALID_SIZE && res != ESP_ERR_INVALID_CRC)
+        abort();
+
+    return 0;
+}
@@ -0,0 +1,31 @@
+#include <stdlib.h>
+
+#include "pms7003.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    pms_values_t values = {0};
+    int start = -1;
+    int res;
+
+    if (size > 4096)
+        return 0;
+
+    res = pms_decode(data, size, &values, &start);
+
+    if (start < 0 || start > (int)size)
+        abort();
+
+    if (res == ESP_OK && (size - start < PMS_FRAME_LEN || data[start] != 0x42 || data[start + 1] != 0x4D ||
+                          data[start + 2] != 0 || data[start + 3] != PMS_FRAME_LEN - 4))
+        abort();
+
+    // values are only touched for a good frame
+    if (res != ESP_OK && (values.pm25 || values.pm100))
+        abort();
+
+    if (res != ESP_OK && res != ESP_ERR_INVALID_SIZE && res != ESP_ERR_INVALID_CRC)
+        abort();
+
+    return 0;
+}
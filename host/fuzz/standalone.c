@@ -0,0 +1,213 @@
+/*
+Driver for the fuzz targets when libFuzzer is not available, e.g. with gcc:
+
+    pms7003_fuzz FILE|DIR...                  runs every input once
+    pms7003_fuzz -runs=N [-seed=S] DIR...     mutates the inputs N times
+
+The first form replays a corpus or a crash and works with AFL:
+afl-fuzz -i corpus/pms7003 -o out -- ./pms7003_fuzz @@. On a crash the
+input is written to crash-input.
+*/
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_LEN 512
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+typedef struct
+{
+    uint8_t *data;
+    size_t size;
+} input_t;
+
+static input_t *inputs;
+static size_t input_count;
+
+static uint8_t current[MAX_LEN];
+static size_t current_size;
+
+static void on_crash(int sig)
+{
+    int fd = open("crash-input", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd >= 0)
+    {
+        (void)!write(fd, current, current_size);
+        close(fd);
+    }
+
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static void load_file(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    input_t input;
+
+    if (!f)
+        return;
+
+    input.data = malloc(MAX_LEN);
+    input.size = fread(input.data, 1, MAX_LEN, f);
+    fclose(f);
+
+    inputs = realloc(inputs, (input_count + 1) * sizeof(input_t));
+    inputs[input_count++] = input;
+}
+
+static void load_path(const char *path)
+{
+    struct stat st;
+    struct dirent *entry;
+    DIR *dir;
+
+    if (stat(path, &st))
+    {
+        perror(path);
+        return;
+    }
+
+    if (!S_ISDIR(st.st_mode))
+    {
+        load_file(path);
+        return;
+    }
+
+    dir = opendir(path);
+    while (dir && (entry = readdir(dir)))
+    {
+        char file[1024];
+
+        if (entry->d_name[0] == '.')
+            continue;
+        snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+        load_file(file);
+    }
+    if (dir)
+        closedir(dir);
+}
+
+static void run(const uint8_t *data, size_t size)
+{
+    memcpy(current, data, size);
+    current_size = size;
+    LLVMFuzzerTestOneInput(current, current_size);
+}
+
+static void mutate(void)
+{
+    int mutations = 1 + rand() % 4;
+
+    for (int m = 0; m < mutations; m++)
+    {
+        size_t pos = current_size ? rand() % current_size : 0;
+        const input_t *other;
+
+        switch (rand() % 7)
+        {
+        case 0: // flip a bit
+            if (current_size)
+                current[pos] ^= 1 << (rand() % 8);
+            break;
+        case 1: // random byte
+            if (current_size)
+                current[pos] = rand();
+            break;
+        case 2: // insert a byte
+            if (current_size < MAX_LEN)
+            {
+                memmove(current + pos + 1, current + pos, current_size - pos);
+                current[pos] = rand();
+                current_size++;
+            }
+            break;
+        case 3: // drop a byte
+            if (current_size)
+            {
+                memmove(current + pos, current + pos + 1, current_size - pos - 1);
+                current_size--;
+            }
+            break;
+        case 4: // truncate
+            current_size = pos;
+            break;
+        case 5: // append another input, like two frames in a row
+            other = &inputs[rand() % input_count];
+            if (current_size + other->size <= MAX_LEN)
+            {
+                memcpy(current + current_size, other->data, other->size);
+                current_size += other->size;
+            }
+            break;
+        case 6: // interesting values
+            if (current_size)
+                current[pos] = (uint8_t[]){0x00, 0xFF, 0x42, 0x4D, 0x86, 0x7F, 0x80}[rand() % 7];
+            break;
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long runs = 0;
+    unsigned seed = 1;
+    struct timespec start, end;
+    double elapsed;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strncmp(argv[i], "-runs=", 6))
+            runs = strtoul(argv[i] + 6, NULL, 10);
+        else if (!strncmp(argv[i], "-seed=", 6))
+            seed = strtoul(argv[i] + 6, NULL, 10);
+        else if (argv[i][0] == '-')
+            continue; // other libFuzzer options
+        else
+            load_path(argv[i]);
+    }
+
+    if (!input_count)
+    {
+        fprintf(stderr, "usage: %s [-runs=N] [-seed=S] FILE|DIR...\n", argv[0]);
+        return 1;
+    }
+
+    signal(SIGABRT, on_crash);
+    signal(SIGSEGV, on_crash);
+    signal(SIGBUS, on_crash);
+    srand(seed);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (size_t i = 0; i < input_count; i++)
+        run(inputs[i].data, inputs[i].size);
+
+    for (unsigned long r = 0; r < runs; r++)
+    {
+        const input_t *input = &inputs[rand() % input_count];
+
+        memcpy(current, input->data, input->size);
+        current_size = input->size;
+        mutate();
+        LLVMFuzzerTestOneInput(current, current_size);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    printf("%zu inputs, %lu mutated runs in %.2f s (%.0f exec/s)\n", input_count, runs, elapsed,
+           (input_count + runs) / (elapsed > 0 ? elapsed : 1e-9));
+
+    return 0;
+}
@@ -0,0 +1,410 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/uart.h"
+#include "driver/i2c.h"
+
+#include "shim.h"
+
+#include "dust_sensor.h"
+
+#include "bmp280_sim.h"
+#include "fault.h"
+#include "mhz19_sim.h"
+#include "pms7003_sim.h"
+
+#define CAPTURE_CHUNK_SIZE 4096
+#define MAX_COMMANDS 32
+
+void app_main();
+
+extern esp_mqtt_client_handle_t mqtt_client;
+
+// a message delivered to the firmware's MQTT client, --command
+typedef struct
+{
+    uint64_t at;
+    const char *topic;
+    const char *payload;
+} command_t;
+
+static command_t commands[MAX_COMMANDS];
+static int command_count;
+
+static FILE *capture_file;
+
+static void capture_task(void *arg)
+{
+    static uint8_t chunk[CAPTURE_CHUNK_SIZE];
+
+    for (;;)
+    {
+        int length = capture_take(chunk, sizeof(chunk));
+
+        if (length)
+        {
+            fwrite(chunk, 1, length, capture_file);
+            fflush(capture_file);
+        }
+        vTaskDelay(1000 / portTICK_PERIOD_MS);
+    }
+}
+
+static int parse_command(char *arg)
+{
+    // SECONDS:TOPIC:PAYLOAD, the payload may contain colons
+    char *topic = strchr(arg, ':');
+    char *payload = topic ? strchr(topic + 1, ':') : NULL;
+
+    if (!payload || command_count == MAX_COMMANDS)
+        return -1;
+
+    *topic++ = 0;
+    *payload++ = 0;
+    commands[command_count++] = (command_t){strtoull(arg, NULL, 10) * 1000000, topic, payload};
+
+    return 0;
+}
+
+static int compare_commands(const void *a, const void *b)
+{
+    const command_t *x = a;
+    const command_t *y = b;
+
+    return (x->at > y->at) - (x->at < y->at);
+}
+
+static void command_task(void *arg)
+{
+    qsort(commands, command_count, sizeof(command_t), compare_commands);
+
+    for (int i = 0; i < command_count; i++)
+    {
+        uint64_t now = shim_now();
+
+        if (commands[i].at > now)
+            vTaskDelay((commands[i].at - now) / 1000 / portTICK_PERIOD_MS);
+        fprintf(stderr, "command at %.1f s: %s %s\n", shim_now() / 1e6, commands[i].topic, commands[i].payload);
+        shim_mqtt_deliver(mqtt_client, commands[i].topic, commands[i].payload, strlen(commands[i].payload), false);
+    }
+
+    vTaskDelete(NULL);
+}
+
+static void main_task(void *arg)
+{
+    // records from boot on, like CAPTURE_ENABLE on the device
+    if (capture_file)
+    {
+        if (capture_start(CAPTURE_CHUNK_SIZE) == ESP_OK)
+            xTaskCreate(capture_task, "capture", 2048, NULL, 1, NULL);
+        else
+            fprintf(stderr, "can't start capture\n");
+    }
+
+    app_main();
+
+    shim_set_name(dust_values.lock, "dust_values.lock");
+    shim_set_name(co2_values.lock, "co2_values.lock");
+    shim_set_name(bmp_values.lock, "bmp_values.lock");
+
+    if (command_count)
+        xTaskCreate(command_task, "command", 2048, NULL, 1, NULL);
+
+    vTaskDelete(NULL);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [--virtual] [--seconds N] [--print-mqtt]\n"
+            "          [--sim] [--pms-tty PATH] [--co2-tty PATH] [--capture FILE]\n"
+            "          [--report] [--log-level N] [--fault CLASS=RATE[:SECONDS]]... [--seed N]\n"
+            "          [--nvs FILE] [--ota DIR] [--http-port N] [--command SECONDS:TOPIC:PAYLOAD]...\n"
+            "fault classes: bitflip, drop (per byte), i2c (per transaction),\n"
+            "               stuck, wifi, broker (episodes per hour of SECONDS)\n",
+            name);
+}
+
+static pms_sim_t pms;
+static mhz19_sim_t co2;
+static bmp280_sim_t bmp280;
+static fault_t faults;
+
+static void attach_sensors(void)
+{
+    static const double pms_defaults[] = {12, 20, 8};
+    static const double co2_defaults[] = {650, 24};
+    static const double bmp_defaults[] = {22.5, 101325};
+    static const sim_timing_t timing = {.baud = 9600, .latency = 10000};
+    static sim_trace_t pms_trace, co2_trace, bmp_trace;
+
+    trace_init_constant(&pms_trace, pms_defaults, 3);
+    trace_init_constant(&co2_trace, co2_defaults, 2);
+    trace_init_constant(&bmp_trace, bmp_defaults, 2);
+
+    pms_sim_init(&pms, &pms_trace);
+    mhz19_sim_init(&co2, &co2_trace);
+    bmp280_sim_init(&bmp280, &bmp_trace);
+
+    sim_uart_attach(UART_NUM_2, &pms.base, &timing);
+    sim_uart_attach(UART_NUM_1, &co2.base, &timing);
+    bmp280_sim_attach(&bmp280, I2C_NUM_0);
+
+    if (fault_enabled(&faults))
+    {
+        fault_attach_uart(&faults, &pms.base, FAULT_TARGET_DUST);
+        fault_attach_uart(&faults, &co2.base, FAULT_TARGET_CO2);
+        fault_attach_bmp280(&faults, &bmp280);
+    }
+}
+
+static void print_sensor_stats(void)
+{
+    const bmp280_sim_stats_t *bmp = &bmp280.stats;
+
+    fprintf(stderr, "pms7003: %u requests, %u bytes sent\n", pms.base.requests, pms.base.bytes_out);
+    fprintf(stderr, "mh-z19: %u requests, %u bytes sent\n", co2.base.requests, co2.base.bytes_out);
+    fprintf(stderr, "bmp280: %u transactions (%u reads, %u writes), %u bytes read, %u bytes written, "
+                    "%u measurements, %u data reads, %.1f transactions per data read\n",
+            bmp->transactions, bmp->reads, bmp->writes, bmp->bytes_read, bmp->bytes_written,
+            bmp->measurements, bmp->data_reads,
+            bmp->data_reads ? (double)bmp->transactions / bmp->data_reads : 0.0);
+}
+
+/*
+Age of the samples at publishing time, from the status messages, as the
+end-to-end latency of each sensor.
+*/
+
+#define AGE_BUCKETS 3600 // seconds
+
+typedef struct
+{
+    const char *sensor;
+    uint32_t count;
+    uint32_t not_valid;
+    uint64_t sum;
+    uint32_t max;
+    uint32_t buckets[AGE_BUCKETS + 1];
+} age_stats_t;
+
+static age_stats_t ages[] = {{.sensor = "dust"}, {.sensor = "co2"}, {.sensor = "bmp"}};
+static bool print_mqtt;
+
+static void count_status(const char *topic, const char *data, int len)
+{
+    static const char status_topic[] = MQTT_TOPIC_PREFIX "/" MQTT_TOPIC_STATUS "/";
+    char payload[256];
+    const char *age;
+
+    if (strncmp(topic, status_topic, sizeof(status_topic) - 1) || len >= (int)sizeof(payload))
+        return;
+
+    memcpy(payload, data, len);
+    payload[len] = '\0';
+
+    for (size_t i = 0; i < sizeof(ages) / sizeof(ages[0]); i++)
+    {
+        age_stats_t *stats = &ages[i];
+        uint32_t value;
+
+        if (strcmp(topic + sizeof(status_topic) - 1, stats->sensor))
+            continue;
+
+        if (!strstr(payload, "\"status\":\"valid\""))
+        {
+            stats->not_valid++;
+            return;
+        }
+
+        age = strstr(payload, "\"age\":");
+        if (!age)
+            return;
+        value = strtoul(age + 6, NULL, 10);
+
+        stats->count++;
+        stats->sum += value;
+        if (value > stats->max)
+            stats->max = value;
+        stats->buckets[value < AGE_BUCKETS ? value : AGE_BUCKETS]++;
+    }
+}
+
+static uint32_t age_percentile(const age_stats_t *stats, double fraction)
+{
+    uint64_t target = stats->count * fraction;
+    uint64_t seen = 0;
+
+    for (uint32_t age = 0; age <= AGE_BUCKETS; age++)
+    {
+        seen += stats->buckets[age];
+        if (seen > target)
+            return age;
+    }
+
+    return AGE_BUCKETS;
+}
+
+static void print_latency_report(void)
+{
+    fprintf(stderr, "sample age at publishing (s):\n  %-6s %8s %8s %6s %6s %6s %6s\n", "sensor", "valid",
+            "invalid", "mean", "p50", "p95", "max");
+
+    for (size_t i = 0; i < sizeof(ages) / sizeof(ages[0]); i++)
+    {
+        const age_stats_t *stats = &ages[i];
+
+        fprintf(stderr, "  %-6s %8u %8u %6.1f %6u %6u %6u\n", stats->sensor, stats->count, stats->not_valid,
+                stats->count ? (double)stats->sum / stats->count : 0.0, age_percentile(stats, 0.5),
+                age_percentile(stats, 0.95), stats->max);
+    }
+}
+
+static int report_connect(void *ctx, esp_mqtt_client_handle_t client, const esp_mqtt_client_config_t *config)
+{
+    return ESP_OK;
+}
+
+static void report_disconnect(void *ctx, esp_mqtt_client_handle_t client)
+{
+}
+
+static int report_publish(void *ctx, esp_mqtt_client_handle_t client, const char *topic, const char *data,
+                          int len, int qos, int retain)
+{
+    count_status(topic, data, len);
+
+    if (print_mqtt)
+    {
+        flockfile(stdout);
+        printf("%s %.*s\n", topic, len, data);
+        fflush(stdout);
+        funlockfile(stdout);
+    }
+
+    return ESP_OK;
+}
+
+static int report_subscribe(void *ctx, esp_mqtt_client_handle_t client, const char *topic, int qos)
+{
+    return ESP_OK;
+}
+
+int main(int argc, char **argv)
+{
+    static const shim_mqtt_broker_t report_broker = {
+        .connect = report_connect,
+        .disconnect = report_disconnect,
+        .publish = report_publish,
+        .subscribe = report_subscribe,
+    };
+    bool report = false;
+    shim_clock_t clock = SHIM_CLOCK_REAL;
+    uint64_t seconds = 0;
+    bool sim = false;
+    const char *pms_tty = NULL;
+    const char *co2_tty = NULL;
+    const char *nvs_file = NULL;
+    const char *ota_dir = NULL;
+
+    fault_init(&faults, 1, MQTT_DELAY * 1000ULL);
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--virtual"))
+            clock = SHIM_CLOCK_VIRTUAL;
+        else if (!strcmp(argv[i], "--seconds") && i + 1 < argc)
+            seconds = strtoull(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--print-mqtt"))
+            print_mqtt = true;
+        else if (!strcmp(argv[i], "--report"))
+            report = true;
+        else if (!strcmp(argv[i], "--log-level") && i + 1 < argc)
+            shim_log_limit(atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--fault") && i + 1 < argc)
+        {
+            if (fault_parse(&faults, argv[++i]))
+            {
+                fprintf(stderr, "bad fault: %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+            faults.rng = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--nvs") && i + 1 < argc)
+            nvs_file = argv[++i];
+        else if (!strcmp(argv[i], "--ota") && i + 1 < argc)
+            ota_dir = argv[++i];
+        else if (!strcmp(argv[i], "--http-port") && i + 1 < argc)
+            shim_httpd_port(atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--command") && i + 1 < argc)
+        {
+            if (parse_command(argv[++i]))
+            {
+                fprintf(stderr, "bad command: %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--sim"))
+            sim = true;
+        else if (!strcmp(argv[i], "--pms-tty") && i + 1 < argc)
+            pms_tty = argv[++i];
+        else if (!strcmp(argv[i], "--co2-tty") && i + 1 < argc)
+            co2_tty = argv[++i];
+        else if (!strcmp(argv[i], "--capture") && i + 1 < argc)
+        {
+            capture_file = fopen(argv[++i], "wb");
+            if (!capture_file)
+            {
+                perror(argv[i]);
+                return 1;
+            }
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    shim_init(clock);
+    if ((nvs_file && shim_nvs_file(nvs_file)) || (ota_dir && shim_ota_dir(ota_dir)))
+        return 1;
+    shim_mqtt_set_broker(&report_broker);
+    if (fault_enabled(&faults))
+    {
+        fault_attach_broker(&faults, &report_broker);
+        fault_start(&faults);
+    }
+
+    if (sim)
+        attach_sensors();
+    if ((pms_tty && shim_uart_attach_tty(UART_NUM_2, pms_tty)) ||
+        (co2_tty && shim_uart_attach_tty(UART_NUM_1, co2_tty)))
+    {
+        fprintf(stderr, "cannot open sensor tty\n");
+        return 1;
+    }
+
+    xTaskCreate(main_task, "main", 3584, NULL, 1, NULL);
+
+    shim_run(seconds * 1000000);
+
+    if (sim)
+        print_sensor_stats();
+
+    if (report)
+    {
+        shim_report(stderr);
+        print_latency_report();
+    }
+
+    if (fault_enabled(&faults))
+        fault_report(&faults, stderr);
+
+    return 0;
+}
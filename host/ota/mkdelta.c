@@ -0,0 +1,538 @@
+/*
+Makes a patch for an over-the-air update (src/delta.h, src/ota.h) from the
+image running on the device to a new one, and applies patches for checking.
+
+    mkdelta OLD NEW PATCH          delta from OLD to NEW
+    mkdelta --full NEW PATCH       the whole of NEW, for a device running
+                                   an unknown image
+    mkdelta --apply OLD PATCH NEW  what the device would write
+
+Matching is bsdiff's approach with a hash index instead of suffix sorting:
+for every position of the new image the longest exact match in the old one
+is looked up, and a match is only followed if it beats carrying on at the
+current alignment. Matches are then extended forwards and backwards while
+at least half of the bytes agree, so code that moved and changed a little
+becomes a copy with sparse differences. Runs of equal bytes in a copy cost
+one varint, which is what keeps the patch small without compression.
+*/
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mbedtls/sha256.h"
+
+#include "delta.h"
+
+#define HASH_BYTES 8       // shortest match that is looked up
+#define HASH_BITS 20
+#define HASH_CHAIN 64      // candidates looked at per position
+#define MIN_MATCH 16       // shorter exact matches are not worth a record
+#define MIN_GAIN 8         // a new alignment must beat the current one by this
+#define ZERO_RUN_BREAK 3   // zero differences that end a run of differences
+
+typedef struct
+{
+    uint8_t *data;
+    size_t size;
+} buffer_t;
+
+typedef struct
+{
+    FILE *file;
+    size_t size;
+    size_t records;
+    size_t copied;
+    size_t differing;
+    size_t inserted;
+} patch_t;
+
+static int32_t *head;
+static int32_t *chain;
+
+static int read_file(const char *path, buffer_t *buffer)
+{
+    FILE *file = fopen(path, "rb");
+    long size;
+
+    if (!file)
+    {
+        perror(path);
+        return -1;
+    }
+
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    buffer->size = size;
+    buffer->data = malloc(size ? size : 1);
+    if (!buffer->data || fread(buffer->data, 1, size, file) != (size_t)size)
+    {
+        fprintf(stderr, "%s: can't read\n", path);
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+
+    if (buffer->size > UINT32_MAX)
+    {
+        fprintf(stderr, "%s: too large\n", path);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void put(patch_t *patch, const void *data, size_t length)
+{
+    fwrite(data, 1, length, patch->file);
+    patch->size += length;
+}
+
+static void put_varint(patch_t *patch, uint64_t value)
+{
+    uint8_t bytes[10];
+    size_t n = 0;
+
+    do
+    {
+        bytes[n] = value & 0x7f;
+        value >>= 7;
+        if (value)
+            bytes[n] |= 0x80;
+        n++;
+    } while (value);
+
+    put(patch, bytes, n);
+}
+
+static void put_u32(patch_t *patch, uint32_t value)
+{
+    uint8_t bytes[4] = {value, value >> 8, value >> 16, value >> 24};
+
+    put(patch, bytes, 4);
+}
+
+static void put_header(patch_t *patch, const buffer_t *old, const buffer_t *new)
+{
+    uint8_t sha256[32];
+
+    put(patch, DELTA_MAGIC, 4);
+    put_u32(patch, old->size);
+    put_u32(patch, new->size);
+    mbedtls_sha256_ret(old->data, old->size, sha256, 0);
+    put(patch, sha256, sizeof(sha256));
+    mbedtls_sha256_ret(new->data, new->size, sha256, 0);
+    put(patch, sha256, sizeof(sha256));
+}
+
+/*
+A record: `copy` bytes of `new` against the old image at `old_pos`, then
+`insert` bytes of `new` after them, then the old position moves by `seek`.
+*/
+static void put_record(patch_t *patch, const uint8_t *old, size_t old_pos, const uint8_t *new, size_t copy,
+                       size_t insert, int64_t seek)
+{
+    size_t i = 0;
+
+    patch->records++;
+    patch->copied += copy;
+    patch->inserted += insert;
+
+    put_varint(patch, copy);
+    while (i < copy)
+    {
+        size_t skip = 0;
+        size_t count = 0;
+        size_t zeros = 0;
+
+        while (i + skip < copy && new[i + skip] == old[old_pos + i + skip])
+            skip++;
+        put_varint(patch, skip);
+        i += skip;
+        if (i == copy)
+            break;
+
+        // up to a few equal bytes in a row stay in the run, they cost less than a new one
+        while (i + count < copy)
+        {
+            if (new[i + count] == old[old_pos + i + count])
+            {
+                if (++zeros == ZERO_RUN_BREAK)
+                {
+                    count -= ZERO_RUN_BREAK - 1;
+                    break;
+                }
+            }
+            else
+                zeros = 0;
+            count++;
+        }
+        if (i + count == copy)
+            count -= zeros;
+
+        put_varint(patch, count);
+        for (size_t j = 0; j < count; j++)
+        {
+            uint8_t diff = new[i + j] - old[old_pos + i + j];
+
+            put(patch, &diff, 1);
+            patch->differing += diff != 0;
+        }
+        i += count;
+    }
+
+    put_varint(patch, insert);
+    put(patch, new + copy, insert);
+    put_varint(patch, (uint64_t)(seek << 1) ^ (uint64_t)(seek >> 63));
+}
+
+static uint32_t hash(const uint8_t *data)
+{
+    uint64_t value;
+
+    memcpy(&value, data, sizeof(value));
+
+    return (value * 0x9e3779b97f4a7c15ULL) >> (64 - HASH_BITS);
+}
+
+static void index_old(const buffer_t *old)
+{
+    head = malloc(sizeof(*head) << HASH_BITS);
+    chain = malloc(sizeof(*chain) * (old->size ? old->size : 1));
+    if (!head || !chain)
+        abort();
+
+    memset(head, 0xff, sizeof(*head) << HASH_BITS);
+    for (size_t i = 0; i + HASH_BYTES <= old->size; i++)
+    {
+        uint32_t h = hash(old->data + i);
+
+        chain[i] = head[h];
+        head[h] = i;
+    }
+}
+
+static size_t match_length(const buffer_t *old, size_t old_pos, const buffer_t *new, size_t new_pos)
+{
+    size_t n = 0;
+
+    while (old_pos + n < old->size && new_pos + n < new->size && old->data[old_pos + n] == new->data[new_pos + n])
+        n++;
+
+    return n;
+}
+
+// longest exact match of new[scan...] in the old image
+static size_t find_match(const buffer_t *old, const buffer_t *new, size_t scan, size_t *pos)
+{
+    size_t best = 0;
+    int tries = HASH_CHAIN;
+
+    if (scan + HASH_BYTES > new->size)
+        return 0;
+
+    for (int32_t candidate = head[hash(new->data + scan)]; candidate >= 0 && tries--; candidate = chain[candidate])
+    {
+        size_t length = match_length(old, candidate, new, scan);
+
+        if (length > best)
+        {
+            best = length;
+            *pos = candidate;
+        }
+    }
+
+    return best;
+}
+
+// bytes of new[scan, scan + length) equal to the old image at the alignment `offset`
+static size_t aligned_matches(const buffer_t *old, const buffer_t *new, size_t scan, size_t length, int64_t offset)
+{
+    size_t n = 0;
+
+    for (size_t i = scan; i < scan + length; i++)
+    {
+        int64_t pos = (int64_t)i + offset;
+
+        if (pos >= 0 && (size_t)pos < old->size && old->data[pos] == new->data[i])
+            n++;
+    }
+
+    return n;
+}
+
+static void diff(const buffer_t *old, const buffer_t *new, patch_t *patch)
+{
+    size_t scan = 0;
+    size_t last_scan = 0; // start of the pending copy in the new image
+    size_t last_pos = 0;  // and in the old one
+    int64_t last_offset = 0;
+
+    index_old(old);
+
+    while (scan < new->size)
+    {
+        size_t pos = 0;
+        size_t length = find_match(old, new, scan, &pos);
+        size_t forward = 0;
+        size_t backward = 0;
+
+        if (length < MIN_MATCH)
+        {
+            scan++;
+            continue;
+        }
+
+        if ((int64_t)pos - (int64_t)scan == last_offset ||
+            aligned_matches(old, new, scan, length, last_offset) + MIN_GAIN > length)
+        {
+            // the current alignment does about as well
+            scan += length;
+            continue;
+        }
+
+        // how far the pending copy reaches, bsdiff's lenf
+        {
+            size_t s = 0;
+            long best = 0;
+
+            for (size_t i = 0; last_scan + i < scan && last_pos + i < old->size; i++)
+            {
+                if (old->data[last_pos + i] == new->data[last_scan + i])
+                    s++;
+                if ((long)(2 * s) - (long)(i + 1) > best)
+                {
+                    best = 2 * s - (i + 1);
+                    forward = i + 1;
+                }
+            }
+        }
+
+        // and how far back the new match reaches, lenb
+        {
+            size_t s = 0;
+            long best = 0;
+
+            for (size_t i = 1; scan >= last_scan + i && pos >= i; i++)
+            {
+                if (old->data[pos - i] == new->data[scan - i])
+                    s++;
+                if ((long)(2 * s) - (long)i > best)
+                {
+                    best = 2 * s - i;
+                    backward = i;
+                }
+            }
+        }
+
+        // overlapping, split where the two alignments do best
+        if (last_scan + forward > scan - backward)
+        {
+            size_t overlap = last_scan + forward - (scan - backward);
+            long s = 0;
+            long best = 0;
+            size_t split = 0;
+
+            for (size_t i = 0; i < overlap; i++)
+            {
+                size_t at = scan - backward + i;
+
+                if (new->data[at] == old->data[last_pos + forward - overlap + i])
+                    s++;
+                if (new->data[at] == old->data[pos - backward + i])
+                    s--;
+                if (s > best)
+                {
+                    best = s;
+                    split = i + 1;
+                }
+            }
+
+            forward += split - overlap;
+            backward -= split;
+        }
+
+        put_record(patch, old->data, last_pos, new->data + last_scan, forward, scan - backward - last_scan - forward,
+                   (int64_t)(pos - backward) - (int64_t)(last_pos + forward));
+
+        last_scan = scan - backward;
+        last_pos = pos - backward;
+        last_offset = (int64_t)pos - (int64_t)scan;
+        scan += length;
+    }
+
+    // the rest of the new image
+    {
+        size_t forward = 0;
+        size_t s = 0;
+        long best = 0;
+
+        for (size_t i = 0; last_scan + i < new->size && last_pos + i < old->size; i++)
+        {
+            if (old->data[last_pos + i] == new->data[last_scan + i])
+                s++;
+            if ((long)(2 * s) - (long)(i + 1) > best)
+            {
+                best = 2 * s - (i + 1);
+                forward = i + 1;
+            }
+        }
+
+        if (last_scan < new->size)
+            put_record(patch, old->data, last_pos, new->data + last_scan, forward, new->size - last_scan - forward, 0);
+    }
+}
+
+/* --apply */
+
+typedef struct
+{
+    const buffer_t *old;
+    FILE *out;
+    mbedtls_sha256_context sha;
+} apply_t;
+
+static esp_err_t apply_header(void *ctx, const delta_header_t *header)
+{
+    apply_t *apply = ctx;
+    uint8_t sha256[32];
+
+    if (header->old_size > apply->old->size)
+        return ESP_ERR_INVALID_SIZE;
+
+    mbedtls_sha256_ret(apply->old->data, header->old_size, sha256, 0);
+
+    return memcmp(sha256, header->old_sha256, sizeof(sha256)) ? ESP_ERR_INVALID_VERSION : ESP_OK;
+}
+
+static esp_err_t apply_read_old(void *ctx, uint32_t offset, uint8_t *data, size_t length)
+{
+    apply_t *apply = ctx;
+
+    memcpy(data, apply->old->data + offset, length);
+
+    return ESP_OK;
+}
+
+static esp_err_t apply_write_new(void *ctx, const uint8_t *data, size_t length)
+{
+    apply_t *apply = ctx;
+
+    mbedtls_sha256_update_ret(&apply->sha, data, length);
+
+    return fwrite(data, 1, length, apply->out) == length ? ESP_OK : ESP_FAIL;
+}
+
+static int apply_patch(const char *old_path, const char *patch_path, const char *new_path)
+{
+    static const delta_ops_t ops = {
+        .header = apply_header,
+        .read_old = apply_read_old,
+        .write_new = apply_write_new,
+    };
+    buffer_t old;
+    buffer_t patch;
+    apply_t apply;
+    delta_t delta;
+    uint8_t sha256[32];
+    esp_err_t err;
+
+    if (read_file(old_path, &old) || read_file(patch_path, &patch))
+        return 1;
+
+    apply.old = &old;
+    apply.out = fopen(new_path, "wb");
+    if (!apply.out)
+    {
+        perror(new_path);
+        return 1;
+    }
+    mbedtls_sha256_init(&apply.sha);
+    mbedtls_sha256_starts_ret(&apply.sha, 0);
+
+    delta_init(&delta, &ops, &apply);
+    err = delta_feed(&delta, patch.data, patch.size);
+    if (err == ESP_OK)
+        err = delta_finish(&delta);
+    fclose(apply.out);
+
+    mbedtls_sha256_finish_ret(&apply.sha, sha256);
+    if (err == ESP_OK && memcmp(sha256, delta.header.new_sha256, sizeof(sha256)))
+        err = ESP_ERR_INVALID_CRC;
+
+    if (err != ESP_OK)
+    {
+        fprintf(stderr, "%s: %s\n", patch_path, esp_err_to_name(err));
+        return 1;
+    }
+
+    return 0;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s OLD NEW PATCH\n"
+            "       %s --full NEW PATCH\n"
+            "       %s --apply OLD PATCH NEW\n",
+            name, name, name);
+}
+
+int main(int argc, char **argv)
+{
+    buffer_t old = {NULL, 0};
+    buffer_t new;
+    patch_t patch = {0};
+    uint8_t sha256[32];
+    bool full = argc == 4 && !strcmp(argv[1], "--full");
+
+    if (argc == 5 && !strcmp(argv[1], "--apply"))
+        return apply_patch(argv[2], argv[3], argv[4]);
+
+    if (argc != 4 || (!full && argv[1][0] == '-'))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if ((!full && read_file(argv[1], &old)) || read_file(argv[2], &new))
+        return 1;
+
+    patch.file = fopen(argv[3], "wb");
+    if (!patch.file)
+    {
+        perror(argv[3]);
+        return 1;
+    }
+
+    put_header(&patch, &old, &new);
+    if (full)
+    {
+        if (new.size)
+            put_record(&patch, NULL, 0, new.data, 0, new.size, 0);
+    }
+    else
+        diff(&old, &new, &patch);
+
+    if (fclose(patch.file))
+    {
+        perror(argv[3]);
+        return 1;
+    }
+
+    // what goes after the URL in the ota/set command
+    mbedtls_sha256_ret(new.data, new.size, sha256, 0);
+    for (size_t i = 0; i < sizeof(sha256); i++)
+        printf("%02x", sha256[i]);
+    printf("\n");
+
+    fprintf(stderr, "%zu -> %zu bytes, patch %zu bytes (%.1f%%): %zu records, %zu bytes copied (%zu differing), "
+                    "%zu inserted\n",
+            old.size, new.size, patch.size, new.size ? 100.0 * patch.size / new.size : 0.0, patch.records,
+            patch.copied, patch.differing, patch.inserted);
+
+    return 0;
+}
@@ -0,0 +1,471 @@
+/*
+Replays a field capture (see src/capture.h) through the firmware: the
+recorded sensor answers are fed to the drivers in virtual time, and the
+parse throughput, error rates and the published values are reported. With
+--baseline the values are compared against an earlier --output run.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "dust_sensor.h"
+
+#include "shim.h"
+
+#include "sim_uart.h"
+
+typedef struct
+{
+    double time;
+    char *topic;
+    char *payload;
+} output_t;
+
+typedef struct
+{
+    output_t *items;
+    size_t count;
+    size_t capacity;
+} output_list_t;
+
+typedef struct
+{
+    sim_uart_device_t base;
+    uint8_t source;
+    size_t cursor;
+    uint32_t commands;
+    uint32_t unmatched;
+} replay_uart_t;
+
+typedef struct
+{
+    size_t cursor;
+    uint32_t reads;
+    uint32_t writes;
+    uint32_t unmatched;
+} replay_i2c_t;
+
+static capture_record_t *records;
+static size_t record_count;
+static uint64_t replayed_bytes;
+
+static output_list_t outputs;
+
+static void app_task(void *arg)
+{
+    void app_main();
+
+    app_main();
+    vTaskDelete(NULL);
+}
+
+static int load_capture(const char *path)
+{
+    static uint8_t *data;
+    size_t length = 0, capacity = 0, pos = 0, n;
+    capture_record_t record;
+    FILE *f = fopen(path, "rb");
+    int res;
+
+    if (!f)
+        return -1;
+
+    do
+    {
+        if (length == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 65536;
+            data = realloc(data, capacity);
+        }
+        n = fread(data + length, 1, capacity - length, f);
+        length += n;
+    } while (n);
+    fclose(f);
+
+    capacity = 0;
+    while ((res = capture_parse(data, length, &pos, &record)) == 1)
+    {
+        if (record_count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 1024;
+            records = realloc(records, capacity * sizeof(capture_record_t));
+        }
+        records[record_count++] = record;
+    }
+
+    if (res < 0)
+        fprintf(stderr, "malformed capture at offset %zu, %zu records used\n", pos, record_count);
+
+    return record_count ? 0 : -1;
+}
+
+static uint8_t record_source(const capture_record_t *record)
+{
+    return record->type & CAPTURE_SOURCE_MASK;
+}
+
+static size_t replay_uart_input(sim_uart_device_t *dev, uint64_t now, const uint8_t *data, size_t len,
+                                uint8_t *out, size_t size)
+{
+    /*
+    Finds the next recorded command equal to the one sent and answers with
+    everything the sensor sent after it, until its next command.
+    */
+
+    replay_uart_t *replay = (replay_uart_t *)dev;
+    size_t out_len = 0;
+    size_t i;
+
+    replay->commands++;
+
+    for (i = replay->cursor; i < record_count; i++)
+    {
+        if (record_source(&records[i]) == replay->source && (records[i].type & CAPTURE_FLAG_TX) &&
+            records[i].length == len && !memcmp(records[i].data, data, len))
+            break;
+    }
+
+    if (i == record_count)
+    {
+        replay->unmatched++;
+        return 0;
+    }
+
+    for (i++; i < record_count; i++)
+    {
+        capture_record_t *record = &records[i];
+
+        if (record_source(record) != replay->source)
+            continue;
+        if (record->type & CAPTURE_FLAG_TX)
+            break;
+
+        if (out_len + record->length <= size)
+        {
+            memcpy(out + out_len, record->data, record->length);
+            out_len += record->length;
+        }
+    }
+
+    replay->cursor = i;
+    replayed_bytes += out_len;
+    dev->bytes_out += out_len;
+
+    return out_len;
+}
+
+static int replay_i2c_transfer(void *ctx, const uint8_t *tx, size_t tx_len, uint8_t *rx, size_t rx_len)
+{
+    replay_i2c_t *replay = ctx;
+    bool write = rx_len == 0;
+    size_t i;
+
+    if (!tx_len)
+        return ESP_FAIL;
+
+    if (write)
+        replay->writes++;
+    else
+        replay->reads++;
+
+    for (i = replay->cursor; i < record_count; i++)
+    {
+        capture_record_t *record = &records[i];
+
+        if (record_source(record) == CAPTURE_BMP280 && !(record->type & CAPTURE_FLAG_TX) == !write &&
+            record->length && record->data[0] == tx[0] && (write || record->length - 1 == rx_len))
+            break;
+    }
+
+    if (i == record_count)
+    {
+        replay->unmatched++;
+        return write ? ESP_OK : ESP_FAIL;
+    }
+
+    replay->cursor = i + 1;
+
+    if (records[i].type & CAPTURE_FLAG_ERROR)
+        return ESP_FAIL;
+
+    if (!write)
+    {
+        memcpy(rx, records[i].data + 1, rx_len);
+        replayed_bytes += rx_len;
+    }
+
+    return ESP_OK;
+}
+
+static void output_add(output_list_t *list, double time, const char *topic, const char *payload, int len)
+{
+    output_t *item;
+
+    if (list->count == list->capacity)
+    {
+        list->capacity = list->capacity ? list->capacity * 2 : 1024;
+        list->items = realloc(list->items, list->capacity * sizeof(output_t));
+    }
+
+    item = &list->items[list->count++];
+    item->time = time;
+    item->topic = strdup(topic);
+    item->payload = strndup(payload, len);
+}
+
+static int replay_publish(void *ctx, esp_mqtt_client_handle_t client, const char *topic, const char *data,
+                          int len, int qos, int retain)
+{
+    output_add(&outputs, shim_now() / 1e6, topic, data, len);
+
+    return ESP_OK;
+}
+
+static int replay_connect(void *ctx, esp_mqtt_client_handle_t client, const esp_mqtt_client_config_t *config)
+{
+    return ESP_OK;
+}
+
+static void replay_disconnect(void *ctx, esp_mqtt_client_handle_t client)
+{
+}
+
+static int replay_subscribe(void *ctx, esp_mqtt_client_handle_t client, const char *topic, int qos)
+{
+    return ESP_OK;
+}
+
+static int load_outputs(const char *path, output_list_t *list)
+{
+    FILE *f = fopen(path, "r");
+    char line[512];
+
+    if (!f)
+        return -1;
+
+    while (fgets(line, sizeof(line), f))
+    {
+        char topic[256];
+        double time;
+        int offset;
+
+        line[strcspn(line, "\n")] = '\0';
+        if (sscanf(line, "%lf %255s %n", &time, topic, &offset) == 2)
+            output_add(list, time, topic, line + offset, strlen(line + offset));
+    }
+    fclose(f);
+
+    return 0;
+}
+
+static void write_outputs(const char *path)
+{
+    FILE *f = fopen(path, "w");
+
+    if (!f)
+    {
+        perror(path);
+        return;
+    }
+
+    for (size_t i = 0; i < outputs.count; i++)
+        fprintf(f, "%.3f %s %s\n", outputs.items[i].time, outputs.items[i].topic, outputs.items[i].payload);
+    fclose(f);
+}
+
+static void compare_outputs(const output_list_t *baseline)
+{
+    /*
+    Pairs the n-th message of a topic in both runs. Numeric payloads are
+    compared by value, others must be equal.
+    */
+
+    size_t compared = 0, differ = 0;
+    char **seen = calloc(baseline->count, sizeof(char *));
+    size_t seen_count = 0;
+
+    for (size_t b = 0; b < baseline->count; b++)
+    {
+        const char *topic = baseline->items[b].topic;
+        size_t base_n = 0, out_n = 0, pairs = 0, topic_differ = 0;
+        double max_delta = 0, sum_delta = 0;
+        size_t j = 0;
+        bool done = false;
+
+        for (size_t k = 0; k < seen_count && !done; k++)
+            done = !strcmp(seen[k], topic);
+        if (done)
+            continue;
+        seen[seen_count++] = (char *)topic;
+
+        for (size_t i = b; i < baseline->count; i++)
+        {
+            const char *expected = baseline->items[i].payload;
+            char *end_expected, *end_actual;
+            double e, a;
+
+            if (strcmp(baseline->items[i].topic, topic))
+                continue;
+            base_n++;
+
+            while (j < outputs.count && strcmp(outputs.items[j].topic, topic))
+                j++;
+            if (j == outputs.count)
+                continue;
+
+            pairs++;
+            e = strtod(expected, &end_expected);
+            a = strtod(outputs.items[j].payload, &end_actual);
+            if (*expected && !*end_expected && *outputs.items[j].payload && !*end_actual)
+            {
+                double delta = a > e ? a - e : e - a;
+
+                if (delta > max_delta)
+                    max_delta = delta;
+                sum_delta += delta;
+                if (delta > 0)
+                    topic_differ++;
+            }
+            else if (strcmp(expected, outputs.items[j].payload))
+                topic_differ++;
+            j++;
+        }
+
+        for (size_t i = 0; i < outputs.count; i++)
+            out_n += !strcmp(outputs.items[i].topic, topic);
+
+        compared += pairs;
+        differ += topic_differ + (base_n > out_n ? base_n - out_n : out_n - base_n);
+
+        if (topic_differ || base_n != out_n)
+            printf("  %s: %zu/%zu messages, %zu differ, max delta %g, mean delta %g\n", topic, out_n, base_n,
+                   topic_differ, max_delta, pairs ? sum_delta / pairs : 0.0);
+    }
+
+    printf("outputs: %zu compared with the baseline, %zu differ\n", compared, differ);
+    free(seen);
+}
+
+static void print_stats(const char *name, const sample_stats_t *stats)
+{
+    double reads = stats->reads ? stats->reads : 1;
+
+    printf("%s: %u reads, %u checksum errors (%.2f%%), %u timeouts (%.2f%%), %u out of range (%.2f%%)\n", name,
+           stats->reads, stats->checksum_errors, 100 * stats->checksum_errors / reads, stats->timeouts,
+           100 * stats->timeouts / reads, stats->out_of_range, 100 * stats->out_of_range / reads);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s CAPTURE [--output FILE] [--baseline FILE] [--extra-seconds N] [--print-mqtt]\n",
+            name);
+}
+
+int main(int argc, char **argv)
+{
+    static const sim_timing_t timing = {.baud = 9600, .latency = 10000};
+    static replay_uart_t pms = {.base = {.name = "pms7003", .input = replay_uart_input}, .source = CAPTURE_PMS7003};
+    static replay_uart_t co2 = {.base = {.name = "mh-z19", .input = replay_uart_input}, .source = CAPTURE_MHZ19};
+    static replay_i2c_t bmp280;
+    shim_mqtt_broker_t broker = {
+        .connect = replay_connect,
+        .disconnect = replay_disconnect,
+        .publish = replay_publish,
+        .subscribe = replay_subscribe,
+    };
+    const char *capture_path = NULL;
+    const char *output_path = NULL;
+    const char *baseline_path = NULL;
+    uint64_t extra = 10;
+    bool print = false;
+    output_list_t baseline = {0};
+    size_t counts[CAPTURE_BMP280 + 1] = {0};
+    struct timeval start, end;
+    double span, wall;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--output") && i + 1 < argc)
+            output_path = argv[++i];
+        else if (!strcmp(argv[i], "--baseline") && i + 1 < argc)
+            baseline_path = argv[++i];
+        else if (!strcmp(argv[i], "--extra-seconds") && i + 1 < argc)
+            extra = strtoull(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--print-mqtt"))
+            print = true;
+        else if (argv[i][0] != '-' && !capture_path)
+            capture_path = argv[i];
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!capture_path)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (load_capture(capture_path))
+    {
+        fprintf(stderr, "cannot load capture %s\n", capture_path);
+        return 1;
+    }
+
+    if (baseline_path && load_outputs(baseline_path, &baseline))
+    {
+        fprintf(stderr, "cannot load baseline %s\n", baseline_path);
+        return 1;
+    }
+
+    for (size_t i = 0; i < record_count; i++)
+        counts[record_source(&records[i])]++;
+    span = records[record_count - 1].time / 1000.0;
+
+    printf("capture: %zu records over %.0f s: pms7003 %zu, mh-z19 %zu, bmp280 %zu\n", record_count, span,
+           counts[CAPTURE_PMS7003], counts[CAPTURE_MHZ19], counts[CAPTURE_BMP280]);
+
+    shim_init(SHIM_CLOCK_VIRTUAL);
+    shim_mqtt_set_broker(&broker);
+
+    sim_uart_attach(UART_NUM_2, &pms.base, &timing);
+    sim_uart_attach(UART_NUM_1, &co2.base, &timing);
+    shim_i2c_attach(I2C_NUM_0, 0x76, &(shim_i2c_device_t){.transfer = replay_i2c_transfer, .ctx = &bmp280});
+
+    xTaskCreate(app_task, "main", 3584, NULL, 1, NULL);
+
+    gettimeofday(&start, NULL);
+    shim_run((uint64_t)(span + extra) * 1000000);
+    gettimeofday(&end, NULL);
+
+    wall = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+
+    printf("replay: %.0f s of device time in %.3f s, %.0fx real time, %.0f bytes/s through the drivers\n",
+           span + extra, wall, (span + extra) / wall, replayed_bytes / wall);
+    printf("commands: pms7003 %u (%u unmatched), mh-z19 %u (%u unmatched), "
+           "bmp280 %u reads %u writes (%u unmatched)\n",
+           pms.commands, pms.unmatched, co2.commands, co2.unmatched, bmp280.reads, bmp280.writes,
+           bmp280.unmatched);
+
+    print_stats("dust", &dust_values.stats);
+    print_stats("co2", &co2_values.stats);
+    print_stats("bmp", &bmp_values.stats);
+
+    if (print)
+    {
+        for (size_t i = 0; i < outputs.count; i++)
+            printf("%.3f %s %s\n", outputs.items[i].time, outputs.items[i].topic, outputs.items[i].payload);
+    }
+
+    if (output_path)
+        write_outputs(output_path);
+
+    if (baseline_path)
+        compare_outputs(&baseline);
+
+    return 0;
+}
@@ -0,0 +1,105 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_event.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+#include "kernel.h"
+
+#define EVENT_MAX_HANDLERS 16
+#define EVENT_QUEUE_LENGTH 32
+#define EVENT_MAX_DATA 64
+
+typedef struct
+{
+    esp_event_base_t base;
+    int32_t id;
+    esp_event_handler_t handler;
+    void *arg;
+} event_handler_t;
+
+typedef struct
+{
+    esp_event_base_t base;
+    int32_t id;
+    size_t size;
+    uint8_t data[EVENT_MAX_DATA];
+} event_t;
+
+static event_handler_t handlers[EVENT_MAX_HANDLERS];
+static int handler_count;
+static QueueHandle_t event_queue;
+
+static void event_task(void *arg)
+{
+    event_t event;
+
+    for (;;)
+    {
+        if (xQueueReceive(event_queue, &event, portMAX_DELAY) != pdTRUE)
+            continue;
+
+        for (int i = 0; i < handler_count; i++)
+        {
+            event_handler_t *h = &handlers[i];
+
+            if ((h->base == ESP_EVENT_ANY_BASE || h->base == event.base) &&
+                (h->id == ESP_EVENT_ANY_ID || h->id == event.id))
+                h->handler(h->arg, event.base, event.id, event.size ? event.data : NULL);
+        }
+    }
+}
+
+esp_err_t esp_event_loop_create_default(void)
+{
+    if (event_queue)
+        return ESP_ERR_INVALID_STATE;
+
+    event_queue = xQueueCreate(EVENT_QUEUE_LENGTH, sizeof(event_t));
+    xTaskCreate(event_task, "sys_evt", 2304, NULL, 20, NULL);
+
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_register(esp_event_base_t event_base, int32_t event_id,
+                                     esp_event_handler_t event_handler, void *event_handler_arg)
+{
+    if (handler_count == EVENT_MAX_HANDLERS)
+        return ESP_ERR_NO_MEM;
+
+    k_enter();
+    handlers[handler_count].base = event_base;
+    handlers[handler_count].id = event_id;
+    handlers[handler_count].handler = event_handler;
+    handlers[handler_count].arg = event_handler_arg;
+    handler_count++;
+    k_leave();
+
+    return ESP_OK;
+}
+
+esp_err_t esp_event_post(esp_event_base_t event_base, int32_t event_id, void *event_data,
+                         size_t event_data_size, TickType_t ticks_to_wait)
+{
+    event_t event = {
+        .base = event_base,
+        .id = event_id,
+        .size = event_data_size,
+    };
+
+    if (!event_queue)
+        return ESP_ERR_INVALID_STATE;
+
+    if (event_data_size > EVENT_MAX_DATA)
+        return ESP_ERR_INVALID_SIZE;
+
+    if (event_data_size)
+        memcpy(event.data, event_data, event_data_size);
+
+    // callbacks in kernel context cannot wait for room in the queue
+    if (xQueueSend(event_queue, &event, k_in_task() ? ticks_to_wait : 0) != pdTRUE)
+        return ESP_ERR_TIMEOUT;
+
+    return ESP_OK;
+}
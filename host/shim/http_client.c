@@ -0,0 +1,254 @@
+#define _GNU_SOURCE
+
+#include <netdb.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "esp_http_client.h"
+
+#define HTTP_MAX_HOST 128
+#define HTTP_MAX_PATH 512
+#define HTTP_MAX_HEADERS 512 // extra request headers
+#define HTTP_HEAD_BUFFER 4096 // response head, body bytes read with it are kept
+
+struct esp_http_client
+{
+    char host[HTTP_MAX_HOST];
+    char port[8];
+    char path[HTTP_MAX_PATH];
+    char headers[HTTP_MAX_HEADERS];
+    int timeout_ms;
+    int fd;
+    int status;
+    int64_t content_length;
+    int64_t body_read;
+    char head[HTTP_HEAD_BUFFER];
+    size_t head_length;
+    size_t body_start; // of the body bytes in `head`
+};
+
+static bool parse_url(esp_http_client_handle_t client, const char *url)
+{
+    const char *host = url;
+    const char *path;
+    const char *colon;
+    size_t len;
+
+    if (strncmp(host, "http://", 7))
+        return false;
+    host += 7;
+
+    path = host + strcspn(host, "/");
+    colon = memchr(host, ':', path - host);
+    len = (colon ? colon : path) - host;
+    if (!len || len >= sizeof(client->host) || strlen(path) >= sizeof(client->path))
+        return false;
+
+    memcpy(client->host, host, len);
+    client->host[len] = 0;
+    if (colon)
+    {
+        len = path - colon - 1;
+        if (!len || len >= sizeof(client->port))
+            return false;
+        memcpy(client->port, colon + 1, len);
+        client->port[len] = 0;
+    }
+    else
+        strcpy(client->port, "80");
+    strcpy(client->path, *path ? path : "/");
+
+    return true;
+}
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config)
+{
+    esp_http_client_handle_t client = calloc(1, sizeof(*client));
+
+    if (!client)
+        return NULL;
+
+    if (!config->url || !parse_url(client, config->url))
+    {
+        fprintf(stderr, "shim: can't use URL %s, only http://host[:port]/path\n", config->url ? config->url : "");
+        free(client);
+        return NULL;
+    }
+
+    client->timeout_ms = config->timeout_ms ? config->timeout_ms : 5000;
+    client->fd = -1;
+
+    return client;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char *key, const char *value)
+{
+    size_t used = strlen(client->headers);
+    int len = snprintf(client->headers + used, sizeof(client->headers) - used, "%s: %s\r\n", key, value);
+
+    if (len < 0 || (size_t)len >= sizeof(client->headers) - used)
+    {
+        client->headers[used] = 0;
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+static bool send_all(int fd, const char *data, size_t len)
+{
+    while (len)
+    {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+
+        if (n <= 0)
+            return false;
+        data += n;
+        len -= n;
+    }
+
+    return true;
+}
+
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len)
+{
+    struct addrinfo hints = {.ai_socktype = SOCK_STREAM};
+    struct timeval timeout = {client->timeout_ms / 1000, client->timeout_ms % 1000 * 1000};
+    struct addrinfo *res;
+    char request[HTTP_MAX_PATH + HTTP_MAX_HOST + HTTP_MAX_HEADERS + 64];
+    int len;
+
+    if (write_len > 0)
+        return ESP_ERR_NOT_SUPPORTED;
+
+    esp_http_client_close(client);
+
+    if (getaddrinfo(client->host, client->port, &hints, &res))
+        return ESP_FAIL;
+
+    client->fd = socket(res->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (client->fd < 0 || setsockopt(client->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) ||
+        setsockopt(client->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) ||
+        connect(client->fd, res->ai_addr, res->ai_addrlen))
+    {
+        freeaddrinfo(res);
+        esp_http_client_close(client);
+        return ESP_FAIL;
+    }
+    freeaddrinfo(res);
+
+    len = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n%s\r\n",
+                   client->path, client->host, client->headers);
+    if (!send_all(client->fd, request, len))
+    {
+        esp_http_client_close(client);
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+int esp_http_client_fetch_headers(esp_http_client_handle_t client)
+{
+    char *end = NULL;
+
+    if (client->fd < 0)
+        return ESP_FAIL;
+
+    while (!end)
+    {
+        ssize_t n;
+
+        if (client->head_length == sizeof(client->head) - 1)
+            return ESP_FAIL;
+        n = recv(client->fd, client->head + client->head_length, sizeof(client->head) - 1 - client->head_length, 0);
+        if (n <= 0)
+            return ESP_FAIL;
+        client->head_length += n;
+        client->head[client->head_length] = 0;
+        end = strstr(client->head, "\r\n\r\n");
+    }
+
+    client->body_start = end + 4 - client->head;
+    if (sscanf(client->head, "HTTP/1.%*d %d", &client->status) != 1)
+        return ESP_FAIL;
+
+    client->content_length = -1;
+    for (char *line = strstr(client->head, "\r\n"); line && line < end; line = strstr(line + 2, "\r\n"))
+    {
+        if (!strncasecmp(line + 2, "Content-Length:", 15))
+            client->content_length = strtoll(line + 17, NULL, 10);
+        else if (!strncasecmp(line + 2, "Transfer-Encoding:", 18))
+        {
+            fprintf(stderr, "shim: chunked HTTP responses are not supported\n");
+            return ESP_FAIL;
+        }
+    }
+
+    return client->content_length < 0 ? -1 : (int)client->content_length;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client)
+{
+    return client->status;
+}
+
+int esp_http_client_read(esp_http_client_handle_t client, char *buffer, int len)
+{
+    ssize_t n;
+
+    if (client->fd < 0)
+        return -1;
+
+    if (client->content_length >= 0 && len > client->content_length - client->body_read)
+        len = client->content_length - client->body_read;
+    if (len <= 0)
+        return 0;
+
+    if (client->body_start < client->head_length)
+    {
+        n = client->head_length - client->body_start;
+        if (n > len)
+            n = len;
+        memcpy(buffer, client->head + client->body_start, n);
+        client->body_start += n;
+    }
+    else
+    {
+        n = recv(client->fd, buffer, len, 0);
+        if (n < 0)
+            return -1;
+    }
+
+    client->body_read += n;
+
+    return n;
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t client)
+{
+    if (client->fd >= 0)
+        close(client->fd);
+    client->fd = -1;
+    client->status = 0;
+    client->content_length = -1;
+    client->body_read = 0;
+    client->head_length = 0;
+    client->body_start = 0;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client)
+{
+    esp_http_client_close(client);
+    free(client);
+
+    return ESP_OK;
+}
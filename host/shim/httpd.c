@@ -0,0 +1,576 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "esp_http_server.h"
+#include "freertos/task.h"
+
+#include "shim.h"
+#include "kernel.h"
+
+#define HTTPD_HEAD_BUFFER 2048 // request line and headers, longer requests are refused
+#define HTTPD_MAX_HEADERS 512  // extra response headers
+#define HTTPD_SND_BUF 5744     // CONFIG_LWIP_TCP_SND_BUF_DEFAULT, streams block like on the device
+
+typedef struct
+{
+    int fd;
+    int method;
+    char uri[HTTPD_MAX_URI_LEN + 1];
+} httpd_conn_t;
+
+// connection kept open by a handler that used httpd_send()
+typedef struct
+{
+    int fd; // -1 for a free slot
+    void *ctx;
+    httpd_free_ctx_fn_t free_ctx;
+    bool closing;
+} httpd_sess_t;
+
+typedef struct
+{
+    httpd_config_t config;
+    int listen_fd;
+    int wake_fd[2]; // makes the acceptor poll the current sessions
+    httpd_uri_t *handlers;
+    int handler_count;
+    httpd_conn_t *pending; // accepted requests waiting for the server task
+    int pending_head;
+    int pending_count;
+    httpd_sess_t *sessions; // max_open_sockets
+    uint32_t refused;       // with max_open_sockets requests pending
+} httpd_server_t;
+
+// response state of a request, its aux
+typedef struct
+{
+    int fd;
+    const char *status;
+    const char *type;
+    char headers[HTTPD_MAX_HEADERS];
+    bool sent; // complete response
+    bool raw;  // httpd_send(), the handler owns the connection
+} httpd_resp_t;
+
+static int port_override;
+
+void shim_httpd_port(int port)
+{
+    port_override = port;
+}
+
+static bool send_all(int fd, const char *data, size_t len)
+{
+    while (len)
+    {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+
+        if (n <= 0)
+            return false;
+        data += n;
+        len -= n;
+    }
+
+    return true;
+}
+
+static int parse_method(const char *head, size_t len)
+{
+    static const struct
+    {
+        const char *name;
+        int method;
+    } methods[] = {{"GET ", HTTP_GET}, {"HEAD ", HTTP_HEAD}, {"POST ", HTTP_POST}, {"DELETE ", HTTP_DELETE}};
+
+    for (size_t i = 0; i < sizeof(methods) / sizeof(methods[0]); i++)
+    {
+        if (!strncmp(head, methods[i].name, strlen(methods[i].name)))
+            return methods[i].method;
+    }
+
+    return -1;
+}
+
+// reads the request head on the acceptor thread, false if it is not a request we take
+static bool read_request(httpd_server_t *server, int fd, httpd_conn_t *conn)
+{
+    char head[HTTPD_HEAD_BUFFER];
+    size_t len = 0;
+    const char *uri;
+    size_t uri_len;
+
+    while (len < sizeof(head) - 1)
+    {
+        ssize_t n = recv(fd, head + len, sizeof(head) - 1 - len, 0);
+
+        if (n <= 0)
+            return false;
+        len += n;
+        head[len] = 0;
+        if (strstr(head, "\r\n\r\n"))
+            break;
+    }
+    if (!strstr(head, "\r\n\r\n"))
+        return false;
+
+    conn->method = parse_method(head, len);
+    uri = strchr(head, ' ');
+    if (conn->method < 0 || !uri)
+        return false;
+    uri++;
+    uri_len = strcspn(uri, " \r\n");
+    if (uri_len > HTTPD_MAX_URI_LEN)
+        return false;
+
+    memcpy(conn->uri, uri, uri_len);
+    conn->uri[uri_len] = 0;
+    conn->fd = fd;
+
+    return true;
+}
+
+static void accept_request(httpd_server_t *server)
+{
+    static const char bad_request[] = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    struct timeval recv_timeout = {server->config.recv_wait_timeout, 0};
+    struct timeval send_timeout = {server->config.send_wait_timeout, 0};
+    int send_buffer = HTTPD_SND_BUF;
+    httpd_conn_t conn;
+    int fd = accept4(server->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+
+    if (fd < 0)
+        return;
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &recv_timeout, sizeof(recv_timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &send_buffer, sizeof(send_buffer));
+
+    if (!read_request(server, fd, &conn))
+    {
+        send_all(fd, bad_request, sizeof(bad_request) - 1);
+        close(fd);
+        return;
+    }
+
+    k_enter();
+    if (server->pending_count == server->config.max_open_sockets)
+    {
+        server->refused++;
+        close(fd);
+    }
+    else
+    {
+        server->pending[(server->pending_head + server->pending_count) % server->config.max_open_sockets] = conn;
+        server->pending_count++;
+        k_wake(server);
+    }
+    k_leave();
+}
+
+// anything a kept session receives is dropped, end of stream or an error closes it
+static void check_session(httpd_server_t *server, int slot, int fd)
+{
+    httpd_sess_t *sess = &server->sessions[slot];
+    char buf[256];
+
+    // under the lock: the server task frees the slot before it closes the fd
+    k_enter();
+    if (sess->fd == fd && !sess->closing)
+    {
+        ssize_t n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+        {
+            sess->closing = true;
+            k_wake(server);
+        }
+    }
+    k_leave();
+}
+
+static void *acceptor(void *arg)
+{
+    httpd_server_t *server = arg;
+    int max = server->config.max_open_sockets;
+    struct pollfd fds[2 + max];
+    int slots[2 + max];
+
+    for (;;)
+    {
+        int count = 2;
+        char drain[64];
+
+        fds[0] = (struct pollfd){.fd = server->listen_fd, .events = POLLIN};
+        fds[1] = (struct pollfd){.fd = server->wake_fd[0], .events = POLLIN};
+        k_enter();
+        for (int i = 0; i < max; i++)
+        {
+            if (server->sessions[i].fd < 0 || server->sessions[i].closing)
+                continue;
+            slots[count] = i;
+            fds[count++] = (struct pollfd){.fd = server->sessions[i].fd, .events = POLLIN};
+        }
+        k_leave();
+
+        if (poll(fds, count, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return NULL;
+        }
+
+        if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL))
+            return NULL;
+        if (fds[1].revents)
+            while (read(server->wake_fd[0], drain, sizeof(drain)) > 0)
+                ;
+        for (int i = 2; i < count; i++)
+        {
+            if (fds[i].revents)
+                check_session(server, slots[i], fds[i].fd);
+        }
+        if (fds[0].revents & POLLIN)
+            accept_request(server);
+    }
+}
+
+static void wake_acceptor(httpd_server_t *server)
+{
+    char byte = 0;
+
+    if (write(server->wake_fd[1], &byte, 1) < 0)
+        return; // full, a wake-up is pending anyway
+}
+
+static bool keep_session(httpd_server_t *server, int fd, const httpd_req_t *req)
+{
+    bool kept = false;
+
+    k_enter();
+    for (int i = 0; i < server->config.max_open_sockets && !kept; i++)
+    {
+        if (server->sessions[i].fd >= 0)
+            continue;
+        server->sessions[i] = (httpd_sess_t){.fd = fd, .ctx = req->sess_ctx, .free_ctx = req->free_ctx};
+        kept = true;
+    }
+    k_leave();
+
+    if (kept)
+        wake_acceptor(server);
+
+    return kept;
+}
+
+static void free_ctx(void *ctx, httpd_free_ctx_fn_t fn)
+{
+    if (fn)
+        fn(ctx);
+    else
+        free(ctx);
+}
+
+// ends the sessions marked closing, outside the lock as free_ctx may block
+static void close_sessions(httpd_server_t *server)
+{
+    for (int i = 0; i < server->config.max_open_sockets; i++)
+    {
+        httpd_sess_t sess;
+
+        k_enter();
+        sess = server->sessions[i];
+        if (sess.fd >= 0 && sess.closing)
+            server->sessions[i].fd = -1;
+        k_leave();
+
+        if (sess.fd < 0 || !sess.closing)
+            continue;
+        free_ctx(sess.ctx, sess.free_ctx);
+        close(sess.fd);
+        wake_acceptor(server);
+    }
+}
+
+static bool sessions_closing(httpd_server_t *server)
+{
+    for (int i = 0; i < server->config.max_open_sockets; i++)
+    {
+        if (server->sessions[i].fd >= 0 && server->sessions[i].closing)
+            return true;
+    }
+
+    return false;
+}
+
+static const httpd_uri_t *find_handler(httpd_server_t *server, const httpd_conn_t *conn)
+{
+    size_t len = strcspn(conn->uri, "?");
+
+    for (int i = 0; i < server->handler_count; i++)
+    {
+        const httpd_uri_t *handler = &server->handlers[i];
+
+        if ((int)handler->method == conn->method && strlen(handler->uri) == len &&
+            !strncmp(handler->uri, conn->uri, len))
+            return handler;
+    }
+
+    return NULL;
+}
+
+static void server_task(void *arg)
+{
+    httpd_server_t *server = arg;
+
+    for (;;)
+    {
+        httpd_conn_t conn;
+        httpd_req_t req = {.handle = server};
+        httpd_resp_t resp = {.status = "200 OK", .type = "text/html"};
+        const httpd_uri_t *handler;
+
+        k_enter();
+        while (!server->pending_count && !sessions_closing(server))
+            k_block(server, K_FOREVER);
+        k_leave();
+
+        close_sessions(server);
+
+        k_enter();
+        if (!server->pending_count)
+        {
+            k_leave();
+            continue;
+        }
+        conn = server->pending[server->pending_head];
+        server->pending_head = (server->pending_head + 1) % server->config.max_open_sockets;
+        server->pending_count--;
+        k_leave();
+
+        resp.fd = conn.fd;
+        req.method = conn.method;
+        req.aux = &resp;
+        memcpy((char *)req.uri, conn.uri, sizeof(conn.uri));
+
+        handler = find_handler(server, &conn);
+        if (!handler)
+            httpd_resp_send_err(&req, HTTPD_404_NOT_FOUND, NULL);
+        else
+        {
+            req.user_ctx = handler->user_ctx;
+            if (handler->handler(&req) != ESP_OK && !resp.sent && !resp.raw)
+                httpd_resp_send_err(&req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+            else if (resp.raw && !resp.sent && keep_session(server, conn.fd, &req))
+                continue;
+        }
+
+        if (req.sess_ctx)
+            free_ctx(req.sess_ctx, req.free_ctx);
+        close(conn.fd);
+    }
+}
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config)
+{
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_ANY)};
+    httpd_server_t *server = calloc(1, sizeof(*server));
+    pthread_t thread;
+    int one = 1;
+
+    if (!server)
+        return ESP_ERR_NO_MEM;
+
+    server->config = *config;
+    server->handlers = calloc(config->max_uri_handlers, sizeof(httpd_uri_t));
+    server->pending = calloc(config->max_open_sockets, sizeof(httpd_conn_t));
+    server->sessions = calloc(config->max_open_sockets, sizeof(httpd_sess_t));
+    server->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    addr.sin_port = htons(port_override ? port_override : config->server_port);
+
+    for (int i = 0; server->sessions && i < config->max_open_sockets; i++)
+        server->sessions[i].fd = -1;
+
+    if (!server->handlers || !server->pending || !server->sessions || server->listen_fd < 0 ||
+        pipe2(server->wake_fd, O_CLOEXEC | O_NONBLOCK) ||
+        setsockopt(server->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) ||
+        bind(server->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+        listen(server->listen_fd, config->backlog_conn))
+    {
+        fprintf(stderr, "shim: can't serve HTTP on port %d\n", ntohs(addr.sin_port));
+        if (server->listen_fd >= 0)
+            close(server->listen_fd);
+        free(server->handlers);
+        free(server->pending);
+        free(server->sessions);
+        free(server);
+        return ESP_ERR_HTTPD_TASK;
+    }
+
+    if (xTaskCreate(server_task, "httpd", config->stack_size, server, config->task_priority, NULL) != pdPASS ||
+        pthread_create(&thread, NULL, acceptor, server))
+        return ESP_ERR_HTTPD_TASK;
+    pthread_detach(thread);
+
+    fprintf(stderr, "shim: serving HTTP on port %d\n", ntohs(addr.sin_port));
+    *handle = server;
+
+    return ESP_OK;
+}
+
+esp_err_t httpd_stop(httpd_handle_t handle)
+{
+    httpd_server_t *server = handle;
+
+    // the acceptor ends, the server task stays blocked
+    shutdown(server->listen_fd, SHUT_RDWR);
+
+    return ESP_OK;
+}
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri_handler)
+{
+    httpd_server_t *server = handle;
+    esp_err_t err = ESP_OK;
+
+    k_enter();
+    for (int i = 0; i < server->handler_count; i++)
+    {
+        if (server->handlers[i].method == uri_handler->method && !strcmp(server->handlers[i].uri, uri_handler->uri))
+            err = ESP_ERR_HTTPD_HANDLER_EXISTS;
+    }
+    if (err == ESP_OK && server->handler_count == server->config.max_uri_handlers)
+        err = ESP_ERR_HTTPD_HANDLERS_FULL;
+    if (err == ESP_OK)
+        server->handlers[server->handler_count++] = *uri_handler;
+    k_leave();
+
+    return err;
+}
+
+esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status)
+{
+    ((httpd_resp_t *)r->aux)->status = status;
+
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type)
+{
+    ((httpd_resp_t *)r->aux)->type = type;
+
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field, const char *value)
+{
+    httpd_resp_t *resp = r->aux;
+    size_t used = strlen(resp->headers);
+    int len = snprintf(resp->headers + used, sizeof(resp->headers) - used, "%s: %s\r\n", field, value);
+
+    if (len < 0 || (size_t)len >= sizeof(resp->headers) - used)
+    {
+        resp->headers[used] = 0;
+        return ESP_ERR_HTTPD_RESP_SEND;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len)
+{
+    httpd_resp_t *resp = r->aux;
+    char head[128 + HTTPD_MAX_HEADERS];
+    int len;
+
+    if (buf_len == HTTPD_RESP_USE_STRLEN)
+        buf_len = buf ? strlen(buf) : 0;
+
+    len = snprintf(head, sizeof(head), "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %zd\r\n%sConnection: close\r\n\r\n",
+                   resp->status, resp->type, buf_len, resp->headers);
+    resp->sent = true;
+
+    if (!send_all(resp->fd, head, len) || (r->method != HTTP_HEAD && !send_all(resp->fd, buf, buf_len)))
+        return ESP_ERR_HTTPD_RESP_SEND;
+
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_err(httpd_req_t *req, httpd_err_code_t error, const char *msg)
+{
+    static const char *statuses[] = {
+        [HTTPD_400_BAD_REQUEST] = "400 Bad Request",
+        [HTTPD_404_NOT_FOUND] = "404 Not Found",
+        [HTTPD_500_INTERNAL_SERVER_ERROR] = "500 Internal Server Error",
+    };
+
+    httpd_resp_set_status(req, statuses[error]);
+    httpd_resp_set_type(req, "text/plain");
+
+    return httpd_resp_send(req, msg ? msg : statuses[error], HTTPD_RESP_USE_STRLEN);
+}
+
+int httpd_req_to_sockfd(httpd_req_t *r)
+{
+    return ((httpd_resp_t *)r->aux)->fd;
+}
+
+static int sock_err(void)
+{
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? HTTPD_SOCK_ERR_TIMEOUT : HTTPD_SOCK_ERR_FAIL;
+}
+
+int httpd_send(httpd_req_t *r, const char *buf, size_t buf_len)
+{
+    httpd_resp_t *resp = r->aux;
+    ssize_t n;
+
+    if (!buf && buf_len)
+        return HTTPD_SOCK_ERR_INVALID;
+
+    resp->raw = true;
+    n = send(resp->fd, buf, buf_len, MSG_NOSIGNAL);
+
+    return n < 0 ? sock_err() : n;
+}
+
+int httpd_socket_send(httpd_handle_t hd, int sockfd, const char *buf, size_t buf_len, int flags)
+{
+    ssize_t n;
+
+    if (!buf && buf_len)
+        return HTTPD_SOCK_ERR_INVALID;
+
+    n = send(sockfd, buf, buf_len, flags | MSG_NOSIGNAL);
+
+    return n < 0 ? sock_err() : n;
+}
+
+esp_err_t httpd_sess_trigger_close(httpd_handle_t handle, int sockfd)
+{
+    httpd_server_t *server = handle;
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+
+    k_enter();
+    for (int i = 0; i < server->config.max_open_sockets; i++)
+    {
+        if (server->sessions[i].fd != sockfd)
+            continue;
+        server->sessions[i].closing = true;
+        k_wake(server);
+        err = ESP_OK;
+    }
+    k_leave();
+
+    return err;
+}
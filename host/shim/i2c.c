@@ -0,0 +1,197 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "driver/i2c.h"
+
+#include "shim.h"
+#include "kernel.h"
+
+#define I2C_MAX_DEVICES 8
+#define I2C_MAX_OPS 64
+
+typedef enum
+{
+    I2C_OP_START,
+    I2C_OP_STOP,
+    I2C_OP_WRITE,
+    I2C_OP_READ,
+} i2c_op_type_t;
+
+typedef struct
+{
+    i2c_op_type_t type;
+    uint8_t data;
+    uint8_t *dest;
+} i2c_op_t;
+
+struct shim_i2c_cmd
+{
+    i2c_op_t ops[I2C_MAX_OPS];
+    int count;
+};
+
+typedef struct
+{
+    uint8_t addr;
+    shim_i2c_device_t device;
+} i2c_slave_t;
+
+typedef struct
+{
+    bool installed;
+    i2c_slave_t slaves[I2C_MAX_DEVICES];
+    int slave_count;
+} shim_i2c_t;
+
+static shim_i2c_t buses[I2C_NUM_MAX];
+
+void shim_i2c_attach(int i2c_num, uint8_t addr, const shim_i2c_device_t *device)
+{
+    shim_i2c_t *bus = &buses[i2c_num];
+
+    k_enter();
+    if (bus->slave_count < I2C_MAX_DEVICES)
+    {
+        bus->slaves[bus->slave_count].addr = addr;
+        bus->slaves[bus->slave_count].device = *device;
+        bus->slave_count++;
+    }
+    k_leave();
+}
+
+esp_err_t i2c_param_config(i2c_port_t i2c_num, const i2c_config_t *i2c_conf)
+{
+    return i2c_num < I2C_NUM_MAX ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t i2c_driver_install(i2c_port_t i2c_num, i2c_mode_t mode, size_t slv_rx_buf_len,
+                             size_t slv_tx_buf_len, int intr_alloc_flags)
+{
+    if (i2c_num >= I2C_NUM_MAX)
+        return ESP_ERR_INVALID_ARG;
+
+    buses[i2c_num].installed = true;
+
+    return ESP_OK;
+}
+
+i2c_cmd_handle_t i2c_cmd_link_create(void)
+{
+    return calloc(1, sizeof(struct shim_i2c_cmd));
+}
+
+void i2c_cmd_link_delete(i2c_cmd_handle_t cmd_handle)
+{
+    free(cmd_handle);
+}
+
+static esp_err_t i2c_add_op(i2c_cmd_handle_t cmd, i2c_op_type_t type, uint8_t data, uint8_t *dest)
+{
+    if (cmd->count == I2C_MAX_OPS)
+        return ESP_ERR_NO_MEM;
+
+    cmd->ops[cmd->count].type = type;
+    cmd->ops[cmd->count].data = data;
+    cmd->ops[cmd->count].dest = dest;
+    cmd->count++;
+
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_start(i2c_cmd_handle_t cmd_handle)
+{
+    return i2c_add_op(cmd_handle, I2C_OP_START, 0, NULL);
+}
+
+esp_err_t i2c_master_stop(i2c_cmd_handle_t cmd_handle)
+{
+    return i2c_add_op(cmd_handle, I2C_OP_STOP, 0, NULL);
+}
+
+esp_err_t i2c_master_write_byte(i2c_cmd_handle_t cmd_handle, uint8_t data, bool ack_en)
+{
+    return i2c_add_op(cmd_handle, I2C_OP_WRITE, data, NULL);
+}
+
+esp_err_t i2c_master_read_byte(i2c_cmd_handle_t cmd_handle, uint8_t *data, int ack)
+{
+    return i2c_add_op(cmd_handle, I2C_OP_READ, 0, data);
+}
+
+static i2c_slave_t *i2c_find(shim_i2c_t *bus, uint8_t addr)
+{
+    for (int i = 0; i < bus->slave_count; i++)
+    {
+        if (bus->slaves[i].addr == addr)
+            return &bus->slaves[i];
+    }
+
+    return NULL;
+}
+
+esp_err_t i2c_master_cmd_begin(i2c_port_t i2c_num, i2c_cmd_handle_t cmd_handle, TickType_t ticks_to_wait)
+{
+    /*
+    Collapses the command link into one write-then-read transfer: bytes after
+    the first address byte are written, bytes after a repeated start with the
+    read bit are read.
+    */
+
+    shim_i2c_t *bus = &buses[i2c_num];
+    i2c_slave_t *slave = NULL;
+    uint8_t tx[I2C_MAX_OPS];
+    uint8_t rx[I2C_MAX_OPS];
+    size_t tx_len = 0;
+    size_t rx_len = 0;
+    bool expect_addr = false;
+    esp_err_t res;
+
+    if (i2c_num >= I2C_NUM_MAX || !bus->installed)
+        return ESP_ERR_INVALID_STATE;
+
+    for (int i = 0; i < cmd_handle->count; i++)
+    {
+        i2c_op_t *op = &cmd_handle->ops[i];
+
+        switch (op->type)
+        {
+        case I2C_OP_START:
+            expect_addr = true;
+            break;
+        case I2C_OP_WRITE:
+            if (expect_addr)
+            {
+                expect_addr = false;
+                if (!slave)
+                    slave = i2c_find(bus, op->data >> 1);
+            }
+            else
+                tx[tx_len++] = op->data;
+            break;
+        case I2C_OP_READ:
+            rx_len++;
+            break;
+        case I2C_OP_STOP:
+            break;
+        }
+    }
+
+    if (!slave)
+        return ESP_FAIL;
+
+    k_enter();
+    res = slave->device.transfer(slave->device.ctx, tx, tx_len, rx, rx_len);
+    k_leave();
+
+    if (res != ESP_OK)
+        return res;
+
+    rx_len = 0;
+    for (int i = 0; i < cmd_handle->count; i++)
+    {
+        if (cmd_handle->ops[i].type == I2C_OP_READ)
+            *cmd_handle->ops[i].dest = rx[rx_len++];
+    }
+
+    return ESP_OK;
+}
@@ -0,0 +1,22 @@
+#ifndef _SHIM_GPIO_H
+#define _SHIM_GPIO_H
+
+typedef enum
+{
+    GPIO_NUM_NC = -1,
+    GPIO_NUM_0 = 0,
+    GPIO_NUM_16 = 16,
+    GPIO_NUM_17 = 17,
+    GPIO_NUM_19 = 19,
+    GPIO_NUM_21 = 21,
+    GPIO_NUM_32 = 32,
+    GPIO_NUM_33 = 33,
+} gpio_num_t;
+
+typedef enum
+{
+    GPIO_PULLUP_DISABLE = 0,
+    GPIO_PULLUP_ENABLE = 1,
+} gpio_pullup_t;
+
+#endif // _SHIM_GPIO_H
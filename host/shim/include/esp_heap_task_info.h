@@ -0,0 +1,6 @@
+#ifndef _SHIM_ESP_HEAP_TASK_INFO_H
+#define _SHIM_ESP_HEAP_TASK_INFO_H
+
+// nothing is used from it on the host
+
+#endif // _SHIM_ESP_HEAP_TASK_INFO_H
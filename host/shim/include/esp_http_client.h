@@ -0,0 +1,39 @@
+#ifndef _SHIM_ESP_HTTP_CLIENT_H
+#define _SHIM_ESP_HTTP_CLIENT_H
+
+/*
+Subset of the esp_http_client API for streaming GET requests over plain
+HTTP/1.1, with Content-Length bodies (no chunked encoding). The socket is
+blocking, the calling task holds the shim scheduler while it waits.
+*/
+
+#include "esp_err.h"
+
+typedef struct esp_http_client *esp_http_client_handle_t;
+
+typedef struct
+{
+    const char *url;
+    int timeout_ms;
+    int buffer_size;
+} esp_http_client_config_t;
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config);
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char *key, const char *value);
+
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len);
+
+// content length of the response, -1 if it has none or on error
+int esp_http_client_fetch_headers(esp_http_client_handle_t client);
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client);
+
+// up to `len` bytes of the body, 0 at its end, -1 on error
+int esp_http_client_read(esp_http_client_handle_t client, char *buffer, int len);
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t client);
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client);
+
+#endif // _SHIM_ESP_HTTP_CLIENT_H
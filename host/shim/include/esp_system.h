@@ -0,0 +1,12 @@
+#ifndef _SHIM_ESP_SYSTEM_H
+#define _SHIM_ESP_SYSTEM_H
+
+#include <stdint.h>
+
+// ends the host run with exit status SHIM_RESTART_STATUS, see shim.h
+void esp_restart(void) __attribute__((noreturn));
+
+// pseudo-random, the same sequence in every run
+uint32_t esp_random(void);
+
+#endif // _SHIM_ESP_SYSTEM_H
@@ -0,0 +1,9 @@
+#ifndef _SHIM_ESP_TIMER_H
+#define _SHIM_ESP_TIMER_H
+
+#include <stdint.h>
+
+// microseconds since boot, virtual in simulation mode
+int64_t esp_timer_get_time(void);
+
+#endif // _SHIM_ESP_TIMER_H
@@ -0,0 +1,100 @@
+#ifndef _SHIM_ESP_WIFI_H
+#define _SHIM_ESP_WIFI_H
+
+/*
+Station mode only. The link to the access point is simulated, see
+shim_wifi_set_link() in shim.h.
+*/
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_event.h"
+
+ESP_EVENT_DECLARE_BASE(WIFI_EVENT);
+ESP_EVENT_DECLARE_BASE(IP_EVENT);
+
+typedef enum
+{
+    WIFI_EVENT_WIFI_READY = 0,
+    WIFI_EVENT_SCAN_DONE,
+    WIFI_EVENT_STA_START,
+    WIFI_EVENT_STA_STOP,
+    WIFI_EVENT_STA_CONNECTED,
+    WIFI_EVENT_STA_DISCONNECTED,
+} wifi_event_t;
+
+typedef enum
+{
+    IP_EVENT_STA_GOT_IP,
+    IP_EVENT_STA_LOST_IP,
+} ip_event_t;
+
+typedef struct
+{
+    uint32_t addr;
+} ip4_addr_t;
+
+typedef struct
+{
+    ip4_addr_t ip;
+    ip4_addr_t netmask;
+    ip4_addr_t gw;
+} tcpip_adapter_ip_info_t;
+
+typedef struct
+{
+    int if_index;
+    tcpip_adapter_ip_info_t ip_info;
+    bool ip_changed;
+} ip_event_got_ip_t;
+
+typedef struct
+{
+    int magic;
+} wifi_init_config_t;
+
+#define WIFI_INIT_CONFIG_DEFAULT() {.magic = 0x1F2F3F4F}
+
+typedef enum
+{
+    WIFI_MODE_NULL = 0,
+    WIFI_MODE_STA,
+    WIFI_MODE_AP,
+    WIFI_MODE_APSTA,
+} wifi_mode_t;
+
+typedef enum
+{
+    ESP_IF_WIFI_STA = 0,
+    ESP_IF_WIFI_AP,
+} esp_interface_t;
+
+typedef struct
+{
+    uint8_t ssid[32];
+    uint8_t password[64];
+} wifi_sta_config_t;
+
+typedef union
+{
+    wifi_sta_config_t sta;
+} wifi_config_t;
+
+void tcpip_adapter_init(void);
+
+char *ip4addr_ntoa(const ip4_addr_t *addr);
+
+esp_err_t esp_wifi_init(const wifi_init_config_t *config);
+
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode);
+
+esp_err_t esp_wifi_set_config(esp_interface_t interface, wifi_config_t *conf);
+
+esp_err_t esp_wifi_start(void);
+
+esp_err_t esp_wifi_connect(void);
+
+esp_err_t esp_wifi_disconnect(void);
+
+#endif // _SHIM_ESP_WIFI_H
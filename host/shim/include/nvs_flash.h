@@ -0,0 +1,11 @@
+#ifndef _SHIM_NVS_FLASH_H
+#define _SHIM_NVS_FLASH_H
+
+#include "esp_err.h"
+#include "nvs.h"
+
+esp_err_t nvs_flash_init(void);
+
+esp_err_t nvs_flash_erase(void);
+
+#endif // _SHIM_NVS_FLASH_H
@@ -0,0 +1,167 @@
+#ifndef _SHIM_H
+#define _SHIM_H
+
+/*
+Host side of the ESP-IDF/FreeRTOS shim.
+
+Firmware tasks run as host threads, but only one of them at a time: a task
+runs until it blocks (delay, semaphore, event group, queue, UART read) and
+the scheduler then picks the ready task with the highest priority. With
+SHIM_CLOCK_VIRTUAL the clock jumps to the next timeout whenever all tasks are
+blocked, so runs are deterministic and much faster than real time.
+
+All functions here may be called from any thread and from shim callbacks.
+*/
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "mqtt_client.h"
+
+typedef enum
+{
+    SHIM_CLOCK_REAL,
+    SHIM_CLOCK_VIRTUAL,
+} shim_clock_t;
+
+void shim_init(shim_clock_t clock);
+
+/*
+Runs the scheduler for `duration` microseconds of shim time, 0 means forever.
+Call after the initial tasks were created.
+*/
+void shim_run(uint64_t duration);
+
+// microseconds since shim_init()
+uint64_t shim_now(void);
+
+/*
+Resources and latencies of the run so far: per task activations, host CPU
+time, longest run without blocking and stack use; waits and timeouts per
+semaphore; queue high water marks; heap in use; Wi-Fi and MQTT link events.
+*/
+void shim_report(FILE *out);
+
+// names a semaphore or queue in the report
+void shim_set_name(const void *object, const char *name);
+
+// drops log messages above `level` (esp_log_level_t) whatever the tag levels are
+void shim_log_limit(int level);
+
+typedef void (*shim_callback_t)(void *arg);
+
+/*
+Calls `callback` from the scheduler `delay` microseconds from now. Callbacks
+run in kernel context: they may feed devices, post events and give
+semaphores, but must not block.
+*/
+void shim_call_after(uint64_t delay, shim_callback_t callback, void *arg);
+
+/*
+UART peer. `write` gets the bytes sent by the firmware, the peer answers with
+shim_uart_feed().
+*/
+typedef struct
+{
+    void (*write)(void *ctx, const uint8_t *data, size_t len);
+    void *ctx;
+} shim_uart_device_t;
+
+void shim_uart_attach(int uart_num, const shim_uart_device_t *device);
+
+void shim_uart_feed(int uart_num, const uint8_t *data, size_t len);
+
+// connects the UART to a serial device or pty, e.g. one served by sensorsim
+int shim_uart_attach_tty(int uart_num, const char *path);
+
+/*
+I2C slave. One combined transaction: `tx_len` bytes written, then `rx_len`
+bytes read after a repeated start. Returns ESP_OK or ESP_FAIL for a NACK.
+*/
+typedef struct
+{
+    int (*transfer)(void *ctx, const uint8_t *tx, size_t tx_len, uint8_t *rx, size_t rx_len);
+    void *ctx;
+} shim_i2c_device_t;
+
+void shim_i2c_attach(int i2c_num, uint8_t addr, const shim_i2c_device_t *device);
+
+// state of the simulated link to the access point, up by default
+void shim_wifi_set_link(bool up);
+
+/*
+Keeps NVS in the file at `path`: loaded now, if it exists, and rewritten on
+every commit, so settings survive between runs. Without it NVS starts empty.
+*/
+int shim_nvs_file(const char *path);
+
+/*
+Keeps the ota_0 and ota_1 partitions and otadata in the directory `dir`, as
+ota_0.bin, ota_1.bin and otadata. They are loaded now and the bootloader's
+part of the rollback runs: a new image is booted pending verification, one
+that was booted before and never confirmed is aborted and the other one is
+booted. Without it both partitions start erased and ota_0 runs.
+*/
+int shim_ota_dir(const char *dir);
+
+// exit status of the host run after esp_restart(), a script can boot it again
+#define SHIM_RESTART_STATUS 3
+
+// serves HTTP on `port` whatever port the firmware asks for, 0 leaves it
+void shim_httpd_port(int port);
+
+/*
+MQTT broker backend. The default one accepts everything and, if enabled with
+shim_mqtt_print(), prints published messages to stdout.
+*/
+typedef struct
+{
+    int (*connect)(void *ctx, esp_mqtt_client_handle_t client, const esp_mqtt_client_config_t *config);
+    void (*disconnect)(void *ctx, esp_mqtt_client_handle_t client);
+    int (*publish)(void *ctx, esp_mqtt_client_handle_t client, const char *topic, const char *data,
+                   int len, int qos, int retain);
+    int (*subscribe)(void *ctx, esp_mqtt_client_handle_t client, const char *topic, int qos);
+    void *ctx;
+} shim_mqtt_broker_t;
+
+void shim_mqtt_set_broker(const shim_mqtt_broker_t *broker);
+
+void shim_mqtt_print(bool enable);
+
+/*
+Completes a connect for which the backend returned ESP_ERR_NOT_FINISHED,
+`ok` tells whether the broker accepted it.
+*/
+void shim_mqtt_connect_done(esp_mqtt_client_handle_t client, bool ok);
+
+// the broker closed the connection, the client reconnects like esp-mqtt does
+void shim_mqtt_drop(esp_mqtt_client_handle_t client);
+
+// delivers a message to the client as MQTT_EVENT_DATA if it subscribed to the topic, `retain` as the broker's flag
+void shim_mqtt_deliver(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, bool retain);
+
+/*
+Backend for a real broker, e.g. mosquitto on localhost: MQTT 3.1.1 over TCP
+at `uri` (mqtt://host[:port]) for every client, whatever its configured URI.
+Connects complete in the background, publishes block until the packet is in
+the socket buffer. Use with SHIM_CLOCK_REAL. Returns 0 on success.
+*/
+int shim_mqtt_socket_init(const char *uri);
+
+/*
+Subscribes a connection of its own to `filter` and measures, for messages
+published by the clients of this process, the time until the broker
+delivered them back.
+*/
+int shim_mqtt_socket_monitor(const char *filter);
+
+/*
+Connect latencies and failures, connections dropped by the broker, publish
+rate, unsent bytes per client after publishing (the outbox) and, with a
+monitor, broker latency.
+*/
+void shim_mqtt_socket_report(FILE *out);
+
+#endif // _SHIM_H
@@ -0,0 +1,52 @@
+#ifndef _SHIM_KERNEL_H
+#define _SHIM_KERNEL_H
+
+/*
+Internals of the shim scheduler shared by the shim modules.
+
+The kernel lock protects all shim state. k_enter()/k_leave() nest, so shim
+functions can be called both from tasks and from callbacks that already run
+under the lock.
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "freertos/FreeRTOS.h"
+
+#define K_FOREVER UINT64_MAX
+
+void k_enter(void);
+
+void k_leave(void);
+
+uint64_t k_now(void);
+
+// absolute deadline in microseconds for a FreeRTOS timeout in ticks
+uint64_t k_deadline(TickType_t ticks);
+
+/*
+Blocks the calling task until k_wake(obj) or the deadline. Must be called
+with the lock taken once. Returns false on timeout. Threads that are not
+shim tasks never block and get false immediately.
+*/
+bool k_block(const void *obj, uint64_t deadline);
+
+// makes all tasks blocked on `obj` ready
+void k_wake(const void *obj);
+
+// true if the caller is a shim task and not a shim callback
+bool k_in_task(void);
+
+// called by the Wi-Fi shim when the station gets or loses its IP
+void k_mqtt_link_changed(bool up);
+
+bool k_wifi_link_up(void);
+
+// sections of shim_report()
+void k_wifi_report(FILE *out);
+
+void k_mqtt_report(FILE *out);
+
+#endif // _SHIM_KERNEL_H
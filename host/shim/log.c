@@ -0,0 +1,138 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "nvs_flash.h"
+
+#include "shim.h"
+#include "kernel.h"
+
+#define LOG_MAX_TAGS 32
+
+typedef struct
+{
+    char tag[32];
+    esp_log_level_t level;
+} log_tag_level_t;
+
+static log_tag_level_t tag_levels[LOG_MAX_TAGS];
+static int tag_count;
+static esp_log_level_t default_level = ESP_LOG_INFO;
+static esp_log_level_t limit = ESP_LOG_VERBOSE;
+
+void shim_log_limit(int level)
+{
+    limit = level;
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    if (!strcmp(tag, "*"))
+    {
+        default_level = level;
+        return;
+    }
+
+    for (int i = 0; i < tag_count; i++)
+    {
+        if (!strcmp(tag_levels[i].tag, tag))
+        {
+            tag_levels[i].level = level;
+            return;
+        }
+    }
+
+    if (tag_count < LOG_MAX_TAGS)
+    {
+        strncpy(tag_levels[tag_count].tag, tag, sizeof(tag_levels[0].tag) - 1);
+        tag_levels[tag_count].level = level;
+        tag_count++;
+    }
+}
+
+static esp_log_level_t tag_level(const char *tag)
+{
+    for (int i = 0; i < tag_count; i++)
+    {
+        if (!strcmp(tag_levels[i].tag, tag))
+            return tag_levels[i].level;
+    }
+
+    return default_level;
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    static const char letters[] = "NEWIDV";
+    va_list args;
+
+    if (level > limit || level > tag_level(tag))
+        return;
+
+    flockfile(stderr);
+    fprintf(stderr, "%c (%llu) %s: ", letters[level], (unsigned long long)(k_now() / 1000), tag);
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+    funlockfile(stderr);
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code)
+    {
+    case ESP_OK:
+        return "ESP_OK";
+    case ESP_FAIL:
+        return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:
+        return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:
+        return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE:
+        return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE:
+        return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND:
+        return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED:
+        return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT:
+        return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_RESPONSE:
+        return "ESP_ERR_INVALID_RESPONSE";
+    case ESP_ERR_INVALID_CRC:
+        return "ESP_ERR_INVALID_CRC";
+    case ESP_ERR_INVALID_VERSION:
+        return "ESP_ERR_INVALID_VERSION";
+    case ESP_ERR_NOT_FINISHED:
+        return "ESP_ERR_NOT_FINISHED";
+    case ESP_ERR_NVS_NOT_FOUND:
+        return "ESP_ERR_NVS_NOT_FOUND";
+    case ESP_ERR_NVS_TYPE_MISMATCH:
+        return "ESP_ERR_NVS_TYPE_MISMATCH";
+    case ESP_ERR_NVS_READ_ONLY:
+        return "ESP_ERR_NVS_READ_ONLY";
+    case ESP_ERR_NVS_NOT_ENOUGH_SPACE:
+        return "ESP_ERR_NVS_NOT_ENOUGH_SPACE";
+    case ESP_ERR_NVS_INVALID_NAME:
+        return "ESP_ERR_NVS_INVALID_NAME";
+    case ESP_ERR_NVS_INVALID_HANDLE:
+        return "ESP_ERR_NVS_INVALID_HANDLE";
+    case ESP_ERR_NVS_KEY_TOO_LONG:
+        return "ESP_ERR_NVS_KEY_TOO_LONG";
+    case ESP_ERR_NVS_INVALID_LENGTH:
+        return "ESP_ERR_NVS_INVALID_LENGTH";
+    case ESP_ERR_OTA_PARTITION_CONFLICT:
+        return "ESP_ERR_OTA_PARTITION_CONFLICT";
+    case ESP_ERR_OTA_VALIDATE_FAILED:
+        return "ESP_ERR_OTA_VALIDATE_FAILED";
+    case ESP_ERR_OTA_ROLLBACK_FAILED:
+        return "ESP_ERR_OTA_ROLLBACK_FAILED";
+    default:
+        return "UNKNOWN ERROR";
+    }
+}
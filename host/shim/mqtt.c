@@ -0,0 +1,427 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mqtt_client.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+#include "shim.h"
+#include "kernel.h"
+
+#define MQTT_CONNECT_TIME 100000    // microseconds
+#define MQTT_RECONNECT_TIME 10000000 // esp-mqtt default reconnect timeout
+#define MQTT_EVENT_QUEUE_LENGTH 16
+#define MQTT_MAX_TOPIC 128
+#define MQTT_MAX_DATA 512
+#define MQTT_MAX_SUBSCRIPTIONS 8
+#define MQTT_MAX_CLIENTS 1024
+
+typedef struct
+{
+    esp_mqtt_event_id_t id;
+    int msg_id;
+    int data_len;
+    bool retain;
+    char topic[MQTT_MAX_TOPIC];
+    char data[MQTT_MAX_DATA];
+} mqtt_queued_event_t;
+
+struct esp_mqtt_client
+{
+    esp_mqtt_client_config_t config;
+    esp_event_handler_t handler;
+    void *handler_arg;
+    QueueHandle_t events;
+
+    bool started;
+    bool connecting;
+    bool connected;
+    int next_msg_id;
+
+    char subscriptions[MQTT_MAX_SUBSCRIPTIONS][MQTT_MAX_TOPIC];
+    int subscription_count;
+};
+
+static bool print_messages;
+
+static esp_mqtt_client_handle_t clients[MQTT_MAX_CLIENTS];
+static int client_count;
+
+static uint32_t connects;
+static uint32_t connect_failures;
+static uint32_t connection_losses;
+static uint32_t publishes;
+static uint32_t publish_failures;
+
+void k_mqtt_report(FILE *out)
+{
+    fprintf(out, "mqtt: %d clients, %u connects, %u failed attempts, %u connections lost, "
+                 "%u messages published, %u failed\n",
+            client_count, connects, connect_failures, connection_losses, publishes, publish_failures);
+}
+
+static int default_connect(void *ctx, esp_mqtt_client_handle_t client, const esp_mqtt_client_config_t *config)
+{
+    return ESP_OK;
+}
+
+static void default_disconnect(void *ctx, esp_mqtt_client_handle_t client)
+{
+}
+
+static int default_publish(void *ctx, esp_mqtt_client_handle_t client, const char *topic, const char *data,
+                           int len, int qos, int retain)
+{
+    if (print_messages)
+    {
+        flockfile(stdout);
+        printf("%s %.*s\n", topic, len, data);
+        fflush(stdout);
+        funlockfile(stdout);
+    }
+
+    return ESP_OK;
+}
+
+static int default_subscribe(void *ctx, esp_mqtt_client_handle_t client, const char *topic, int qos)
+{
+    return ESP_OK;
+}
+
+static shim_mqtt_broker_t broker = {
+    .connect = default_connect,
+    .disconnect = default_disconnect,
+    .publish = default_publish,
+    .subscribe = default_subscribe,
+};
+
+void shim_mqtt_set_broker(const shim_mqtt_broker_t *new_broker)
+{
+    k_enter();
+    broker = *new_broker;
+    k_leave();
+}
+
+void shim_mqtt_print(bool enable)
+{
+    print_messages = enable;
+}
+
+static void mqtt_queue_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t id, int msg_id,
+                             const char *topic, const char *data, int data_len, bool retain)
+{
+    mqtt_queued_event_t event = {
+        .id = id,
+        .msg_id = msg_id,
+        .retain = retain,
+    };
+
+    if (topic)
+        strncpy(event.topic, topic, MQTT_MAX_TOPIC - 1);
+
+    if (data)
+    {
+        event.data_len = data_len < MQTT_MAX_DATA ? data_len : MQTT_MAX_DATA;
+        memcpy(event.data, data, event.data_len);
+    }
+
+    if (xQueueSend(client->events, &event, 0) != pdTRUE)
+        fprintf(stderr, "shim: mqtt event queue overflow, event %d dropped\n", id);
+}
+
+static void mqtt_event_task(void *arg)
+{
+    esp_mqtt_client_handle_t client = arg;
+    mqtt_queued_event_t queued;
+
+    for (;;)
+    {
+        esp_mqtt_event_t event = {0};
+
+        if (xQueueReceive(client->events, &queued, portMAX_DELAY) != pdTRUE)
+            continue;
+
+        event.event_id = queued.id;
+        event.client = client;
+        event.user_context = client->config.user_context;
+        event.msg_id = queued.msg_id;
+        if (queued.topic[0])
+        {
+            event.topic = queued.topic;
+            event.topic_len = strlen(queued.topic);
+        }
+        event.data = queued.data;
+        event.data_len = queued.data_len;
+        event.total_data_len = queued.data_len;
+        event.retain = queued.retain;
+
+        if (client->handler)
+            client->handler(client->handler_arg, "MQTT_EVENTS", queued.id, &event);
+    }
+}
+
+static void mqtt_connect(void *arg);
+
+static void mqtt_connect_done(esp_mqtt_client_handle_t client, bool ok)
+{
+    client->connecting = false;
+
+    if (!client->started)
+    {
+        if (ok)
+            broker.disconnect(broker.ctx, client);
+        return;
+    }
+
+    if (ok)
+    {
+        connects++;
+        client->connected = true;
+        mqtt_queue_event(client, MQTT_EVENT_CONNECTED, 0, NULL, NULL, 0, false);
+        return;
+    }
+
+    connect_failures++;
+    mqtt_queue_event(client, MQTT_EVENT_ERROR, 0, NULL, NULL, 0, false);
+    mqtt_queue_event(client, MQTT_EVENT_DISCONNECTED, 0, NULL, NULL, 0, false);
+
+    client->connecting = true;
+    shim_call_after(MQTT_RECONNECT_TIME, mqtt_connect, client);
+}
+
+static void mqtt_connect(void *arg)
+{
+    esp_mqtt_client_handle_t client = arg;
+    int res = ESP_FAIL;
+
+    if (!client->started || client->connected)
+    {
+        client->connecting = false;
+        return;
+    }
+
+    mqtt_queue_event(client, MQTT_EVENT_BEFORE_CONNECT, 0, NULL, NULL, 0, false);
+
+    if (k_wifi_link_up())
+        res = broker.connect(broker.ctx, client, &client->config);
+
+    // the backend calls shim_mqtt_connect_done() when the broker answered
+    if (res == ESP_ERR_NOT_FINISHED)
+        return;
+
+    mqtt_connect_done(client, res == ESP_OK);
+}
+
+void shim_mqtt_connect_done(esp_mqtt_client_handle_t client, bool ok)
+{
+    k_enter();
+    if (client->connecting && !client->connected)
+        mqtt_connect_done(client, ok);
+    k_leave();
+}
+
+static void mqtt_connection_lost(esp_mqtt_client_handle_t client)
+{
+    connection_losses++;
+    client->connected = false;
+    client->subscription_count = 0;
+    broker.disconnect(broker.ctx, client);
+    mqtt_queue_event(client, MQTT_EVENT_DISCONNECTED, 0, NULL, NULL, 0, false);
+
+    if (client->started && !client->connecting)
+    {
+        client->connecting = true;
+        shim_call_after(MQTT_RECONNECT_TIME, mqtt_connect, client);
+    }
+}
+
+void shim_mqtt_drop(esp_mqtt_client_handle_t client)
+{
+    k_enter();
+    if (client->connected)
+        mqtt_connection_lost(client);
+    k_leave();
+}
+
+void k_mqtt_link_changed(bool up)
+{
+    for (int i = 0; i < client_count; i++)
+    {
+        if (!up && clients[i]->connected)
+            mqtt_connection_lost(clients[i]);
+    }
+}
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config)
+{
+    esp_mqtt_client_handle_t client;
+    char name[24];
+
+    if (client_count == MQTT_MAX_CLIENTS)
+        return NULL;
+
+    client = calloc(1, sizeof(struct esp_mqtt_client));
+    client->config = *config;
+    client->events = xQueueCreate(MQTT_EVENT_QUEUE_LENGTH, sizeof(mqtt_queued_event_t));
+
+    k_enter();
+    clients[client_count++] = client;
+    k_leave();
+
+    snprintf(name, sizeof(name), "mqtt_task%d", client_count - 1);
+    xTaskCreate(mqtt_event_task, name, 6144, client, 5, NULL);
+
+    return client;
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client)
+{
+    k_enter();
+
+    if (client->started)
+    {
+        k_leave();
+        return ESP_FAIL;
+    }
+
+    client->started = true;
+    if (!client->connecting)
+    {
+        client->connecting = true;
+        shim_call_after(MQTT_CONNECT_TIME, mqtt_connect, client);
+    }
+
+    k_leave();
+
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client)
+{
+    k_enter();
+
+    client->started = false;
+    client->subscription_count = 0;
+    if (client->connected)
+    {
+        client->connected = false;
+        broker.disconnect(broker.ctx, client);
+    }
+
+    k_leave();
+
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client)
+{
+    return esp_mqtt_client_stop(client);
+}
+
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event,
+                                         esp_event_handler_t event_handler, void *event_handler_arg)
+{
+    client->handler = event_handler;
+    client->handler_arg = event_handler_arg;
+
+    return ESP_OK;
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data,
+                            int len, int qos, int retain)
+{
+    int msg_id;
+
+    if (len == 0 && data)
+        len = strlen(data);
+
+    k_enter();
+
+    if (!client->connected)
+    {
+        k_leave();
+        return -1;
+    }
+
+    msg_id = qos ? ++client->next_msg_id : 0;
+
+    if (broker.publish(broker.ctx, client, topic, data, len, qos, retain) != ESP_OK)
+    {
+        publish_failures++;
+        mqtt_connection_lost(client);
+        k_leave();
+        return -1;
+    }
+    publishes++;
+
+    if (qos)
+        mqtt_queue_event(client, MQTT_EVENT_PUBLISHED, msg_id, NULL, NULL, 0, false);
+
+    k_leave();
+
+    return msg_id;
+}
+
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client, const char *topic, int qos)
+{
+    int msg_id;
+
+    k_enter();
+
+    if (!client->connected || client->subscription_count == MQTT_MAX_SUBSCRIPTIONS)
+    {
+        k_leave();
+        return -1;
+    }
+
+    strncpy(client->subscriptions[client->subscription_count++], topic, MQTT_MAX_TOPIC - 1);
+    msg_id = ++client->next_msg_id;
+    broker.subscribe(broker.ctx, client, topic, qos);
+    mqtt_queue_event(client, MQTT_EVENT_SUBSCRIBED, msg_id, NULL, NULL, 0, false);
+
+    k_leave();
+
+    return msg_id;
+}
+
+static bool topic_matches(const char *filter, const char *topic)
+{
+    while (*filter)
+    {
+        if (*filter == '#')
+            return true;
+
+        if (*filter == '+')
+        {
+            while (*topic && *topic != '/')
+                topic++;
+            filter++;
+            continue;
+        }
+
+        if (*filter != *topic)
+            return false;
+
+        filter++;
+        topic++;
+    }
+
+    return *topic == '\0';
+}
+
+void shim_mqtt_deliver(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, bool retain)
+{
+    k_enter();
+
+    for (int i = 0; client->connected && i < client->subscription_count; i++)
+    {
+        if (topic_matches(client->subscriptions[i], topic))
+        {
+            mqtt_queue_event(client, MQTT_EVENT_DATA, 0, topic, data, len, retain);
+            break;
+        }
+    }
+
+    k_leave();
+}
@@ -0,0 +1,861 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/sockios.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mqtt_client.h"
+
+#include "shim.h"
+
+#define SOCKET_MAX_CONNECTIONS 1040 // clients and monitors
+#define SOCKET_BUFFER 2048          // incoming packets, larger ones are skipped
+#define SOCKET_MAX_PACKET 1024      // outgoing
+#define SOCKET_KEEPALIVE 120        // seconds, esp-mqtt default
+#define SOCKET_SENT_SLOTS 65536     // topics waiting for the monitor
+#define SOCKET_MONITOR_RETRY 1000000 // microseconds
+#define HIST_RESOLUTION 10          // microseconds
+#define HIST_BUCKETS 100000
+
+#define PACKET_CONNECT 0x10
+#define PACKET_CONNACK 0x20
+#define PACKET_PUBLISH 0x30
+#define PACKET_SUBSCRIBE 0x82
+#define PACKET_PINGREQ 0xc0
+#define PACKET_DISCONNECT 0xe0
+
+typedef struct
+{
+    uint32_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint32_t buckets[HIST_BUCKETS + 1];
+} sock_hist_t;
+
+typedef struct
+{
+    esp_mqtt_client_handle_t client; // NULL for a monitor
+    int index;
+    const esp_mqtt_client_config_t *config;
+    char *filter; // of a monitor
+    int fd;
+    bool tcp_pending; // TCP handshake in progress
+    bool connecting;  // waiting for the CONNACK
+    uint64_t connect_start;
+    uint64_t last_sent;
+    uint32_t keepalive; // microseconds
+    uint16_t packet_id;
+    uint8_t in[SOCKET_BUFFER];
+    size_t in_len;
+    size_t skip; // rest of an oversized packet
+    uint32_t outbox_max;
+} sock_conn_t;
+
+typedef struct
+{
+    uint64_t hash;
+    uint64_t time;
+} sock_sent_t;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t thread;
+static int wake[2] = {-1, -1};
+static struct sockaddr_storage broker_addr;
+static socklen_t broker_addr_len;
+static uint64_t start_time;
+
+static sock_conn_t *conns[SOCKET_MAX_CONNECTIONS];
+static int conn_count;
+static sock_sent_t sent[SOCKET_SENT_SLOTS];
+
+static uint32_t connects;
+static uint32_t connect_failures;
+static uint32_t drops;
+static uint32_t publishes;
+static uint32_t publish_failures;
+static uint64_t bytes_sent;
+static uint32_t received;
+static sock_hist_t connect_hist;
+static sock_hist_t latency_hist;
+
+static uint64_t host_time(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void hist_add(sock_hist_t *hist, uint64_t value)
+{
+    uint64_t bucket = value / HIST_RESOLUTION;
+
+    hist->count++;
+    hist->sum += value;
+    if (value > hist->max)
+        hist->max = value;
+    hist->buckets[bucket < HIST_BUCKETS ? bucket : HIST_BUCKETS]++;
+}
+
+static double hist_percentile(const sock_hist_t *hist, double fraction)
+{
+    uint64_t target = hist->count * fraction;
+    uint64_t seen = 0;
+
+    for (uint32_t i = 0; i <= HIST_BUCKETS; i++)
+    {
+        seen += hist->buckets[i];
+        if (seen > target)
+            return i * HIST_RESOLUTION;
+    }
+
+    return HIST_BUCKETS * HIST_RESOLUTION;
+}
+
+static void hist_print(FILE *out, const char *name, const sock_hist_t *hist)
+{
+    fprintf(out, "  %-17s %8u %9.2f %9.2f %9.2f %9.2f\n", name, hist->count,
+            hist->count ? hist->sum / 1e3 / hist->count : 0.0, hist_percentile(hist, 0.5) / 1e3,
+            hist_percentile(hist, 0.95) / 1e3, hist->max / 1e3);
+}
+
+static uint64_t topic_hash(const char *topic, size_t len)
+{
+    // FNV-1a, 0 marks a free slot
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < len; i++)
+        hash = (hash ^ (uint8_t)topic[i]) * 1099511628211ULL;
+
+    return hash ? hash : 1;
+}
+
+/* Packets */
+
+static size_t put_length(uint8_t *out, size_t length)
+{
+    size_t n = 0;
+
+    do
+    {
+        out[n] = length & 0x7f;
+        length >>= 7;
+        if (length)
+            out[n] |= 0x80;
+        n++;
+    } while (length);
+
+    return n;
+}
+
+static size_t put_string(uint8_t *out, const char *data, size_t len)
+{
+    out[0] = len >> 8;
+    out[1] = len & 0xff;
+    memcpy(out + 2, data, len);
+
+    return len + 2;
+}
+
+// fixed header in front of `body`, which starts 5 bytes into `packet`
+static size_t finish_packet(uint8_t *packet, uint8_t type, size_t body_len)
+{
+    uint8_t header[5];
+    size_t n;
+
+    header[0] = type;
+    n = 1 + put_length(header + 1, body_len);
+    memcpy(packet + 5 - n, header, n);
+
+    return n;
+}
+
+// sends a whole packet, the caller holds the lock
+static int conn_send(sock_conn_t *conn, const uint8_t *data, size_t len)
+{
+    while (len)
+    {
+        ssize_t n = send(conn->fd, data, len, MSG_NOSIGNAL);
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+
+    conn->last_sent = host_time();
+
+    return 0;
+}
+
+static int send_connect(sock_conn_t *conn, const esp_mqtt_client_config_t *config, int index)
+{
+    uint8_t packet[5 + SOCKET_MAX_PACKET];
+    uint8_t *body = packet + 5;
+    char client_id[64];
+    size_t n = 0;
+    uint8_t flags = 0x02; // clean session
+    size_t start;
+
+    if (config && config->client_id)
+        snprintf(client_id, sizeof(client_id), "%s", config->client_id);
+    else
+        snprintf(client_id, sizeof(client_id), "dustsensor-%d-%d", getpid(), index);
+
+    if (config && config->username && config->username[0])
+        flags |= 0x80;
+    if (config && config->password && config->password[0])
+        flags |= 0x40;
+
+    n += put_string(body + n, "MQTT", 4);
+    body[n++] = 4; // 3.1.1
+    body[n++] = flags;
+    body[n++] = conn->keepalive / 1000000 >> 8;
+    body[n++] = conn->keepalive / 1000000 & 0xff;
+    n += put_string(body + n, client_id, strlen(client_id));
+    if (flags & 0x80)
+        n += put_string(body + n, config->username, strlen(config->username));
+    if (flags & 0x40)
+        n += put_string(body + n, config->password, strlen(config->password));
+
+    start = 5 - finish_packet(packet, PACKET_CONNECT, n);
+
+    return conn_send(conn, packet + start, 5 - start + n);
+}
+
+/* Connections */
+
+static void wake_thread(void)
+{
+    (void)!write(wake[1], "", 1);
+}
+
+static sock_conn_t *conn_find(esp_mqtt_client_handle_t client)
+{
+    for (int i = 0; i < conn_count; i++)
+    {
+        if (conns[i]->client == client)
+            return conns[i];
+    }
+
+    return NULL;
+}
+
+static sock_conn_t *conn_add(esp_mqtt_client_handle_t client)
+{
+    sock_conn_t *conn;
+
+    if (conn_count == SOCKET_MAX_CONNECTIONS)
+        return NULL;
+
+    conn = calloc(1, sizeof(sock_conn_t));
+    conn->client = client;
+    conn->index = conn_count;
+    conn->fd = -1;
+    conns[conn_count++] = conn;
+
+    return conn;
+}
+
+static void conn_close(sock_conn_t *conn)
+{
+    if (conn->fd < 0)
+        return;
+
+    close(conn->fd);
+    conn->fd = -1;
+    conn->tcp_pending = false;
+    conn->connecting = false;
+    conn->in_len = 0;
+    conn->skip = 0;
+}
+
+static int send_subscribe(sock_conn_t *conn, const char *topic, int qos);
+
+// TCP is up, sends CONNECT; the socket blocks from now on
+static int conn_established(sock_conn_t *conn)
+{
+    conn->tcp_pending = false;
+    conn->connecting = true;
+
+    if (fcntl(conn->fd, F_SETFL, 0) || send_connect(conn, conn->config, conn->index))
+        return -1;
+
+    // SUBSCRIBE may follow CONNECT without waiting for the CONNACK
+    if (conn->filter && send_subscribe(conn, conn->filter, 0))
+        return -1;
+
+    return 0;
+}
+
+/*
+Starts the TCP connection, the handshake and the CONNACK are completed by
+the thread: the scheduler does not wait for SYN retransmissions when the
+listen queue of the broker overflows in a reconnect storm.
+*/
+static int conn_open(sock_conn_t *conn, const esp_mqtt_client_config_t *config)
+{
+    int one = 1;
+
+    conn->fd = socket(broker_addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (conn->fd < 0)
+        return -1;
+
+    // small packets go out at once, latencies are the broker's and not Nagle's
+    setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    conn->config = config;
+    conn->connect_start = host_time();
+    conn->keepalive = (config && config->keepalive ? config->keepalive : SOCKET_KEEPALIVE) * 1000000ULL;
+
+    if (!connect(conn->fd, (struct sockaddr *)&broker_addr, broker_addr_len))
+    {
+        if (conn_established(conn))
+        {
+            conn_close(conn);
+            return -1;
+        }
+    }
+    else if (errno == EINPROGRESS)
+        conn->tcp_pending = true;
+    else
+    {
+        conn_close(conn);
+        return -1;
+    }
+
+    wake_thread();
+
+    return 0;
+}
+
+static int socket_connect(void *ctx, esp_mqtt_client_handle_t client, const esp_mqtt_client_config_t *config)
+{
+    sock_conn_t *conn;
+    int res = ESP_ERR_NOT_FINISHED;
+
+    pthread_mutex_lock(&lock);
+
+    conn = conn_find(client);
+    if (!conn)
+        conn = conn_add(client);
+    if (conn)
+        conn_close(conn);
+
+    if (!conn || conn_open(conn, config))
+    {
+        connect_failures++;
+        res = ESP_FAIL;
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    return res;
+}
+
+static void socket_disconnect(void *ctx, esp_mqtt_client_handle_t client)
+{
+    static const uint8_t packet[] = {PACKET_DISCONNECT, 0};
+    sock_conn_t *conn;
+
+    pthread_mutex_lock(&lock);
+
+    conn = conn_find(client);
+    if (conn && conn->fd >= 0)
+    {
+        conn_send(conn, packet, sizeof(packet));
+        conn_close(conn);
+    }
+
+    pthread_mutex_unlock(&lock);
+}
+
+static void remember_sent(const char *topic, size_t len, uint64_t time)
+{
+    uint64_t hash = topic_hash(topic, len);
+    uint32_t slot = hash % SOCKET_SENT_SLOTS;
+
+    // the slot of the topic or a free one, an old entry is overwritten otherwise
+    for (int i = 0; i < 8; i++)
+    {
+        sock_sent_t *entry = &sent[(slot + i) % SOCKET_SENT_SLOTS];
+
+        if (entry->hash == hash || !entry->hash)
+        {
+            slot = (slot + i) % SOCKET_SENT_SLOTS;
+            break;
+        }
+    }
+
+    sent[slot].hash = hash;
+    sent[slot].time = time;
+}
+
+static uint64_t take_sent(const char *topic, size_t len)
+{
+    uint64_t hash = topic_hash(topic, len);
+    uint32_t slot = hash % SOCKET_SENT_SLOTS;
+
+    for (int i = 0; i < 8; i++)
+    {
+        sock_sent_t *entry = &sent[(slot + i) % SOCKET_SENT_SLOTS];
+
+        if (entry->hash == hash)
+        {
+            uint64_t time = entry->time;
+
+            entry->hash = 0;
+            return time;
+        }
+    }
+
+    return 0;
+}
+
+static int socket_publish(void *ctx, esp_mqtt_client_handle_t client, const char *topic, const char *data,
+                          int len, int qos, int retain)
+{
+    uint8_t packet[5 + SOCKET_MAX_PACKET];
+    uint8_t *body = packet + 5;
+    size_t topic_len = strlen(topic);
+    sock_conn_t *conn;
+    size_t n = 0;
+    size_t start;
+    int unsent;
+    int res = ESP_FAIL;
+
+    if (topic_len + len + 4 > SOCKET_MAX_PACKET)
+        return ESP_ERR_INVALID_SIZE;
+
+    pthread_mutex_lock(&lock);
+
+    conn = conn_find(client);
+    if (conn && conn->fd >= 0 && !conn->tcp_pending && !conn->connecting)
+    {
+        n += put_string(body, topic, topic_len);
+        if (qos)
+        {
+            conn->packet_id = conn->packet_id % 0xffff + 1;
+            body[n++] = conn->packet_id >> 8;
+            body[n++] = conn->packet_id & 0xff;
+        }
+        memcpy(body + n, data, len);
+        n += len;
+        start = 5 - finish_packet(packet, PACKET_PUBLISH | (qos ? 0x02 : 0) | (retain ? 0x01 : 0), n);
+
+        if (!conn_send(conn, packet + start, 5 - start + n))
+        {
+            publishes++;
+            bytes_sent += 5 - start + n;
+            remember_sent(topic, topic_len, conn->last_sent);
+            if (!ioctl(conn->fd, SIOCOUTQ, &unsent) && (uint32_t)unsent > conn->outbox_max)
+                conn->outbox_max = unsent;
+            res = ESP_OK;
+        }
+        else
+            conn_close(conn);
+    }
+
+    if (res != ESP_OK)
+        publish_failures++;
+
+    pthread_mutex_unlock(&lock);
+
+    return res;
+}
+
+static int send_subscribe(sock_conn_t *conn, const char *topic, int qos)
+{
+    uint8_t packet[5 + SOCKET_MAX_PACKET];
+    uint8_t *body = packet + 5;
+    size_t n = 0;
+    size_t start;
+
+    if (strlen(topic) + 5 > SOCKET_MAX_PACKET)
+        return -1;
+
+    conn->packet_id = conn->packet_id % 0xffff + 1;
+    body[n++] = conn->packet_id >> 8;
+    body[n++] = conn->packet_id & 0xff;
+    n += put_string(body + n, topic, strlen(topic));
+    body[n++] = qos;
+    start = 5 - finish_packet(packet, PACKET_SUBSCRIBE, n);
+
+    return conn_send(conn, packet + start, 5 - start + n);
+}
+
+static int socket_subscribe(void *ctx, esp_mqtt_client_handle_t client, const char *topic, int qos)
+{
+    sock_conn_t *conn;
+    int res = ESP_FAIL;
+
+    pthread_mutex_lock(&lock);
+
+    conn = conn_find(client);
+    if (conn && conn->fd >= 0 && !conn->tcp_pending && !send_subscribe(conn, topic, qos))
+        res = ESP_OK;
+
+    pthread_mutex_unlock(&lock);
+
+    return res;
+}
+
+/* Receiving thread */
+
+typedef enum
+{
+    EVENT_NONE,
+    EVENT_CONNECTED,
+    EVENT_REFUSED,
+    EVENT_LOST,
+    EVENT_DATA,
+} sock_event_t;
+
+typedef struct
+{
+    sock_event_t type;
+    esp_mqtt_client_handle_t client;
+    char topic[256];
+    char data[SOCKET_BUFFER];
+    int len;
+    bool retain;
+} sock_delivery_t;
+
+// one complete packet from the buffer of `conn`, returns its length or 0
+static size_t parse_packet(sock_conn_t *conn, sock_delivery_t *out)
+{
+    size_t length = 0;
+    size_t header = 1;
+    uint8_t type;
+
+    do
+    {
+        if (header >= conn->in_len || header > 4)
+            return 0;
+        length |= (size_t)(conn->in[header] & 0x7f) << (7 * (header - 1));
+    } while (conn->in[header++] & 0x80);
+
+    if (header + length > SOCKET_BUFFER)
+    {
+        // too big to keep, dropped while it arrives
+        conn->skip = header + length;
+        return 0;
+    }
+    if (header + length > conn->in_len)
+        return 0;
+
+    type = conn->in[0] & 0xf0;
+
+    if (type == PACKET_CONNACK && conn->connecting && length >= 2)
+    {
+        uint64_t latency = host_time() - conn->connect_start;
+
+        conn->connecting = false;
+        if (conn->in[header + 1] == 0)
+        {
+            connects++;
+            hist_add(&connect_hist, latency);
+            out->type = EVENT_CONNECTED;
+        }
+        else
+        {
+            connect_failures++;
+            out->type = EVENT_REFUSED;
+        }
+    }
+    else if (type == PACKET_PUBLISH && length >= 2)
+    {
+        const uint8_t *p = conn->in + header;
+        size_t topic_len = p[0] << 8 | p[1];
+        size_t skip = 2 + topic_len + ((conn->in[0] & 0x06) ? 2 : 0);
+        uint64_t time;
+
+        if (skip <= length && topic_len < sizeof(out->topic))
+        {
+            memcpy(out->topic, p + 2, topic_len);
+            out->topic[topic_len] = '\0';
+            out->len = length - skip;
+            memcpy(out->data, p + skip, out->len);
+            out->retain = conn->in[0] & 0x01;
+            out->type = EVENT_DATA;
+
+            received++;
+            time = take_sent(out->topic, topic_len);
+            if (time)
+                hist_add(&latency_hist, host_time() - time);
+        }
+    }
+
+    return header + length;
+}
+
+static void conn_receive(sock_conn_t *conn, int fd)
+{
+    sock_delivery_t *delivery = malloc(sizeof(sock_delivery_t));
+    ssize_t n;
+
+    pthread_mutex_lock(&lock);
+
+    // closed and maybe reopened since the poll
+    if (conn->fd != fd)
+    {
+        pthread_mutex_unlock(&lock);
+        free(delivery);
+        return;
+    }
+
+    if (conn->tcp_pending)
+    {
+        int error = 0;
+        socklen_t len = sizeof(error);
+
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) || error || conn_established(conn))
+            n = 0;
+        else
+            n = -1, errno = EAGAIN;
+    }
+    else
+        n = recv(fd, conn->in + conn->in_len, SOCKET_BUFFER - conn->in_len, MSG_DONTWAIT);
+    if (n <= 0 && !(n < 0 && (errno == EAGAIN || errno == EINTR)))
+    {
+        delivery->type = conn->tcp_pending || conn->connecting ? EVENT_REFUSED : EVENT_LOST;
+        delivery->client = conn->client;
+        if (conn->tcp_pending || conn->connecting)
+            connect_failures++;
+        else
+            drops++;
+        conn_close(conn);
+        pthread_mutex_unlock(&lock);
+
+        if (delivery->client && delivery->type == EVENT_REFUSED)
+            shim_mqtt_connect_done(delivery->client, false);
+        else if (delivery->client)
+            shim_mqtt_drop(delivery->client);
+        free(delivery);
+        return;
+    }
+    if (n > 0)
+        conn->in_len += n;
+
+    for (;;)
+    {
+        size_t used;
+
+        if (conn->skip)
+        {
+            size_t drop = conn->skip < conn->in_len ? conn->skip : conn->in_len;
+
+            memmove(conn->in, conn->in + drop, conn->in_len - drop);
+            conn->in_len -= drop;
+            conn->skip -= drop;
+            if (conn->skip)
+                break;
+        }
+
+        delivery->type = EVENT_NONE;
+        delivery->client = conn->client;
+        used = parse_packet(conn, delivery);
+        if (!used)
+            break;
+        memmove(conn->in, conn->in + used, conn->in_len - used);
+        conn->in_len -= used;
+
+        // the scheduler is entered without the lock, publishing takes them the other way round
+        pthread_mutex_unlock(&lock);
+
+        if (delivery->client)
+        {
+            if (delivery->type == EVENT_CONNECTED || delivery->type == EVENT_REFUSED)
+                shim_mqtt_connect_done(delivery->client, delivery->type == EVENT_CONNECTED);
+            else if (delivery->type == EVENT_DATA)
+                shim_mqtt_deliver(delivery->client, delivery->topic, delivery->data, delivery->len, delivery->retain);
+        }
+
+        pthread_mutex_lock(&lock);
+        if (conn->fd != fd)
+            break;
+    }
+
+    pthread_mutex_unlock(&lock);
+    free(delivery);
+}
+
+static void *socket_thread(void *arg)
+{
+    static struct pollfd fds[SOCKET_MAX_CONNECTIONS + 1];
+    static sock_conn_t *polled[SOCKET_MAX_CONNECTIONS + 1];
+
+    for (;;)
+    {
+        static const uint8_t ping[] = {PACKET_PINGREQ, 0};
+        uint64_t now = host_time();
+        int timeout = 1000;
+        int count = 1;
+
+        fds[0].fd = wake[0];
+        fds[0].events = POLLIN;
+
+        pthread_mutex_lock(&lock);
+        for (int i = 0; i < conn_count; i++)
+        {
+            sock_conn_t *conn = conns[i];
+
+            // monitors have no esp-mqtt client to reconnect them
+            if (conn->fd < 0 && !conn->client && now - conn->connect_start > SOCKET_MONITOR_RETRY)
+                conn_open(conn, NULL);
+
+            if (conn->fd < 0)
+                continue;
+
+            if (!conn->tcp_pending && !conn->connecting && now - conn->last_sent > conn->keepalive / 2)
+                conn_send(conn, ping, sizeof(ping));
+
+            fds[count].fd = conn->fd;
+            fds[count].events = conn->tcp_pending ? POLLOUT : POLLIN;
+            polled[count] = conn;
+            count++;
+        }
+        pthread_mutex_unlock(&lock);
+
+        if (poll(fds, count, timeout) < 0)
+            continue;
+
+        if (fds[0].revents & POLLIN)
+        {
+            char buf[64];
+
+            (void)!read(wake[0], buf, sizeof(buf));
+        }
+
+        for (int i = 1; i < count; i++)
+        {
+            if (fds[i].revents)
+                conn_receive(polled[i], fds[i].fd);
+        }
+    }
+
+    return NULL;
+}
+
+/* Setup and report */
+
+static int resolve(const char *uri)
+{
+    struct addrinfo hints = {.ai_socktype = SOCK_STREAM};
+    struct addrinfo *res;
+    char host[128];
+    const char *port = "1883";
+    const char *colon;
+    size_t len;
+
+    if (!strncmp(uri, "mqtt://", 7))
+        uri += 7;
+
+    colon = strchr(uri, ':');
+    len = colon ? (size_t)(colon - uri) : strcspn(uri, "/");
+    if (len >= sizeof(host))
+        return -1;
+    memcpy(host, uri, len);
+    host[len] = '\0';
+    if (colon)
+        port = colon + 1;
+
+    if (getaddrinfo(host, port, &hints, &res))
+        return -1;
+
+    memcpy(&broker_addr, res->ai_addr, res->ai_addrlen);
+    broker_addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+
+    return 0;
+}
+
+int shim_mqtt_socket_init(const char *uri)
+{
+    static const shim_mqtt_broker_t broker = {
+        .connect = socket_connect,
+        .disconnect = socket_disconnect,
+        .publish = socket_publish,
+        .subscribe = socket_subscribe,
+    };
+
+    if (resolve(uri) || pipe2(wake, O_CLOEXEC | O_NONBLOCK) ||
+        pthread_create(&thread, NULL, socket_thread, NULL))
+        return -1;
+
+    start_time = host_time();
+    shim_mqtt_set_broker(&broker);
+
+    return 0;
+}
+
+int shim_mqtt_socket_monitor(const char *filter)
+{
+    sock_conn_t *conn;
+    int res = -1;
+
+    pthread_mutex_lock(&lock);
+
+    conn = conn_add(NULL);
+    if (conn)
+    {
+        conn->filter = strdup(filter);
+        if (!conn_open(conn, NULL))
+            res = 0;
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    return res;
+}
+
+void shim_mqtt_socket_report(FILE *out)
+{
+    double seconds = (host_time() - start_time) / 1e6;
+    uint64_t outbox_sum = 0;
+    uint32_t outbox_max = 0;
+    int clients = 0;
+
+    pthread_mutex_lock(&lock);
+
+    for (int i = 0; i < conn_count; i++)
+    {
+        if (!conns[i]->client)
+            continue;
+        clients++;
+        outbox_sum += conns[i]->outbox_max;
+        if (conns[i]->outbox_max > outbox_max)
+            outbox_max = conns[i]->outbox_max;
+    }
+
+    fprintf(out, "broker connection: %d clients, %u connects, %u failed, %u dropped by the broker\n", clients,
+            connects, connect_failures, drops);
+    fprintf(out, "published: %u messages (%.1f/s), %llu bytes (%.1f KiB/s), %u failed\n", publishes,
+            publishes / seconds, (unsigned long long)bytes_sent, bytes_sent / 1024.0 / seconds,
+            publish_failures);
+    fprintf(out, "outbox: unacknowledged bytes in the socket after a publish, max per client: "
+                 "mean %.0f, max %u\n",
+            clients ? (double)outbox_sum / clients : 0.0, outbox_max);
+    fprintf(out, "  %-17s %8s %9s %9s %9s %9s\n", "latency (ms)", "count", "mean", "p50", "p95", "max");
+    hist_print(out, "connect", &connect_hist);
+    if (received)
+        hist_print(out, "broker round trip", &latency_hist);
+
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,322 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "nvs_flash.h"
+
+#include "shim.h"
+#include "kernel.h"
+
+#define NVS_MAX_ENTRIES 128
+#define NVS_MAX_NAMESPACES 16
+#define NVS_MAX_VALUE 512
+
+typedef enum
+{
+    NVS_TYPE_I32 = 1,
+    NVS_TYPE_U32,
+    NVS_TYPE_BLOB,
+} nvs_type_t;
+
+typedef struct
+{
+    char namespace[NVS_KEY_NAME_MAX_SIZE];
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    uint8_t type;
+    uint16_t length;
+    uint8_t value[NVS_MAX_VALUE];
+} nvs_entry_t;
+
+typedef struct
+{
+    char name[NVS_KEY_NAME_MAX_SIZE];
+    bool writable;
+} nvs_open_namespace_t;
+
+static nvs_entry_t entries[NVS_MAX_ENTRIES];
+static int entry_count;
+
+// handles are indices into this table plus one
+static nvs_open_namespace_t handles[NVS_MAX_NAMESPACES];
+
+static const char *nvs_path;
+
+static void nvs_save(void)
+{
+    FILE *file;
+
+    if (!nvs_path)
+        return;
+
+    file = fopen(nvs_path, "wb");
+    if (!file)
+    {
+        perror(nvs_path);
+        return;
+    }
+    fwrite(entries, sizeof(nvs_entry_t), entry_count, file);
+    fclose(file);
+}
+
+int shim_nvs_file(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+
+    nvs_path = path;
+    entry_count = 0;
+    if (!file)
+        return 0;
+
+    entry_count = fread(entries, sizeof(nvs_entry_t), NVS_MAX_ENTRIES, file);
+    fclose(file);
+
+    for (int i = 0; i < entry_count; i++)
+    {
+        if (entries[i].length > NVS_MAX_VALUE || !entries[i].type ||
+            !memchr(entries[i].namespace, 0, NVS_KEY_NAME_MAX_SIZE) ||
+            !memchr(entries[i].key, 0, NVS_KEY_NAME_MAX_SIZE))
+        {
+            fprintf(stderr, "shim: %s is not an NVS file\n", path);
+            entry_count = 0;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+esp_err_t nvs_flash_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    k_enter();
+    entry_count = 0;
+    nvs_save();
+    k_leave();
+
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    if (strlen(name) >= NVS_KEY_NAME_MAX_SIZE)
+        return ESP_ERR_NVS_INVALID_NAME;
+
+    k_enter();
+
+    for (int i = 0; i < NVS_MAX_NAMESPACES; i++)
+    {
+        if (!handles[i].name[0])
+        {
+            strcpy(handles[i].name, name);
+            handles[i].writable = open_mode == NVS_READWRITE;
+            *out_handle = i + 1;
+            k_leave();
+            return ESP_OK;
+        }
+    }
+
+    k_leave();
+
+    return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    k_enter();
+    if (handle >= 1 && handle <= NVS_MAX_NAMESPACES)
+        handles[handle - 1].name[0] = 0;
+    k_leave();
+}
+
+static nvs_open_namespace_t *nvs_namespace(nvs_handle_t handle)
+{
+    if (handle < 1 || handle > NVS_MAX_NAMESPACES || !handles[handle - 1].name[0])
+        return NULL;
+
+    return &handles[handle - 1];
+}
+
+static nvs_entry_t *nvs_find(const nvs_open_namespace_t *ns, const char *key)
+{
+    for (int i = 0; i < entry_count; i++)
+    {
+        if (!strcmp(entries[i].namespace, ns->name) && !strcmp(entries[i].key, key))
+            return &entries[i];
+    }
+
+    return NULL;
+}
+
+static esp_err_t nvs_set(nvs_handle_t handle, const char *key, nvs_type_t type, const void *value, size_t length)
+{
+    nvs_open_namespace_t *ns;
+    nvs_entry_t *entry;
+
+    if (strlen(key) >= NVS_KEY_NAME_MAX_SIZE)
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    if (length > NVS_MAX_VALUE)
+        return ESP_ERR_NVS_INVALID_LENGTH;
+
+    k_enter();
+
+    ns = nvs_namespace(handle);
+    if (!ns || !ns->writable)
+    {
+        k_leave();
+        return ns ? ESP_ERR_NVS_READ_ONLY : ESP_ERR_NVS_INVALID_HANDLE;
+    }
+
+    entry = nvs_find(ns, key);
+    if (!entry)
+    {
+        if (entry_count == NVS_MAX_ENTRIES)
+        {
+            k_leave();
+            return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+        }
+        entry = &entries[entry_count++];
+        memset(entry, 0, sizeof(*entry));
+        strcpy(entry->namespace, ns->name);
+        strcpy(entry->key, key);
+    }
+
+    entry->type = type;
+    entry->length = length;
+    memcpy(entry->value, value, length);
+
+    k_leave();
+
+    return ESP_OK;
+}
+
+static esp_err_t nvs_get(nvs_handle_t handle, const char *key, nvs_type_t type, void *value, size_t *length)
+{
+    nvs_open_namespace_t *ns;
+    nvs_entry_t *entry;
+    esp_err_t err = ESP_OK;
+
+    k_enter();
+
+    ns = nvs_namespace(handle);
+    entry = ns ? nvs_find(ns, key) : NULL;
+
+    if (!ns)
+        err = ESP_ERR_NVS_INVALID_HANDLE;
+    else if (!entry)
+        err = ESP_ERR_NVS_NOT_FOUND;
+    else if (entry->type != type)
+        err = ESP_ERR_NVS_TYPE_MISMATCH;
+    else if (value && *length < entry->length)
+        err = ESP_ERR_NVS_INVALID_LENGTH;
+    else
+    {
+        if (value)
+            memcpy(value, entry->value, entry->length);
+        *length = entry->length;
+    }
+
+    k_leave();
+
+    return err;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    k_enter();
+
+    if (!nvs_namespace(handle))
+    {
+        k_leave();
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    nvs_save();
+
+    k_leave();
+
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_i32(nvs_handle_t handle, const char *key, int32_t value)
+{
+    return nvs_set(handle, key, NVS_TYPE_I32, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_i32(nvs_handle_t handle, const char *key, int32_t *out_value)
+{
+    size_t length = sizeof(*out_value);
+
+    return nvs_get(handle, key, NVS_TYPE_I32, out_value, &length);
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value)
+{
+    return nvs_set(handle, key, NVS_TYPE_U32, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *out_value)
+{
+    size_t length = sizeof(*out_value);
+
+    return nvs_get(handle, key, NVS_TYPE_U32, out_value, &length);
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    return nvs_set(handle, key, NVS_TYPE_BLOB, value, length);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+    return nvs_get(handle, key, NVS_TYPE_BLOB, out_value, length);
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    nvs_open_namespace_t *ns;
+    nvs_entry_t *entry;
+
+    k_enter();
+
+    ns = nvs_namespace(handle);
+    entry = ns ? nvs_find(ns, key) : NULL;
+    if (!entry)
+    {
+        k_leave();
+        return ns ? ESP_ERR_NVS_NOT_FOUND : ESP_ERR_NVS_INVALID_HANDLE;
+    }
+
+    *entry = entries[--entry_count];
+
+    k_leave();
+
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_all(nvs_handle_t handle)
+{
+    nvs_open_namespace_t *ns;
+
+    k_enter();
+
+    ns = nvs_namespace(handle);
+    if (!ns)
+    {
+        k_leave();
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+
+    for (int i = 0; i < entry_count;)
+    {
+        if (!strcmp(entries[i].namespace, ns->name))
+            entries[i] = entries[--entry_count];
+        else
+            i++;
+    }
+
+    k_leave();
+
+    return ESP_OK;
+}
@@ -0,0 +1,359 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_ota_ops.h"
+#include "esp_system.h"
+
+#include "shim.h"
+#include "kernel.h"
+
+#define OTA_PARTITION_SIZE 0x100000
+
+// the app partitions of partitions.csv
+static const esp_partition_t partitions[2] = {
+    {ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0, 0x30000, OTA_PARTITION_SIZE, "ota_0", false},
+    {ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_1, 0x130000, OTA_PARTITION_SIZE, "ota_1", false},
+};
+
+// otadata, what the bootloader reads
+static struct
+{
+    int boot;
+    esp_ota_img_states_t state[2];
+} otadata = {0, {ESP_OTA_IMG_UNDEFINED, ESP_OTA_IMG_UNDEFINED}};
+
+static uint8_t *flash[2];
+static uint32_t written[2]; // image length, what is kept in the file
+static int running;
+
+static int update = -1; // partition of the open update
+static uint32_t update_length;
+
+static const char *ota_dir;
+
+static const char *state_name(esp_ota_img_states_t state)
+{
+    switch (state)
+    {
+    case ESP_OTA_IMG_NEW:
+        return "new";
+    case ESP_OTA_IMG_PENDING_VERIFY:
+        return "pending verify";
+    case ESP_OTA_IMG_VALID:
+        return "valid";
+    case ESP_OTA_IMG_INVALID:
+        return "invalid";
+    case ESP_OTA_IMG_ABORTED:
+        return "aborted";
+    default:
+        return "undefined";
+    }
+}
+
+static uint8_t *partition_data(int index)
+{
+    if (!flash[index])
+    {
+        flash[index] = malloc(OTA_PARTITION_SIZE);
+        if (!flash[index])
+            abort();
+        memset(flash[index], 0xff, OTA_PARTITION_SIZE);
+    }
+
+    return flash[index];
+}
+
+static int partition_index(const esp_partition_t *partition)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        if (partition == &partitions[i])
+            return i;
+    }
+
+    return -1;
+}
+
+static void ota_path(char *path, size_t size, const char *name, const char *suffix)
+{
+    snprintf(path, size, "%s/%s%s", ota_dir, name, suffix);
+}
+
+static void save_otadata(void)
+{
+    char path[4096];
+    FILE *file;
+
+    if (!ota_dir)
+        return;
+
+    ota_path(path, sizeof(path), "otadata", "");
+    file = fopen(path, "w");
+    if (!file)
+    {
+        perror(path);
+        return;
+    }
+    fprintf(file, "%d %u %u\n", otadata.boot, (unsigned)otadata.state[0], (unsigned)otadata.state[1]);
+    fclose(file);
+}
+
+static void save_partition(int index)
+{
+    char path[4096];
+    FILE *file;
+
+    if (!ota_dir)
+        return;
+
+    ota_path(path, sizeof(path), partitions[index].label, ".bin");
+    file = fopen(path, "wb");
+    if (!file)
+    {
+        perror(path);
+        return;
+    }
+    fwrite(partition_data(index), 1, written[index], file);
+    fclose(file);
+}
+
+static bool bootable(int index)
+{
+    return otadata.state[index] != ESP_OTA_IMG_INVALID && otadata.state[index] != ESP_OTA_IMG_ABORTED &&
+           written[index];
+}
+
+int shim_ota_dir(const char *dir)
+{
+    char path[4096];
+    FILE *file;
+
+    ota_dir = dir;
+
+    for (int i = 0; i < 2; i++)
+    {
+        ota_path(path, sizeof(path), partitions[i].label, ".bin");
+        file = fopen(path, "rb");
+        if (!file)
+            continue;
+        written[i] = fread(partition_data(i), 1, OTA_PARTITION_SIZE, file);
+        fclose(file);
+    }
+
+    ota_path(path, sizeof(path), "otadata", "");
+    file = fopen(path, "r");
+    if (file)
+    {
+        unsigned state[2];
+
+        if (fscanf(file, "%d %u %u", &otadata.boot, &state[0], &state[1]) != 3 || otadata.boot < 0 ||
+            otadata.boot > 1)
+        {
+            fprintf(stderr, "shim: %s is not an otadata file\n", path);
+            fclose(file);
+            return -1;
+        }
+        otadata.state[0] = state[0];
+        otadata.state[1] = state[1];
+        fclose(file);
+    }
+
+    // the bootloader's part of the rollback
+    if (otadata.state[otadata.boot] == ESP_OTA_IMG_NEW)
+        otadata.state[otadata.boot] = ESP_OTA_IMG_PENDING_VERIFY;
+    else if (otadata.state[otadata.boot] == ESP_OTA_IMG_PENDING_VERIFY)
+    {
+        // booted once and never confirmed
+        fprintf(stderr, "shim: %s was not confirmed, rolling back\n", partitions[otadata.boot].label);
+        otadata.state[otadata.boot] = ESP_OTA_IMG_ABORTED;
+    }
+    if (!bootable(otadata.boot) && bootable(!otadata.boot))
+        otadata.boot = !otadata.boot;
+
+    running = otadata.boot;
+    fprintf(stderr, "shim: booting %s, %u bytes, %s\n", partitions[running].label, written[running],
+            state_name(otadata.state[running]));
+    save_otadata();
+
+    return 0;
+}
+
+void esp_restart(void)
+{
+    fprintf(stderr, "shim: esp_restart(), the run ends\n");
+    fflush(stdout);
+    exit(SHIM_RESTART_STATUS);
+}
+
+uint32_t esp_random(void)
+{
+    static uint32_t state = 0x9e3779b9;
+    uint32_t value;
+
+    // xorshift32
+    k_enter();
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    value = state;
+    k_leave();
+
+    return value;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+    int index = partition_index(partition);
+
+    if (index < 0)
+        return ESP_ERR_INVALID_ARG;
+    if (src_offset > partition->size || size > partition->size - src_offset)
+        return ESP_ERR_INVALID_SIZE;
+
+    k_enter();
+    memcpy(dst, partition_data(index) + src_offset, size);
+    k_leave();
+
+    return ESP_OK;
+}
+
+const esp_partition_t *esp_ota_get_running_partition(void)
+{
+    return &partitions[running];
+}
+
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start_from)
+{
+    int index = partition_index(start_from ? start_from : esp_ota_get_running_partition());
+
+    return index < 0 ? NULL : &partitions[!index];
+}
+
+esp_err_t esp_ota_begin(const esp_partition_t *partition, size_t image_size, esp_ota_handle_t *out_handle)
+{
+    int index = partition_index(partition);
+
+    if (index < 0)
+        return ESP_ERR_INVALID_ARG;
+    if (index == running)
+        return ESP_ERR_OTA_PARTITION_CONFLICT;
+    if (image_size != OTA_SIZE_UNKNOWN && image_size > partition->size)
+        return ESP_ERR_INVALID_SIZE;
+
+    k_enter();
+    if (update >= 0)
+    {
+        k_leave();
+        return ESP_ERR_INVALID_STATE;
+    }
+    // erased flash
+    memset(partition_data(index), 0xff, OTA_PARTITION_SIZE);
+    written[index] = 0;
+    update = index;
+    update_length = 0;
+    k_leave();
+
+    *out_handle = 1;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void *data, size_t size)
+{
+    esp_err_t err = ESP_OK;
+
+    k_enter();
+    if (handle != 1 || update < 0)
+        err = ESP_ERR_INVALID_ARG;
+    else if (size > OTA_PARTITION_SIZE - update_length)
+        err = ESP_ERR_INVALID_SIZE;
+    else
+    {
+        memcpy(partition_data(update) + update_length, data, size);
+        update_length += size;
+    }
+    k_leave();
+
+    return err;
+}
+
+esp_err_t esp_ota_end(esp_ota_handle_t handle)
+{
+    esp_err_t err = ESP_OK;
+
+    k_enter();
+    if (handle != 1 || update < 0)
+        err = ESP_ERR_NOT_FOUND;
+    else if (!update_length)
+        err = ESP_ERR_OTA_VALIDATE_FAILED;
+    else
+    {
+        written[update] = update_length;
+        save_partition(update);
+    }
+    // the handle is freed even if the image is not valid
+    update = -1;
+    k_leave();
+
+    return err;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition)
+{
+    int index = partition_index(partition);
+
+    if (index < 0)
+        return ESP_ERR_INVALID_ARG;
+    if (!written[index])
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+
+    k_enter();
+    otadata.boot = index;
+    if (index != running)
+        otadata.state[index] = ESP_OTA_IMG_NEW;
+    save_otadata();
+    k_leave();
+
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_get_state_partition(const esp_partition_t *partition, esp_ota_img_states_t *ota_state)
+{
+    int index = partition_index(partition);
+
+    if (index < 0)
+        return ESP_ERR_INVALID_ARG;
+
+    k_enter();
+    *ota_state = otadata.state[index];
+    k_leave();
+
+    return *ota_state == ESP_OTA_IMG_UNDEFINED ? ESP_ERR_NOT_FOUND : ESP_OK;
+}
+
+esp_err_t esp_ota_mark_app_valid_cancel_rollback(void)
+{
+    k_enter();
+    otadata.state[running] = ESP_OTA_IMG_VALID;
+    save_otadata();
+    k_leave();
+
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_mark_app_invalid_rollback_and_reboot(void)
+{
+    k_enter();
+    if (!bootable(!running))
+    {
+        k_leave();
+        return ESP_ERR_OTA_ROLLBACK_FAILED;
+    }
+    otadata.state[running] = ESP_OTA_IMG_INVALID;
+    otadata.boot = !running;
+    save_otadata();
+    k_leave();
+
+    esp_restart();
+}
@@ -0,0 +1,954 @@
+#define _GNU_SOURCE
+
+#include <malloc.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "esp_timer.h"
+
+#include "shim.h"
+#include "kernel.h"
+
+#define TASK_MIN_HOST_STACK (64 * 1024)
+#define TASK_STACK_FILL 0xA5
+
+#define HEAP_SAMPLE_INTERVAL 60000000 // microseconds
+
+typedef enum
+{
+    TASK_READY,
+    TASK_RUNNING,
+    TASK_BLOCKED,
+    TASK_DELETED,
+} task_state_t;
+
+struct shim_task
+{
+    pthread_t thread;
+    pthread_cond_t cond;
+    char name[16];
+    UBaseType_t priority;
+    TaskFunction_t code;
+    void *parameters;
+
+    uint8_t *stack;
+    size_t stack_size;
+
+    task_state_t state;
+    uint64_t ready_seq;
+    const void *wait_obj;
+    uint64_t wake_at;
+    bool timed_out;
+
+    // statistics for shim_report()
+    uint32_t activations;
+    uint64_t run_start; // host nanoseconds
+    uint64_t run_ns;
+    uint64_t max_slice_ns;
+    bool returned;
+
+    struct shim_task *next;
+};
+
+typedef struct shim_timer
+{
+    uint64_t at;
+    uint64_t seq;
+    shim_callback_t callback;
+    void *arg;
+    struct shim_timer *next;
+} shim_timer_t;
+
+struct shim_semaphore
+{
+    UBaseType_t count;
+    UBaseType_t max;
+
+    char name[32];
+    uint32_t takes;
+    uint32_t timeouts;
+    uint64_t wait_total;
+    uint64_t wait_max;
+    struct shim_semaphore *next;
+};
+
+struct shim_event_group
+{
+    EventBits_t bits;
+};
+
+struct shim_queue
+{
+    uint8_t *items;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+
+    char name[32];
+    uint32_t sends;
+    uint32_t send_timeouts;
+    UBaseType_t high_water;
+    struct shim_queue *next;
+};
+
+static pthread_mutex_t k_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t k_idle = PTHREAD_COND_INITIALIZER;
+static __thread int k_depth;
+static __thread struct shim_task *k_self;
+
+static shim_clock_t k_clock;
+static struct timespec k_start;
+static uint64_t k_virtual_now;
+static uint64_t k_end = K_FOREVER;
+static bool k_finished;
+static bool k_in_callback;
+
+static struct shim_task *k_tasks;
+static struct shim_task *k_current;
+static shim_timer_t *k_timers;
+static uint64_t k_seq;
+
+static struct shim_semaphore *k_semaphores;
+static struct shim_queue *k_queues;
+static int k_object_count;
+
+static size_t heap_first, heap_last, heap_max;
+static uint32_t heap_samples;
+
+void k_enter(void)
+{
+    if (k_depth++ == 0)
+        pthread_mutex_lock(&k_mutex);
+}
+
+void k_leave(void)
+{
+    if (--k_depth == 0)
+        pthread_mutex_unlock(&k_mutex);
+}
+
+static uint64_t real_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)(ts.tv_sec - k_start.tv_sec) * 1000000 + ts.tv_nsec / 1000 - k_start.tv_nsec / 1000;
+}
+
+static uint64_t host_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// called when the running task gives up the CPU
+static void k_account(struct shim_task *task)
+{
+    uint64_t slice = host_ns() - task->run_start;
+
+    task->run_ns += slice;
+    if (slice > task->max_slice_ns)
+        task->max_slice_ns = slice;
+}
+
+uint64_t k_now(void)
+{
+    return k_clock == SHIM_CLOCK_VIRTUAL ? k_virtual_now : real_now();
+}
+
+uint64_t k_deadline(TickType_t ticks)
+{
+    if (ticks == portMAX_DELAY)
+        return K_FOREVER;
+
+    return k_now() + (uint64_t)ticks * portTICK_PERIOD_MS * 1000;
+}
+
+bool k_in_task(void)
+{
+    return k_self != NULL && !k_in_callback;
+}
+
+static void k_make_ready(struct shim_task *task, bool timed_out)
+{
+    task->state = TASK_READY;
+    task->timed_out = timed_out;
+    task->wait_obj = NULL;
+    task->ready_seq = k_seq++;
+}
+
+static void k_fire_timers(uint64_t now)
+{
+    while (k_timers && k_timers->at <= now)
+    {
+        shim_timer_t *timer = k_timers;
+
+        k_timers = timer->next;
+        k_in_callback = true;
+        timer->callback(timer->arg);
+        k_in_callback = false;
+        free(timer);
+    }
+}
+
+static struct shim_task *k_pick(uint64_t now)
+{
+    struct shim_task *best = NULL;
+
+    for (struct shim_task *task = k_tasks; task; task = task->next)
+    {
+        if (task->state == TASK_BLOCKED && task->wake_at <= now)
+            k_make_ready(task, true);
+
+        if (task->state != TASK_READY)
+            continue;
+
+        if (!best || task->priority > best->priority ||
+            (task->priority == best->priority && task->ready_seq < best->ready_seq))
+            best = task;
+    }
+
+    return best;
+}
+
+static uint64_t k_next_event(void)
+{
+    uint64_t next = k_timers ? k_timers->at : K_FOREVER;
+
+    for (struct shim_task *task = k_tasks; task; task = task->next)
+    {
+        if (task->state == TASK_BLOCKED && task->wake_at < next)
+            next = task->wake_at;
+    }
+
+    return next;
+}
+
+static void k_idle_wait(uint64_t until)
+{
+    struct timespec ts;
+
+    if (until == K_FOREVER)
+    {
+        pthread_cond_wait(&k_idle, &k_mutex);
+        return;
+    }
+
+    if (until <= real_now())
+        return;
+
+    // k_idle uses the default clock of condition variables
+    until -= real_now();
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += until / 1000000;
+    ts.tv_nsec += (until % 1000000) * 1000;
+    if (ts.tv_nsec >= 1000000000)
+    {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&k_idle, &k_mutex, &ts);
+}
+
+/*
+Hands the CPU to the next ready task. When nothing is ready the clock is
+advanced to the next timeout (virtual) or the caller sleeps until it or an
+external event (real).
+*/
+static void k_dispatch(void)
+{
+    while (!k_finished)
+    {
+        uint64_t now = k_now();
+        uint64_t next;
+        struct shim_task *task;
+
+        k_fire_timers(now);
+
+        task = k_pick(now);
+        if (task)
+        {
+            task->state = TASK_RUNNING;
+            task->activations++;
+            task->run_start = host_ns();
+            k_current = task;
+            pthread_cond_signal(&task->cond);
+            return;
+        }
+
+        k_current = NULL;
+        next = k_next_event();
+
+        if (now >= k_end || (k_clock == SHIM_CLOCK_VIRTUAL && next > k_end))
+        {
+            if (k_clock == SHIM_CLOCK_VIRTUAL && k_end != K_FOREVER)
+                k_virtual_now = k_end;
+            k_finished = true;
+            pthread_cond_broadcast(&k_idle);
+            return;
+        }
+
+        if (k_clock == SHIM_CLOCK_VIRTUAL)
+        {
+            if (next == K_FOREVER)
+            {
+                fprintf(stderr, "shim: all tasks are blocked forever, stopping\n");
+                k_finished = true;
+                pthread_cond_broadcast(&k_idle);
+                return;
+            }
+            k_virtual_now = next;
+        }
+        else
+            k_idle_wait(next < k_end ? next : k_end);
+    }
+}
+
+static void k_switch(struct shim_task *self)
+{
+    k_account(self);
+    k_dispatch();
+
+    while (self->state != TASK_RUNNING)
+        pthread_cond_wait(&self->cond, &k_mutex);
+}
+
+bool k_block(const void *obj, uint64_t deadline)
+{
+    struct shim_task *self = k_self;
+
+    if (!k_in_task())
+        return false;
+
+    self->state = TASK_BLOCKED;
+    self->wait_obj = obj;
+    self->wake_at = deadline;
+    self->timed_out = false;
+
+    k_switch(self);
+
+    return !self->timed_out;
+}
+
+void k_wake(const void *obj)
+{
+    bool woken = false;
+
+    for (struct shim_task *task = k_tasks; task; task = task->next)
+    {
+        if (task->state == TASK_BLOCKED && task->wait_obj == obj)
+        {
+            k_make_ready(task, false);
+            woken = true;
+        }
+    }
+
+    if (woken && !k_current)
+        pthread_cond_broadcast(&k_idle);
+}
+
+void shim_init(shim_clock_t clock)
+{
+    k_clock = clock;
+    clock_gettime(CLOCK_MONOTONIC, &k_start);
+}
+
+static void heap_sample(void *arg)
+{
+    size_t used = mallinfo2().uordblks;
+
+    if (!heap_samples++)
+        heap_first = used;
+    heap_last = used;
+    if (used > heap_max)
+        heap_max = used;
+
+    shim_call_after(HEAP_SAMPLE_INTERVAL, heap_sample, NULL);
+}
+
+void shim_run(uint64_t duration)
+{
+    k_enter();
+
+    if (!heap_samples)
+        heap_sample(NULL);
+
+    k_end = duration ? k_now() + duration : K_FOREVER;
+    k_finished = false;
+
+    if (!k_current)
+        k_dispatch();
+
+    while (!k_finished)
+        pthread_cond_wait(&k_idle, &k_mutex);
+
+    k_leave();
+}
+
+uint64_t shim_now(void)
+{
+    return k_now();
+}
+
+void shim_call_after(uint64_t delay, shim_callback_t callback, void *arg)
+{
+    shim_timer_t *timer = malloc(sizeof(shim_timer_t));
+    shim_timer_t **pos;
+
+    k_enter();
+
+    timer->at = k_now() + delay;
+    timer->seq = k_seq++;
+    timer->callback = callback;
+    timer->arg = arg;
+
+    for (pos = &k_timers; *pos && (*pos)->at <= timer->at; pos = &(*pos)->next)
+        ;
+    timer->next = *pos;
+    *pos = timer;
+
+    if (!k_current)
+        pthread_cond_broadcast(&k_idle);
+
+    k_leave();
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return k_now();
+}
+
+/*
+Tasks
+*/
+
+static void task_exit(struct shim_task *task)
+{
+    k_enter();
+    task->state = TASK_DELETED;
+    if (k_current == task)
+    {
+        k_account(task);
+        k_dispatch();
+    }
+    k_leave();
+
+    pthread_exit(NULL);
+}
+
+static void *task_entry(void *arg)
+{
+    struct shim_task *task = arg;
+
+    k_self = task;
+
+    k_enter();
+    while (task->state != TASK_RUNNING)
+        pthread_cond_wait(&task->cond, &k_mutex);
+    k_leave();
+
+    task->code(task->parameters);
+
+    // FreeRTOS asserts here, the report lists such tasks
+    fprintf(stderr, "shim: task %s returned from its function\n", task->name);
+    task->returned = true;
+    task_exit(task);
+
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stack_depth,
+                       void *parameters, UBaseType_t priority, TaskHandle_t *created_task)
+{
+    struct shim_task *task = calloc(1, sizeof(struct shim_task));
+    struct shim_task **tail;
+    pthread_attr_t attr;
+
+    strncpy(task->name, name, sizeof(task->name) - 1);
+    task->code = code;
+    task->parameters = parameters;
+    task->priority = priority;
+    pthread_cond_init(&task->cond, NULL);
+
+    // host code needs more stack than the target, the fill pattern gives the high water mark
+    task->stack_size = stack_depth * 4 > TASK_MIN_HOST_STACK ? stack_depth * 4 : TASK_MIN_HOST_STACK;
+    task->stack_size = (task->stack_size + 4095) & ~4095;
+    if (posix_memalign((void **)&task->stack, 4096, task->stack_size))
+    {
+        free(task);
+        return pdFAIL;
+    }
+    memset(task->stack, TASK_STACK_FILL, task->stack_size);
+
+    k_enter();
+
+    k_make_ready(task, false);
+    for (tail = &k_tasks; *tail; tail = &(*tail)->next)
+        ;
+    *tail = task;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, task->stack, task->stack_size);
+    pthread_create(&task->thread, &attr, task_entry, task);
+    pthread_attr_destroy(&attr);
+
+    if (!k_current)
+        pthread_cond_broadcast(&k_idle);
+
+    k_leave();
+
+    if (created_task)
+        *created_task = task;
+
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (!task || task == k_self)
+    {
+        task_exit(k_self);
+        return;
+    }
+
+    k_enter();
+    task->state = TASK_DELETED;
+    k_leave();
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    if (!k_self)
+    {
+        if (k_clock == SHIM_CLOCK_REAL)
+            usleep((uint64_t)ticks * portTICK_PERIOD_MS * 1000);
+        return;
+    }
+
+    if (ticks == 0)
+    {
+        taskYIELD();
+        return;
+    }
+
+    k_enter();
+    k_block(NULL, k_deadline(ticks));
+    k_leave();
+}
+
+void taskYIELD(void)
+{
+    if (!k_self)
+        return;
+
+    k_enter();
+    k_make_ready(k_self, false);
+    k_switch(k_self);
+    k_leave();
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return k_now() / 1000 / portTICK_PERIOD_MS;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return k_self;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+    size_t unused = 0;
+
+    if (!task)
+        task = k_self;
+    if (!task)
+        return 0;
+
+    // the stack grows down, untouched fill is at the bottom
+    while (unused < task->stack_size && task->stack[unused] == TASK_STACK_FILL)
+        unused++;
+
+    return unused;
+}
+
+/*
+Semaphores
+*/
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count)
+{
+    struct shim_semaphore *semaphore = calloc(1, sizeof(struct shim_semaphore));
+
+    semaphore->max = max_count;
+    semaphore->count = initial_count;
+
+    k_enter();
+    snprintf(semaphore->name, sizeof(semaphore->name), "%s#%d", k_self ? k_self->name : "host",
+             k_object_count++);
+    semaphore->next = k_semaphores;
+    k_semaphores = semaphore;
+    k_leave();
+
+    return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return xSemaphoreCreateCounting(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return xSemaphoreCreateCounting(1, 1);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore)
+{
+    struct shim_semaphore **pos;
+
+    k_enter();
+    for (pos = &k_semaphores; *pos && *pos != semaphore; pos = &(*pos)->next)
+        ;
+    if (*pos)
+        *pos = semaphore->next;
+    k_leave();
+
+    free(semaphore);
+}
+
+static void semaphore_count_wait(struct shim_semaphore *semaphore, uint64_t start, bool taken)
+{
+    uint64_t wait = k_now() - start;
+
+    if (taken)
+        semaphore->takes++;
+    else
+        semaphore->timeouts++;
+
+    semaphore->wait_total += wait;
+    if (wait > semaphore->wait_max)
+        semaphore->wait_max = wait;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks)
+{
+    uint64_t deadline;
+    uint64_t start;
+
+    k_enter();
+
+    start = k_now();
+    deadline = k_deadline(ticks);
+    while (semaphore->count == 0)
+    {
+        if ((ticks == 0 || !k_block(semaphore, deadline)) && semaphore->count == 0)
+        {
+            semaphore_count_wait(semaphore, start, false);
+            k_leave();
+            return pdFALSE;
+        }
+    }
+    semaphore->count--;
+    semaphore_count_wait(semaphore, start, true);
+
+    k_leave();
+
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    BaseType_t res = pdFALSE;
+
+    k_enter();
+
+    if (semaphore->count < semaphore->max)
+    {
+        semaphore->count++;
+        k_wake(semaphore);
+        res = pdTRUE;
+    }
+
+    k_leave();
+
+    return res;
+}
+
+/*
+Event groups
+*/
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+    return calloc(1, sizeof(struct shim_event_group));
+}
+
+static bool event_group_satisfied(EventBits_t current, EventBits_t bits, BaseType_t wait_for_all)
+{
+    return wait_for_all ? (current & bits) == bits : (current & bits) != 0;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit,
+                                BaseType_t wait_for_all, TickType_t ticks)
+{
+    EventBits_t res;
+    uint64_t deadline;
+
+    k_enter();
+
+    deadline = k_deadline(ticks);
+    while (!event_group_satisfied(group->bits, bits, wait_for_all))
+    {
+        if ((ticks == 0 || !k_block(group, deadline)) &&
+            !event_group_satisfied(group->bits, bits, wait_for_all))
+        {
+            res = group->bits;
+            k_leave();
+            return res;
+        }
+    }
+
+    res = group->bits;
+    if (clear_on_exit)
+        group->bits &= ~bits;
+
+    k_leave();
+
+    return res;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    EventBits_t res;
+
+    k_enter();
+    group->bits |= bits;
+    res = group->bits;
+    k_wake(group);
+    k_leave();
+
+    return res;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    EventBits_t res;
+
+    k_enter();
+    res = group->bits;
+    group->bits &= ~bits;
+    k_leave();
+
+    return res;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group)
+{
+    return group->bits;
+}
+
+/*
+Queues. Receivers wait on the queue, senders on the byte after it.
+*/
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    struct shim_queue *queue = calloc(1, sizeof(struct shim_queue));
+
+    queue->items = calloc(length, item_size);
+    queue->length = length;
+    queue->item_size = item_size;
+
+    k_enter();
+    snprintf(queue->name, sizeof(queue->name), "%s#%d", k_self ? k_self->name : "host", k_object_count++);
+    queue->next = k_queues;
+    k_queues = queue;
+    k_leave();
+
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    struct shim_queue **pos;
+
+    k_enter();
+    for (pos = &k_queues; *pos && *pos != queue; pos = &(*pos)->next)
+        ;
+    if (*pos)
+        *pos = queue->next;
+    k_leave();
+
+    free(queue->items);
+    free(queue);
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+    uint64_t deadline;
+
+    k_enter();
+
+    deadline = k_deadline(ticks);
+    while (queue->count == queue->length)
+    {
+        if ((ticks == 0 || !k_block((uint8_t *)queue + 1, deadline)) && queue->count == queue->length)
+        {
+            queue->send_timeouts++;
+            k_leave();
+            return pdFALSE;
+        }
+    }
+
+    memcpy(queue->items + ((queue->head + queue->count) % queue->length) * queue->item_size,
+           item, queue->item_size);
+    queue->count++;
+    queue->sends++;
+    if (queue->count > queue->high_water)
+        queue->high_water = queue->count;
+    k_wake(queue);
+
+    k_leave();
+
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+    uint64_t deadline;
+
+    k_enter();
+
+    deadline = k_deadline(ticks);
+    while (queue->count == 0)
+    {
+        if ((ticks == 0 || !k_block(queue, deadline)) && queue->count == 0)
+        {
+            k_leave();
+            return pdFALSE;
+        }
+    }
+
+    memcpy(item, queue->items + queue->head * queue->item_size, queue->item_size);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    k_wake((uint8_t *)queue + 1);
+
+    k_leave();
+
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    return queue->count;
+}
+
+/*
+Report
+*/
+
+void shim_set_name(const void *object, const char *name)
+{
+    k_enter();
+
+    for (struct shim_semaphore *semaphore = k_semaphores; semaphore; semaphore = semaphore->next)
+    {
+        if (semaphore == object)
+            snprintf(semaphore->name, sizeof(semaphore->name), "%s", name);
+    }
+
+    for (struct shim_queue *queue = k_queues; queue; queue = queue->next)
+    {
+        if (queue == object)
+            snprintf(queue->name, sizeof(queue->name), "%s", name);
+    }
+
+    k_leave();
+}
+
+static const char *task_state_name(const struct shim_task *task)
+{
+    if (task->returned)
+        return "RETURNED";
+
+    switch (task->state)
+    {
+    case TASK_READY:
+        return "ready";
+    case TASK_RUNNING:
+        return "running";
+    case TASK_BLOCKED:
+        return "blocked";
+    default:
+        return "deleted";
+    }
+}
+
+void shim_report(FILE *out)
+{
+    uint64_t returned = 0;
+
+    k_enter();
+
+    fprintf(out, "shim report at %.3f s (%s clock)\n", k_now() / 1e6,
+            k_clock == SHIM_CLOCK_VIRTUAL ? "virtual" : "real");
+
+    fprintf(out, "tasks:\n  %-20s %4s %11s %10s %12s %16s %s\n", "name", "prio", "activations", "cpu ms",
+            "max slice ms", "host stack used", "state");
+    for (struct shim_task *task = k_tasks; task; task = task->next)
+    {
+        size_t unused = 0;
+
+        while (unused < task->stack_size && task->stack[unused] == TASK_STACK_FILL)
+            unused++;
+
+        fprintf(out, "  %-20s %4u %11u %10.1f %12.3f %8zu/%-7zu %s\n", task->name, (unsigned)task->priority,
+                task->activations, task->run_ns / 1e6, task->max_slice_ns / 1e6, task->stack_size - unused,
+                task->stack_size, task_state_name(task));
+        returned += task->returned;
+    }
+
+    fprintf(out, "semaphores:\n  %-24s %10s %9s %12s %12s\n", "name", "takes", "timeouts", "avg wait ms",
+            "max wait ms");
+    for (struct shim_semaphore *semaphore = k_semaphores; semaphore; semaphore = semaphore->next)
+    {
+        uint32_t attempts = semaphore->takes + semaphore->timeouts;
+
+        fprintf(out, "  %-24s %10u %9u %12.3f %12.3f\n", semaphore->name, semaphore->takes, semaphore->timeouts,
+                attempts ? semaphore->wait_total / 1e3 / attempts : 0.0, semaphore->wait_max / 1e3);
+    }
+
+    fprintf(out, "queues:\n  %-24s %6s %10s %10s %13s\n", "name", "length", "high water", "sends",
+            "send timeouts");
+    for (struct shim_queue *queue = k_queues; queue; queue = queue->next)
+        fprintf(out, "  %-24s %6u %10u %10u %13u\n", queue->name, (unsigned)queue->length,
+                (unsigned)queue->high_water, queue->sends, queue->send_timeouts);
+
+    fprintf(out, "heap in use: %zu KiB at start, %zu KiB at end, %zu KiB max (%u samples)\n", heap_first / 1024,
+            heap_last / 1024, heap_max / 1024, heap_samples);
+
+    k_wifi_report(out);
+    k_mqtt_report(out);
+
+    if (returned)
+        fprintf(out, "WARNING: %llu task(s) returned from their function\n", (unsigned long long)returned);
+
+    k_leave();
+}
@@ -0,0 +1,200 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "driver/uart.h"
+
+#include "shim.h"
+#include "kernel.h"
+
+#define UART_RX_RING 1024
+
+typedef struct
+{
+    bool installed;
+    shim_uart_device_t device;
+    uint8_t rx[UART_RX_RING];
+    size_t rx_head;
+    size_t rx_count;
+} shim_uart_t;
+
+static shim_uart_t uarts[UART_NUM_MAX];
+
+void shim_uart_attach(int uart_num, const shim_uart_device_t *device)
+{
+    k_enter();
+    uarts[uart_num].device = *device;
+    k_leave();
+}
+
+void shim_uart_feed(int uart_num, const uint8_t *data, size_t len)
+{
+    shim_uart_t *uart = &uarts[uart_num];
+
+    k_enter();
+
+    // like the hardware FIFO, bytes that do not fit are lost
+    for (size_t i = 0; i < len && uart->rx_count < UART_RX_RING; i++)
+    {
+        uart->rx[(uart->rx_head + uart->rx_count) % UART_RX_RING] = data[i];
+        uart->rx_count++;
+    }
+    k_wake(uart);
+
+    k_leave();
+}
+
+static void tty_write(void *ctx, const uint8_t *data, size_t len)
+{
+    int fd = (intptr_t)ctx;
+
+    (void)!write(fd, data, len);
+}
+
+typedef struct
+{
+    int uart_num;
+    int fd;
+} tty_reader_t;
+
+static void *tty_read(void *arg)
+{
+    tty_reader_t *reader = arg;
+    uint8_t buf[64];
+    ssize_t n;
+
+    while ((n = read(reader->fd, buf, sizeof(buf))) > 0)
+        shim_uart_feed(reader->uart_num, buf, n);
+
+    return NULL;
+}
+
+int shim_uart_attach_tty(int uart_num, const char *path)
+{
+    tty_reader_t *reader;
+    struct termios tio;
+    pthread_t thread;
+    int fd;
+
+    fd = open(path, O_RDWR | O_NOCTTY);
+    if (fd < 0)
+        return -1;
+
+    // the sensors talk 9600 8N1, on a pty the speed is ignored
+    if (tcgetattr(fd, &tio) == 0)
+    {
+        cfmakeraw(&tio);
+        cfsetspeed(&tio, B9600);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+
+    reader = malloc(sizeof(tty_reader_t));
+    reader->uart_num = uart_num;
+    reader->fd = fd;
+    if (pthread_create(&thread, NULL, tty_read, reader))
+    {
+        close(fd);
+        free(reader);
+        return -1;
+    }
+    pthread_detach(thread);
+
+    shim_uart_attach(uart_num, &(shim_uart_device_t){
+                                   .write = tty_write,
+                                   .ctx = (void *)(intptr_t)fd,
+                               });
+
+    return 0;
+}
+
+esp_err_t uart_param_config(uart_port_t uart_num, const uart_config_t *uart_config)
+{
+    return uart_num < UART_NUM_MAX ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t uart_set_pin(uart_port_t uart_num, int tx_io_num, int rx_io_num, int rts_io_num, int cts_io_num)
+{
+    return uart_num < UART_NUM_MAX ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t uart_driver_install(uart_port_t uart_num, int rx_buffer_size, int tx_buffer_size,
+                              int queue_size, void *uart_queue, int intr_alloc_flags)
+{
+    if (uart_num >= UART_NUM_MAX)
+        return ESP_ERR_INVALID_ARG;
+
+    uarts[uart_num].installed = true;
+
+    return ESP_OK;
+}
+
+int uart_write_bytes(uart_port_t uart_num, const char *src, size_t size)
+{
+    shim_uart_t *uart = &uarts[uart_num];
+
+    if (uart_num >= UART_NUM_MAX || !uart->installed)
+        return -1;
+
+    k_enter();
+    if (uart->device.write)
+        uart->device.write(uart->device.ctx, (const uint8_t *)src, size);
+    k_leave();
+
+    return size;
+}
+
+int uart_read_bytes(uart_port_t uart_num, uint8_t *buf, uint32_t length, TickType_t ticks_to_wait)
+{
+    shim_uart_t *uart = &uarts[uart_num];
+    uint64_t deadline;
+    uint32_t count = 0;
+
+    if (uart_num >= UART_NUM_MAX || !uart->installed)
+        return -1;
+
+    k_enter();
+
+    deadline = k_deadline(ticks_to_wait);
+    for (;;)
+    {
+        while (count < length && uart->rx_count)
+        {
+            buf[count++] = uart->rx[uart->rx_head];
+            uart->rx_head = (uart->rx_head + 1) % UART_RX_RING;
+            uart->rx_count--;
+        }
+
+        if (count == length || ticks_to_wait == 0 || !k_block(uart, deadline))
+            break;
+    }
+
+    // bytes that arrived right at the deadline
+    while (count < length && uart->rx_count)
+    {
+        buf[count++] = uart->rx[uart->rx_head];
+        uart->rx_head = (uart->rx_head + 1) % UART_RX_RING;
+        uart->rx_count--;
+    }
+
+    k_leave();
+
+    return count;
+}
+
+esp_err_t uart_flush(uart_port_t uart_num)
+{
+    if (uart_num >= UART_NUM_MAX)
+        return ESP_ERR_INVALID_ARG;
+
+    k_enter();
+    uarts[uart_num].rx_head = 0;
+    uarts[uart_num].rx_count = 0;
+    k_leave();
+
+    return ESP_OK;
+}
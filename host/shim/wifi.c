@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_wifi.h"
+
+#include "shim.h"
+#include "kernel.h"
+
+#define WIFI_CONNECT_TIME 300000   // microseconds until IP_EVENT_STA_GOT_IP
+#define WIFI_CONNECT_FAIL_TIME 3000000
+
+ESP_EVENT_DEFINE_BASE(WIFI_EVENT);
+ESP_EVENT_DEFINE_BASE(IP_EVENT);
+
+static bool link_up = true;
+static bool started;
+static bool connecting;
+static bool connected;
+
+static uint32_t connects;
+static uint32_t connect_failures;
+static uint32_t disconnects;
+static uint64_t down_since;
+static uint64_t down_total;
+static uint64_t down_max;
+
+static void wifi_went_down(void)
+{
+    disconnects++;
+    down_since = k_now();
+}
+
+static void wifi_came_up(void)
+{
+    uint64_t down = k_now() - down_since;
+
+    connects++;
+    if (connects > 1)
+    {
+        down_total += down;
+        if (down > down_max)
+            down_max = down;
+    }
+}
+
+void k_wifi_report(FILE *out)
+{
+    fprintf(out, "wifi: %u connects, %u failed attempts, %u disconnects, %.1f s down in total, %.1f s max\n",
+            connects, connect_failures, disconnects, down_total / 1e6, down_max / 1e6);
+}
+
+static void wifi_connect_done(void *arg)
+{
+    connecting = false;
+
+    if (!started)
+        return;
+
+    if (link_up)
+    {
+        ip_event_got_ip_t event = {0};
+
+        event.ip_info.ip.addr = 0x0204a8c0; // 192.168.4.2
+        connected = true;
+        wifi_came_up();
+        esp_event_post(IP_EVENT, IP_EVENT_STA_GOT_IP, &event, sizeof(event), 0);
+        k_mqtt_link_changed(true);
+    }
+    else
+    {
+        connect_failures++;
+        esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, NULL, 0, 0);
+    }
+}
+
+void shim_wifi_set_link(bool up)
+{
+    k_enter();
+
+    link_up = up;
+    if (!up && connected)
+    {
+        connected = false;
+        wifi_went_down();
+        k_mqtt_link_changed(false);
+        esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, NULL, 0, 0);
+    }
+
+    k_leave();
+}
+
+bool k_wifi_link_up(void)
+{
+    return connected;
+}
+
+void tcpip_adapter_init(void)
+{
+}
+
+char *ip4addr_ntoa(const ip4_addr_t *addr)
+{
+    static char buf[16];
+
+    snprintf(buf, sizeof(buf), "%u.%u.%u.%u", addr->addr & 0xff, (addr->addr >> 8) & 0xff,
+             (addr->addr >> 16) & 0xff, addr->addr >> 24);
+
+    return buf;
+}
+
+esp_err_t esp_wifi_init(const wifi_init_config_t *config)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode)
+{
+    return mode == WIFI_MODE_STA ? ESP_OK : ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t esp_wifi_set_config(esp_interface_t interface, wifi_config_t *conf)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_start(void)
+{
+    k_enter();
+    started = true;
+    k_leave();
+
+    return esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_START, NULL, 0, portMAX_DELAY);
+}
+
+esp_err_t esp_wifi_connect(void)
+{
+    k_enter();
+
+    if (!started)
+    {
+        k_leave();
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (!connecting && !connected)
+    {
+        connecting = true;
+        shim_call_after(link_up ? WIFI_CONNECT_TIME : WIFI_CONNECT_FAIL_TIME, wifi_connect_done, NULL);
+    }
+
+    k_leave();
+
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_disconnect(void)
+{
+    k_enter();
+    if (connected)
+    {
+        connected = false;
+        wifi_went_down();
+        k_mqtt_link_changed(false);
+        esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, NULL, 0, 0);
+    }
+    k_leave();
+
+    return ESP_OK;
+}
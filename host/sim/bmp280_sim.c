@@ -0,0 +1,358 @@
+#include <math.h>
+#include <string.h>
+
+#include "esp_err.h"
+
+#include "shim.h"
+
+#include "bmp280_sim.h"
+
+#define REG_CALIB 0x88
+#define REG_CHIP_ID 0xD0
+#define REG_RESET 0xE0
+#define REG_STATUS 0xF3
+#define REG_CTRL_MEAS 0xF4
+#define REG_CONFIG 0xF5
+#define REG_PRESS_MSB 0xF7
+#define REG_TEMP_XLSB 0xFC
+
+#define CHIP_ID 0x58
+#define RESET_CMD 0xB6
+
+#define MODE_SLEEP 0
+#define MODE_FORCED 1
+#define MODE_NORMAL 3
+
+#define RAW_SKIPPED 0x80000
+
+// sample calibration from the datasheet
+static const uint16_t dig_t1 = 27504;
+static const int16_t dig_t2 = 26435;
+static const int16_t dig_t3 = -1000;
+static const uint16_t dig_p1 = 36477;
+static const int16_t dig_p[10] = {0, 0, -10685, 3024, 2855, 140, -7, 15500, -14600, 6000}; // P2..P9
+
+// standby time in microseconds by config t_sb
+static const uint32_t standby_us[8] = {500, 62500, 125000, 250000, 500000, 1000000, 2000000, 4000000};
+
+/* Compensation formulas of the datasheet, used backwards to produce raw values */
+
+static double compensate_t_fine(double adc_t)
+{
+    double var1 = (adc_t / 16384.0 - dig_t1 / 1024.0) * dig_t2;
+    double var2 = (adc_t / 131072.0 - dig_t1 / 8192.0) * (adc_t / 131072.0 - dig_t1 / 8192.0) * dig_t3;
+
+    return var1 + var2;
+}
+
+static double compensate_pres(double adc_p, double t_fine)
+{
+    double var1 = t_fine / 2.0 - 64000.0;
+    double var2 = var1 * var1 * dig_p[6] / 32768.0;
+    double p;
+
+    var2 = var2 + var1 * dig_p[5] * 2.0;
+    var2 = var2 / 4.0 + dig_p[4] * 65536.0;
+    var1 = (dig_p[3] * var1 * var1 / 524288.0 + dig_p[2] * var1) / 524288.0;
+    var1 = (1.0 + var1 / 32768.0) * dig_p1;
+
+    p = 1048576.0 - adc_p;
+    p = (p - var2 / 4096.0) * 6250.0 / var1;
+    var1 = dig_p[9] * p * p / 2147483648.0;
+    var2 = p * dig_p[8] / 32768.0;
+
+    return p + (var1 + var2 + dig_p[7]) / 16.0;
+}
+
+// temperature rises with the raw value
+static double raw_temp(double temp)
+{
+    double lo = 0, hi = 0xFFFFF;
+
+    for (int i = 0; i < 40; i++)
+    {
+        double mid = (lo + hi) / 2;
+
+        if (compensate_t_fine(mid) / 5120.0 < temp)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+// pressure falls with the raw value
+static double raw_pres(double pres, double t_fine)
+{
+    double lo = 0, hi = 0xFFFFF;
+
+    for (int i = 0; i < 40; i++)
+    {
+        double mid = (lo + hi) / 2;
+
+        if (compensate_pres(mid, t_fine) > pres)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+static double gaussian(bmp280_sim_t *sim)
+{
+    double u1, u2;
+
+    sim->rng = sim->rng * 1664525 + 1013904223;
+    u1 = (sim->rng + 1.0) / 4294967297.0;
+    sim->rng = sim->rng * 1664525 + 1013904223;
+    u2 = sim->rng / 4294967296.0;
+
+    return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+static int oversampling(uint8_t osrs)
+{
+    return osrs ? 1 << ((osrs > 5 ? 5 : osrs) - 1) : 0;
+}
+
+// typical measurement time, datasheet 3.8.1
+static uint64_t measurement_time(uint8_t ctrl_meas)
+{
+    int os_t = oversampling(ctrl_meas >> 5);
+    int os_p = oversampling((ctrl_meas >> 2) & 7);
+
+    return 1000 + 2000 * os_t + (os_p ? 2000 * os_p + 500 : 0);
+}
+
+static void put_raw(uint8_t *reg, uint32_t raw)
+{
+    reg[0] = raw >> 12;
+    reg[1] = (raw >> 4) & 0xff;
+    reg[2] = (raw & 0xf) << 4;
+}
+
+/*
+Raw value at the resolution of the oversampling setting, 16 bits at 1x up to
+20 bits; with the IIR filter on the output always has 20 bits.
+*/
+static uint32_t quantize(double raw, uint8_t osrs, bool filter)
+{
+    int bits = filter ? 20 : 15 + (osrs > 5 ? 5 : osrs);
+    uint32_t value = raw < 0 ? 0 : raw > 0xFFFFF ? 0xFFFFF : (uint32_t)raw;
+
+    return value & ~((1u << (20 - bits)) - 1);
+}
+
+static void measure(bmp280_sim_t *sim, uint64_t at)
+{
+    uint8_t ctrl = sim->regs[REG_CTRL_MEAS];
+    uint8_t osrs_t = ctrl >> 5;
+    uint8_t osrs_p = (ctrl >> 2) & 7;
+    int coeff = (sim->regs[REG_CONFIG] >> 2) & 7;
+    int filter = coeff ? 1 << (coeff > 4 ? 4 : coeff) : 0;
+    double temp, pres, adc_t, adc_p;
+
+    sim->stats.measurements++;
+
+    if (!osrs_t)
+    {
+        // pressure needs the temperature, both are skipped
+        put_raw(sim->regs + REG_PRESS_MSB, RAW_SKIPPED);
+        put_raw(sim->regs + REG_PRESS_MSB + 3, RAW_SKIPPED);
+        return;
+    }
+
+    temp = trace_value(sim->trace, 0, at) + sim->noise_temp * gaussian(sim) / sqrt(oversampling(osrs_t));
+    pres = trace_value(sim->trace, 1, at) + sim->noise_pres * gaussian(sim) / sqrt(oversampling(osrs_p ? osrs_p : 1));
+    adc_t = raw_temp(temp);
+    adc_p = raw_pres(pres, compensate_t_fine(adc_t));
+
+    // the IIR filter starts from the first measurement after a reset
+    if (filter)
+    {
+        if (!sim->filter_primed)
+        {
+            sim->filtered_temp = adc_t;
+            sim->filtered_pres = adc_p;
+            sim->filter_primed = true;
+        }
+        sim->filtered_temp = (sim->filtered_temp * (filter - 1) + adc_t) / filter;
+        sim->filtered_pres = (sim->filtered_pres * (filter - 1) + adc_p) / filter;
+        adc_t = sim->filtered_temp;
+        adc_p = sim->filtered_pres;
+    }
+
+    put_raw(sim->regs + REG_PRESS_MSB + 3, quantize(adc_t, osrs_t, filter));
+    put_raw(sim->regs + REG_PRESS_MSB, osrs_p ? quantize(adc_p, osrs_p, filter) : RAW_SKIPPED);
+}
+
+// runs the measurements due by `now`
+static void advance(bmp280_sim_t *sim, uint64_t now)
+{
+    uint8_t mode = sim->regs[REG_CTRL_MEAS] & 3;
+    uint64_t period;
+
+    if (!sim->pending)
+        return;
+
+    if (mode == MODE_FORCED)
+    {
+        if (now >= sim->next_done)
+        {
+            measure(sim, sim->next_done);
+            sim->regs[REG_CTRL_MEAS] &= ~3;
+            sim->pending = false;
+        }
+        return;
+    }
+
+    period = sim->measure_time + standby_us[sim->regs[REG_CONFIG] >> 5];
+
+    // after a long gap only the last measurements matter, the filter has settled
+    if (now > sim->next_done + 256 * period)
+        sim->next_done += (now - sim->next_done) / period * period - 256 * period;
+
+    while (sim->next_done <= now)
+    {
+        measure(sim, sim->next_done);
+        sim->next_done += period;
+    }
+}
+
+static void set_mode(bmp280_sim_t *sim, uint64_t now)
+{
+    uint8_t mode = sim->regs[REG_CTRL_MEAS] & 3;
+
+    sim->measure_time = measurement_time(sim->regs[REG_CTRL_MEAS]);
+    sim->pending = mode == MODE_FORCED || mode == MODE_NORMAL;
+    sim->next_done = now + sim->measure_time;
+}
+
+static void reset(bmp280_sim_t *sim)
+{
+    uint8_t *calib = sim->regs + REG_CALIB;
+
+    memset(sim->regs, 0, sizeof(sim->regs));
+
+    calib[0] = dig_t1 & 0xff;
+    calib[1] = dig_t1 >> 8;
+    calib[2] = (uint16_t)dig_t2 & 0xff;
+    calib[3] = (uint16_t)dig_t2 >> 8;
+    calib[4] = (uint16_t)dig_t3 & 0xff;
+    calib[5] = (uint16_t)dig_t3 >> 8;
+    calib[6] = dig_p1 & 0xff;
+    calib[7] = dig_p1 >> 8;
+    for (int i = 2; i <= 9; i++)
+    {
+        calib[4 + 2 * i] = (uint16_t)dig_p[i] & 0xff;
+        calib[5 + 2 * i] = (uint16_t)dig_p[i] >> 8;
+    }
+
+    sim->regs[REG_CHIP_ID] = CHIP_ID;
+    put_raw(sim->regs + REG_PRESS_MSB, RAW_SKIPPED);
+    put_raw(sim->regs + REG_PRESS_MSB + 3, RAW_SKIPPED);
+
+    sim->pending = false;
+    sim->filter_primed = false;
+}
+
+static uint8_t read_reg(bmp280_sim_t *sim, uint8_t reg, uint64_t now)
+{
+    if (reg == REG_STATUS)
+    {
+        bool measuring = sim->pending && now + sim->measure_time >= sim->next_done;
+
+        return measuring ? 0x08 : 0;
+    }
+
+    return sim->regs[reg];
+}
+
+static void write_reg(bmp280_sim_t *sim, uint8_t reg, uint8_t value, uint64_t now)
+{
+    switch (reg)
+    {
+    case REG_RESET:
+        if (value == RESET_CMD)
+            reset(sim);
+        break;
+    case REG_CTRL_MEAS:
+        sim->regs[reg] = value;
+        set_mode(sim, now);
+        break;
+    case REG_CONFIG:
+        sim->regs[reg] = value;
+        break;
+    default:
+        // read-only registers ignore writes
+        break;
+    }
+}
+
+int bmp280_sim_transfer(bmp280_sim_t *sim, uint64_t now, const uint8_t *tx, size_t tx_len, uint8_t *rx,
+                        size_t rx_len)
+{
+    sim->stats.transactions++;
+    sim->stats.bytes_written += tx_len;
+    sim->stats.bytes_read += rx_len;
+
+    advance(sim, now);
+
+    if (rx_len)
+    {
+        uint8_t reg = tx_len ? tx[0] : 0;
+
+        sim->stats.reads++;
+        if (reg + rx_len > REG_PRESS_MSB && reg <= REG_TEMP_XLSB)
+            sim->stats.data_reads++;
+
+        // burst reads auto-increment the address
+        for (size_t i = 0; i < rx_len; i++)
+            rx[i] = read_reg(sim, reg + i, now);
+    }
+    else if (tx_len >= 2)
+    {
+        sim->stats.writes++;
+
+        // writes are register/value pairs, without auto-increment
+        for (size_t i = 0; i + 1 < tx_len; i += 2)
+            write_reg(sim, tx[i], tx[i + 1], now);
+    }
+
+    return 0;
+}
+
+void bmp280_sim_init(bmp280_sim_t *sim, const sim_trace_t *trace)
+{
+    memset(sim, 0, sizeof(bmp280_sim_t));
+
+    sim->trace = trace;
+    sim->noise_temp = 0.01;
+    sim->noise_pres = 2.0;
+    sim->rng = 1;
+
+    reset(sim);
+}
+
+static int bmp280_sim_shim_transfer(void *ctx, const uint8_t *tx, size_t tx_len, uint8_t *rx, size_t rx_len)
+{
+    bmp280_sim_t *sim = ctx;
+    int res;
+
+    if (sim->fault && (res = sim->fault(sim->fault_ctx, shim_now())) != ESP_OK)
+        return res;
+
+    return bmp280_sim_transfer(sim, shim_now(), tx, tx_len, rx, rx_len);
+}
+
+void bmp280_sim_attach(bmp280_sim_t *sim, int i2c_num)
+{
+    shim_i2c_device_t device = {
+        .transfer = bmp280_sim_shim_transfer,
+        .ctx = sim,
+    };
+
+    shim_i2c_attach(i2c_num, BMP280_SIM_ADDR, &device);
+}
@@ -0,0 +1,68 @@
+#ifndef _BMP280_SIM_H
+#define _BMP280_SIM_H
+
+/*
+BMP280 register model for the I2C bus of the host build: chip ID, soft reset,
+calibration NVM, ctrl_meas and config, and data registers updated at the
+measurement times of the configured mode, oversampling, standby time and IIR
+filter. Trace channels: 0 - temperature C, 1 - pressure Pa.
+*/
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "trace.h"
+
+#define BMP280_SIM_ADDR 0x76
+
+typedef struct
+{
+    uint32_t transactions;
+    uint32_t reads;
+    uint32_t writes;
+    uint32_t bytes_read;
+    uint32_t bytes_written;
+    uint32_t measurements;
+    uint32_t data_reads; // reads touching the data registers
+} bmp280_sim_stats_t;
+
+typedef struct
+{
+    const sim_trace_t *trace;
+    double noise_temp; // C, RMS at 1x oversampling
+    double noise_pres; // Pa, RMS at 1x oversampling
+
+    uint8_t regs[256];
+    uint64_t next_done;   // end of the measurement in progress, microseconds
+    uint64_t measure_time; // duration of a measurement in progress
+    bool pending;
+    double filtered_temp; // IIR state, raw units
+    double filtered_pres;
+    bool filter_primed;
+    uint32_t rng;
+
+    /*
+    Called before each transaction on the shim bus, anything but ESP_OK fails
+    it with that error. See fault.h.
+    */
+    int (*fault)(void *ctx, uint64_t now);
+    void *fault_ctx;
+
+    bmp280_sim_stats_t stats;
+} bmp280_sim_t;
+
+void bmp280_sim_init(bmp280_sim_t *sim, const sim_trace_t *trace);
+
+/*
+One I2C transaction at `now` microseconds: `tx` starts with the register
+address, followed by register/value pairs for a write; `rx_len` bytes are
+read from consecutive registers. Returns 0, the model always acknowledges.
+*/
+int bmp280_sim_transfer(bmp280_sim_t *sim, uint64_t now, const uint8_t *tx, size_t tx_len, uint8_t *rx,
+                        size_t rx_len);
+
+// attaches the model to an I2C bus of the shim at BMP280_SIM_ADDR
+void bmp280_sim_attach(bmp280_sim_t *sim, int i2c_num);
+
+#endif // _BMP280_SIM_H
@@ -0,0 +1,437 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_err.h"
+
+#include "fault.h"
+
+static const char *const class_names[FAULT_CLASSES] = {
+    [FAULT_BIT_FLIP] = "bitflip",
+    [FAULT_BYTE_DROP] = "drop",
+    [FAULT_I2C_TIMEOUT] = "i2c",
+    [FAULT_STUCK] = "stuck",
+    [FAULT_WIFI_DROP] = "wifi",
+    [FAULT_BROKER_REFUSAL] = "broker",
+};
+
+// sensor names in the status topics
+static const char *const target_names[FAULT_TARGETS] = {
+    [FAULT_TARGET_DUST] = "dust",
+    [FAULT_TARGET_CO2] = "co2",
+    [FAULT_TARGET_BMP] = "bmp",
+    [FAULT_TARGET_NETWORK] = "network",
+};
+
+static bool is_episode(fault_class_t class)
+{
+    return class >= FAULT_STUCK;
+}
+
+static double fault_random(fault_t *faults)
+{
+    faults->rng = faults->rng * 1664525 + 1013904223;
+
+    return faults->rng / 4294967296.0;
+}
+
+static bool fault_chance(fault_t *faults, fault_class_t class)
+{
+    // no random numbers drawn for disabled classes, runs stay comparable
+    return faults->config[class].rate > 0 && fault_random(faults) < faults->config[class].rate;
+}
+
+static void incident_open(fault_t *faults, fault_class_t class, fault_target_t target, uint64_t now)
+{
+    fault_incident_t *incident = &faults->incidents[class][target];
+
+    faults->stats[class].injected++;
+
+    if (!incident->open)
+    {
+        memset(incident, 0, sizeof(fault_incident_t));
+        incident->open = true;
+        incident->start = now;
+        incident->errors = faults->errors[target];
+        faults->stats[class].incidents++;
+    }
+
+    if (now > incident->end)
+        incident->end = now;
+}
+
+static void incident_close(fault_t *faults, fault_class_t class, fault_target_t target, uint64_t now)
+{
+    fault_incident_t *incident = &faults->incidents[class][target];
+    fault_stats_t *stats = &faults->stats[class];
+    uint64_t ttr = now - incident->end;
+    uint32_t expected = (now - incident->start) / faults->update_interval;
+    uint32_t seconds = ttr / 1000000;
+
+    stats->recovered++;
+    stats->ttr_sum += ttr;
+    if (ttr > stats->ttr_max)
+        stats->ttr_max = ttr;
+    stats->ttr_buckets[seconds < FAULT_TTR_BUCKETS ? seconds : FAULT_TTR_BUCKETS]++;
+
+    if (target != FAULT_TARGET_NETWORK)
+        stats->failed_reads += faults->errors[target] - incident->errors;
+    if (expected > incident->updates)
+        stats->missed_updates += expected - incident->updates;
+
+    incident->open = false;
+}
+
+/* Hooks of the simulated sensors */
+
+static size_t fault_uart(void *ctx, uint64_t now, uint8_t *data, size_t len)
+{
+    fault_port_t *port = ctx;
+    fault_t *faults = port->faults;
+    size_t n = 0;
+
+    if (faults->stuck[port->index])
+        return 0;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        uint8_t byte = data[i];
+
+        if (fault_chance(faults, FAULT_BYTE_DROP))
+        {
+            incident_open(faults, FAULT_BYTE_DROP, port->index, now);
+            continue;
+        }
+
+        if (fault_chance(faults, FAULT_BIT_FLIP))
+        {
+            byte ^= 1 << (int)(fault_random(faults) * 8);
+            incident_open(faults, FAULT_BIT_FLIP, port->index, now);
+        }
+
+        data[n++] = byte;
+    }
+
+    return n;
+}
+
+static int fault_i2c(void *ctx, uint64_t now)
+{
+    fault_port_t *port = ctx;
+    fault_t *faults = port->faults;
+
+    // a hung BMP280 holds SDA and nothing acknowledges
+    if (faults->stuck[port->index])
+        return ESP_FAIL;
+
+    if (fault_chance(faults, FAULT_I2C_TIMEOUT))
+    {
+        incident_open(faults, FAULT_I2C_TIMEOUT, port->index, now);
+        return ESP_ERR_TIMEOUT;
+    }
+
+    return ESP_OK;
+}
+
+void fault_attach_uart(fault_t *faults, sim_uart_device_t *dev, fault_target_t target)
+{
+    dev->fault = fault_uart;
+    dev->fault_ctx = &faults->targets[target];
+}
+
+void fault_attach_bmp280(fault_t *faults, bmp280_sim_t *sim)
+{
+    sim->fault = fault_i2c;
+    sim->fault_ctx = &faults->targets[FAULT_TARGET_BMP];
+}
+
+/* Broker in between */
+
+static void fault_observe(fault_t *faults, const char *topic, const char *data, int len)
+{
+    /*
+    Status messages end with /status/<sensor> and carry
+    {"status":"...","age":N,"reads":N,"checksum":N,"timeout":N,"range":N}.
+    */
+
+    const char *name = strrchr(topic, '/');
+    char payload[256];
+    char status[16];
+    unsigned age, reads, checksum, timeout, range;
+    uint64_t now = shim_now();
+    int target;
+
+    if (!name || name - topic < 7 || strncmp(name - 7, "/status", 7) || len >= (int)sizeof(payload))
+        return;
+
+    for (target = 0; target < FAULT_TARGET_NETWORK; target++)
+    {
+        if (!strcmp(name + 1, target_names[target]))
+            break;
+    }
+    if (target == FAULT_TARGET_NETWORK)
+        return;
+
+    memcpy(payload, data, len);
+    payload[len] = '\0';
+    if (sscanf(payload, "{\"status\":\"%15[^\"]\",\"age\":%u,\"reads\":%u,\"checksum\":%u,\"timeout\":%u,\"range\":%u",
+               status, &age, &reads, &checksum, &timeout, &range) != 6)
+        return;
+
+    faults->errors[target] = checksum + timeout + range;
+
+    for (int class = 0; class < FAULT_CLASSES; class++)
+    {
+        fault_incident_t *incident = &faults->incidents[class][target];
+        fault_incident_t *network = &faults->incidents[class][FAULT_TARGET_NETWORK];
+
+        if (incident->open && !strcmp(status, "valid"))
+        {
+            incident->updates++;
+            if (!incident->active && now - age * 1000000ULL > incident->end)
+                incident_close(faults, class, target, now);
+        }
+
+        // one status message per sensor and update
+        if (network->open && target == FAULT_TARGET_DUST)
+        {
+            network->updates++;
+            if (!network->active)
+                incident_close(faults, class, FAULT_TARGET_NETWORK, now);
+        }
+    }
+}
+
+static int fault_connect(void *ctx, esp_mqtt_client_handle_t client, const esp_mqtt_client_config_t *config)
+{
+    fault_t *faults = ctx;
+
+    if (faults->refusing)
+        return ESP_FAIL;
+
+    return faults->broker.connect(faults->broker.ctx, client, config);
+}
+
+static void fault_disconnect(void *ctx, esp_mqtt_client_handle_t client)
+{
+    fault_t *faults = ctx;
+
+    faults->broker.disconnect(faults->broker.ctx, client);
+}
+
+static int fault_publish(void *ctx, esp_mqtt_client_handle_t client, const char *topic, const char *data,
+                         int len, int qos, int retain)
+{
+    fault_t *faults = ctx;
+    int res;
+
+    // the broker closes the connection, the client sees it on the next publish
+    if (faults->refusing)
+        return ESP_FAIL;
+
+    res = faults->broker.publish(faults->broker.ctx, client, topic, data, len, qos, retain);
+    if (res == ESP_OK)
+        fault_observe(faults, topic, data, len);
+
+    return res;
+}
+
+static int fault_subscribe(void *ctx, esp_mqtt_client_handle_t client, const char *topic, int qos)
+{
+    fault_t *faults = ctx;
+
+    return faults->broker.subscribe(faults->broker.ctx, client, topic, qos);
+}
+
+void fault_attach_broker(fault_t *faults, const shim_mqtt_broker_t *broker)
+{
+    shim_mqtt_broker_t wrapper = {
+        .connect = fault_connect,
+        .disconnect = fault_disconnect,
+        .publish = fault_publish,
+        .subscribe = fault_subscribe,
+        .ctx = faults,
+    };
+
+    faults->broker = *broker;
+    shim_mqtt_set_broker(&wrapper);
+}
+
+/* Episodes */
+
+static void episode_begin(void *arg);
+
+static void episode_schedule(fault_port_t *port)
+{
+    fault_t *faults = port->faults;
+    double hours = -log(1.0 - fault_random(faults)) / faults->config[port->index].rate;
+
+    shim_call_after(hours * 3600e6, episode_begin, port);
+}
+
+static void episode_end(void *arg)
+{
+    fault_port_t *port = arg;
+    fault_t *faults = port->faults;
+    int target = FAULT_TARGET_NETWORK;
+
+    switch (port->index)
+    {
+    case FAULT_STUCK:
+        for (target = 0; target < FAULT_TARGET_NETWORK && !faults->stuck[target]; target++)
+            ;
+        faults->stuck[target] = false;
+        break;
+    case FAULT_WIFI_DROP:
+        shim_wifi_set_link(true);
+        break;
+    case FAULT_BROKER_REFUSAL:
+        faults->refusing = false;
+        break;
+    }
+
+    faults->incidents[port->index][target].active = false;
+    faults->incidents[port->index][target].end = shim_now();
+
+    episode_schedule(port);
+}
+
+static void episode_begin(void *arg)
+{
+    fault_port_t *port = arg;
+    fault_t *faults = port->faults;
+    int target = FAULT_TARGET_NETWORK;
+
+    switch (port->index)
+    {
+    case FAULT_STUCK:
+        target = fault_random(faults) * FAULT_TARGET_NETWORK;
+        faults->stuck[target] = true;
+        break;
+    case FAULT_WIFI_DROP:
+        shim_wifi_set_link(false);
+        break;
+    case FAULT_BROKER_REFUSAL:
+        faults->refusing = true;
+        break;
+    }
+
+    incident_open(faults, port->index, target, shim_now());
+    faults->incidents[port->index][target].active = true;
+
+    shim_call_after(faults->config[port->index].duration, episode_end, port);
+}
+
+void fault_init(fault_t *faults, uint32_t seed, uint64_t update_interval)
+{
+    memset(faults, 0, sizeof(fault_t));
+
+    faults->update_interval = update_interval;
+    faults->rng = seed;
+
+    for (int i = 0; i < FAULT_TARGETS; i++)
+        faults->targets[i] = (fault_port_t){.faults = faults, .index = i};
+    for (int i = 0; i < FAULT_CLASSES; i++)
+        faults->episodes[i] = (fault_port_t){.faults = faults, .index = i};
+}
+
+int fault_parse(fault_t *faults, const char *spec)
+{
+    const char *value = strchr(spec, '=');
+    double seconds;
+    char *end;
+
+    if (!value)
+        return -1;
+
+    for (int class = 0; class < FAULT_CLASSES; class++)
+    {
+        fault_config_t *config = &faults->config[class];
+
+        if (strncmp(spec, class_names[class], value - spec) || class_names[class][value - spec])
+            continue;
+
+        config->rate = strtod(value + 1, &end);
+        if (end == value + 1 || config->rate < 0)
+            return -1;
+
+        if (!is_episode(class))
+            return *end || config->rate > 1 ? -1 : 0;
+
+        if (*end != ':')
+            return -1;
+        seconds = strtod(end + 1, &end);
+        if (seconds <= 0 || *end)
+            return -1;
+        config->duration = seconds * 1e6;
+
+        return 0;
+    }
+
+    return -1;
+}
+
+bool fault_enabled(const fault_t *faults)
+{
+    for (int class = 0; class < FAULT_CLASSES; class++)
+    {
+        if (faults->config[class].rate > 0)
+            return true;
+    }
+
+    return false;
+}
+
+void fault_start(fault_t *faults)
+{
+    for (int class = FAULT_STUCK; class < FAULT_CLASSES; class++)
+    {
+        if (faults->config[class].rate > 0)
+            episode_schedule(&faults->episodes[class]);
+    }
+}
+
+static double ttr_percentile(const fault_stats_t *stats, double fraction)
+{
+    uint64_t target = stats->recovered * fraction;
+    uint64_t seen = 0;
+
+    for (uint32_t seconds = 0; seconds <= FAULT_TTR_BUCKETS; seconds++)
+    {
+        seen += stats->ttr_buckets[seconds];
+        if (seen > target)
+            return seconds;
+    }
+
+    return FAULT_TTR_BUCKETS;
+}
+
+void fault_report(const fault_t *faults, FILE *out)
+{
+    fprintf(out, "faults (time to recover in s, p50/p95 with 1 s resolution):\n"
+                 "  %-7s %-12s %9s %9s %9s %8s %6s %6s %8s %8s %8s\n",
+            "class", "rate", "injected", "incidents", "recovered", "ttr mean", "p50", "p95", "max",
+            "failed", "missed");
+
+    for (int class = 0; class < FAULT_CLASSES; class++)
+    {
+        const fault_config_t *config = &faults->config[class];
+        const fault_stats_t *stats = &faults->stats[class];
+        char rate[32];
+
+        if (config->rate <= 0)
+            continue;
+
+        if (is_episode(class))
+            snprintf(rate, sizeof(rate), "%g/h %gs", config->rate, config->duration / 1e6);
+        else
+            snprintf(rate, sizeof(rate), "%g", config->rate);
+
+        fprintf(out, "  %-7s %-12s %9u %9u %9u %8.1f %6.0f %6.0f %8.1f %8u %8u\n", class_names[class], rate,
+                stats->injected, stats->incidents, stats->recovered,
+                stats->recovered ? stats->ttr_sum / 1e6 / stats->recovered : 0.0, ttr_percentile(stats, 0.5),
+                ttr_percentile(stats, 0.95), stats->ttr_max / 1e6, stats->failed_reads, stats->missed_updates);
+    }
+
+    fprintf(out, "  failed: sensor reads with an error, missed: MQTT updates without a valid sample\n");
+}
@@ -0,0 +1,125 @@
+#ifndef _SIM_FAULT_H
+#define _SIM_FAULT_H
+
+/*
+Fault injection for the host build: corrupted and lost bytes on the sensor
+UARTs, I2C timeouts, sensors that stop answering, access point and broker
+outages. Faults on bytes and transactions happen with a probability per byte
+or transaction, outages ("episodes") at a rate per hour with a fixed length.
+
+Every fault opens an incident for the sensor it hits, or for the network. An
+incident is recovered by the first status message published after the fault
+is over which reports a valid sample taken after it; for the network, by the
+first status message published at all. Per fault class the report gives the
+time to recover, the failed sensor reads and the MQTT updates missed in the
+meantime.
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "shim.h"
+
+#include "bmp280_sim.h"
+#include "sim_uart.h"
+
+#define FAULT_TTR_BUCKETS 3600 // seconds
+
+typedef enum
+{
+    FAULT_BIT_FLIP,       // per byte sent by a UART sensor
+    FAULT_BYTE_DROP,      // per byte sent by a UART sensor
+    FAULT_I2C_TIMEOUT,    // per I2C transaction
+    FAULT_STUCK,          // episodes: a random sensor does not answer
+    FAULT_WIFI_DROP,      // episodes: the access point is gone
+    FAULT_BROKER_REFUSAL, // episodes: the broker drops and refuses connections
+    FAULT_CLASSES,
+} fault_class_t;
+
+typedef enum
+{
+    FAULT_TARGET_DUST,
+    FAULT_TARGET_CO2,
+    FAULT_TARGET_BMP,
+    FAULT_TARGET_NETWORK,
+    FAULT_TARGETS,
+} fault_target_t;
+
+typedef struct
+{
+    double rate;       // probability per byte or transaction, episodes per hour
+    uint64_t duration; // of an episode, microseconds
+} fault_config_t;
+
+typedef struct
+{
+    bool open;
+    bool active;     // episode not over yet
+    uint64_t start;
+    uint64_t end;    // last fault or end of the episode
+    uint32_t errors; // error counters of the sensor at the start
+    uint32_t updates;
+} fault_incident_t;
+
+typedef struct
+{
+    uint32_t injected;
+    uint32_t incidents;
+    uint32_t recovered;
+    uint64_t ttr_sum; // microseconds
+    uint64_t ttr_max;
+    uint32_t ttr_buckets[FAULT_TTR_BUCKETS + 1];
+    uint32_t failed_reads;
+    uint32_t missed_updates;
+} fault_stats_t;
+
+struct fault;
+
+typedef struct
+{
+    struct fault *faults;
+    int index; // target, or class for the episode timers
+} fault_port_t;
+
+typedef struct fault
+{
+    fault_config_t config[FAULT_CLASSES];
+    uint64_t update_interval;
+    uint32_t rng;
+
+    bool stuck[FAULT_TARGETS];
+    bool refusing;
+    shim_mqtt_broker_t broker;
+
+    fault_port_t targets[FAULT_TARGETS];
+    fault_port_t episodes[FAULT_CLASSES];
+    fault_incident_t incidents[FAULT_CLASSES][FAULT_TARGETS];
+    uint32_t errors[FAULT_TARGETS]; // from the last status message
+    fault_stats_t stats[FAULT_CLASSES];
+} fault_t;
+
+// `update_interval` is the MQTT update period of the firmware, microseconds
+void fault_init(fault_t *faults, uint32_t seed, uint64_t update_interval);
+
+/*
+Sets a class from "name=rate" or "name=rate:seconds" for episodes, names
+are bitflip, drop, i2c, stuck, wifi and broker. Returns 0 on success.
+*/
+int fault_parse(fault_t *faults, const char *spec);
+
+bool fault_enabled(const fault_t *faults);
+
+void fault_attach_uart(fault_t *faults, sim_uart_device_t *dev, fault_target_t target);
+
+void fault_attach_bmp280(fault_t *faults, bmp280_sim_t *sim);
+
+// puts the fault layer between the MQTT client and `broker`
+void fault_attach_broker(fault_t *faults, const shim_mqtt_broker_t *broker);
+
+// schedules the first episodes, call before shim_run()
+void fault_start(fault_t *faults);
+
+void fault_report(const fault_t *faults, FILE *out);
+
+#endif // _SIM_FAULT_H
@@ -0,0 +1,72 @@
+#include <math.h>
+#include <string.h>
+
+#include "mhz19_sim.h"
+
+#define MHZ19_CMD_READ 0x86
+
+static uint8_t mhz19_sim_checksum(const uint8_t *packet)
+{
+    uint8_t sum = 0;
+
+    for (int i = 1; i < 8; i++)
+        sum += packet[i];
+
+    return 0xff - sum + 1;
+}
+
+size_t mhz19_sim_frame(uint16_t ppm, int8_t temp, uint8_t *out)
+{
+    out[0] = 0xFF;
+    out[1] = MHZ19_CMD_READ;
+    out[2] = ppm >> 8;
+    out[3] = ppm & 0xff;
+    out[4] = temp + 40;
+    out[5] = 0; // status
+    out[6] = 0;
+    out[7] = 0;
+    out[8] = mhz19_sim_checksum(out);
+
+    return MHZ19_SIM_FRAME_LEN;
+}
+
+static size_t mhz19_sim_input(sim_uart_device_t *dev, uint64_t now, const uint8_t *data, size_t len,
+                              uint8_t *out, size_t size)
+{
+    mhz19_sim_t *sim = (mhz19_sim_t *)dev;
+    size_t out_len = 0;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        if (sim->cmd_len == 0 && data[i] != 0xFF)
+            continue;
+
+        sim->cmd[sim->cmd_len++] = data[i];
+        if (sim->cmd_len < MHZ19_SIM_FRAME_LEN)
+            continue;
+
+        sim->cmd_len = 0;
+        if (sim->cmd[8] != mhz19_sim_checksum(sim->cmd) || sim->cmd[2] != MHZ19_CMD_READ)
+            continue;
+
+        if (size - out_len < MHZ19_SIM_FRAME_LEN)
+            break;
+
+        dev->requests++;
+        out_len += mhz19_sim_frame(lround(trace_value(sim->trace, 0, now)),
+                                   lround(trace_value(sim->trace, 1, now)), out + out_len);
+    }
+
+    dev->bytes_out += out_len;
+
+    return out_len;
+}
+
+void mhz19_sim_init(mhz19_sim_t *sim, const sim_trace_t *trace)
+{
+    memset(sim, 0, sizeof(mhz19_sim_t));
+
+    sim->base.name = "mh-z19";
+    sim->base.input = mhz19_sim_input;
+    sim->trace = trace;
+}
@@ -0,0 +1,27 @@
+#ifndef _MHZ19_SIM_H
+#define _MHZ19_SIM_H
+
+/*
+MH-Z19B model answering the 0x86 read command.
+Trace channels: 0 - CO2 ppm, 1 - temperature C.
+*/
+
+#include "sim_uart.h"
+#include "trace.h"
+
+#define MHZ19_SIM_FRAME_LEN 9
+
+typedef struct
+{
+    sim_uart_device_t base;
+    const sim_trace_t *trace;
+
+    uint8_t cmd[MHZ19_SIM_FRAME_LEN];
+    size_t cmd_len;
+} mhz19_sim_t;
+
+void mhz19_sim_init(mhz19_sim_t *sim, const sim_trace_t *trace);
+
+size_t mhz19_sim_frame(uint16_t ppm, int8_t temp, uint8_t *out);
+
+#endif // _MHZ19_SIM_H
@@ -0,0 +1,176 @@
+#include <math.h>
+#include <string.h>
+
+#include "pms7003_sim.h"
+
+#define PMS_CMD_MODE 0xE1
+#define PMS_CMD_READ 0xE2
+#define PMS_CMD_SLEEP 0xE4
+
+static void put16(uint8_t *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v & 0xff;
+}
+
+size_t pms_sim_frame(uint16_t pm1, uint16_t pm25, uint16_t pm10, uint8_t *out)
+{
+    uint16_t sum = 0;
+
+    memset(out, 0, PMS_SIM_FRAME_LEN);
+    out[0] = 0x42;
+    out[1] = 0x4D;
+    put16(out + 2, 28);
+
+    put16(out + 4, pm1); // CF=1
+    put16(out + 6, pm25);
+    put16(out + 8, pm10);
+    put16(out + 10, pm1); // atmospheric
+    put16(out + 12, pm25);
+    put16(out + 14, pm10);
+
+    // particle counts per 0.1 l, roughly proportional to the mass
+    put16(out + 16, pm1 * 60);
+    put16(out + 18, pm1 * 20);
+    put16(out + 20, pm25 * 5);
+    put16(out + 22, pm25);
+    put16(out + 24, pm10 / 4);
+    put16(out + 26, pm10 / 10);
+
+    out[28] = 0x91; // version
+
+    for (int i = 0; i < 30; i++)
+        sum += out[i];
+    put16(out + 30, sum);
+
+    return PMS_SIM_FRAME_LEN;
+}
+
+static size_t pms_sim_reading(pms_sim_t *sim, uint64_t now, uint8_t *out)
+{
+    double scale = 1;
+
+    if (now - sim->wake_time < sim->warmup)
+        scale = (double)(now - sim->wake_time) / sim->warmup;
+
+    return pms_sim_frame(lround(scale * trace_value(sim->trace, 2, now)),
+                         lround(scale * trace_value(sim->trace, 0, now)),
+                         lround(scale * trace_value(sim->trace, 1, now)), out);
+}
+
+static size_t pms_sim_ack(uint8_t cmd, uint8_t data, uint8_t *out)
+{
+    uint16_t sum;
+
+    out[0] = 0x42;
+    out[1] = 0x4D;
+    out[2] = 0x00;
+    out[3] = 0x04;
+    out[4] = cmd;
+    out[5] = data;
+    sum = 0x42 + 0x4D + 0x04 + cmd + data;
+    put16(out + 6, sum);
+
+    return 8;
+}
+
+static size_t pms_sim_command(pms_sim_t *sim, uint64_t now, uint8_t *out, size_t size)
+{
+    uint8_t cmd = sim->cmd[2];
+    uint8_t data = sim->cmd[4];
+
+    if (size < PMS_SIM_FRAME_LEN)
+        return 0;
+
+    if (sim->sleeping)
+    {
+        // only wakeup is heard, and it is not answered
+        if (cmd == PMS_CMD_SLEEP && data == 1)
+        {
+            sim->sleeping = false;
+            sim->wake_time = now;
+            sim->passive = false;
+        }
+        return 0;
+    }
+
+    switch (cmd)
+    {
+    case PMS_CMD_READ:
+        if (!sim->passive)
+            return 0;
+        sim->base.requests++;
+        return pms_sim_reading(sim, now, out);
+    case PMS_CMD_MODE:
+        sim->passive = data == 0;
+        return pms_sim_ack(cmd, data, out);
+    case PMS_CMD_SLEEP:
+        if (data == 0)
+        {
+            sim->sleeping = true;
+            return pms_sim_ack(cmd, data, out);
+        }
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+static size_t pms_sim_input(sim_uart_device_t *dev, uint64_t now, const uint8_t *data, size_t len,
+                            uint8_t *out, size_t size)
+{
+    pms_sim_t *sim = (pms_sim_t *)dev;
+    size_t out_len = 0;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        uint16_t sum = 0;
+
+        // resynchronize on the 0x42 0x4D start bytes
+        if ((sim->cmd_len == 0 && data[i] != 0x42) || (sim->cmd_len == 1 && data[i] != 0x4D))
+        {
+            sim->cmd_len = data[i] == 0x42 ? 1 : 0;
+            continue;
+        }
+
+        sim->cmd[sim->cmd_len++] = data[i];
+        if (sim->cmd_len < sizeof(sim->cmd))
+            continue;
+
+        sim->cmd_len = 0;
+        for (int j = 0; j < 5; j++)
+            sum += sim->cmd[j];
+        if (sum != ((sim->cmd[5] << 8) | sim->cmd[6]))
+            continue;
+
+        out_len += pms_sim_command(sim, now, out + out_len, size - out_len);
+    }
+
+    dev->bytes_out += out_len;
+
+    return out_len;
+}
+
+static size_t pms_sim_poll(sim_uart_device_t *dev, uint64_t now, uint8_t *out, size_t size)
+{
+    pms_sim_t *sim = (pms_sim_t *)dev;
+
+    if (sim->passive || sim->sleeping || size < PMS_SIM_FRAME_LEN)
+        return 0;
+
+    dev->bytes_out += PMS_SIM_FRAME_LEN;
+
+    return pms_sim_reading(sim, now, out);
+}
+
+void pms_sim_init(pms_sim_t *sim, const sim_trace_t *trace)
+{
+    memset(sim, 0, sizeof(pms_sim_t));
+
+    sim->base.name = "pms7003";
+    sim->base.input = pms_sim_input;
+    sim->base.poll = pms_sim_poll;
+    sim->base.poll_interval = PMS_SIM_ACTIVE_INTERVAL;
+    sim->trace = trace;
+    sim->warmup = 30000000;
+}
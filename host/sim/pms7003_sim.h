@@ -0,0 +1,36 @@
+#ifndef _PMS7003_SIM_H
+#define _PMS7003_SIM_H
+
+/*
+PMS7003 model: active and passive mode, sleep/wakeup, 32 byte data frames.
+Trace channels: 0 - PM2.5, 1 - PM10, 2 - PM1.0, ug/m3.
+*/
+
+#include <stdbool.h>
+
+#include "sim_uart.h"
+#include "trace.h"
+
+#define PMS_SIM_FRAME_LEN 32
+#define PMS_SIM_ACTIVE_INTERVAL 1000000 // microseconds between frames in active mode
+
+typedef struct
+{
+    sim_uart_device_t base;
+    const sim_trace_t *trace;
+    uint64_t warmup; // microseconds after wakeup with readings still ramping up
+
+    bool passive;
+    bool sleeping;
+    uint64_t wake_time;
+
+    uint8_t cmd[7];
+    size_t cmd_len;
+} pms_sim_t;
+
+void pms_sim_init(pms_sim_t *sim, const sim_trace_t *trace);
+
+// builds a data frame with atmospheric and CF=1 values set to the same numbers
+size_t pms_sim_frame(uint16_t pm1, uint16_t pm25, uint16_t pm10, uint8_t *out);
+
+#endif // _PMS7003_SIM_H
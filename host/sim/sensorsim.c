@@ -0,0 +1,113 @@
+/*
+Virtual PMS7003 and MH-Z19 on pseudo-terminals.
+
+Prints the pty paths, which the host build (--pms-tty, --co2-tty) or any other
+program talking to the real sensors can open instead of a serial port.
+*/
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mhz19_sim.h"
+#include "pms7003_sim.h"
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+    stop = 1;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [--no-pms] [--no-co2] [--pms-trace FILE] [--co2-trace FILE]\n"
+            "          [--baud N] [--latency-ms N] [--seconds N]\n",
+            name);
+}
+
+int main(int argc, char **argv)
+{
+    static const double pms_defaults[] = {12, 20, 8};
+    static const double co2_defaults[] = {650, 24};
+    sim_timing_t timing = {.baud = 9600, .latency = 10000};
+    const char *pms_trace_path = NULL;
+    const char *co2_trace_path = NULL;
+    int pms_enabled = 1, co2_enabled = 1;
+    unsigned seconds = 0;
+    sim_trace_t pms_trace, co2_trace;
+    pms_sim_t pms;
+    mhz19_sim_t co2;
+    sim_pty_t pms_pty, co2_pty;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--no-pms"))
+            pms_enabled = 0;
+        else if (!strcmp(argv[i], "--no-co2"))
+            co2_enabled = 0;
+        else if (!strcmp(argv[i], "--pms-trace") && i + 1 < argc)
+            pms_trace_path = argv[++i];
+        else if (!strcmp(argv[i], "--co2-trace") && i + 1 < argc)
+            co2_trace_path = argv[++i];
+        else if (!strcmp(argv[i], "--baud") && i + 1 < argc)
+            timing.baud = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--latency-ms") && i + 1 < argc)
+            timing.latency = strtoull(argv[++i], NULL, 10) * 1000;
+        else if (!strcmp(argv[i], "--seconds") && i + 1 < argc)
+            seconds = strtoul(argv[++i], NULL, 10);
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    trace_init_constant(&pms_trace, pms_defaults, 3);
+    trace_init_constant(&co2_trace, co2_defaults, 2);
+    if ((pms_trace_path && trace_load(&pms_trace, pms_trace_path)) ||
+        (co2_trace_path && trace_load(&co2_trace, co2_trace_path)))
+    {
+        fprintf(stderr, "cannot load trace\n");
+        return 1;
+    }
+
+    pms_sim_init(&pms, &pms_trace);
+    mhz19_sim_init(&co2, &co2_trace);
+
+    if (pms_enabled)
+    {
+        if (sim_pty_start(&pms_pty, &pms.base, &timing))
+        {
+            perror("pms7003 pty");
+            return 1;
+        }
+        printf("pms7003 %s\n", pms_pty.name);
+    }
+    if (co2_enabled)
+    {
+        if (sim_pty_start(&co2_pty, &co2.base, &timing))
+        {
+            perror("mh-z19 pty");
+            return 1;
+        }
+        printf("mh-z19 %s\n", co2_pty.name);
+    }
+    fflush(stdout);
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    for (unsigned elapsed = 0; !stop && (!seconds || elapsed < seconds); elapsed++)
+        sleep(1);
+
+    if (pms_enabled)
+        printf("pms7003: %u requests, %u bytes sent\n", pms.base.requests, pms.base.bytes_out);
+    if (co2_enabled)
+        printf("mh-z19: %u requests, %u bytes sent\n", co2.base.requests, co2.base.bytes_out);
+
+    return 0;
+}
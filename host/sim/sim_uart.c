@@ -0,0 +1,241 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shim.h"
+
+#include "sim_uart.h"
+
+#define SIM_UART_BUFFER 256
+
+uint64_t sim_byte_time(const sim_timing_t *timing)
+{
+    // start, 8 data bits, stop
+    return timing->baud ? 10000000ULL / timing->baud : 0;
+}
+
+/* In-process transport over the shim UART */
+
+typedef struct
+{
+    sim_uart_device_t *dev;
+    int uart_num;
+    sim_timing_t timing;
+    uint64_t busy_until; // end of the answer being sent
+} sim_port_t;
+
+typedef struct
+{
+    sim_port_t *port;
+    size_t len;
+    uint8_t data[];
+} sim_chunk_t;
+
+static void sim_port_deliver(void *arg)
+{
+    sim_chunk_t *chunk = arg;
+
+    shim_uart_feed(chunk->port->uart_num, chunk->data, chunk->len);
+    free(chunk);
+}
+
+// schedules `len` bytes starting at `start`, one byte per byte time
+static void sim_port_send(sim_port_t *port, uint64_t start, uint8_t *data, size_t len)
+{
+    uint64_t byte_time = sim_byte_time(&port->timing);
+    uint64_t now = shim_now();
+
+    if (port->dev->fault)
+        len = port->dev->fault(port->dev->fault_ctx, start, data, len);
+
+    if (start < port->busy_until)
+        start = port->busy_until;
+
+    for (size_t i = 0; i < len;)
+    {
+        // without timing everything goes in one chunk
+        size_t n = byte_time ? 1 : len;
+        sim_chunk_t *chunk = malloc(sizeof(sim_chunk_t) + n);
+
+        chunk->port = port;
+        chunk->len = n;
+        memcpy(chunk->data, data + i, n);
+        i += n;
+        shim_call_after(start + i * byte_time - now, sim_port_deliver, chunk);
+    }
+
+    port->busy_until = start + len * byte_time;
+}
+
+static void sim_port_write(void *ctx, const uint8_t *data, size_t len)
+{
+    sim_port_t *port = ctx;
+    uint8_t out[SIM_UART_BUFFER];
+    uint64_t now = shim_now();
+    size_t n;
+
+    // the command is complete when its last byte is on the wire
+    now += len * sim_byte_time(&port->timing);
+
+    n = port->dev->input(port->dev, now, data, len, out, sizeof(out));
+    if (n)
+        sim_port_send(port, now + port->timing.latency, out, n);
+}
+
+static void sim_port_poll(void *arg)
+{
+    sim_port_t *port = arg;
+    uint8_t out[SIM_UART_BUFFER];
+    size_t n;
+
+    n = port->dev->poll(port->dev, shim_now(), out, sizeof(out));
+    if (n)
+        sim_port_send(port, shim_now(), out, n);
+
+    shim_call_after(port->dev->poll_interval, sim_port_poll, port);
+}
+
+void sim_uart_attach(int uart_num, sim_uart_device_t *dev, const sim_timing_t *timing)
+{
+    sim_port_t *port = calloc(1, sizeof(sim_port_t));
+    shim_uart_device_t device = {
+        .write = sim_port_write,
+        .ctx = port,
+    };
+
+    port->dev = dev;
+    port->uart_num = uart_num;
+    port->timing = *timing;
+
+    shim_uart_attach(uart_num, &device);
+
+    if (dev->poll && dev->poll_interval)
+        shim_call_after(dev->poll_interval, sim_port_poll, port);
+}
+
+/* Pseudo-terminal transport */
+
+static uint64_t sim_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void sim_sleep(uint64_t us)
+{
+    struct timespec ts = {
+        .tv_sec = us / 1000000,
+        .tv_nsec = (us % 1000000) * 1000,
+    };
+
+    while (nanosleep(&ts, &ts) && errno == EINTR)
+        ;
+}
+
+static void sim_pty_send(sim_pty_t *pty, const uint8_t *data, size_t len)
+{
+    uint64_t byte_time = sim_byte_time(&pty->timing);
+
+    if (!byte_time)
+    {
+        // a full pty buffer means nobody reads, the answer is lost like on a wire
+        (void)!write(pty->master, data, len);
+        return;
+    }
+
+    for (size_t i = 0; i < len; i++)
+    {
+        sim_sleep(byte_time);
+        if (write(pty->master, data + i, 1) < 0)
+            return;
+    }
+}
+
+static void *sim_pty_serve(void *arg)
+{
+    sim_pty_t *pty = arg;
+    sim_uart_device_t *dev = pty->dev;
+    uint64_t start = sim_clock();
+    uint64_t next_poll = dev->poll_interval;
+
+    for (;;)
+    {
+        struct pollfd pfd = {.fd = pty->master, .events = POLLIN};
+        uint8_t in[SIM_UART_BUFFER];
+        uint8_t out[SIM_UART_BUFFER];
+        int timeout = -1;
+        uint64_t now = sim_clock() - start;
+        ssize_t n;
+        size_t out_len;
+
+        if (dev->poll && dev->poll_interval)
+            timeout = next_poll > now ? (next_poll - now + 999) / 1000 : 0;
+
+        if (poll(&pfd, 1, timeout) < 0 && errno != EINTR)
+            break;
+
+        now = sim_clock() - start;
+
+        if (dev->poll && dev->poll_interval && now >= next_poll)
+        {
+            out_len = dev->poll(dev, now, out, sizeof(out));
+            sim_pty_send(pty, out, out_len);
+            next_poll += dev->poll_interval;
+        }
+
+        if (!(pfd.revents & POLLIN))
+            continue;
+
+        n = read(pty->master, in, sizeof(in));
+        if (n <= 0)
+            continue;
+
+        out_len = dev->input(dev, now, in, n, out, sizeof(out));
+        if (out_len)
+        {
+            sim_sleep(pty->timing.latency);
+            sim_pty_send(pty, out, out_len);
+        }
+    }
+
+    return NULL;
+}
+
+int sim_pty_start(sim_pty_t *pty, sim_uart_device_t *dev, const sim_timing_t *timing)
+{
+    struct termios tio;
+
+    pty->dev = dev;
+    pty->timing = *timing;
+
+    pty->master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (pty->master < 0 || grantpt(pty->master) || unlockpt(pty->master) ||
+        ptsname_r(pty->master, pty->name, sizeof(pty->name)))
+        return -1;
+
+    /*
+    Keep the slave side open so the master does not see a hangup between
+    clients, and put it into raw mode: the protocols are binary.
+    */
+    pty->slave = open(pty->name, O_RDWR | O_NOCTTY);
+    if (pty->slave < 0 || tcgetattr(pty->slave, &tio))
+        return -1;
+    cfmakeraw(&tio);
+    if (tcsetattr(pty->slave, TCSANOW, &tio))
+        return -1;
+
+    if (pthread_create(&pty->thread, NULL, sim_pty_serve, pty))
+        return -1;
+
+    return 0;
+}
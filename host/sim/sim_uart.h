@@ -0,0 +1,70 @@
+#ifndef _SIM_UART_H
+#define _SIM_UART_H
+
+/*
+Simulated UART sensors and the transports connecting them to the firmware:
+in-process on a shim UART, or on a pseudo-terminal for a separate process.
+*/
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct sim_uart_device
+{
+    const char *name;
+
+    /*
+    Bytes sent to the sensor at `now` microseconds. The answer, if any, is
+    written to `out`, returns its length.
+    */
+    size_t (*input)(struct sim_uart_device *dev, uint64_t now, const uint8_t *data, size_t len,
+                    uint8_t *out, size_t size);
+
+    // unsolicited output, called every `poll_interval` microseconds if set
+    size_t (*poll)(struct sim_uart_device *dev, uint64_t now, uint8_t *out, size_t size);
+    uint64_t poll_interval;
+
+    /*
+    Called with every answer before it goes on the wire of a shim UART, may
+    change it in place, returns the length to send. See fault.h.
+    */
+    size_t (*fault)(void *ctx, uint64_t now, uint8_t *data, size_t len);
+    void *fault_ctx;
+
+    uint32_t requests;
+    uint32_t bytes_out;
+} sim_uart_device_t;
+
+typedef struct
+{
+    uint32_t baud;    // 0 sends answers at once
+    uint64_t latency; // microseconds between the end of a command and the first byte of the answer
+} sim_timing_t;
+
+// time of one 8N1 byte in microseconds
+uint64_t sim_byte_time(const sim_timing_t *timing);
+
+/*
+Connects the device to a shim UART of the host build, bytes are delivered
+with the configured timing on the shim clock.
+*/
+void sim_uart_attach(int uart_num, sim_uart_device_t *dev, const sim_timing_t *timing);
+
+typedef struct
+{
+    sim_uart_device_t *dev;
+    sim_timing_t timing;
+    int master;
+    int slave;
+    char name[64];
+    pthread_t thread;
+} sim_pty_t;
+
+/*
+Serves the device on a new pseudo-terminal from a background thread. The
+path of the terminal to open is in `pty->name`. Returns 0 on success.
+*/
+int sim_pty_start(sim_pty_t *pty, sim_uart_device_t *dev, const sim_timing_t *timing);
+
+#endif // _SIM_UART_H
@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+void trace_init_constant(sim_trace_t *trace, const double *values, int channels)
+{
+    memset(trace, 0, sizeof(sim_trace_t));
+
+    for (int i = 0; i < channels && i < TRACE_MAX_CHANNELS; i++)
+        trace->defaults[i] = values[i];
+}
+
+int trace_load(sim_trace_t *trace, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char line[256];
+    size_t capacity = 0;
+
+    if (!f)
+        return -1;
+
+    while (fgets(line, sizeof(line), f))
+    {
+        trace_point_t point;
+        char *p = line;
+        char *end;
+
+        while (*p == ' ' || *p == '\t')
+            p++;
+        if (*p == '#' || *p == '\n' || *p == '\0')
+            continue;
+
+        point.time = strtod(p, &end);
+        if (end == p)
+            continue;
+
+        for (int i = 0; i < TRACE_MAX_CHANNELS; i++)
+        {
+            p = end + strspn(end, " \t,");
+            point.values[i] = strtod(p, &end);
+            if (end == p)
+                point.values[i] = trace->defaults[i];
+        }
+
+        if (trace->count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            trace->points = realloc(trace->points, capacity * sizeof(trace_point_t));
+        }
+        trace->points[trace->count++] = point;
+    }
+
+    fclose(f);
+
+    return trace->count ? 0 : -1;
+}
+
+double trace_value(const sim_trace_t *trace, int channel, uint64_t now)
+{
+    double t = now / 1e6;
+    double period;
+    size_t lo = 0;
+    size_t hi;
+
+    if (!trace->count)
+        return trace->defaults[channel];
+
+    if (trace->count == 1)
+        return trace->points[0].values[channel];
+
+    period = trace->points[trace->count - 1].time;
+    if (period > 0)
+        t -= period * (uint64_t)(t / period);
+
+    // binary search for the segment containing t
+    hi = trace->count - 1;
+    while (hi - lo > 1)
+    {
+        size_t mid = (lo + hi) / 2;
+
+        if (trace->points[mid].time <= t)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    if (t <= trace->points[lo].time)
+        return trace->points[lo].values[channel];
+
+    return trace->points[lo].values[channel] +
+           (trace->points[hi].values[channel] - trace->points[lo].values[channel]) *
+               (t - trace->points[lo].time) / (trace->points[hi].time - trace->points[lo].time);
+}
@@ -0,0 +1,39 @@
+#ifndef _SIM_TRACE_H
+#define _SIM_TRACE_H
+
+/*
+Concentration trace driving a simulated sensor: points of (seconds, values)
+interpolated linearly and repeated after the last point. A trace without
+points returns the constant defaults.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRACE_MAX_CHANNELS 4
+
+typedef struct
+{
+    double time;
+    double values[TRACE_MAX_CHANNELS];
+} trace_point_t;
+
+typedef struct
+{
+    trace_point_t *points;
+    size_t count;
+    double defaults[TRACE_MAX_CHANNELS];
+} sim_trace_t;
+
+void trace_init_constant(sim_trace_t *trace, const double *values, int channels);
+
+/*
+Loads whitespace or comma separated lines "seconds value [value...]", lines
+starting with '#' are comments. Missing columns keep the defaults. Returns 0
+on success.
+*/
+int trace_load(sim_trace_t *trace, const char *path);
+
+double trace_value(const sim_trace_t *trace, int channel, uint64_t now);
+
+#endif // _SIM_TRACE_H
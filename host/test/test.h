@@ -0,0 +1,108 @@
+#ifndef _TEST_H
+#define _TEST_H
+
+/*
+Unit tests of the firmware modules on the host, run by ctest. A test file
+lists its cases and ends with TEST_MAIN(cases); the cases run one after the
+other in a task of the shim, on the virtual clock, so the code under test
+may use semaphores, queues, event groups and NVS. CHECK() and friends
+report a failure with its line and carry on; the exit status is 1 if any
+check failed.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "shim.h"
+
+typedef struct
+{
+    const char *name;
+    void (*run)(void);
+} test_case_t;
+
+#define TEST(name) {#name, name}
+
+static int test_failures;
+
+#define CHECK(condition) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            test_failures++; \
+        } \
+    } while (0)
+
+#define CHECK_INT(actual, expected) \
+    do \
+    { \
+        long long actual_ = (actual), expected_ = (expected); \
+        if (actual_ != expected_) \
+        { \
+            fprintf(stderr, "%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, #actual, actual_, \
+                    expected_); \
+            test_failures++; \
+        } \
+    } while (0)
+
+#define CHECK_NEAR(actual, expected, tolerance) \
+    do \
+    { \
+        double actual_ = (actual), expected_ = (expected); \
+        if (!(fabs(actual_ - expected_) <= (tolerance))) \
+        { \
+            fprintf(stderr, "%s:%d: %s is %.9g, expected %.9g\n", __FILE__, __LINE__, #actual, actual_, \
+                    expected_); \
+            test_failures++; \
+        } \
+    } while (0)
+
+#define CHECK_STR(actual, expected) \
+    do \
+    { \
+        const char *actual_ = (actual), *expected_ = (expected); \
+        if (strcmp(actual_, expected_)) \
+        { \
+            fprintf(stderr, "%s:%d: %s is \"%s\", expected \"%s\"\n", __FILE__, __LINE__, #actual, actual_, \
+                    expected_); \
+            test_failures++; \
+        } \
+    } while (0)
+
+static const test_case_t *test_cases;
+static size_t test_count;
+
+static void test_task(void *arg)
+{
+    for (size_t i = 0; i < test_count; i++)
+    {
+        int failures = test_failures;
+
+        test_cases[i].run();
+        fprintf(stderr, "%s %s\n", test_failures == failures ? "ok  " : "FAIL", test_cases[i].name);
+    }
+
+    exit(test_failures ? 1 : 0);
+}
+
+#define TEST_MAIN(cases) \
+    int main(void) \
+    { \
+        test_cases = cases; \
+        test_count = sizeof(cases) / sizeof(cases[0]); \
+        shim_log_limit(ESP_LOG_WARN); \
+        shim_init(SHIM_CLOCK_VIRTUAL); \
+        xTaskCreate(test_task, "test", 16384, NULL, 10, NULL); \
+        shim_run(0); \
+        return 1; \
+    }
+
+#endif // _TEST_H
@@ -0,0 +1,173 @@
+// adaptive sampling: the periods from the samples, the clamps and requested samples
+
+#include "test.h"
+
+#include "esp_timer.h"
+#include "nvs_flash.h"
+
+#include "adaptive.h"
+#include "dust_sensor.h"
+
+static int command(const char *text)
+{
+    return config_command(text, strlen(text));
+}
+
+// a sample of the dust sensor, then the sleep of its task; returns the milliseconds slept
+static int32_t sample(float pm)
+{
+    int64_t start;
+
+    adaptive_update(ADAPTIVE_PM25, pm, esp_timer_get_time());
+    adaptive_update(ADAPTIVE_PM100, pm, esp_timer_get_time());
+
+    start = esp_timer_get_time();
+    adaptive_delay(ADAPTIVE_DUST);
+    return (esp_timer_get_time() - start) / 1000;
+}
+
+static void requester_task(void *arg)
+{
+    vTaskDelay((intptr_t)arg / portTICK_PERIOD_MS);
+    xEventGroupSetBits(eg_app_status, REQUEST_DUST_BIT);
+    vTaskDelete(NULL);
+}
+
+// sets REQUEST_DUST_BIT `ms` milliseconds from now
+static void request_after(int ms)
+{
+    xTaskCreate(requester_task, "request", 4096, (void *)(intptr_t)ms, 5, NULL);
+}
+
+static void setup(void)
+{
+    nvs_flash_init();
+    eg_app_status = xEventGroupCreate();
+    config_init();
+    CHECK_INT(command("dust_delay=60000 dust_min_delay=2000 co2_delay=60000 bmp_delay=60000 mqtt_delay=30000"), 0);
+}
+
+static void fixed_period_when_off(void)
+{
+    CHECK_INT(command("adaptive=0"), 0);
+
+    CHECK_INT(sample(10), 60000);
+    CHECK_INT(sample(500), 60000);
+    CHECK_INT(adaptive_period(ADAPTIVE_DUST), 60000);
+    CHECK_INT(adaptive_mqtt_period(), 30000);
+}
+
+static void halves_then_backs_off(void)
+{
+    int32_t period;
+    int samples = 0;
+
+    CHECK_INT(command("adaptive=1"), 0);
+
+    // the mean settles on a steady value, the period stays at the maximum
+    for (int i = 0; i < 60; i++)
+        sample(10);
+    CHECK_INT(sample(10), 60000);
+    CHECK_INT(adaptive_mqtt_period(), 30000);
+
+    // a step moves the channel, the period halves down to the minimum
+    xEventGroupClearBits(eg_app_status, CONFIG_MQTT_BIT);
+    CHECK_INT(sample(100), 30000);
+    CHECK(!(xEventGroupGetBits(eg_app_status) & CONFIG_MQTT_BIT));
+    CHECK_INT(sample(100), 15000);
+    CHECK(xEventGroupGetBits(eg_app_status) & CONFIG_MQTT_BIT);
+    CHECK_INT(adaptive_mqtt_period(), 15000);
+    CHECK_INT(sample(100), 7500);
+    CHECK_INT(sample(100), 3750);
+    CHECK_INT(sample(100), 2000);
+
+    // until the variance decays, then by ADAPTIVE_BACKOFF per sample
+    do
+        period = sample(100);
+    while (period == 2000 && ++samples < 50);
+    CHECK(samples < 50);
+    CHECK_INT(period, 2500);
+    CHECK_INT(sample(100), 3125);
+    CHECK_INT(sample(100), 3906);
+
+    for (samples = 0; sample(100) < 60000 && samples < 50; samples++)
+        ;
+    CHECK(samples < 50);
+    CHECK_INT(sample(100), 60000);
+}
+
+static void rate_moves_the_channel(void)
+{
+    // samples 20 s apart
+    CHECK_INT(command("dust_delay=20000"), 0);
+    CHECK_INT(sample(100), 20000);
+
+    // 6 per minute, over ADAPTIVE_PM25_RATE, but within ADAPTIVE_PM25_SD of the last sample is noise
+    CHECK_INT(sample(102), 20000);
+
+    // 12 per minute, with the deviation still below ADAPTIVE_PM25_SD
+    CHECK_INT(sample(106), 10000);
+
+    CHECK_INT(command("dust_delay=60000"), 0);
+}
+
+static void min_above_max(void)
+{
+    // the minimum gives way to the maximum
+    CHECK_INT(command("dust_delay=10000 dust_min_delay=20000"), 0);
+    CHECK_INT(adaptive_period(ADAPTIVE_DUST), 10000);
+    CHECK_INT(sample(1000), 10000);
+    CHECK_INT(sample(5000), 10000);
+    CHECK_INT(adaptive_period(ADAPTIVE_DUST), 10000);
+
+    CHECK_INT(command("dust_delay=60000 dust_min_delay=2000"), 0);
+}
+
+static void requested_sample(void)
+{
+    CHECK_INT(command("adaptive=0"), 0);
+    xEventGroupClearBits(eg_app_status, REQUEST_DUST_BIT | SAMPLED_DUST_BIT);
+
+    // a request wakes the task at once, after the minimum period
+    request_after(10000);
+    CHECK_INT(sample(10), 10000);
+    CHECK(!(xEventGroupGetBits(eg_app_status) & SAMPLED_DUST_BIT));
+
+    // the sample taken after it answers the request
+    CHECK_INT(sample(10), 60000);
+    CHECK(xEventGroupGetBits(eg_app_status) & SAMPLED_DUST_BIT);
+    CHECK(!(xEventGroupGetBits(eg_app_status) & REQUEST_DUST_BIT));
+
+    // the next one doesn't
+    xEventGroupClearBits(eg_app_status, SAMPLED_DUST_BIT);
+    CHECK_INT(sample(10), 60000);
+    CHECK(!(xEventGroupGetBits(eg_app_status) & SAMPLED_DUST_BIT));
+}
+
+static void min_delay_gates_requests(void)
+{
+    // no sooner than dust_min_delay after the previous read
+    CHECK_INT(command("dust_min_delay=5000"), 0);
+    xEventGroupClearBits(eg_app_status, REQUEST_DUST_BIT | SAMPLED_DUST_BIT);
+
+    request_after(500);
+    CHECK_INT(sample(10), 5000);
+    CHECK(adaptive_last_read(ADAPTIVE_DUST) > 0);
+    CHECK_INT(esp_timer_get_time() / 1000 - adaptive_last_read(ADAPTIVE_DUST), 5000);
+    CHECK_INT(sample(10), 60000);
+    CHECK(xEventGroupGetBits(eg_app_status) & SAMPLED_DUST_BIT);
+
+    CHECK_INT(command("dust_min_delay=2000"), 0);
+}
+
+static const test_case_t cases[] = {
+    TEST(setup),
+    TEST(fixed_period_when_off),
+    TEST(halves_then_backs_off),
+    TEST(rate_moves_the_channel),
+    TEST(min_above_max),
+    TEST(requested_sample),
+    TEST(min_delay_gates_requests),
+};
+
+TEST_MAIN(cases)
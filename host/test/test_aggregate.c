@@ -0,0 +1,113 @@
+// aggregate_u16(), the robust aggregate of oversampled frames
+
+#include "test.h"
+
+#include "aggregate.h"
+
+static void no_frames(void)
+{
+    uint16_t values[1];
+    uint8_t used = 99;
+
+    CHECK_INT(aggregate_u16(values, 0, AGGREGATE_MEDIAN, &used), 0);
+    CHECK_INT(used, 0);
+}
+
+static void single_frame(void)
+{
+    uint16_t values[] = {42};
+    uint8_t used;
+
+    CHECK_INT(aggregate_u16(values, 1, AGGREGATE_TRIMMED_MEAN, &used), 42);
+    CHECK_INT(used, 1);
+}
+
+static void high_outlier_is_rejected(void)
+{
+    uint16_t values[] = {10, 11, 200, 12, 11};
+    uint8_t used;
+
+    // median 11, MAD 1, so the cut-off is 1.4826 * 3 = 4 from the median
+    CHECK_INT(aggregate_u16(values, 5, AGGREGATE_MEDIAN, &used), 11);
+    CHECK_INT(used, 4);
+
+    // sorted in place
+    CHECK_INT(values[0], 10);
+    CHECK_INT(values[4], 200);
+}
+
+static void low_outlier_is_rejected(void)
+{
+    uint16_t values[] = {53, 0, 51, 50, 52};
+    uint8_t used;
+
+    CHECK_INT(aggregate_u16(values, 5, AGGREGATE_TRIMMED_MEAN, &used), 52);
+    CHECK_INT(used, 4);
+}
+
+static void identical_frames_keep_close_ones(void)
+{
+    uint16_t values[] = {5, 5, 6, 5};
+    uint8_t used;
+
+    // the MAD is 0, AGGREGATE_MIN_SPREAD keeps the 6
+    aggregate_u16(values, 4, AGGREGATE_MEDIAN, &used);
+    CHECK_INT(used, 4);
+}
+
+static void just_inside_and_outside_the_cut_off(void)
+{
+    uint16_t inside[] = {100, 99, 101, 100, 104};
+    uint16_t outside[] = {100, 99, 101, 100, 105};
+    uint8_t used;
+
+    aggregate_u16(inside, 5, AGGREGATE_MEDIAN, &used);
+    CHECK_INT(used, 5);
+    aggregate_u16(outside, 5, AGGREGATE_MEDIAN, &used);
+    CHECK_INT(used, 4);
+}
+
+static void trimmed_mean_drops_the_quartiles(void)
+{
+    uint16_t values[] = {80, 10, 70, 20, 60, 30, 50, 40};
+    uint8_t used;
+
+    // wide spread, nothing rejected; the mean of 30..60
+    CHECK_INT(aggregate_u16(values, 8, AGGREGATE_TRIMMED_MEAN, &used), 45);
+    CHECK_INT(used, 8);
+}
+
+static void even_count_median_rounds(void)
+{
+    uint16_t values[] = {10, 11, 12, 13};
+    uint8_t used;
+
+    CHECK_INT(aggregate_u16(values, 4, AGGREGATE_MEDIAN, &used), 12);
+    CHECK_INT(used, 4);
+}
+
+static void count_is_capped(void)
+{
+    uint16_t values[AGGREGATE_MAX_FRAMES + 4];
+    uint8_t used;
+
+    for (int i = 0; i < AGGREGATE_MAX_FRAMES + 4; i++)
+        values[i] = 30;
+
+    CHECK_INT(aggregate_u16(values, AGGREGATE_MAX_FRAMES + 4, AGGREGATE_MEDIAN, &used), 30);
+    CHECK_INT(used, AGGREGATE_MAX_FRAMES);
+}
+
+static const test_case_t cases[] = {
+    TEST(no_frames),
+    TEST(single_frame),
+    TEST(high_outlier_is_rejected),
+    TEST(low_outlier_is_rejected),
+    TEST(identical_frames_keep_close_ones),
+    TEST(just_inside_and_outside_the_cut_off),
+    TEST(trimmed_mean_drops_the_quartiles),
+    TEST(even_count_median_rounds),
+    TEST(count_is_capped),
+};
+
+TEST_MAIN(cases)
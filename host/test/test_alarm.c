@@ -0,0 +1,180 @@
+// alarm rules: commands and the hysteresis of every kind
+
+#include "test.h"
+
+#include "alarm.h"
+#include "nvs_flash.h"
+
+#define MINUTE 60000000LL // microseconds
+
+static int64_t now = MINUTE;
+
+static int command(const char *text)
+{
+    return alarm_command(text, strlen(text));
+}
+
+// the state of the only rule after a sample one minute after the last one
+static bool sample(cal_channel_t channel, float value)
+{
+    char json[512];
+
+    now += MINUTE;
+    alarm_sample(channel, value, now);
+
+    alarm_format(json, sizeof(json));
+    return strstr(json, "\"active\":true") != NULL;
+}
+
+static void setup(void)
+{
+    nvs_flash_init();
+    alarm_init();
+    CHECK_INT(command("clear=all"), 0);
+}
+
+static void above(void)
+{
+    CHECK_INT(command("clear=all co2.above=1000:100"), 0);
+
+    CHECK(!sample(CAL_CO2, 900));
+    CHECK(!sample(CAL_CO2, 1000));
+    CHECK(sample(CAL_CO2, 1000.5));
+    CHECK(sample(CAL_CO2, 950));
+    CHECK(sample(CAL_CO2, 900.5));
+    CHECK(!sample(CAL_CO2, 900));
+    CHECK(!sample(CAL_CO2, 950));
+
+    // other channels don't touch it
+    CHECK(!sample(CAL_PM25, 5000));
+}
+
+static void below(void)
+{
+    CHECK_INT(command("clear=all temp.below=5:1"), 0);
+
+    CHECK(!sample(CAL_TEMP, 6));
+    CHECK(!sample(CAL_TEMP, 5));
+    CHECK(sample(CAL_TEMP, 4.9));
+    CHECK(sample(CAL_TEMP, 5.9));
+    CHECK(!sample(CAL_TEMP, 6));
+}
+
+static void without_hysteresis(void)
+{
+    CHECK_INT(command("clear=all pm100.above=50"), 0);
+
+    CHECK(sample(CAL_PM100, 51));
+    CHECK(!sample(CAL_PM100, 50));
+    CHECK(sample(CAL_PM100, 50.1));
+}
+
+static void rise(void)
+{
+    CHECK_INT(command("clear=all pm25.rise=20:5"), 0);
+
+    // rates per minute, the samples are a minute apart
+    CHECK(!sample(CAL_PM25, 10));
+    CHECK(!sample(CAL_PM25, 30));
+    CHECK(sample(CAL_PM25, 51));
+    CHECK(sample(CAL_PM25, 67));
+    CHECK(!sample(CAL_PM25, 82));
+    CHECK(!sample(CAL_PM25, 50));
+}
+
+static void fall(void)
+{
+    CHECK_INT(command("clear=all pres.fall=2:1"), 0);
+
+    CHECK(!sample(CAL_PRES, 760));
+    CHECK(!sample(CAL_PRES, 758));
+    CHECK(sample(CAL_PRES, 755.5));
+    CHECK(sample(CAL_PRES, 754));
+    CHECK(!sample(CAL_PRES, 753));
+    CHECK(!sample(CAL_PRES, 770));
+}
+
+static void rate_needs_time_between_samples(void)
+{
+    char json[512];
+
+    CHECK_INT(command("clear=all co2.rise=100"), 0);
+    CHECK(!sample(CAL_CO2, 400));
+    CHECK(sample(CAL_CO2, 600));
+
+    // a sample at the same time has no rate, the state stays
+    alarm_sample(CAL_CO2, 600, now);
+    alarm_format(json, sizeof(json));
+    CHECK(strstr(json, "\"active\":true") != NULL);
+}
+
+static void replaced_rule_starts_over(void)
+{
+    CHECK_INT(command("clear=all co2.above=1000:100"), 0);
+    CHECK(sample(CAL_CO2, 1200));
+
+    CHECK_INT(command("co2.above=1500:100"), 0);
+    CHECK(!sample(CAL_CO2, 1200));
+    CHECK(sample(CAL_CO2, 1600));
+
+    // removed
+    CHECK_INT(command("co2.above="), 0);
+    CHECK(!sample(CAL_CO2, 1600));
+}
+
+static void bad_rules_are_rejected(void)
+{
+    char json[512];
+
+    CHECK_INT(command("clear=all"), 0);
+    CHECK_INT(command("pm25.rise=0"), 1);
+    CHECK_INT(command("pm25.fall=-3"), 1);
+    CHECK_INT(command("pm25.above=10:-1"), 1);
+    CHECK_INT(command("pm25.above=10:x"), 1);
+    CHECK_INT(command("pm25.above=inf"), 1);
+    CHECK_INT(command("dust.above=10 pm25.sideways=10 pm25"), 3);
+    CHECK_INT(command("clear=dust"), 1);
+
+    alarm_format(json, sizeof(json));
+    CHECK_STR(json, "[]");
+}
+
+static void rules_are_limited(void)
+{
+    CHECK_INT(command("clear=all pm25.above=1 pm25.below=1 pm25.rise=1 pm25.fall=1 "
+                      "pm100.above=1 pm100.below=1 pm100.rise=1 pm100.fall=1"),
+              0);
+    CHECK_INT(command("co2.above=1"), 1);
+
+    // replacing one still works
+    CHECK_INT(command("pm25.above=2"), 0);
+    CHECK_INT(command("clear=pm100 co2.above=1"), 0);
+}
+
+static void stored_rules_survive_init(void)
+{
+    char json[512];
+
+    CHECK_INT(command("clear=all co2.above=1500:100"), 0);
+    alarm_init();
+
+    alarm_format(json, sizeof(json));
+    CHECK_STR(json, "[{\"channel\":\"co2\",\"rule\":\"above\",\"threshold\":1500,\"hysteresis\":100,"
+                    "\"active\":false}]");
+}
+
+static const test_case_t cases[] = {
+    TEST(setup),
+    TEST(above),
+    TEST(below),
+    TEST(without_hysteresis),
+    TEST(rise),
+    TEST(fall),
+    TEST(rate_needs_time_between_samples),
+    TEST(replaced_rule_starts_over),
+    TEST(bad_rules_are_rejected),
+    TEST(rules_are_limited),
+    TEST(stored_rules_survive_init),
+};
+
+TEST_MAIN(cases)
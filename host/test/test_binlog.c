@@ -0,0 +1,190 @@
+// binlog formatting, readers and the ring wrapping around
+
+#include "test.h"
+
+#include "binlog.h"
+#include "dust_sensor.h"
+
+#define TAG "test"
+
+static int read_all(binlog_reader_t *reader, esp_log_level_t level)
+{
+    binlog_entry_t entry;
+    char text[256];
+    int count = 0;
+
+    while (binlog_read(reader, level, &entry, text, sizeof(text)) >= 0)
+        count++;
+
+    return count;
+}
+
+static void setup(void)
+{
+    binlog_init();
+}
+
+static void formats_like_printf(void)
+{
+    binlog_reader_t reader = {0};
+    binlog_entry_t entry;
+    char text[256];
+    char expected[256];
+    const char *tag = TAG;
+
+    vTaskDelay(1234 / portTICK_PERIOD_MS);
+    binlog_write(ESP_LOG_DEBUG, tag, "%d %u %ld %lld %zu %.2f %5s|%x %c %% %p", -1, 2u, 3L, 4LL, (size_t)5, 6.125,
+                 "ab", 255, 'z', (void *)&reader);
+    snprintf(expected, sizeof(expected), "%d %u %ld %lld %zu %.2f %5s|%x %c %% %p", -1, 2u, 3L, 4LL, (size_t)5,
+             6.125, "ab", 255, 'z', (void *)&reader);
+
+    CHECK_INT(binlog_read(&reader, ESP_LOG_VERBOSE, &entry, text, sizeof(text)), strlen(expected));
+    CHECK_STR(text, expected);
+    CHECK_INT(entry.level, ESP_LOG_DEBUG);
+    CHECK(entry.tag == tag);
+    CHECK_INT(entry.time, 1234);
+    CHECK_INT(reader.missed, 0);
+    CHECK_INT(binlog_read(&reader, ESP_LOG_VERBOSE, &entry, text, sizeof(text)), -1);
+}
+
+static void strings_are_copied_and_cut(void)
+{
+    binlog_reader_t reader = {0};
+    binlog_entry_t entry;
+    char text[256];
+    char name[] = "0123456789012345678901234567890123456789";
+
+    read_all(&reader, ESP_LOG_VERBOSE);
+    binlog_write(ESP_LOG_DEBUG, TAG, "[%s]", name);
+    name[0] = 'X';
+
+    binlog_read(&reader, ESP_LOG_VERBOSE, &entry, text, sizeof(text));
+    CHECK_STR(text, "[01234567890123456789012345678901]");
+}
+
+static void short_buffer_truncates(void)
+{
+    binlog_reader_t reader = {0};
+    binlog_entry_t entry;
+    char text[8];
+
+    read_all(&reader, ESP_LOG_VERBOSE);
+    binlog_write(ESP_LOG_DEBUG, TAG, "value %d of %d", 12345, 67890);
+
+    // the length it would have, like snprintf()
+    CHECK_INT(binlog_read(&reader, ESP_LOG_VERBOSE, &entry, text, sizeof(text)), 20);
+    CHECK_STR(text, "value 1");
+}
+
+static void unsupported_and_large_are_dropped(void)
+{
+    binlog_reader_t reader = {0};
+    binlog_entry_t entry;
+    char text[256];
+    const char *s = "0123456789012345678901234567890123456789";
+
+    read_all(&reader, ESP_LOG_VERBOSE);
+    binlog_write(ESP_LOG_DEBUG, TAG, "%*d", 5, 1);
+    binlog_write(ESP_LOG_DEBUG, TAG, "%s %s %s %s", s, s, s, s);
+    binlog_write(ESP_LOG_DEBUG, TAG, "kept");
+
+    binlog_read(&reader, ESP_LOG_VERBOSE, &entry, text, sizeof(text));
+    CHECK_STR(text, "kept");
+    CHECK_INT(binlog_read(&reader, ESP_LOG_VERBOSE, &entry, text, sizeof(text)), -1);
+}
+
+static void levels_are_filtered(void)
+{
+    binlog_reader_t reader = {0};
+    binlog_entry_t entry;
+    char text[256];
+
+    read_all(&reader, ESP_LOG_VERBOSE);
+    binlog_write(ESP_LOG_VERBOSE, TAG, "verbose");
+    binlog_write(ESP_LOG_DEBUG, TAG, "debug");
+    binlog_write(ESP_LOG_VERBOSE, TAG, "verbose");
+
+    CHECK(binlog_read(&reader, ESP_LOG_DEBUG, &entry, text, sizeof(text)) >= 0);
+    CHECK_STR(text, "debug");
+    CHECK_INT(binlog_read(&reader, ESP_LOG_DEBUG, &entry, text, sizeof(text)), -1);
+    CHECK_INT(reader.missed, 0);
+}
+
+static void slow_reader_misses_the_oldest(void)
+{
+    binlog_reader_t slow = {0};
+    binlog_reader_t other = {0};
+    binlog_entry_t entry;
+    char text[256];
+    int first = -1, last = -1, count = 0;
+
+    read_all(&slow, ESP_LOG_VERBOSE);
+    read_all(&other, ESP_LOG_VERBOSE);
+
+    for (int i = 0; i < 1000; i++)
+        binlog_write(ESP_LOG_DEBUG, TAG, "record %d", i);
+
+    while (binlog_read(&slow, ESP_LOG_VERBOSE, &entry, text, sizeof(text)) >= 0)
+    {
+        int n = atoi(text + 7);
+
+        CHECK(last < 0 || n == last + 1);
+        if (first < 0)
+            first = n;
+        last = n;
+        count++;
+    }
+
+    // the oldest are overwritten, the rest come in order up to the newest
+    CHECK_INT(last, 999);
+    CHECK(first > 0);
+    CHECK_INT(slow.missed, first);
+    CHECK_INT(slow.missed + count, 1000);
+
+    // readers are independent
+    CHECK_INT(read_all(&other, ESP_LOG_VERBOSE), count);
+    CHECK_INT(other.missed, first);
+}
+
+static void reader_keeps_up_across_the_wrap(void)
+{
+    binlog_reader_t reader = {0};
+    binlog_entry_t entry;
+    char text[256];
+    char expected[64];
+    char word[BINLOG_MAX_STRING + 1];
+
+    // catch up, the start of the log is overwritten by now
+    read_all(&reader, ESP_LOG_VERBOSE);
+    reader.missed = 0;
+
+    // records of varying length, so that they straddle the end of the ring at every offset
+    for (int i = 0; i < 2000; i++)
+    {
+        int length = i % BINLOG_MAX_STRING;
+
+        memset(word, 'a' + i % 26, length);
+        word[length] = 0;
+        binlog_write(ESP_LOG_DEBUG, TAG, "%d:%s", i, word);
+        snprintf(expected, sizeof(expected), "%d:%s", i, word);
+
+        CHECK(binlog_read(&reader, ESP_LOG_VERBOSE, &entry, text, sizeof(text)) >= 0);
+        CHECK_STR(text, expected);
+    }
+
+    CHECK_INT(reader.missed, 0);
+    CHECK(reader.position > 4 * BINLOG_BUFFER_SIZE);
+}
+
+static const test_case_t cases[] = {
+    TEST(setup),
+    TEST(formats_like_printf),
+    TEST(strings_are_copied_and_cut),
+    TEST(short_buffer_truncates),
+    TEST(unsupported_and_large_are_dropped),
+    TEST(levels_are_filtered),
+    TEST(slow_reader_misses_the_oldest),
+    TEST(reader_keeps_up_across_the_wrap),
+};
+
+TEST_MAIN(cases)
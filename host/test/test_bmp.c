@@ -0,0 +1,56 @@
+// bmp_init() and bmp_fill_values() against the BMP280 model, before and after the first conversion
+
+#include "test.h"
+
+#include "bmp.h"
+#include "bmp280_sim.h"
+#include "sample.h"
+
+static const double defaults[] = {21.5, 101325};
+static sim_trace_t trace;
+static bmp280_sim_t sim;
+
+static void setup(void)
+{
+    trace_init_constant(&trace, defaults, 2);
+    bmp280_sim_init(&sim, &trace);
+    bmp280_sim_attach(&sim, I2C_NUM_0);
+}
+
+static void init_waits_for_the_first_conversion(void)
+{
+    bmp_values_t values = {0};
+
+    CHECK_INT(bmp_init(0, 0, I2C_NUM_0), ESP_OK);
+
+    CHECK_INT(bmp_fill_values(&values), ESP_OK);
+    CHECK_NEAR(values.temp, 21.5, 0.1);
+    CHECK_NEAR(values.pres, 101325, 10);
+}
+
+static void reset_value_is_not_a_sample(void)
+{
+    bmp_values_t values = {-1, -1};
+
+    // the data registers are back to BMP_RAW_SKIPPED until the next conversion
+    CHECK_INT(bmp280_soft_reset(&bmp), 0);
+    CHECK_INT(bmp280_set_config(&bmp.conf, &bmp), 0);
+    CHECK_INT(bmp280_set_power_mode(BMP280_NORMAL_MODE, &bmp), 0);
+
+    CHECK_INT(bmp_fill_values(&values), ESP_ERR_NOT_FINISHED);
+    CHECK_INT(sample_status_from_err(ESP_ERR_NOT_FINISHED), SAMPLE_TIMEOUT);
+    CHECK_NEAR(values.temp, -1, 0);
+    CHECK_NEAR(values.pres, -1, 0);
+
+    vTaskDelay((bmp280_compute_meas_time(&bmp) * 115 / 100 + 1) / portTICK_PERIOD_MS);
+    CHECK_INT(bmp_fill_values(&values), ESP_OK);
+    CHECK_NEAR(values.pres, 101325, 10);
+}
+
+static const test_case_t cases[] = {
+    TEST(setup),
+    TEST(init_waits_for_the_first_conversion),
+    TEST(reset_value_is_not_a_sample),
+};
+
+TEST_MAIN(cases)
@@ -0,0 +1,185 @@
+// the least-squares fit of calibration pairs and the ranges between breakpoints
+
+#include "test.h"
+
+#include "calibration.h"
+#include "config.h"
+#include "nvs_flash.h"
+
+static int command(const char *text)
+{
+    return calibration_command(text, strlen(text));
+}
+
+static void pair(cal_channel_t channel, float raw, float ref)
+{
+    float corrected;
+
+    calibration_apply(channel, raw, &corrected);
+    CHECK_INT(calibration_add_reference(channel, ref), ESP_OK);
+}
+
+static float apply(cal_channel_t channel, float raw)
+{
+    float corrected;
+
+    calibration_apply(channel, raw, &corrected);
+    return corrected;
+}
+
+static void setup(void)
+{
+    nvs_flash_init();
+    config_init(); // the max ages of raw readings
+    calibration_init();
+
+    // esp_timer_get_time() 0 means no raw reading
+    vTaskDelay(1000 / portTICK_PERIOD_MS);
+}
+
+static void fit_without_pairs(void)
+{
+    cal_fit_t fit = {0};
+    double a = 5, b = 5;
+
+    CHECK(!cal_fit_line(&fit, &a, &b));
+    CHECK_NEAR(a, 5, 0);
+}
+
+static void fit_offset_only(void)
+{
+    cal_fit_t fit = {0};
+    double a, b;
+
+    cal_fit_add(&fit, 10, 12);
+    CHECK(cal_fit_line(&fit, &a, &b));
+    CHECK_NEAR(a, 1, 0);
+    CHECK_NEAR(b, 2, 1e-12);
+
+    // the same raw value again still gives no slope
+    cal_fit_add(&fit, 10, 14);
+    CHECK(cal_fit_line(&fit, &a, &b));
+    CHECK_NEAR(a, 1, 0);
+    CHECK_NEAR(b, 3, 1e-12);
+}
+
+static void fit_exact_line(void)
+{
+    cal_fit_t fit = {0};
+    double a, b;
+
+    for (int raw = 0; raw <= 10; raw++)
+        cal_fit_add(&fit, raw, 2 * raw + 3);
+
+    CHECK(cal_fit_line(&fit, &a, &b));
+    CHECK_NEAR(a, 2, 1e-12);
+    CHECK_NEAR(b, 3, 1e-12);
+}
+
+static void fit_matches_closed_form(void)
+{
+    static const double raw[] = {412, 455, 530, 610, 702, 815, 950, 1100};
+    static const double ref[] = {400, 447, 512, 601, 688, 790, 941, 1075};
+    int n = sizeof(raw) / sizeof(raw[0]);
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    cal_fit_t fit = {0};
+    double a, b;
+
+    for (int i = 0; i < n; i++)
+    {
+        cal_fit_add(&fit, raw[i], ref[i]);
+        sx += raw[i];
+        sy += ref[i];
+        sxx += raw[i] * raw[i];
+        sxy += raw[i] * ref[i];
+    }
+
+    CHECK(cal_fit_line(&fit, &a, &b));
+    CHECK_NEAR(a, (n * sxy - sx * sy) / (n * sxx - sx * sx), 1e-9);
+    CHECK_NEAR(b, (sy - a * sx) / n, 1e-6);
+}
+
+static void uncalibrated_passes_through(void)
+{
+    float corrected = 0;
+
+    CHECK(!calibration_apply(CAL_CO2, 815, &corrected));
+    CHECK_NEAR(corrected, 815, 0);
+
+    CHECK_INT(calibration_add_reference(CAL_TEMP, 21), ESP_ERR_INVALID_STATE);
+    CHECK_INT(calibration_add_reference(CAL_CO2, NAN), ESP_ERR_INVALID_ARG);
+}
+
+static void breaks_are_checked(void)
+{
+    float decreasing[] = {50, 20};
+    float too_many[CAL_MAX_SEGMENTS] = {1, 2, 3, 4};
+
+    CHECK_INT(calibration_set_breaks(CAL_PM25, decreasing, 2), ESP_ERR_INVALID_ARG);
+    CHECK_INT(calibration_set_breaks(CAL_PM25, too_many, CAL_MAX_SEGMENTS), ESP_ERR_INVALID_SIZE);
+    CHECK_INT(command("breaks.pm25=10:x"), 1);
+}
+
+static void ranges_have_their_own_lines(void)
+{
+    float breaks[] = {50};
+
+    CHECK_INT(calibration_set_breaks(CAL_PM25, breaks, 1), ESP_OK);
+
+    pair(CAL_PM25, 10, 20);
+    CHECK_NEAR(apply(CAL_PM25, 30), 40, 1e-4);
+
+    // the upper range has no pairs yet and uses the lower one
+    CHECK_NEAR(apply(CAL_PM25, 80), 90, 1e-4);
+
+    pair(CAL_PM25, 100, 90);
+    CHECK_NEAR(apply(CAL_PM25, 30), 40, 1e-4);
+    CHECK_NEAR(apply(CAL_PM25, 80), 70, 1e-4);
+
+    // a breakpoint belongs to the range above it
+    CHECK_NEAR(apply(CAL_PM25, 50), 40, 1e-4);
+    CHECK_NEAR(apply(CAL_PM25, 49.9), 59.9, 1e-4);
+}
+
+static void nearest_range_with_pairs(void)
+{
+    CHECK_INT(command("breaks.pm100=100:200:300"), 0);
+
+    pair(CAL_PM100, 250, 260);
+    CHECK_NEAR(apply(CAL_PM100, 50), 60, 1e-4);
+    CHECK_NEAR(apply(CAL_PM100, 350), 360, 1e-4);
+
+    pair(CAL_PM100, 150, 140);
+    CHECK_NEAR(apply(CAL_PM100, 50), 40, 1e-4);
+    CHECK_NEAR(apply(CAL_PM100, 350), 360, 1e-4);
+}
+
+static void stored_fits_survive_init(void)
+{
+    calibration_init();
+    CHECK_NEAR(apply(CAL_PM25, 80), 70, 1e-4);
+    CHECK_NEAR(apply(CAL_PM100, 50), 40, 1e-4);
+
+    // new breakpoints drop the pairs
+    CHECK_INT(command("breaks.pm25="), 0);
+    CHECK(!calibration_apply(CAL_PM25, 80, &(float){0}));
+
+    CHECK_INT(command("reset=pm100"), 0);
+    calibration_init();
+    CHECK_NEAR(apply(CAL_PM100, 50), 50, 0);
+}
+
+static const test_case_t cases[] = {
+    TEST(setup),
+    TEST(fit_without_pairs),
+    TEST(fit_offset_only),
+    TEST(fit_exact_line),
+    TEST(fit_matches_closed_form),
+    TEST(uncalibrated_passes_through),
+    TEST(breaks_are_checked),
+    TEST(ranges_have_their_own_lines),
+    TEST(nearest_range_with_pairs),
+    TEST(stored_fits_survive_init),
+};
+
+TEST_MAIN(cases)
@@ -0,0 +1,221 @@
+// coap_payload(), decoded back from CBOR
+
+#include "test.h"
+
+#include "esp_timer.h"
+#include "nvs_flash.h"
+
+#include "dust_sensor.h"
+
+#define KEYS (COAP_KEY_PRES + 1)
+
+typedef struct
+{
+    int pairs;
+    bool present[KEYS];
+    int64_t value[KEYS];
+    char device[64];
+} payload_t;
+
+// CBOR head at `*pos`, returns the major type or -1
+static int cbor_head(const uint8_t *data, size_t length, size_t *pos, uint32_t *value)
+{
+    uint8_t head;
+    int extra;
+
+    if (*pos >= length)
+        return -1;
+    head = data[(*pos)++];
+
+    switch (head & 0x1f)
+    {
+    case 24:
+        extra = 1;
+        break;
+    case 25:
+        extra = 2;
+        break;
+    case 26:
+        extra = 4;
+        break;
+    default:
+        if ((head & 0x1f) > 23)
+            return -1;
+        *value = head & 0x1f;
+        return head >> 5;
+    }
+
+    if (length - *pos < (size_t)extra)
+        return -1;
+    for (*value = 0; extra; extra--)
+        *value = *value << 8 | data[(*pos)++];
+
+    return head >> 5;
+}
+
+// the map of the payload, false if it is not one of unique integer keys to integers or text
+static bool decode(const uint8_t *data, size_t length, payload_t *payload)
+{
+    size_t pos = 0;
+    uint32_t pairs, key, value;
+
+    memset(payload, 0, sizeof(*payload));
+
+    if (cbor_head(data, length, &pos, &pairs) != 5)
+        return false;
+    payload->pairs = pairs;
+
+    for (uint32_t i = 0; i < pairs; i++)
+    {
+        int major;
+
+        if (cbor_head(data, length, &pos, &key) != 0 || key >= KEYS || payload->present[key])
+            return false;
+        payload->present[key] = true;
+
+        major = cbor_head(data, length, &pos, &value);
+        if (major == 0)
+            payload->value[key] = value;
+        else if (major == 1)
+            payload->value[key] = -1 - (int64_t)value;
+        else if (major == 3 && value < sizeof(payload->device) && length - pos >= value)
+        {
+            memcpy(payload->device, data + pos, value);
+            pos += value;
+        }
+        else
+            return false;
+    }
+
+    // nothing after the map
+    return pos == length;
+}
+
+static void set_samples(bool valid, uint8_t aqi_hours)
+{
+    sample_status_t status = valid ? SAMPLE_VALID : SAMPLE_TIMEOUT;
+    int64_t now = esp_timer_get_time();
+
+    dust_values.pm25 = 12;
+    dust_values.pm100 = 300;
+    dust_values.aqi = 57;
+    dust_values.aqi_hours = aqi_hours;
+    dust_values.status = status;
+    dust_values.timestamp = now;
+
+    co2_values.ppm = 1234;
+    co2_values.status = status;
+    co2_values.timestamp = now;
+
+    bmp_values.temp = -5.26;
+    bmp_values.pres = 101325.4;
+    bmp_values.status = status;
+    bmp_values.timestamp = now;
+}
+
+static void setup(void)
+{
+    nvs_flash_init();
+    config_init(); // the max ages of the samples
+    dust_values.lock = xSemaphoreCreateMutex();
+    co2_values.lock = xSemaphoreCreateMutex();
+    bmp_values.lock = xSemaphoreCreateMutex();
+
+    vTaskDelay(5000 / portTICK_PERIOD_MS);
+}
+
+static void without_samples(void)
+{
+    uint8_t buffer[128];
+    payload_t payload;
+    size_t length;
+
+    set_samples(false, 24);
+    length = coap_payload(buffer, sizeof(buffer), 7);
+
+    CHECK(decode(buffer, length, &payload));
+    CHECK_INT(payload.pairs, 4);
+    CHECK_INT(payload.value[COAP_KEY_VERSION], COAP_PAYLOAD_VERSION);
+    CHECK_STR(payload.device, MQTT_TOPIC_PREFIX);
+    CHECK_INT(payload.value[COAP_KEY_SEQ], 7);
+    CHECK_INT(payload.value[COAP_KEY_UPTIME], 5);
+    CHECK(!payload.present[COAP_KEY_PM25]);
+}
+
+static void all_samples(void)
+{
+    uint8_t buffer[128];
+    payload_t payload;
+    size_t length;
+
+    set_samples(true, AQI_MIN_HOURS);
+    length = coap_payload(buffer, sizeof(buffer), 70000);
+
+    CHECK(decode(buffer, length, &payload));
+    CHECK_INT(payload.pairs, 10);
+    CHECK_INT(payload.value[COAP_KEY_SEQ], 70000);
+    CHECK_INT(payload.value[COAP_KEY_PM25], 12);
+    CHECK_INT(payload.value[COAP_KEY_PM100], 300);
+    CHECK_INT(payload.value[COAP_KEY_AQI], 57);
+    CHECK_INT(payload.value[COAP_KEY_CO2], 1234);
+    CHECK_INT(payload.value[COAP_KEY_TEMP], -53);
+    CHECK_INT(payload.value[COAP_KEY_PRES], 101325);
+}
+
+static void provisional_aqi_is_left_out(void)
+{
+    uint8_t buffer[128];
+    payload_t payload;
+    size_t length;
+
+    set_samples(true, AQI_MIN_HOURS - 1);
+    length = coap_payload(buffer, sizeof(buffer), 1);
+
+    CHECK(decode(buffer, length, &payload));
+    CHECK_INT(payload.pairs, 9);
+    CHECK(payload.present[COAP_KEY_PM25]);
+    CHECK(!payload.present[COAP_KEY_AQI]);
+}
+
+static void stale_samples_are_left_out(void)
+{
+    uint8_t buffer[128];
+    payload_t payload;
+    size_t length;
+
+    set_samples(true, 24);
+    vTaskDelay((CO2_MAX_AGE + 1000) / portTICK_PERIOD_MS);
+    dust_values.timestamp = esp_timer_get_time();
+    bmp_values.timestamp = esp_timer_get_time();
+
+    length = coap_payload(buffer, sizeof(buffer), 1);
+    CHECK(decode(buffer, length, &payload));
+    CHECK(!payload.present[COAP_KEY_CO2]);
+    CHECK(payload.present[COAP_KEY_PRES]);
+}
+
+static void too_small_buffer(void)
+{
+    uint8_t buffer[128];
+    size_t length;
+
+    set_samples(true, 24);
+    length = coap_payload(buffer, sizeof(buffer), 1);
+    CHECK(length > 0);
+
+    memset(buffer, 0xAA, sizeof(buffer));
+    CHECK_INT(coap_payload(buffer, length - 1, 1), 0);
+    CHECK_INT(buffer[length - 1], 0xAA);
+    CHECK_INT(coap_payload(buffer, length, 1), length);
+}
+
+static const test_case_t cases[] = {
+    TEST(setup),
+    TEST(without_samples),
+    TEST(all_samples),
+    TEST(provisional_aqi_is_left_out),
+    TEST(stale_samples_are_left_out),
+    TEST(too_small_buffer),
+};
+
+TEST_MAIN(cases)
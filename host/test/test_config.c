@@ -0,0 +1,132 @@
+// config_command(): parsing, range checks, storage and the wake bits
+
+#include "test.h"
+
+#include "config.h"
+#include "dust_sensor.h"
+#include "nvs_flash.h"
+
+static int command(const char *text)
+{
+    return config_command(text, strlen(text));
+}
+
+static void setup(void)
+{
+    nvs_flash_init();
+    eg_app_status = xEventGroupCreate();
+    config_init();
+}
+
+static void defaults_without_storage(void)
+{
+    CHECK_INT(config_get_int(CONFIG_DUST_TASK_DELAY), DUST_TASK_DELAY);
+    CHECK_INT(config_get_int(CONFIG_MQTT_DELAY), MQTT_DELAY);
+    CHECK_NEAR(config_get_float(CONFIG_TEMP_K_A), TEMP_K_A, 1e-9);
+}
+
+static void range_checks(void)
+{
+    CHECK_INT(command("dust_delay=999"), 1);
+    CHECK_INT(command("dust_delay=1000"), 0);
+    CHECK_INT(config_get_int(CONFIG_DUST_TASK_DELAY), 1000);
+    CHECK_INT(command("dust_delay=86400001"), 1);
+    CHECK_INT(config_get_int(CONFIG_DUST_TASK_DELAY), 1000);
+
+    CHECK_INT(command("avg_frames=0"), 1);
+    CHECK_INT(command("avg_frames=17"), 1);
+    CHECK_INT(command("avg_frames=16"), 0);
+    CHECK_INT(config_get_int(CONFIG_DUST_AVG_FRAMES), AGGREGATE_MAX_FRAMES);
+
+    CHECK_INT(command("temp_k_a=0.05"), 1);
+    CHECK_INT(command("temp_k_a=0.5"), 0);
+    CHECK_NEAR(config_get_float(CONFIG_TEMP_K_A), 0.5, 1e-9);
+    CHECK_INT(command("altitude=-500"), 0);
+    CHECK_INT(command("altitude=nan"), 1);
+    CHECK_NEAR(config_get_float(CONFIG_SITE_ALTITUDE), -500, 1e-9);
+}
+
+static void malformed_pairs(void)
+{
+    CHECK_INT(command("dust_delay=10x"), 1);
+    CHECK_INT(command("dust_delay="), 1);
+    CHECK_INT(command("dust_delay"), 1);
+    CHECK_INT(command("no_such_setting=1"), 1);
+    CHECK_INT(command("temp_k_b=1.5e"), 1);
+    CHECK_INT(command(""), 0);
+}
+
+static void pairs_apply_on_their_own(void)
+{
+    CHECK_INT(command("co2_delay=5000, bmp_delay=1,mqtt_delay=60000\n\tcoap_confirm=2"), 2);
+    CHECK_INT(config_get_int(CONFIG_CO2_TASK_DELAY), 5000);
+    CHECK_INT(config_get_int(CONFIG_MQTT_DELAY), 60000);
+    CHECK_INT(config_get_int(CONFIG_BMP_TASK_DELAY), BMP_TASK_DELAY);
+}
+
+static void too_long_is_rejected_whole(void)
+{
+    char text[300];
+
+    memset(text, ' ', sizeof(text));
+    memcpy(text, "co2_delay=7000", 14);
+    text[sizeof(text) - 1] = 0;
+
+    CHECK_INT(command(text), 1);
+    CHECK_INT(config_get_int(CONFIG_CO2_TASK_DELAY), 5000);
+}
+
+static void changes_wake_the_task(void)
+{
+    xEventGroupClearBits(eg_app_status, 0xff);
+    CHECK_INT(command("dust_delay=2000"), 0);
+    CHECK_INT(xEventGroupGetBits(eg_app_status) & 0xff, CONFIG_DUST_BIT);
+
+    // the same value again is not a change
+    xEventGroupClearBits(eg_app_status, 0xff);
+    CHECK_INT(command("dust_delay=2000"), 0);
+    CHECK_INT(xEventGroupGetBits(eg_app_status) & 0xff, 0);
+
+    // settings without a period wake nobody
+    CHECK_INT(command("warmup_frames=3"), 0);
+    CHECK_INT(xEventGroupGetBits(eg_app_status) & 0xff, 0);
+}
+
+static void stored_values_survive_init(void)
+{
+    config_init();
+    CHECK_INT(config_get_int(CONFIG_DUST_TASK_DELAY), 2000);
+    CHECK_INT(config_get_int(CONFIG_MQTT_DELAY), 60000);
+    CHECK_NEAR(config_get_float(CONFIG_TEMP_K_A), 0.5, 1e-9);
+}
+
+static void reset_restores_defaults(void)
+{
+    char json[1024];
+
+    xEventGroupClearBits(eg_app_status, 0xff);
+    CHECK_INT(command("reset"), 0);
+    CHECK_INT(config_get_int(CONFIG_DUST_TASK_DELAY), DUST_TASK_DELAY);
+    CHECK(xEventGroupGetBits(eg_app_status) & CONFIG_MQTT_BIT);
+
+    config_init();
+    CHECK_INT(config_get_int(CONFIG_MQTT_DELAY), MQTT_DELAY);
+
+    CHECK(config_format(json, sizeof(json)) < (int)sizeof(json));
+    CHECK(strstr(json, "\"avg_frames\":") != NULL);
+    CHECK_INT(json[0], '{');
+}
+
+static const test_case_t cases[] = {
+    TEST(setup),
+    TEST(defaults_without_storage),
+    TEST(range_checks),
+    TEST(malformed_pairs),
+    TEST(pairs_apply_on_their_own),
+    TEST(too_long_is_rejected_whole),
+    TEST(changes_wake_the_task),
+    TEST(stored_values_survive_init),
+    TEST(reset_restores_defaults),
+};
+
+TEST_MAIN(cases)
@@ -0,0 +1,173 @@
+// pms_decode() and mhz19_decode() on whole, split, noisy and corrupted frames
+
+#include "test.h"
+
+#include "mhz19.h"
+#include "pms7003.h"
+
+static void pms_frame(uint8_t *frame, uint16_t pm25, uint16_t pm100)
+{
+    uint16_t checksum;
+
+    memset(frame, 0, PMS_FRAME_LEN);
+    frame[0] = 0x42;
+    frame[1] = 0x4D;
+    frame[3] = PMS_FRAME_LEN - 4;
+    frame[12] = pm25 >> 8;
+    frame[13] = pm25 & 0xFF;
+    frame[14] = pm100 >> 8;
+    frame[15] = pm100 & 0xFF;
+
+    checksum = pms_checksum(frame, 30);
+    frame[30] = checksum >> 8;
+    frame[31] = checksum & 0xFF;
+}
+
+static void mhz19_frame(uint8_t *frame, uint16_t ppm)
+{
+    memset(frame, 0, MHZ19_FRAME_LEN);
+    frame[0] = 0xFF;
+    frame[1] = 0x86;
+    frame[2] = ppm >> 8;
+    frame[3] = ppm & 0xFF;
+    frame[8] = mhz_checksum(frame);
+}
+
+static void pms_whole_frame(void)
+{
+    uint8_t frame[PMS_FRAME_LEN];
+    pms_values_t values = {0};
+    int start = -1;
+
+    pms_frame(frame, 12, 345);
+    CHECK_INT(pms_decode(frame, sizeof(frame), &values, &start), ESP_OK);
+    CHECK_INT(start, 0);
+    CHECK_INT(values.pm25, 12);
+    CHECK_INT(values.pm100, 345);
+}
+
+static void pms_skips_noise_and_acks(void)
+{
+    // an answer to the passive mode command, then noise with a stray 0x42 0x4D
+    uint8_t data[64] = {0x42, 0x4D, 0x00, 0x04, 0xE1, 0x00, 0x01, 0x74, 0x11, 0x42, 0x4D, 0x00, 0x99};
+    pms_values_t values = {0};
+    int start = -1;
+
+    pms_frame(data + 13, 250, 500);
+    CHECK_INT(pms_decode(data, 13 + PMS_FRAME_LEN, &values, &start), ESP_OK);
+    CHECK_INT(start, 13);
+    CHECK_INT(values.pm25, 250);
+    CHECK_INT(values.pm100, 500);
+}
+
+static void pms_split_frame(void)
+{
+    uint8_t data[3 + PMS_FRAME_LEN] = {0x00, 0x4D, 0xFF};
+    pms_values_t values = {0};
+    int start;
+
+    pms_frame(data + 3, 1, 2);
+
+    // every prefix is incomplete and keeps the frame start
+    for (int length = 4; length < (int)sizeof(data); length++)
+    {
+        start = -1;
+        CHECK_INT(pms_decode(data, length, &values, &start), ESP_ERR_INVALID_SIZE);
+        CHECK_INT(start, 3);
+    }
+    CHECK_INT(values.pm25, 0);
+
+    CHECK_INT(pms_decode(data, sizeof(data), &values, &start), ESP_OK);
+    CHECK_INT(values.pm25, 1);
+}
+
+static void pms_noise_only(void)
+{
+    uint8_t noise[] = {0x01, 0x4D, 0x42, 0x00, 0x42};
+    pms_values_t values = {0};
+    int start;
+
+    CHECK_INT(pms_decode(noise, 0, &values, &start), ESP_ERR_INVALID_SIZE);
+    CHECK_INT(start, 0);
+
+    // the last 0x42 may begin a frame
+    CHECK_INT(pms_decode(noise, sizeof(noise), &values, &start), ESP_ERR_INVALID_SIZE);
+    CHECK_INT(start, 4);
+
+    CHECK_INT(pms_decode(noise, sizeof(noise) - 1, &values, &start), ESP_ERR_INVALID_SIZE);
+    CHECK_INT(start, 4);
+}
+
+static void pms_bad_checksum(void)
+{
+    uint8_t frame[PMS_FRAME_LEN];
+    pms_values_t values = {0};
+    int start;
+
+    pms_frame(frame, 12, 345);
+    frame[13] ^= 0x04;
+    CHECK_INT(pms_decode(frame, sizeof(frame), &values, &start), ESP_ERR_INVALID_CRC);
+    CHECK_INT(start, 0);
+    CHECK_INT(values.pm25, 0);
+    CHECK_INT(values.pm100, 0);
+}
+
+static void mhz19_whole_frame(void)
+{
+    uint8_t frame[MHZ19_FRAME_LEN];
+    mhz19_values_t values = {0};
+    int start = -1;
+
+    mhz19_frame(frame, 1234);
+    CHECK_INT(mhz19_decode(frame, sizeof(frame), &values, &start), ESP_OK);
+    CHECK_INT(start, 0);
+    CHECK_INT(values.ppm, 1234);
+}
+
+static void mhz19_split_frame(void)
+{
+    uint8_t data[2 + MHZ19_FRAME_LEN] = {0x86, 0xFF};
+    mhz19_values_t values = {0};
+    int start;
+
+    mhz19_frame(data + 2, 415);
+
+    for (int length = 3; length < (int)sizeof(data); length++)
+    {
+        start = -1;
+        CHECK_INT(mhz19_decode(data, length, &values, &start), ESP_ERR_INVALID_SIZE);
+        CHECK_INT(start, 2);
+    }
+
+    // the 0xFF before the frame isn't followed by 0x86
+    CHECK_INT(mhz19_decode(data, 2, &values, &start), ESP_ERR_INVALID_SIZE);
+    CHECK_INT(start, 1);
+
+    CHECK_INT(mhz19_decode(data, sizeof(data), &values, &start), ESP_OK);
+    CHECK_INT(values.ppm, 415);
+}
+
+static void mhz19_bad_checksum(void)
+{
+    uint8_t frame[MHZ19_FRAME_LEN];
+    mhz19_values_t values = {0};
+    int start;
+
+    mhz19_frame(frame, 800);
+    frame[8]++;
+    CHECK_INT(mhz19_decode(frame, sizeof(frame), &values, &start), ESP_ERR_INVALID_CRC);
+    CHECK_INT(values.ppm, 0);
+}
+
+static const test_case_t cases[] = {
+    TEST(pms_whole_frame),
+    TEST(pms_skips_noise_and_acks),
+    TEST(pms_split_frame),
+    TEST(pms_noise_only),
+    TEST(pms_bad_checksum),
+    TEST(mhz19_whole_frame),
+    TEST(mhz19_split_frame),
+    TEST(mhz19_bad_checksum),
+};
+
+TEST_MAIN(cases)
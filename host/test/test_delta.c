@@ -0,0 +1,328 @@
+// delta_feed() on patches split at every byte and on hostile ones
+
+#include "test.h"
+
+#include "delta.h"
+
+#define OLD_SIZE 2000
+#define NEW_SIZE (1500 + 5 + 300)
+
+typedef struct
+{
+    uint8_t data[4096];
+    size_t length;
+} patch_t;
+
+typedef struct
+{
+    const uint8_t *old;
+    uint32_t old_size;
+    uint8_t new[4096];
+    uint32_t new_length;
+    int headers;
+    esp_err_t header_error;
+} image_t;
+
+static uint8_t old_image[OLD_SIZE];
+static uint8_t new_image[NEW_SIZE];
+
+static esp_err_t image_header(void *ctx, const delta_header_t *header)
+{
+    image_t *image = ctx;
+
+    image->headers++;
+    return image->header_error;
+}
+
+static esp_err_t image_read_old(void *ctx, uint32_t offset, uint8_t *data, size_t length)
+{
+    image_t *image = ctx;
+
+    // the decoder checks the bounds before it reads
+    CHECK(offset <= image->old_size && length <= image->old_size - offset);
+    if (offset > image->old_size || length > image->old_size - offset)
+        return ESP_FAIL;
+
+    memcpy(data, image->old + offset, length);
+    return ESP_OK;
+}
+
+static esp_err_t image_write_new(void *ctx, const uint8_t *data, size_t length)
+{
+    image_t *image = ctx;
+
+    if (length > sizeof(image->new) - image->new_length)
+        return ESP_FAIL;
+
+    memcpy(image->new + image->new_length, data, length);
+    image->new_length += length;
+    return ESP_OK;
+}
+
+static const delta_ops_t ops = {image_header, image_read_old, image_write_new};
+
+static void put_bytes(patch_t *patch, const void *data, size_t length)
+{
+    memcpy(patch->data + patch->length, data, length);
+    patch->length += length;
+}
+
+static void put_u32(patch_t *patch, uint32_t value)
+{
+    uint8_t data[4] = {value, value >> 8, value >> 16, value >> 24};
+
+    put_bytes(patch, data, 4);
+}
+
+static void put_varint(patch_t *patch, uint32_t value)
+{
+    do
+    {
+        uint8_t byte = value & 0x7f;
+
+        value >>= 7;
+        patch->data[patch->length++] = byte | (value ? 0x80 : 0);
+    } while (value);
+}
+
+static void put_svarint(patch_t *patch, int32_t value)
+{
+    put_varint(patch, ((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+}
+
+static void put_header(patch_t *patch, uint32_t old_size, uint32_t new_size)
+{
+    uint8_t sha256[32] = {0};
+
+    patch->length = 0;
+    put_bytes(patch, DELTA_MAGIC, 4);
+    put_u32(patch, old_size);
+    put_u32(patch, new_size);
+    put_bytes(patch, sha256, 32);
+    put_bytes(patch, sha256, 32);
+}
+
+/*
+old[0, 600), old[600, 610) + 1, old[610, 1500), "HELLO", then 100 bytes
+back: old[1400, 1700).
+*/
+static void make_patch(patch_t *patch)
+{
+    put_header(patch, OLD_SIZE, NEW_SIZE);
+
+    put_varint(patch, 1500);
+    put_varint(patch, 600);
+    put_varint(patch, 10);
+    for (int i = 0; i < 10; i++)
+        patch->data[patch->length++] = 1;
+    put_varint(patch, 890);
+    put_varint(patch, 5);
+    put_bytes(patch, "HELLO", 5);
+    put_svarint(patch, -100);
+
+    put_varint(patch, 300);
+    put_varint(patch, 300);
+    put_varint(patch, 0);
+    put_svarint(patch, 0);
+}
+
+static void image_init(image_t *image, delta_t *delta)
+{
+    memset(image, 0, sizeof(*image));
+    image->old = old_image;
+    image->old_size = OLD_SIZE;
+    delta_init(delta, &ops, image);
+}
+
+static void setup(void)
+{
+    for (int i = 0; i < OLD_SIZE; i++)
+        old_image[i] = i * 7;
+
+    memcpy(new_image, old_image, 1500);
+    for (int i = 600; i < 610; i++)
+        new_image[i]++;
+    memcpy(new_image + 1500, "HELLO", 5);
+    memcpy(new_image + 1505, old_image + 1400, 300);
+}
+
+static void whole_patch(void)
+{
+    static patch_t patch;
+    static image_t image;
+    static delta_t delta;
+
+    make_patch(&patch);
+    image_init(&image, &delta);
+
+    CHECK_INT(delta_feed(&delta, patch.data, patch.length), ESP_OK);
+    CHECK_INT(delta_finish(&delta), ESP_OK);
+    CHECK_INT(image.headers, 1);
+    CHECK_INT(delta.header.old_size, OLD_SIZE);
+    CHECK_INT(image.new_length, NEW_SIZE);
+    CHECK(!memcmp(image.new, new_image, NEW_SIZE));
+}
+
+static void split_at_every_byte(void)
+{
+    static patch_t patch;
+    static image_t image;
+    static delta_t delta;
+
+    make_patch(&patch);
+
+    for (size_t split = 0; split <= patch.length; split++)
+    {
+        image_init(&image, &delta);
+        CHECK_INT(delta_feed(&delta, patch.data, split), ESP_OK);
+        CHECK_INT(delta_feed(&delta, patch.data + split, patch.length - split), ESP_OK);
+        CHECK_INT(delta_finish(&delta), ESP_OK);
+        CHECK(image.new_length == NEW_SIZE && !memcmp(image.new, new_image, NEW_SIZE));
+    }
+
+    // and one byte at a time
+    image_init(&image, &delta);
+    for (size_t i = 0; i < patch.length; i++)
+        CHECK_INT(delta_feed(&delta, patch.data + i, 1), ESP_OK);
+    CHECK_INT(delta_finish(&delta), ESP_OK);
+    CHECK(image.new_length == NEW_SIZE && !memcmp(image.new, new_image, NEW_SIZE));
+}
+
+static void full_image_against_nothing(void)
+{
+    static patch_t patch;
+    static image_t image;
+    static delta_t delta;
+
+    put_header(&patch, 0, 5);
+    put_varint(&patch, 0);
+    put_varint(&patch, 5);
+    put_bytes(&patch, "HELLO", 5);
+    put_svarint(&patch, 0);
+
+    image_init(&image, &delta);
+    CHECK_INT(delta_feed(&delta, patch.data, patch.length), ESP_OK);
+    CHECK_INT(delta_finish(&delta), ESP_OK);
+    CHECK(image.new_length == 5 && !memcmp(image.new, "HELLO", 5));
+}
+
+// feeds `patch` and expects `expected` from delta_feed(), then the same from delta_finish()
+static void check_rejected(patch_t *patch, esp_err_t expected)
+{
+    static image_t image;
+    static delta_t delta;
+
+    image_init(&image, &delta);
+    CHECK_INT(delta_feed(&delta, patch->data, patch->length), expected);
+    CHECK_INT(delta_feed(&delta, patch->data, 1), expected);
+    CHECK_INT(delta_finish(&delta), expected);
+    CHECK(image.new_length <= delta.header.new_size);
+}
+
+static void hostile_patches(void)
+{
+    static patch_t patch;
+    static image_t image;
+    static delta_t delta;
+
+    // wrong magic
+    make_patch(&patch);
+    patch.data[3] = '0';
+    check_rejected(&patch, ESP_ERR_INVALID_RESPONSE);
+
+    // a copy longer than the new image
+    put_header(&patch, OLD_SIZE, 10);
+    put_varint(&patch, 11);
+    check_rejected(&patch, ESP_ERR_INVALID_SIZE);
+
+    // a skip past the end of the old image
+    put_header(&patch, 100, 200);
+    put_varint(&patch, 200);
+    put_varint(&patch, 200);
+    check_rejected(&patch, ESP_ERR_INVALID_SIZE);
+
+    // differences past the end of the old image
+    put_header(&patch, 100, 200);
+    put_varint(&patch, 200);
+    put_varint(&patch, 90);
+    put_varint(&patch, 20);
+    for (int i = 0; i < 20; i++)
+        patch.data[patch.length++] = 0;
+    check_rejected(&patch, ESP_ERR_INVALID_SIZE);
+
+    // an insert longer than what is left of the new image
+    put_header(&patch, OLD_SIZE, 10);
+    put_varint(&patch, 5);
+    put_varint(&patch, 5);
+    put_varint(&patch, 6);
+    check_rejected(&patch, ESP_ERR_INVALID_SIZE);
+
+    // a seek before the start of the old image
+    put_header(&patch, OLD_SIZE, 10);
+    put_varint(&patch, 5);
+    put_varint(&patch, 5);
+    put_varint(&patch, 0);
+    put_svarint(&patch, -6);
+    check_rejected(&patch, ESP_ERR_INVALID_SIZE);
+
+    // a varint longer than 5 bytes
+    put_header(&patch, OLD_SIZE, 10);
+    for (int i = 0; i < 6; i++)
+        patch.data[patch.length++] = 0x80;
+    patch.data[patch.length++] = 0;
+    check_rejected(&patch, ESP_ERR_INVALID_RESPONSE);
+
+    // bytes after the end
+    make_patch(&patch);
+    patch.data[patch.length++] = 0;
+    check_rejected(&patch, ESP_ERR_INVALID_RESPONSE);
+
+    // cut short
+    make_patch(&patch);
+    image_init(&image, &delta);
+    CHECK_INT(delta_feed(&delta, patch.data, patch.length - 1), ESP_OK);
+    CHECK_INT(delta_finish(&delta), ESP_ERR_INVALID_SIZE);
+
+    // refused by the header callback
+    image_init(&image, &delta);
+    image.header_error = ESP_ERR_INVALID_VERSION;
+    CHECK_INT(delta_feed(&delta, patch.data, patch.length), ESP_ERR_INVALID_VERSION);
+    CHECK_INT(image.new_length, 0);
+}
+
+static void random_records_stay_in_bounds(void)
+{
+    static patch_t patch;
+    static image_t image;
+    static delta_t delta;
+    uint32_t seed = 1;
+
+    for (int run = 0; run < 2000; run++)
+    {
+        put_header(&patch, 1 + run % OLD_SIZE, run % 3000);
+        for (int i = 0; i < 200; i++)
+        {
+            seed = seed * 1103515245 + 12345;
+            patch.data[patch.length++] = seed >> 16;
+        }
+
+        // image_read_old() checks the reads, the writes must fit in the new image
+        image_init(&image, &delta);
+        image.old_size = 1 + run % OLD_SIZE;
+        delta_feed(&delta, patch.data, patch.length);
+        CHECK(image.new_length <= run % 3000);
+        if (delta_finish(&delta) == ESP_OK)
+            CHECK_INT(image.new_length, run % 3000);
+    }
+}
+
+static const test_case_t cases[] = {
+    TEST(setup),
+    TEST(whole_patch),
+    TEST(split_at_every_byte),
+    TEST(full_image_against_nothing),
+    TEST(hostile_patches),
+    TEST(random_records_stay_in_bounds),
+};
+
+TEST_MAIN(cases)
@@ -0,0 +1,149 @@
+// rolling averages, AQI/CAQI, sea level pressure and the ventilation rate
+
+#include "test.h"
+
+#include "derived.h"
+
+static void rolling_average_empty_is_nan(void)
+{
+    rolling_average_t avg = {0};
+
+    CHECK(isnan(rolling_average_1h(&avg)));
+    CHECK(isnan(rolling_average_24h(&avg)));
+    CHECK_INT(rolling_average_24h_hours(&avg), 0);
+}
+
+static void rolling_average_expires_old_buckets(void)
+{
+    rolling_average_t avg = {0};
+
+    rolling_average_update(&avg, 10, 0);
+    rolling_average_update(&avg, 20, 30);
+    CHECK_NEAR(rolling_average_1h(&avg), 15, 1e-6);
+
+    // minute 0 leaves the hour, hour 0 is still in the day
+    rolling_average_update(&avg, 60, 3600);
+    CHECK_NEAR(rolling_average_1h(&avg), 60, 1e-6);
+    CHECK_NEAR(rolling_average_24h(&avg), 30, 1e-6);
+
+    // hour 0 leaves the day
+    rolling_average_update(&avg, 40, 24 * 3600);
+    CHECK_NEAR(rolling_average_24h(&avg), 50, 1e-6);
+}
+
+static void rolling_average_survives_long_gaps(void)
+{
+    rolling_average_t avg = {0};
+
+    rolling_average_update(&avg, 100, 1000);
+    rolling_average_update(&avg, 5, 1000 + 10 * 24 * 3600);
+    CHECK_NEAR(rolling_average_1h(&avg), 5, 1e-6);
+    CHECK_NEAR(rolling_average_24h(&avg), 5, 1e-6);
+    CHECK_INT(rolling_average_24h_hours(&avg), 1);
+}
+
+static void rolling_average_counts_covered_hours(void)
+{
+    rolling_average_t avg = {0};
+    uint32_t now = 0;
+
+    for (int i = 0; i < AQI_MIN_HOURS - 1; i++, now += 3600)
+        rolling_average_update(&avg, 1, now);
+    CHECK_INT(rolling_average_24h_hours(&avg), AQI_MIN_HOURS - 1);
+
+    // a gap of 4 hours, then enough
+    now += 4 * 3600;
+    rolling_average_update(&avg, 1, now);
+    CHECK_INT(rolling_average_24h_hours(&avg), AQI_MIN_HOURS);
+
+    // a day later only the last hours are left
+    for (int i = 0; i < 3; i++)
+        rolling_average_update(&avg, 1, now + 24 * 3600 + i * 3600);
+    CHECK_INT(rolling_average_24h_hours(&avg), 3);
+}
+
+static void aqi_breakpoints(void)
+{
+    CHECK_INT(aqi_us_epa(0, NAN), 0);
+    CHECK_INT(aqi_us_epa(9.0, NAN), 50);
+    CHECK_INT(aqi_us_epa(9.09, NAN), 50); // truncated to 9.0
+    CHECK_INT(aqi_us_epa(9.1, NAN), 51);
+    CHECK_INT(aqi_us_epa(12.0, NAN), 56);
+    CHECK_INT(aqi_us_epa(35.4, NAN), 100);
+    CHECK_INT(aqi_us_epa(35.5, NAN), 101);
+    CHECK_INT(aqi_us_epa(325.4, NAN), 500);
+
+    CHECK_INT(aqi_us_epa(NAN, 54), 50);
+    CHECK_INT(aqi_us_epa(NAN, 54.9), 50);
+    CHECK_INT(aqi_us_epa(NAN, 55), 51);
+    CHECK_INT(aqi_us_epa(NAN, 100), 73);
+
+    // the larger sub-index wins
+    CHECK_INT(aqi_us_epa(9.0, 100), 73);
+    CHECK_INT(aqi_us_epa(35.4, 54), 100);
+    CHECK_INT(aqi_us_epa(NAN, NAN), 0);
+}
+
+static void aqi_categories(void)
+{
+    CHECK_INT(aqi_category(50), AQI_GOOD);
+    CHECK_INT(aqi_category(51), AQI_MODERATE);
+    CHECK_INT(aqi_category(150), AQI_UNHEALTHY_SENSITIVE);
+    CHECK_INT(aqi_category(200), AQI_UNHEALTHY);
+    CHECK_INT(aqi_category(300), AQI_VERY_UNHEALTHY);
+    CHECK_INT(aqi_category(301), AQI_HAZARDOUS);
+    CHECK_STR(aqi_category_name(AQI_UNHEALTHY_SENSITIVE), "unhealthy_sensitive");
+}
+
+static void caqi_breakpoints(void)
+{
+    CHECK_INT(caqi_hourly(15, NAN), 25);
+    CHECK_INT(caqi_hourly(55, NAN), 75);
+    CHECK_INT(caqi_hourly(NAN, 50), 50);
+    CHECK_INT(caqi_hourly(NAN, 180), 100);
+    CHECK_INT(caqi_hourly(15, 50), 50);
+}
+
+static void sea_level_pressure_reduction(void)
+{
+    CHECK_NEAR(sea_level_pressure(100000, 15, 0), 100000, 1e-6);
+    CHECK_NEAR(sea_level_pressure(100000, 15, 100), 101191.6, 0.1);
+
+    // colder air is denser, the correction grows
+    CHECK(sea_level_pressure(100000, -10, 100) > sea_level_pressure(100000, 15, 100));
+}
+
+static void ventilation_from_decay(void)
+{
+    ventilation_t vent;
+
+    ventilation_init(&vent, 400);
+    ventilation_update(&vent, 1400, 1000);
+    CHECK(isnan(vent.ach));
+
+    // the excess falls by 1/e in an hour
+    ventilation_update(&vent, 767.88, 1000 + 3600);
+    CHECK_NEAR(vent.ach, 1, 1e-3);
+
+    // rising keeps the last estimate
+    ventilation_update(&vent, 900, 1000 + 7200);
+    CHECK_NEAR(vent.ach, 1, 1e-3);
+
+    // too soon after the last sample
+    ventilation_update(&vent, 500, 1000 + 7210);
+    CHECK_NEAR(vent.last_ppm, 900, 1e-6);
+}
+
+static const test_case_t cases[] = {
+    TEST(rolling_average_empty_is_nan),
+    TEST(rolling_average_expires_old_buckets),
+    TEST(rolling_average_survives_long_gaps),
+    TEST(rolling_average_counts_covered_hours),
+    TEST(aqi_breakpoints),
+    TEST(aqi_categories),
+    TEST(caqi_breakpoints),
+    TEST(sea_level_pressure_reduction),
+    TEST(ventilation_from_decay),
+};
+
+TEST_MAIN(cases)
@@ -0,0 +1,170 @@
+// filter_update() against brute force over the same samples
+
+#include "test.h"
+
+#include "filter.h"
+
+static uint32_t seed = 1;
+
+// small integers with a few spikes, so there are ties and new extremes
+static float next_sample(void)
+{
+    seed = seed * 1103515245 + 12345;
+    if ((seed >> 16) % 17 == 0)
+        return (float)((seed >> 8) % 1000);
+    return (float)(20 + (seed >> 16) % 10);
+}
+
+static int compare_float(const void *a, const void *b)
+{
+    float x = *(const float *)a, y = *(const float *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void ema_starts_at_first_sample(void)
+{
+    filter_config_t config = {.alpha = 0.25};
+    filter_t filter;
+    filter_output_t output;
+
+    filter_init(&filter, &config);
+    filter_update(&filter, 8);
+    filter_get_output(&filter, &output);
+    CHECK_NEAR(output.ema, 8, 1e-6);
+
+    filter_update(&filter, 16);
+    filter_get_output(&filter, &output);
+    CHECK_NEAR(output.ema, 10, 1e-6);
+    CHECK_INT(output.count, 2);
+}
+
+static void median_matches_sort(void)
+{
+    filter_config_t config = {.median = 5};
+    filter_t filter;
+    filter_output_t output;
+    float samples[200];
+
+    seed = 1;
+    filter_init(&filter, &config);
+
+    for (int i = 0; i < 200; i++)
+    {
+        int n = i + 1 < config.median ? i + 1 : config.median;
+        float sorted[FILTER_MAX_MEDIAN];
+        float expected;
+
+        samples[i] = next_sample();
+        filter_update(&filter, samples[i]);
+        filter_get_output(&filter, &output);
+
+        memcpy(sorted, samples + i + 1 - n, n * sizeof(float));
+        qsort(sorted, n, sizeof(float), compare_float);
+        expected = n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+        CHECK_NEAR(output.median, expected, 1e-6);
+    }
+}
+
+static void window_matches_brute_force(void)
+{
+    filter_config_t config = {.window = 16};
+    filter_t filter;
+    filter_output_t output;
+    float samples[1000];
+
+    seed = 7;
+    filter_init(&filter, &config);
+
+    for (int i = 0; i < 1000; i++)
+    {
+        int n = i + 1 < config.window ? i + 1 : config.window;
+        double sum = 0, squares = 0;
+        float min = INFINITY, max = -INFINITY;
+
+        samples[i] = next_sample();
+        filter_update(&filter, samples[i]);
+        filter_get_output(&filter, &output);
+
+        for (int j = i + 1 - n; j <= i; j++)
+        {
+            sum += samples[j];
+            if (samples[j] < min)
+                min = samples[j];
+            if (samples[j] > max)
+                max = samples[j];
+        }
+        for (int j = i + 1 - n; j <= i; j++)
+            squares += (samples[j] - sum / n) * (samples[j] - sum / n);
+
+        CHECK_NEAR(output.min, min, 0);
+        CHECK_NEAR(output.max, max, 0);
+        CHECK_NEAR(output.mean, sum / n, 1e-3);
+        CHECK_NEAR(output.stddev, n > 1 ? sqrt(squares / (n - 1)) : 0, 1e-2);
+    }
+}
+
+static void monotonic_window_extremes(void)
+{
+    filter_config_t config = {.window = 4};
+    filter_t filter;
+    filter_output_t output;
+
+    filter_init(&filter, &config);
+
+    // rising: the min leaves the window with the oldest sample
+    for (int i = 1; i <= 10; i++)
+    {
+        filter_update(&filter, i);
+        filter_get_output(&filter, &output);
+        CHECK_NEAR(output.max, i, 0);
+        CHECK_NEAR(output.min, i > 4 ? i - 3 : 1, 0);
+    }
+
+    // falling: the max does
+    filter_init(&filter, &config);
+    for (int i = 10; i >= 1; i--)
+    {
+        filter_update(&filter, i);
+        filter_get_output(&filter, &output);
+        CHECK_NEAR(output.min, i, 0);
+        CHECK_NEAR(output.max, i + 3 <= 10 ? i + 3 : 10, 0);
+    }
+}
+
+static void config_is_clamped(void)
+{
+    filter_config_t config = {.median = 100, .window = 200};
+    filter_t filter;
+
+    filter_init(&filter, &config);
+    CHECK_INT(filter.config.median, FILTER_MAX_MEDIAN);
+    CHECK_INT(filter.config.window, FILTER_MAX_WINDOW);
+}
+
+static void format_lists_enabled_stages(void)
+{
+    filter_config_t config = {.alpha = 0.5, .window = 2};
+    filter_t filter;
+    filter_output_t output;
+    char buf[128];
+
+    filter_init(&filter, &config);
+    filter_update(&filter, 1);
+    filter_update(&filter, 3);
+    filter_get_output(&filter, &output);
+
+    filter_format(&output, buf, sizeof(buf));
+    CHECK_STR(buf, "{\"n\":2,\"ema\":2.00,\"mean\":2.00,\"sd\":1.41,\"min\":1.00,\"max\":3.00}");
+}
+
+static const test_case_t cases[] = {
+    TEST(ema_starts_at_first_sample),
+    TEST(median_matches_sort),
+    TEST(window_matches_brute_force),
+    TEST(monotonic_window_extremes),
+    TEST(config_is_clamped),
+    TEST(format_lists_enabled_stages),
+};
+
+TEST_MAIN(cases)
@@ -0,0 +1,156 @@
+// latency histograms: bucket edges, points counted once and acks matched by msg_id
+
+#include "test.h"
+
+// built here with tracing on, for the histograms inside it; the library's copy is left out by the linker
+#define LATENCY_ENABLE 1
+#include "latency.c"
+
+// `ms` on the virtual clock, then `point`
+static void point_after(int ms, latency_source_t source, latency_point_t point)
+{
+    vTaskDelay(ms / portTICK_PERIOD_MS);
+    latency_point(source, point);
+}
+
+static const latency_histogram_t *stage(latency_source_t source, latency_point_t point)
+{
+    return &traces[source].stages[point];
+}
+
+static void setup(void)
+{
+    latency_init();
+
+    // a point reached at 0 reads as not reached
+    vTaskDelay(1000 / portTICK_PERIOD_MS);
+}
+
+static void bucket_edges(void)
+{
+    latency_histogram_t h = {0};
+
+    histogram_add(&h, 0);
+    histogram_add(&h, 1u << LATENCY_MIN_SHIFT);
+    CHECK_INT(h.buckets[0], 2);
+
+    // bucket i holds up to 2^(i + LATENCY_MIN_SHIFT) microseconds
+    for (int i = 1; i < LATENCY_BUCKETS - 1; i++)
+    {
+        memset(&h, 0, sizeof(h));
+        histogram_add(&h, (1u << (i + LATENCY_MIN_SHIFT - 1)) + 1);
+        histogram_add(&h, 1u << (i + LATENCY_MIN_SHIFT));
+        histogram_add(&h, (1u << (i + LATENCY_MIN_SHIFT)) + 1);
+        CHECK_INT(h.buckets[i - 1], 0);
+        CHECK_INT(h.buckets[i], 2);
+        CHECK_INT(h.buckets[i + 1], 1);
+    }
+
+    // the last one is open-ended
+    memset(&h, 0, sizeof(h));
+    histogram_add(&h, (1u << (LATENCY_BUCKETS - 2 + LATENCY_MIN_SHIFT)) + 1);
+    histogram_add(&h, UINT32_MAX);
+    CHECK_INT(h.buckets[LATENCY_BUCKETS - 1], 2);
+    CHECK_INT(h.count, 2);
+    CHECK_INT(h.max, UINT32_MAX);
+    CHECK_INT(h.sum, (1ull << (LATENCY_BUCKETS - 2 + LATENCY_MIN_SHIFT)) + 1 + UINT32_MAX);
+}
+
+static void stages_of_a_sample(void)
+{
+    latency_point(LATENCY_DUST, LATENCY_COMMAND);
+    point_after(30, LATENCY_DUST, LATENCY_FIRST_BYTE);
+    point_after(2, LATENCY_DUST, LATENCY_FRAME);
+    point_after(1, LATENCY_DUST, LATENCY_DECODED);
+    point_after(4, LATENCY_DUST, LATENCY_SNAPSHOT);
+
+    CHECK_INT(stage(LATENCY_DUST, LATENCY_FIRST_BYTE)->sum, 30000);
+    CHECK_INT(stage(LATENCY_DUST, LATENCY_FRAME)->sum, 2000);
+    CHECK_INT(stage(LATENCY_DUST, LATENCY_DECODED)->sum, 1000);
+    CHECK_INT(stage(LATENCY_DUST, LATENCY_SNAPSHOT)->sum, 4000);
+    CHECK_INT(stage(LATENCY_DUST, LATENCY_SNAPSHOT)->count, 1);
+
+    // the other source is traced apart
+    CHECK_INT(stage(LATENCY_CO2, LATENCY_FIRST_BYTE)->count, 0);
+}
+
+static void each_point_counts_once(void)
+{
+    // published twice, measured on the first publication
+    point_after(5, LATENCY_DUST, LATENCY_ENQUEUED);
+    point_after(5, LATENCY_DUST, LATENCY_ENQUEUED);
+    CHECK_INT(stage(LATENCY_DUST, LATENCY_ENQUEUED)->count, 1);
+    CHECK_INT(stage(LATENCY_DUST, LATENCY_ENQUEUED)->sum, 5000);
+
+    // a point without the one before it starts over, nothing is counted
+    point_after(1, LATENCY_DUST, LATENCY_FRAME);
+    point_after(1, LATENCY_DUST, LATENCY_FRAME);
+    CHECK_INT(stage(LATENCY_DUST, LATENCY_FRAME)->count, 1);
+
+    latency_point(LATENCY_DUST, LATENCY_COMMAND);
+    point_after(1, LATENCY_DUST, LATENCY_FRAME);
+    CHECK_INT(stage(LATENCY_DUST, LATENCY_FRAME)->count, 1);
+}
+
+static void acks_by_msg_id(void)
+{
+    latency_point(LATENCY_DUST, LATENCY_SNAPSHOT);
+    latency_point(LATENCY_CO2, LATENCY_SNAPSHOT);
+    latency_enqueued(LATENCY_DUST, 5);
+    latency_enqueued(LATENCY_CO2, 6);
+
+    vTaskDelay(20 / portTICK_PERIOD_MS);
+    latency_acked(7);
+    latency_acked(0);
+    CHECK_INT(stage(LATENCY_DUST, LATENCY_ACKED)->count, 0);
+    CHECK_INT(stage(LATENCY_CO2, LATENCY_ACKED)->count, 0);
+
+    latency_acked(6);
+    CHECK_INT(stage(LATENCY_CO2, LATENCY_ACKED)->count, 1);
+    CHECK_INT(stage(LATENCY_CO2, LATENCY_ACKED)->sum, 20000);
+    CHECK_INT(stage(LATENCY_DUST, LATENCY_ACKED)->count, 0);
+
+    // acked once
+    vTaskDelay(10 / portTICK_PERIOD_MS);
+    latency_acked(6);
+    latency_acked(5);
+    CHECK_INT(stage(LATENCY_CO2, LATENCY_ACKED)->count, 1);
+    CHECK_INT(stage(LATENCY_DUST, LATENCY_ACKED)->count, 1);
+    CHECK_INT(stage(LATENCY_DUST, LATENCY_ACKED)->sum, 30000);
+
+    // QoS 0, no ack to wait for
+    latency_point(LATENCY_DUST, LATENCY_SNAPSHOT);
+    latency_enqueued(LATENCY_DUST, 0);
+    latency_acked(0);
+    latency_acked(-1);
+    CHECK_INT(traces[LATENCY_DUST].msg_id, -1);
+    CHECK_INT(stage(LATENCY_DUST, LATENCY_ACKED)->count, 1);
+}
+
+static void formatted(void)
+{
+    char json[2048];
+    int length = latency_format(LATENCY_CO2, json, sizeof(json));
+
+    CHECK_INT(length, strlen(json));
+
+    // 20 ms is in bucket 8, up to 2^15 us
+    CHECK(strstr(json, "\"ack\":{\"n\":1,\"sum_us\":20000,\"max_us\":20000,\"buckets\":[0,0,0,0,0,0,0,0,1,0,") !=
+          NULL);
+    CHECK(strstr(json, "{\"response\":{\"n\":0,\"sum_us\":0,\"max_us\":0,\"buckets\":[0,") == json);
+
+    // cut like snprintf()
+    CHECK_INT(latency_format(LATENCY_CO2, json, 10), length);
+    CHECK_INT(strlen(json), 9);
+}
+
+static const test_case_t cases[] = {
+    TEST(setup),
+    TEST(bucket_edges),
+    TEST(stages_of_a_sample),
+    TEST(each_point_counts_once),
+    TEST(acks_by_msg_id),
+    TEST(formatted),
+};
+
+TEST_MAIN(cases)
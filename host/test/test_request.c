@@ -0,0 +1,197 @@
+// samples on demand: parsing, the queue, the minimum period of a failing sensor and the timeout
+
+#include "test.h"
+
+#include "esp_event.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "nvs_flash.h"
+
+#include "dust_sensor.h"
+#include "request.h"
+
+static char reply[512];
+static int replies;
+static int dust_reads;
+
+static int accept_connect(void *ctx, esp_mqtt_client_handle_t client, const esp_mqtt_client_config_t *config)
+{
+    return ESP_OK;
+}
+
+static void ignore_disconnect(void *ctx, esp_mqtt_client_handle_t client)
+{
+}
+
+static int accept_subscribe(void *ctx, esp_mqtt_client_handle_t client, const char *topic, int qos)
+{
+    return ESP_OK;
+}
+
+// keeps the last reply to a request
+static int capture_publish(void *ctx, esp_mqtt_client_handle_t client, const char *topic, const char *data,
+                           int len, int qos, int retain)
+{
+    if (strcmp(topic, MQTT_TOPIC_PREFIX "/" MQTT_TOPIC_SAMPLE) || len >= (int)sizeof(reply))
+        return ESP_OK;
+
+    memcpy(reply, data, len);
+    reply[len] = 0;
+    replies++;
+    return ESP_OK;
+}
+
+static int command(const char *text)
+{
+    return request_command(text, strlen(text));
+}
+
+// milliseconds until the next reply, -1 if none comes within `limit`
+static int wait_reply(int limit)
+{
+    int count = replies;
+    int64_t start = esp_timer_get_time();
+
+    while (replies == count)
+    {
+        if (esp_timer_get_time() - start > limit * 1000LL)
+            return -1;
+        vTaskDelay(10 / portTICK_PERIOD_MS);
+    }
+
+    return (esp_timer_get_time() - start) / 1000;
+}
+
+// a dust sensor that never answers, read only when requested
+static void dust_task(void *arg)
+{
+    for (;;)
+    {
+        dust_reads++;
+        xSemaphoreTake(dust_values.lock, portMAX_DELAY);
+        dust_values.status = SAMPLE_TIMEOUT;
+        xSemaphoreGive(dust_values.lock);
+
+        adaptive_delay(ADAPTIVE_DUST);
+    }
+}
+
+static void setup(void)
+{
+    static const shim_mqtt_broker_t broker = {accept_connect, ignore_disconnect, capture_publish, accept_subscribe};
+    esp_mqtt_client_config_t config = {.uri = "mqtt://localhost"};
+    const char *settings = "dust_delay=600000 dust_min_delay=5000";
+
+    nvs_flash_init();
+    eg_app_status = xEventGroupCreate();
+    config_init();
+    CHECK_INT(config_command(settings, strlen(settings)), 0);
+
+    dust_values.lock = xSemaphoreCreateMutex();
+    co2_values.lock = xSemaphoreCreateMutex();
+    bmp_values.lock = xSemaphoreCreateMutex();
+    request_init();
+
+    // the client connects once the station is up
+    esp_event_loop_create_default();
+    esp_wifi_start();
+    esp_wifi_connect();
+    vTaskDelay(1000 / portTICK_PERIOD_MS);
+
+    shim_mqtt_set_broker(&broker);
+    mqtt_client = esp_mqtt_client_init(&config);
+    esp_mqtt_client_start(mqtt_client);
+    vTaskDelay(1000 / portTICK_PERIOD_MS);
+}
+
+static void bad_id(void)
+{
+    CHECK_INT(command("id=a\"b dust"), 1);
+    CHECK_STR(reply, "{\"id\":\"\",\"error\":\"bad id\"}");
+
+    CHECK_INT(command("id=012345678901234567890123456789012"), 1);
+    CHECK_STR(reply, "{\"id\":\"\",\"error\":\"bad id\"}");
+}
+
+static void unknown_sensor(void)
+{
+    CHECK_INT(command("id=q dust pm1"), 1);
+    CHECK_STR(reply, "{\"id\":\"q\",\"error\":\"unknown sensor\"}");
+}
+
+static void busy_when_the_queue_is_full(void)
+{
+    // nothing takes them off the queue yet
+    for (int i = 0; i < REQUEST_QUEUE_LENGTH; i++)
+        CHECK_INT(command("id=queued,dust"), 0);
+
+    CHECK_INT(command("id=full dust"), 1);
+    CHECK_STR(reply, "{\"id\":\"full\",\"error\":\"busy\"}");
+}
+
+static void queued_are_answered_in_order(void)
+{
+    replies = 0;
+    xTaskCreate(dust_task, "dust", 4096, NULL, 5, NULL);
+    xTaskCreate(request_task, "request", 4096, NULL, 5, NULL);
+
+    // the dust sensor was read at its start, the requests get that sample
+    vTaskDelay(100 / portTICK_PERIOD_MS);
+    CHECK_INT(replies, REQUEST_QUEUE_LENGTH);
+    CHECK_INT(dust_reads, 1);
+    CHECK_STR(reply, "{\"id\":\"queued\",\"dust\":{\"status\":\"timeout\"}}");
+}
+
+static void failing_sensor_is_not_read_within_min_delay(void)
+{
+    // the last read failed, but it is within dust_min_delay
+    CHECK_INT(command("id=early dust"), 0);
+    CHECK(wait_reply(100) >= 0);
+    CHECK_INT(dust_reads, 1);
+    CHECK_STR(reply, "{\"id\":\"early\",\"dust\":{\"status\":\"timeout\"}}");
+
+    // after it the sensor is read again, once
+    vTaskDelay(5000 / portTICK_PERIOD_MS);
+    CHECK_INT(command("id=late dust"), 0);
+    CHECK(wait_reply(100) >= 0);
+    CHECK_INT(dust_reads, 2);
+
+    CHECK_INT(command("id=again dust"), 0);
+    CHECK(wait_reply(100) >= 0);
+    CHECK_INT(dust_reads, 2);
+}
+
+static void answered_after_timeout(void)
+{
+    int elapsed;
+
+    // no co2 task takes the sample
+    CHECK_INT(command("id=t co2"), 0);
+    elapsed = wait_reply(REQUEST_TIMEOUT + 1000);
+    CHECK(elapsed >= REQUEST_TIMEOUT && elapsed < REQUEST_TIMEOUT + 100);
+    CHECK_STR(reply, "{\"id\":\"t\",\"co2\":{\"status\":\"none\"}}");
+}
+
+static void all_sensors_by_default(void)
+{
+    CHECK_INT(command(""), 0);
+    CHECK(wait_reply(REQUEST_TIMEOUT + 1000) >= REQUEST_TIMEOUT);
+    CHECK_STR(reply, "{\"id\":\"\",\"dust\":{\"status\":\"timeout\"},\"co2\":{\"status\":\"none\"},"
+                     "\"bmp\":{\"status\":\"none\"}}");
+
+    // the dust sensor was due and read
+    CHECK_INT(dust_reads, 3);
+}
+
+static const test_case_t cases[] = {
+    TEST(setup),
+    TEST(bad_id),
+    TEST(unknown_sensor),
+    TEST(busy_when_the_queue_is_full),
+    TEST(queued_are_answered_in_order),
+    TEST(failing_sensor_is_not_read_within_min_delay),
+    TEST(answered_after_timeout),
+    TEST(all_sensors_by_default),
+};
+
+TEST_MAIN(cases)
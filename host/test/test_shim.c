@@ -0,0 +1,93 @@
+// the FreeRTOS/ESP-IDF shim the firmware and the other tests run on
+
+#include "test.h"
+
+#include "esp_timer.h"
+#include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+static void delay_advances_virtual_clock(void)
+{
+    int64_t start = esp_timer_get_time();
+
+    vTaskDelay(100 / portTICK_PERIOD_MS);
+    CHECK_INT(esp_timer_get_time() - start, 100000);
+}
+
+static void semaphore_take_times_out(void)
+{
+    SemaphoreHandle_t semaphore = xSemaphoreCreateBinary();
+    int64_t start = esp_timer_get_time();
+
+    CHECK(xSemaphoreTake(semaphore, 50 / portTICK_PERIOD_MS) != pdTRUE);
+    CHECK_INT(esp_timer_get_time() - start, 50000);
+
+    xSemaphoreGive(semaphore);
+    CHECK(xSemaphoreTake(semaphore, 0) == pdTRUE);
+    CHECK(xSemaphoreTake(semaphore, 0) != pdTRUE);
+
+    vSemaphoreDelete(semaphore);
+}
+
+static EventGroupHandle_t group;
+
+static void set_bits_later(void *arg)
+{
+    vTaskDelay(20 / portTICK_PERIOD_MS);
+    xEventGroupSetBits(group, BIT1);
+    vTaskDelete(NULL);
+}
+
+static void event_group_wakes_waiter(void)
+{
+    int64_t start;
+    EventBits_t bits;
+
+    group = xEventGroupCreate();
+    xTaskCreate(set_bits_later, "set_bits", 2048, NULL, 10, NULL);
+
+    start = esp_timer_get_time();
+    bits = xEventGroupWaitBits(group, BIT0 | BIT1, pdTRUE, pdFALSE, 100 / portTICK_PERIOD_MS);
+    CHECK(bits & BIT1);
+    CHECK_INT(esp_timer_get_time() - start, 20000);
+
+    // cleared on exit
+    CHECK_INT(xEventGroupGetBits(group) & BIT1, 0);
+
+    // all of them, times out with only one set
+    xEventGroupSetBits(group, BIT0);
+    bits = xEventGroupWaitBits(group, BIT0 | BIT1, pdFALSE, pdTRUE, 10 / portTICK_PERIOD_MS);
+    CHECK_INT(bits & (BIT0 | BIT1), BIT0);
+}
+
+static void queue_is_fifo_and_bounded(void)
+{
+    QueueHandle_t queue = xQueueCreate(2, sizeof(int));
+    int item;
+
+    item = 1;
+    CHECK(xQueueSend(queue, &item, 0) == pdTRUE);
+    item = 2;
+    CHECK(xQueueSend(queue, &item, 0) == pdTRUE);
+    item = 3;
+    CHECK(xQueueSend(queue, &item, 0) != pdTRUE);
+    CHECK_INT(uxQueueMessagesWaiting(queue), 2);
+
+    CHECK(xQueueReceive(queue, &item, 0) == pdTRUE);
+    CHECK_INT(item, 1);
+    CHECK(xQueueReceive(queue, &item, 0) == pdTRUE);
+    CHECK_INT(item, 2);
+    CHECK(xQueueReceive(queue, &item, 10 / portTICK_PERIOD_MS) != pdTRUE);
+
+    vQueueDelete(queue);
+}
+
+static const test_case_t cases[] = {
+    TEST(delay_advances_virtual_clock),
+    TEST(semaphore_take_times_out),
+    TEST(event_group_wakes_waiter),
+    TEST(queue_is_fifo_and_bounded),
+};
+
+TEST_MAIN(cases)
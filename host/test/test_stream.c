@@ -0,0 +1,139 @@
+// the event ring of /stream: whole events per client buffer and a stalled client falling behind
+
+#include "test.h"
+
+// built here with the stream on, for the ring and stream_fill() inside it; the library's copy is left out
+#define STREAM_ENABLE 1
+#include "stream.c"
+
+static uint32_t produced;
+
+// `count` events of varying length, so that they straddle the end of the ring
+static void produce(int count)
+{
+    for (int i = 0; i < count; i++, produced++)
+    {
+        if (produced % 3 == 0)
+            stream_dust(SAMPLE_VALID, produced % 1000, produced);
+        else if (produced % 3 == 1)
+            stream_co2(SAMPLE_TIMEOUT, 0);
+        else
+            stream_bmp(SAMPLE_VALID, produced / 7.0, 101325.0 + produced);
+    }
+}
+
+// checks that the buffer holds whole events with the ids from `*next` on, returns how many
+static int check_events(const stream_client_t *client, uint32_t *next)
+{
+    char text[STREAM_CLIENT_BUFFER + 1];
+    char *p = text;
+    int count = 0;
+
+    memcpy(text, client->buffer, client->length);
+    text[client->length] = 0;
+
+    while (*p)
+    {
+        char *stop = strstr(p, "\n\n");
+        unsigned id;
+
+        CHECK(stop != NULL);
+        if (!stop)
+            break;
+        *stop = 0;
+
+        CHECK(sscanf(p, "id: %u\nevent: ", &id) == 1);
+        CHECK_INT(id, *next);
+        CHECK(strstr(p, "\ndata: {\"t\":") != NULL);
+        CHECK_INT(stop[-1], '}');
+
+        (*next)++;
+        count++;
+        p = stop + 2;
+    }
+
+    return count;
+}
+
+static void setup(void)
+{
+    ring_lock = xSemaphoreCreateBinary();
+    stream_data = xSemaphoreCreateBinary();
+    xSemaphoreGive(ring_lock);
+
+    // the producers only write with a client connected
+    atomic_store(&client_count, 1);
+}
+
+static void client_gets_whole_events(void)
+{
+    stream_client_t client = {.head = ring_head, .events = ring_events};
+    uint32_t next = ring_events;
+    int fills = 0;
+
+    // more than a client buffer, less than the ring
+    produce(12);
+
+    for (stream_fill(&client); client.length; stream_fill(&client), fills++)
+    {
+        CHECK(client.length <= (int)sizeof(client.buffer));
+        CHECK(check_events(&client, &next) > 0);
+    }
+
+    CHECK(fills > 1);
+    CHECK_INT(next, ring_events);
+    CHECK_INT(client.events, ring_events);
+    CHECK_INT(client.head, ring_head);
+}
+
+static void stalled_client_is_told_what_it_missed(void)
+{
+    stream_client_t client = {.head = ring_head, .events = ring_events};
+    uint32_t start = ring_events;
+    uint32_t next;
+    char expected[64];
+
+    // overfills the ring while the client takes nothing
+    while (ring_head - client.head <= STREAM_BUFFER_SIZE)
+        produce(1);
+    produce(5);
+
+    stream_fill(&client);
+    snprintf(expected, sizeof(expected), "event: dropped\ndata: {\"events\":%u}\n\n", ring_events - start);
+    CHECK_INT(client.length, strlen(expected));
+    CHECK(!memcmp(client.buffer, expected, client.length));
+
+    // then it follows from the newest events, whole ones
+    next = ring_events;
+    produce(3);
+    stream_fill(&client);
+    CHECK_INT(check_events(&client, &next), 3);
+    CHECK_INT(client.dropped, 0);
+}
+
+static void whole_events_across_the_wrap(void)
+{
+    stream_client_t client = {.head = ring_head, .events = ring_events};
+    uint32_t next = ring_events;
+    uint32_t start = ring_head;
+
+    // a client that keeps up, the ring goes round several times
+    while (ring_head - start < 4 * STREAM_BUFFER_SIZE)
+    {
+        produce(4);
+        for (stream_fill(&client); client.length; stream_fill(&client))
+            check_events(&client, &next);
+    }
+
+    CHECK_INT(next, ring_events);
+    CHECK_INT(client.head, ring_head);
+}
+
+static const test_case_t cases[] = {
+    TEST(setup),
+    TEST(client_gets_whole_events),
+    TEST(stalled_client_is_told_what_it_missed),
+    TEST(whole_events_across_the_wrap),
+};
+
+TEST_MAIN(cases)
@@ -347,6 +347,8 @@
 #define CONFIG_BT_ACL_CONNECTIONS 4
 #define CONFIG_ESP32_WIFI_TX_BUFFER_TYPE 1
 #define CONFIG_BOOTLOADER_WDT_ENABLE 1
+#define CONFIG_BOOTLOADER_APP_ROLLBACK_ENABLE 1
+#define CONFIG_APP_ROLLBACK_ENABLE 1
 #define CONFIG_GAP_INITIAL_TRACE_LEVEL 2
 #define CONFIG_ESP32_WIFI_AMPDU_RX_ENABLED 1
 #define CONFIG_LWIP_LOOPBACK_MAX_PBUFS 8
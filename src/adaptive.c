@@ -0,0 +1,209 @@
+#include "esp_log.h"
+#define LOG_TAG "adaptive"
+
+#include <math.h>
+
+#include "esp_timer.h"
+
+#include "dust_sensor.h"
+#include "adaptive.h"
+
+typedef struct
+{
+    adaptive_sensor_t sensor;
+    float rate; // per minute
+    float sd;
+} adaptive_limits_t;
+
+typedef struct
+{
+    bool started;
+    float last;
+    float mean;
+    float variance;
+    int64_t time;
+} adaptive_channel_state_t;
+
+typedef struct
+{
+    config_key_t max; // the fixed period when adaptive sampling is off
+    config_key_t min;
+    EventBits_t wake;
+    EventBits_t request; // take a sample now, see request.h
+    EventBits_t sampled; // the requested sample is taken
+    const char *name;
+} adaptive_sensor_config_t;
+
+static const adaptive_limits_t limits[ADAPTIVE_CHANNEL_COUNT] = {
+    [ADAPTIVE_PM25] = {ADAPTIVE_DUST, ADAPTIVE_PM25_RATE, ADAPTIVE_PM25_SD},
+    [ADAPTIVE_PM100] = {ADAPTIVE_DUST, ADAPTIVE_PM100_RATE, ADAPTIVE_PM100_SD},
+    [ADAPTIVE_CO2_PPM] = {ADAPTIVE_CO2, ADAPTIVE_CO2_RATE, ADAPTIVE_CO2_SD},
+    [ADAPTIVE_TEMP] = {ADAPTIVE_BMP, ADAPTIVE_TEMP_RATE, ADAPTIVE_TEMP_SD},
+    [ADAPTIVE_PRES] = {ADAPTIVE_BMP, ADAPTIVE_PRES_RATE, ADAPTIVE_PRES_SD},
+};
+
+static const adaptive_sensor_config_t sensors[ADAPTIVE_SENSOR_COUNT] = {
+    [ADAPTIVE_DUST] = {CONFIG_DUST_TASK_DELAY, CONFIG_DUST_MIN_DELAY, CONFIG_DUST_BIT, REQUEST_DUST_BIT,
+                       SAMPLED_DUST_BIT, "dust"},
+    [ADAPTIVE_CO2] = {CONFIG_CO2_TASK_DELAY, CONFIG_CO2_MIN_DELAY, CONFIG_CO2_BIT, REQUEST_CO2_BIT,
+                      SAMPLED_CO2_BIT, "co2"},
+    [ADAPTIVE_BMP] = {CONFIG_BMP_TASK_DELAY, CONFIG_BMP_MIN_DELAY, CONFIG_BMP_BIT, REQUEST_BMP_BIT,
+                      SAMPLED_BMP_BIT, "bmp"},
+};
+
+// each channel and the flags of a sensor are only touched by the task of the sensor
+static adaptive_channel_state_t channels[ADAPTIVE_CHANNEL_COUNT];
+static bool sampled[ADAPTIVE_SENSOR_COUNT];
+static bool moving[ADAPTIVE_SENSOR_COUNT];
+static bool requested[ADAPTIVE_SENSOR_COUNT]; // the sample being taken was requested
+
+// milliseconds, 0 until the first sample; read by the MQTT task
+static atomic_int periods[ADAPTIVE_SENSOR_COUNT];
+
+// milliseconds since boot when the last read ended, valid or not; read by the request task
+static atomic_uint last_reads[ADAPTIVE_SENSOR_COUNT];
+
+void adaptive_update(adaptive_channel_t channel, float value, int64_t time)
+{
+    adaptive_channel_state_t *c = &channels[channel];
+    const adaptive_limits_t *limit = &limits[channel];
+    float diff;
+
+    sampled[limit->sensor] = true;
+
+    if (!c->started)
+    {
+        c->started = true;
+        c->last = c->mean = value;
+        c->variance = 0;
+        c->time = time;
+        return;
+    }
+
+    diff = value - c->mean;
+    c->mean += ADAPTIVE_ALPHA * diff;
+    c->variance = (1 - ADAPTIVE_ALPHA) * (c->variance + ADAPTIVE_ALPHA * diff * diff);
+
+    // changes within the noise allowance are not counted as a rate
+    if (sqrtf(c->variance) > limit->sd ||
+        (time > c->time && fabsf(value - c->last) > limit->sd &&
+         fabsf(value - c->last) * 60e6f / (time - c->time) > limit->rate))
+        moving[limit->sensor] = true;
+
+    c->last = value;
+    c->time = time;
+}
+
+static int32_t clamp_period(adaptive_sensor_t sensor, int32_t period)
+{
+    int32_t max = config_get_int(sensors[sensor].max);
+    int32_t min = config_get_int(sensors[sensor].min);
+
+    if (min > max)
+        min = max;
+
+    return !period || period > max ? max : period < min ? min : period;
+}
+
+int32_t adaptive_period(adaptive_sensor_t sensor)
+{
+    if (!config_get_int(CONFIG_ADAPTIVE))
+        return config_get_int(sensors[sensor].max);
+
+    return clamp_period(sensor, atomic_load(&periods[sensor]));
+}
+
+int32_t adaptive_mqtt_period(void)
+{
+    int32_t period = config_get_int(CONFIG_MQTT_DELAY);
+
+    if (!config_get_int(CONFIG_ADAPTIVE))
+        return period;
+
+    for (int i = 0; i < ADAPTIVE_SENSOR_COUNT; i++)
+    {
+        int32_t sensor = adaptive_period(i);
+
+        if (sensor < period)
+            period = sensor;
+    }
+
+    return period;
+}
+
+// the next period of `sensor` from the samples since the previous call
+static void adaptive_adjust(adaptive_sensor_t sensor)
+{
+    int32_t period = adaptive_period(sensor);
+    int32_t next = period;
+    int32_t mqtt = adaptive_mqtt_period();
+
+    if (moving[sensor])
+        next = clamp_period(sensor, period / 2);
+    else if (sampled[sensor])
+        next = clamp_period(sensor, period * ADAPTIVE_BACKOFF + 0.5);
+    moving[sensor] = sampled[sensor] = false;
+
+    if (next == period)
+        return;
+
+    atomic_store(&periods[sensor], next);
+    BLOGD(LOG_TAG, "%s period %d ms", sensors[sensor].name, next);
+
+    // the MQTT task sleeps on its old period, shorten it
+    if (adaptive_mqtt_period() < mqtt)
+        xEventGroupSetBits(eg_app_status, CONFIG_MQTT_BIT);
+}
+
+uint32_t adaptive_last_read(adaptive_sensor_t sensor)
+{
+    return atomic_load(&last_reads[sensor]);
+}
+
+void adaptive_delay(adaptive_sensor_t sensor)
+{
+    EventBits_t wake = sensors[sensor].wake;
+    EventBits_t request = sensors[sensor].request;
+    TickType_t start = xTaskGetTickCount();
+
+    atomic_store(&last_reads[sensor], esp_timer_get_time() / 1000);
+
+    /*
+    A request that came in while a sample was being taken gets the next one,
+    taken after it.
+    */
+    if (requested[sensor])
+    {
+        requested[sensor] = false;
+        xEventGroupSetBits(eg_app_status, sensors[sensor].sampled);
+    }
+
+    // the period is the fixed "_delay" setting when adaptive sampling is off
+    if (config_get_int(CONFIG_ADAPTIVE))
+        adaptive_adjust(sensor);
+
+    for (;;)
+    {
+        TickType_t period = adaptive_period(sensor) / portTICK_PERIOD_MS;
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        EventBits_t bits;
+
+        // requested samples come no sooner than the minimum period after the previous read, whatever its outcome
+        if (requested[sensor])
+        {
+            TickType_t min = config_get_int(sensors[sensor].min) / portTICK_PERIOD_MS;
+
+            if (min < period)
+                period = min;
+        }
+
+        if (elapsed >= period)
+            return;
+
+        bits = xEventGroupWaitBits(eg_app_status, wake | request, pdTRUE, pdFALSE, period - elapsed);
+        if (bits & request)
+            requested[sensor] = true;
+        else if (!(bits & wake))
+            return;
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef _ADAPTIVE_H
+#define _ADAPTIVE_H
+
+#include <stdint.h>
+
+#include "config.h"
+
+/*
+Adaptive sampling. With the runtime setting "adaptive=1" each sensor task
+sleeps for a period of its own between its "<sensor>_min_delay" and its
+"<sensor>_delay" instead of the fixed "<sensor>_delay", and MQTT publishes
+at the shortest period of the sensors when that is below "mqtt_delay".
+
+Every valid sample updates, per channel, an exponentially weighted mean and
+variance (weight ADAPTIVE_ALPHA) and the rate of change since the previous
+sample. A channel moves when its rate exceeds its ADAPTIVE_*_RATE per
+minute or its standard deviation its ADAPTIVE_*_SD. If any channel of a
+sensor moves the period of the sensor is halved, down to the minimum; if
+none does it grows by ADAPTIVE_BACKOFF, up to the maximum. The sensor thus
+follows an event within a few samples and slows down gradually after it.
+*/
+
+typedef enum
+{
+    ADAPTIVE_DUST,
+    ADAPTIVE_CO2,
+    ADAPTIVE_BMP,
+    ADAPTIVE_SENSOR_COUNT,
+} adaptive_sensor_t;
+
+typedef enum
+{
+    ADAPTIVE_PM25,
+    ADAPTIVE_PM100,
+    ADAPTIVE_CO2_PPM,
+    ADAPTIVE_TEMP,
+    ADAPTIVE_PRES,
+    ADAPTIVE_CHANNEL_COUNT,
+} adaptive_channel_t;
+
+// a valid sample of `channel` taken at `time`, microseconds since boot
+void adaptive_update(adaptive_channel_t channel, float value, int64_t time);
+
+// the sensor task takes its next sample after this many milliseconds
+int32_t adaptive_period(adaptive_sensor_t sensor);
+
+// milliseconds between MQTT updates
+int32_t adaptive_mqtt_period(void);
+
+// milliseconds since boot when the last read of `sensor` ended, valid or not, 0 before the first
+uint32_t adaptive_last_read(adaptive_sensor_t sensor);
+
+/*
+Sleeps for the period of `sensor`, like config_delay() for its "_delay"
+setting, which it is when adaptive sampling is off. A sample requested
+with the REQUEST_*_BIT of the sensor ends the sleep early, but not before
+"<sensor>_min_delay" has passed since the previous read; the SAMPLED_*_BIT
+is set when called after that sample, see request.h.
+*/
+void adaptive_delay(adaptive_sensor_t sensor);
+
+#endif // _ADAPTIVE_H
@@ -0,0 +1,83 @@
+#include <stdlib.h>
+
+#include "aggregate.h"
+
+static void sort_u16(uint16_t *values, uint8_t count)
+{
+    for (uint8_t i = 1; i < count; i++)
+    {
+        uint16_t v = values[i];
+        int8_t j = i - 1;
+
+        while (j >= 0 && values[j] > v)
+        {
+            values[j + 1] = values[j];
+            j--;
+        }
+        values[j + 1] = v;
+    }
+}
+
+static uint16_t median_sorted_u16(const uint16_t *values, uint8_t count)
+{
+    if (count % 2)
+        return values[count / 2];
+
+    return (values[count / 2 - 1] + values[count / 2] + 1) / 2;
+}
+
+uint16_t aggregate_u16(uint16_t *values, uint8_t count, int mode, uint8_t *used)
+{
+    uint16_t deviations[AGGREGATE_MAX_FRAMES];
+    uint16_t median;
+    uint32_t spread;
+    uint8_t first = 0;
+    uint8_t last;
+    uint32_t sum = 0;
+
+    if (count == 0)
+    {
+        *used = 0;
+        return 0;
+    }
+
+    if (count > AGGREGATE_MAX_FRAMES)
+        count = AGGREGATE_MAX_FRAMES;
+
+    sort_u16(values, count);
+    median = median_sorted_u16(values, count);
+
+    for (uint8_t i = 0; i < count; i++)
+        deviations[i] = abs((int)values[i] - (int)median);
+
+    sort_u16(deviations, count);
+
+    // 1.4826 * MAD estimates the standard deviation for normally distributed noise
+    spread = (uint32_t)median_sorted_u16(deviations, count) * 14826 * AGGREGATE_OUTLIER_K / 10000;
+    if (spread < AGGREGATE_MIN_SPREAD)
+        spread = AGGREGATE_MIN_SPREAD;
+
+    last = count;
+    while (first < last && median - values[first] > (int32_t)spread)
+        first++;
+    while (last > first && values[last - 1] - median > (int32_t)spread)
+        last--;
+
+    values += first;
+    count = last - first;
+    *used = count;
+
+    if (count == 0)
+        return median;
+
+    if (mode == AGGREGATE_MEDIAN)
+        return median_sorted_u16(values, count);
+
+    first = count / 4;
+    last = count - count / 4;
+
+    for (uint8_t i = first; i < last; i++)
+        sum += values[i];
+
+    return (sum + (last - first) / 2) / (last - first);
+}
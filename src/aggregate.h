@@ -0,0 +1,26 @@
+#ifndef _AGGREGATE_H
+#define _AGGREGATE_H
+
+#include <stdint.h>
+
+#define AGGREGATE_MEDIAN 0
+#define AGGREGATE_TRIMMED_MEAN 1
+
+#define AGGREGATE_MAX_FRAMES 16
+
+/*
+Frames further than AGGREGATE_OUTLIER_K scaled MADs from the median are
+rejected. AGGREGATE_MIN_SPREAD keeps identical readings from turning every
+other frame into an outlier.
+*/
+#define AGGREGATE_OUTLIER_K 3
+#define AGGREGATE_MIN_SPREAD 2
+
+/*
+Robust aggregate of `count` readings. `values` is sorted in place.
+Returns the median or the 25% trimmed mean of the frames left after outlier
+rejection, number of those frames is stored in `used`.
+*/
+uint16_t aggregate_u16(uint16_t *values, uint8_t count, int mode, uint8_t *used);
+
+#endif // _AGGREGATE_H
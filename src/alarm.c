@@ -0,0 +1,455 @@
+#include "esp_log.h"
+#define LOG_TAG "alarm"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_timer.h"
+#include "freertos/queue.h"
+#include "nvs.h"
+
+#include "dust_sensor.h"
+#include "alarm.h"
+
+#define ALARM_MAX_COMMAND 256
+#define ALARM_VERSION 1
+#define ALARM_NVS_KEY "rules"
+
+typedef struct
+{
+    uint8_t channel; // cal_channel_t
+    uint8_t kind;    // alarm_kind_t
+    float threshold;
+    float hysteresis;
+} alarm_rule_t;
+
+// what is stored
+typedef struct
+{
+    uint8_t version;
+    uint8_t count;
+    alarm_rule_t rules[ALARM_MAX_RULES];
+} alarm_rules_t;
+
+typedef struct
+{
+    alarm_rule_t rule;
+    bool raised;
+    bool removed; // cleared because the rule was removed or replaced
+    float value;
+    float rate; // per minute, NAN if unknown
+    uint32_t time;
+} alarm_event_t;
+
+static const char *const channel_names[CAL_COUNT] = {
+    [CAL_PM25] = "pm25",
+    [CAL_PM100] = "pm100",
+    [CAL_CO2] = "co2",
+    [CAL_TEMP] = "temp",
+    [CAL_PRES] = "pres",
+};
+
+static const char *const kind_names[ALARM_KIND_COUNT] = {
+    [ALARM_ABOVE] = "above",
+    [ALARM_BELOW] = "below",
+    [ALARM_RISE] = "rise",
+    [ALARM_FALL] = "fall",
+};
+
+static SemaphoreHandle_t alarm_lock;
+static QueueHandle_t alarm_queue;
+static alarm_rules_t rules;
+static bool active[ALARM_MAX_RULES];
+static uint32_t lost; // events that did not fit the queue
+
+// previous sample per channel, for the rate; under the lock
+static float last_value[CAL_COUNT];
+static int64_t last_time[CAL_COUNT];
+
+static int name_find(const char *const *names, int count, const char *name)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (!strcmp(names[i], name))
+            return i;
+    }
+
+    return -1;
+}
+
+static esp_err_t rules_store(const alarm_rules_t *stored)
+{
+    nvs_handle_t nvs;
+    esp_err_t err;
+
+    err = nvs_open(ALARM_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK)
+        return err;
+
+    err = nvs_set_blob(nvs, ALARM_NVS_KEY, stored, sizeof(*stored));
+    if (err == ESP_OK)
+        err = nvs_commit(nvs);
+    nvs_close(nvs);
+
+    if (err != ESP_OK)
+        ESP_LOGE(LOG_TAG, "can't store rules (%s)", esp_err_to_name(err));
+
+    return err;
+}
+
+// call with the lock held
+static int rule_find(cal_channel_t channel, alarm_kind_t kind)
+{
+    for (int i = 0; i < rules.count; i++)
+    {
+        if (rules.rules[i].channel == channel && rules.rules[i].kind == kind)
+            return i;
+    }
+
+    return -1;
+}
+
+// call with the lock held
+static void queue_event(const alarm_rule_t *rule, bool raised, bool removed, float value, float rate,
+                        int64_t time)
+{
+    alarm_event_t event = {*rule, raised, removed, value, rate, time / 1000};
+
+    if (xQueueSend(alarm_queue, &event, 0) != pdTRUE)
+        lost++;
+}
+
+// a raised rule that goes away is cleared, so that its consumers do not stay latched; call with the lock held
+static void rule_drop(int index)
+{
+    const alarm_rule_t *rule = &rules.rules[index];
+
+    if (active[index])
+        queue_event(rule, false, true, last_value[rule->channel], NAN, esp_timer_get_time());
+    active[index] = false;
+}
+
+// call with the lock held
+static void rule_remove(int index)
+{
+    rule_drop(index);
+    rules.count--;
+    memmove(&rules.rules[index], &rules.rules[index + 1], (rules.count - index) * sizeof(alarm_rule_t));
+    memmove(&active[index], &active[index + 1], (rules.count - index) * sizeof(bool));
+}
+
+static esp_err_t rule_set(cal_channel_t channel, alarm_kind_t kind, const char *value)
+{
+    alarm_rule_t rule = {channel, kind, 0, 0};
+    char *end;
+    int index;
+
+    if (*value)
+    {
+        rule.threshold = strtof(value, &end);
+        if (end == value || (*end && *end != ':'))
+            return ESP_ERR_INVALID_ARG;
+        if (*end == ':')
+        {
+            value = end + 1;
+            rule.hysteresis = strtof(value, &end);
+            if (end == value || *end)
+                return ESP_ERR_INVALID_ARG;
+        }
+        if (!isfinite(rule.threshold) || !isfinite(rule.hysteresis) || rule.hysteresis < 0 ||
+            ((kind == ALARM_RISE || kind == ALARM_FALL) && rule.threshold <= 0))
+            return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(alarm_lock, portMAX_DELAY);
+
+    index = rule_find(channel, kind);
+    if (!*value)
+    {
+        if (index >= 0)
+            rule_remove(index);
+    }
+    else if (index >= 0)
+    {
+        rule_drop(index);
+        rules.rules[index] = rule;
+    }
+    else if (rules.count < ALARM_MAX_RULES)
+    {
+        rules.rules[rules.count] = rule;
+        active[rules.count++] = false;
+    }
+    else
+    {
+        xSemaphoreGive(alarm_lock);
+        return ESP_ERR_NO_MEM;
+    }
+
+    xSemaphoreGive(alarm_lock);
+
+    return ESP_OK;
+}
+
+static esp_err_t rules_clear(const char *value)
+{
+    int channel = strcmp(value, "all") ? name_find(channel_names, CAL_COUNT, value) : -1;
+
+    if (channel < 0 && strcmp(value, "all"))
+        return ESP_ERR_NOT_FOUND;
+
+    xSemaphoreTake(alarm_lock, portMAX_DELAY);
+    for (int i = rules.count - 1; i >= 0; i--)
+    {
+        if (channel < 0 || rules.rules[i].channel == channel)
+            rule_remove(i);
+    }
+    xSemaphoreGive(alarm_lock);
+
+    return ESP_OK;
+}
+
+static esp_err_t alarm_pair(char *name, char *value)
+{
+    char *dot;
+    int channel;
+    int kind;
+
+    if (!strcmp(name, "clear"))
+        return rules_clear(value);
+
+    dot = strchr(name, '.');
+    if (!dot)
+        return ESP_ERR_NOT_FOUND;
+    *dot = 0;
+
+    channel = name_find(channel_names, CAL_COUNT, name);
+    kind = name_find(kind_names, ALARM_KIND_COUNT, dot + 1);
+    *dot = '.';
+    if (channel < 0 || kind < 0)
+        return ESP_ERR_NOT_FOUND;
+
+    return rule_set(channel, kind, value);
+}
+
+// applies a command without storing the rules, returns the number of rejected pairs
+static int alarm_apply(const char *data, int length)
+{
+    char command[ALARM_MAX_COMMAND];
+    char *saveptr;
+    int rejected = 0;
+
+    if (length >= (int)sizeof(command))
+    {
+        ESP_LOGW(LOG_TAG, "command of %d bytes is too long", length);
+        return 1;
+    }
+
+    memcpy(command, data, length);
+    command[length] = 0;
+
+    for (char *pair = strtok_r(command, " ,\r\n\t", &saveptr); pair; pair = strtok_r(NULL, " ,\r\n\t", &saveptr))
+    {
+        char *value = strchr(pair, '=');
+        esp_err_t err;
+
+        if (value)
+        {
+            *value++ = 0;
+            err = alarm_pair(pair, value);
+        }
+        else
+            err = ESP_ERR_INVALID_ARG;
+
+        if (err != ESP_OK)
+        {
+            ESP_LOGW(LOG_TAG, "rejected %s%s%s (%s)", pair, value ? "=" : "", value ? value : "",
+                     esp_err_to_name(err));
+            rejected++;
+        }
+    }
+
+    return rejected;
+}
+
+int alarm_command(const char *data, int length)
+{
+    alarm_rules_t stored;
+    int rejected = alarm_apply(data, length);
+
+    xSemaphoreTake(alarm_lock, portMAX_DELAY);
+    stored = rules;
+    xSemaphoreGive(alarm_lock);
+
+    ESP_LOGI(LOG_TAG, "%d rules", stored.count);
+
+    // the rules are used even if they could not be stored, until the next boot
+    rules_store(&stored);
+
+    return rejected;
+}
+
+void alarm_init(void)
+{
+    nvs_handle_t nvs;
+    size_t length = sizeof(rules);
+    esp_err_t err = nvs_open(ALARM_NVS_NAMESPACE, NVS_READONLY, &nvs);
+
+    alarm_lock = xSemaphoreCreateBinary();
+    xSemaphoreGive(alarm_lock);
+    alarm_queue = xQueueCreate(ALARM_QUEUE_LENGTH, sizeof(alarm_event_t));
+
+    if (err == ESP_OK)
+    {
+        err = nvs_get_blob(nvs, ALARM_NVS_KEY, &rules, &length);
+        nvs_close(nvs);
+    }
+
+    if (err == ESP_OK && (length != sizeof(rules) || rules.version != ALARM_VERSION || rules.count > ALARM_MAX_RULES))
+        err = ESP_ERR_INVALID_VERSION;
+
+    if (err != ESP_OK)
+    {
+        if (err != ESP_ERR_NVS_NOT_FOUND)
+            ESP_LOGW(LOG_TAG, "stored rules are not usable (%s)", esp_err_to_name(err));
+        memset(&rules, 0, sizeof(rules));
+        rules.version = ALARM_VERSION;
+        alarm_apply(ALARM_RULES, strlen(ALARM_RULES));
+    }
+
+    for (int i = 0; i < rules.count; i++)
+        ESP_LOGI(LOG_TAG, "%s %s %g, hysteresis %g", channel_names[rules.rules[i].channel],
+                 kind_names[rules.rules[i].kind], rules.rules[i].threshold, rules.rules[i].hysteresis);
+}
+
+// whether `rule` is active after `value`, `rate`, from the state before
+static bool rule_check(const alarm_rule_t *rule, bool was, float value, float rate)
+{
+    switch (rule->kind)
+    {
+    case ALARM_ABOVE:
+        return was ? value > rule->threshold - rule->hysteresis : value > rule->threshold;
+    case ALARM_BELOW:
+        return was ? value < rule->threshold + rule->hysteresis : value < rule->threshold;
+    case ALARM_RISE:
+        if (isnan(rate))
+            return was;
+        return was ? rate > rule->threshold - rule->hysteresis : rate > rule->threshold;
+    case ALARM_FALL:
+        if (isnan(rate))
+            return was;
+        return was ? -rate > rule->threshold - rule->hysteresis : -rate > rule->threshold;
+    default:
+        return false;
+    }
+}
+
+void alarm_sample(cal_channel_t channel, float value, int64_t time)
+{
+    float rate = NAN;
+
+    if (!alarm_lock)
+        return;
+
+    xSemaphoreTake(alarm_lock, portMAX_DELAY);
+
+    if (last_time[channel] && time > last_time[channel])
+        rate = (value - last_value[channel]) * 60e6f / (time - last_time[channel]);
+    last_value[channel] = value;
+    last_time[channel] = time;
+
+    for (int i = 0; i < rules.count; i++)
+    {
+        bool now;
+
+        if (rules.rules[i].channel != channel)
+            continue;
+
+        now = rule_check(&rules.rules[i], active[i], value, rate);
+        if (now == active[i])
+            continue;
+        active[i] = now;
+        queue_event(&rules.rules[i], now, false, value, rate, time);
+    }
+
+    xSemaphoreGive(alarm_lock);
+}
+
+int alarm_format(char *buffer, size_t size)
+{
+    alarm_rules_t copy;
+    bool copy_active[ALARM_MAX_RULES];
+    size_t used = 0;
+
+#define APPEND(...) used += snprintf(buffer + (used < size ? used : size), used < size ? size - used : 0, __VA_ARGS__)
+
+    xSemaphoreTake(alarm_lock, portMAX_DELAY);
+    copy = rules;
+    memcpy(copy_active, active, sizeof(copy_active));
+    xSemaphoreGive(alarm_lock);
+
+    APPEND("[");
+    for (int i = 0; i < copy.count; i++)
+    {
+        const alarm_rule_t *rule = &copy.rules[i];
+
+        APPEND("%s{\"channel\":\"%s\",\"rule\":\"%s\",\"threshold\":%g,\"hysteresis\":%g,\"active\":%s}",
+               i ? "," : "", channel_names[rule->channel], kind_names[rule->kind], rule->threshold,
+               rule->hysteresis, copy_active[i] ? "true" : "false");
+    }
+    APPEND("]");
+
+#undef APPEND
+
+    return used;
+}
+
+void alarm_task()
+{
+    char topic[128];
+    char value[192];
+
+    snprintf(topic, sizeof(topic), "%s/%s", MQTT_TOPIC_PREFIX, MQTT_TOPIC_ALARM);
+
+    ESP_LOGI(LOG_TAG, "task started");
+
+    for (;;)
+    {
+        alarm_event_t event;
+        int length;
+        uint32_t dropped;
+
+        if (xQueueReceive(alarm_queue, &event, portMAX_DELAY) != pdTRUE)
+            continue;
+
+        length = snprintf(value, sizeof(value),
+                          "{\"channel\":\"%s\",\"rule\":\"%s\",\"threshold\":%g,\"state\":\"%s\",\"value\":%g",
+                          channel_names[event.rule.channel], kind_names[event.rule.kind], event.rule.threshold,
+                          event.raised ? "raised" : "cleared", event.value);
+        if (!isnan(event.rate))
+            length += snprintf(value + length, sizeof(value) - length, ",\"rate\":%.3g", event.rate);
+        if (event.removed)
+            length += snprintf(value + length, sizeof(value) - length, ",\"removed\":true");
+        snprintf(value + length, sizeof(value) - length, ",\"time\":%u}", event.time);
+
+        ESP_LOGI(LOG_TAG, "%s", value);
+
+        // held until MQTT is up, the event keeps its time
+        for (;;)
+        {
+            xEventGroupWaitBits(eg_app_status, MQTT_CONNECTED_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+            if (esp_mqtt_client_publish(mqtt_client, topic, value, 0, 1, 0) >= 0)
+                break;
+            vTaskDelay(ALARM_RETRY_DELAY / portTICK_PERIOD_MS);
+        }
+
+        xSemaphoreTake(alarm_lock, portMAX_DELAY);
+        dropped = lost;
+        lost = 0;
+        xSemaphoreGive(alarm_lock);
+
+        if (dropped)
+            ESP_LOGW(LOG_TAG, "%u events did not fit the queue", dropped);
+    }
+}
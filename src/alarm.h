@@ -0,0 +1,79 @@
+#ifndef _ALARM_H
+#define _ALARM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "calibration.h"
+
+/*
+Threshold alarms. Every valid sample of a channel (the calibration
+channels: pm25, pm100, co2, temp, pres) is checked against the rules of the
+channel as soon as it is taken, in the task of the sensor. A rule that
+fires or clears queues an event which alarm_task() publishes at QoS 1 on
+<prefix>/<MQTT_TOPIC_ALARM> right away, independent of the MQTT_DELAY
+cycle; while MQTT is down the events wait in the queue, up to
+ALARM_QUEUE_LENGTH.
+
+Rule kinds, with a threshold and a hysteresis:
+
+    above  fires over the threshold, clears below threshold - hysteresis
+    below  fires under the threshold, clears above threshold + hysteresis
+    rise   fires when the channel rises faster than the threshold per
+           minute, clears below threshold - hysteresis per minute
+    fall   the same for falling
+
+Thresholds are in the published units: ug/m3, ppm, C and mmHg for pres.
+The rate is taken between consecutive samples. Rules are set at runtime
+on <prefix>/<MQTT_TOPIC_ALARM_RULES>/set, see alarm_command(), stored in
+NVS (namespace ALARM_NVS_NAMESPACE) and published, retained, on
+<prefix>/<MQTT_TOPIC_ALARM_RULES>. ALARM_RULES, a command, gives the rules
+until the first one is stored.
+
+Event: {"channel":"co2","rule":"above","threshold":1500,"state":"raised",
+"value":1523,"rate":61.2,"time":123456}, rate per minute, time in
+milliseconds since boot; "state" is "cleared" when the rule clears, and
+also, with "removed":true and the last value, when a raised rule is
+removed or replaced.
+*/
+
+#define ALARM_NVS_NAMESPACE "alarm"
+
+#define ALARM_MAX_RULES 8
+
+typedef enum
+{
+    ALARM_ABOVE,
+    ALARM_BELOW,
+    ALARM_RISE,
+    ALARM_FALL,
+    ALARM_KIND_COUNT,
+} alarm_kind_t;
+
+// loads the stored rules, call once after nvs_flash_init()
+void alarm_init(void);
+
+// a valid sample of `channel` taken at `time`, microseconds since boot
+void alarm_sample(cal_channel_t channel, float value, int64_t time);
+
+/*
+Runs a command received on <prefix>/<MQTT_TOPIC_ALARM_RULES>/set, pairs
+separated by spaces, commas or new lines:
+    <channel>.<kind>=<threshold>[:<hysteresis>]   adds or replaces the rule
+    <channel>.<kind>=                             removes it
+    clear=<channel>                               removes the rules of the channel
+    clear=all
+e.g. "co2.above=1500:100 pm25.rise=20:5". Returns the number of rejected
+pairs.
+*/
+int alarm_command(const char *data, int length);
+
+// rules and their state as a JSON array, returns the length like snprintf()
+int alarm_format(char *buffer, size_t size);
+
+void alarm_task();
+
+#endif // _ALARM_H
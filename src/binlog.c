@@ -0,0 +1,430 @@
+#include "esp_log.h"
+#define LOG_TAG "binlog"
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_timer.h"
+
+#include "dust_sensor.h"
+#include "binlog.h"
+
+typedef enum
+{
+    ARG_INT,
+    ARG_LONG,
+    ARG_LLONG,
+    ARG_SIZE,
+    ARG_DOUBLE,
+    ARG_STRING,
+    ARG_POINTER,
+    ARG_UNSUPPORTED,
+} arg_type_t;
+
+typedef struct
+{
+    uint16_t length; // of the record, header included
+    uint8_t level;
+    uint32_t time;
+    const char *tag;
+    const char *format;
+} record_head_t;
+
+typedef struct
+{
+    char *buffer;
+    size_t size;
+    size_t used; // may exceed size, like snprintf()
+} text_writer_t;
+
+static SemaphoreHandle_t binlog_lock;
+static uint8_t ring[BINLOG_BUFFER_SIZE];
+static uint32_t ring_head; // bytes ever written
+static uint32_t ring_tail; // start of the oldest record
+static uint32_t head_seq;  // records ever written
+static uint32_t tail_seq;
+static uint32_t dropped; // records larger than BINLOG_MAX_RECORD or with unsupported conversions
+
+/*
+Finds the next conversion from `p` on. Returns its '%', sets `end` past it
+and `type` to the argument it takes, or NULL if there is none. "%%" is
+left to the caller.
+*/
+static const char *find_spec(const char *p, const char **end, arg_type_t *type)
+{
+    while ((p = strchr(p, '%')))
+    {
+        const char *q = p + 1;
+        int longs = 0;
+        bool size = false;
+
+        if (*q == '%')
+        {
+            p = q + 1;
+            continue;
+        }
+
+        q += strspn(q, "-+ #0123456789.");
+        for (; *q && strchr("hlzjt", *q); q++)
+        {
+            longs += *q == 'l' ? 1 : *q == 'j' ? 2 : 0;
+            size |= *q == 'z' || *q == 't';
+        }
+
+        *type = ARG_UNSUPPORTED;
+        if (*q && strchr("diouxXc", *q))
+            *type = longs >= 2 ? ARG_LLONG : longs ? ARG_LONG : size ? ARG_SIZE : ARG_INT;
+        else if (*q && strchr("fFeEgGaA", *q))
+            *type = ARG_DOUBLE;
+        else if (*q == 's')
+            *type = ARG_STRING;
+        else if (*q == 'p')
+            *type = ARG_POINTER;
+
+        *end = *q ? q + 1 : q;
+        return p;
+    }
+
+    return NULL;
+}
+
+#define PUT(value)                                                        \
+    do                                                                    \
+    {                                                                     \
+        if (used + sizeof(value) <= sizeof(record))                       \
+            memcpy(record + used, &(value), sizeof(value));               \
+        used += sizeof(value);                                            \
+    } while (0)
+
+#define GET(value)                                                        \
+    do                                                                    \
+    {                                                                     \
+        if (used + sizeof(value) <= length)                               \
+            memcpy(&(value), record + used, sizeof(value));               \
+        used += sizeof(value);                                            \
+    } while (0)
+
+static void ring_copy_in(uint32_t at, const uint8_t *data, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+        ring[(at + i) % BINLOG_BUFFER_SIZE] = data[i];
+}
+
+static void ring_copy_out(uint32_t at, uint8_t *data, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+        data[i] = ring[(at + i) % BINLOG_BUFFER_SIZE];
+}
+
+void binlog_init(void)
+{
+    // a mutex, so that the drain at priority 1 inherits the priority of a writer waiting for it
+    binlog_lock = xSemaphoreCreateMutex();
+}
+
+void binlog_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    uint8_t record[BINLOG_MAX_RECORD];
+    record_head_t head = {.level = level, .tag = tag, .format = format};
+    size_t used = sizeof(head);
+    const char *p = format;
+    const char *end;
+    arg_type_t type;
+    va_list args;
+
+    if (!binlog_lock)
+        return;
+
+    head.time = esp_timer_get_time() / 1000;
+
+    va_start(args, format);
+    while ((p = find_spec(p, &end, &type)))
+    {
+        switch (type)
+        {
+        case ARG_INT:
+        {
+            int value = va_arg(args, int);
+            PUT(value);
+            break;
+        }
+        case ARG_LONG:
+        {
+            long value = va_arg(args, long);
+            PUT(value);
+            break;
+        }
+        case ARG_LLONG:
+        {
+            long long value = va_arg(args, long long);
+            PUT(value);
+            break;
+        }
+        case ARG_SIZE:
+        {
+            size_t value = va_arg(args, size_t);
+            PUT(value);
+            break;
+        }
+        case ARG_DOUBLE:
+        {
+            double value = va_arg(args, double);
+            PUT(value);
+            break;
+        }
+        case ARG_POINTER:
+        {
+            void *value = va_arg(args, void *);
+            PUT(value);
+            break;
+        }
+        case ARG_STRING:
+        {
+            const char *value = va_arg(args, const char *);
+            uint8_t length = value ? strnlen(value, BINLOG_MAX_STRING) : 0;
+
+            PUT(length);
+            if (used + length <= sizeof(record))
+                memcpy(record + used, value, length);
+            used += length;
+            break;
+        }
+        case ARG_UNSUPPORTED:
+            used = sizeof(record) + 1;
+            break;
+        }
+        p = end;
+    }
+    va_end(args);
+
+    xSemaphoreTake(binlog_lock, portMAX_DELAY);
+
+    if (used > sizeof(record))
+    {
+        dropped++;
+        xSemaphoreGive(binlog_lock);
+        return;
+    }
+
+    head.length = used;
+    memcpy(record, &head, sizeof(head));
+
+    // the oldest records make room
+    while (ring_head + used - ring_tail > BINLOG_BUFFER_SIZE)
+    {
+        uint16_t length;
+
+        ring_copy_out(ring_tail, (uint8_t *)&length, sizeof(length));
+        ring_tail += length;
+        tail_seq++;
+    }
+
+    ring_copy_in(ring_head, record, used);
+    ring_head += used;
+    head_seq++;
+
+    xSemaphoreGive(binlog_lock);
+}
+
+static void put_text(text_writer_t *w, const char *text, size_t length)
+{
+    if (w->used < w->size)
+    {
+        size_t n = length < w->size - w->used - 1 ? length : w->size - w->used - 1;
+
+        memcpy(w->buffer + w->used, text, n);
+        w->buffer[w->used + n] = 0;
+    }
+    w->used += length;
+}
+
+// literal text of a format, "%%" is a percent sign
+static void put_literal(text_writer_t *w, const char *p, const char *end)
+{
+    while (p < end)
+    {
+        const char *percent = memchr(p, '%', end - p);
+        size_t length = percent ? (size_t)(percent - p) : (size_t)(end - p);
+
+        put_text(w, p, length);
+        if (!percent)
+            return;
+        put_text(w, "%", 1);
+        p = percent + (percent + 1 < end && percent[1] == '%' ? 2 : 1);
+    }
+}
+
+// formats one conversion, `spec` to `end`, with its argument at `used`
+static size_t put_spec(text_writer_t *w, const char *spec, const char *end, arg_type_t type, const uint8_t *record,
+                       size_t used, size_t length)
+{
+    char format[24];
+    char value[64];
+    char string[BINLOG_MAX_STRING + 1];
+
+    if ((size_t)(end - spec) >= sizeof(format))
+    {
+        put_text(w, spec, end - spec);
+        return length;
+    }
+    memcpy(format, spec, end - spec);
+    format[end - spec] = 0;
+    value[0] = 0;
+
+    switch (type)
+    {
+    case ARG_INT:
+    {
+        int v = 0;
+        GET(v);
+        snprintf(value, sizeof(value), format, v);
+        break;
+    }
+    case ARG_LONG:
+    {
+        long v = 0;
+        GET(v);
+        snprintf(value, sizeof(value), format, v);
+        break;
+    }
+    case ARG_LLONG:
+    {
+        long long v = 0;
+        GET(v);
+        snprintf(value, sizeof(value), format, v);
+        break;
+    }
+    case ARG_SIZE:
+    {
+        size_t v = 0;
+        GET(v);
+        snprintf(value, sizeof(value), format, v);
+        break;
+    }
+    case ARG_DOUBLE:
+    {
+        double v = 0;
+        GET(v);
+        snprintf(value, sizeof(value), format, v);
+        break;
+    }
+    case ARG_POINTER:
+    {
+        void *v = NULL;
+        GET(v);
+        snprintf(value, sizeof(value), format, v);
+        break;
+    }
+    case ARG_STRING:
+    {
+        uint8_t n = 0;
+        GET(n);
+        if (used + n > length)
+            n = 0;
+        memcpy(string, record + used, n);
+        string[n] = 0;
+        used += n;
+        snprintf(value, sizeof(value), format, string);
+        break;
+    }
+    case ARG_UNSUPPORTED:
+        break;
+    }
+
+    put_text(w, value, strlen(value));
+
+    return used;
+}
+
+int binlog_read(binlog_reader_t *reader, esp_log_level_t level, binlog_entry_t *entry, char *text, size_t size)
+{
+    uint8_t record[BINLOG_MAX_RECORD];
+    record_head_t head;
+    text_writer_t w = {text, size, 0};
+    const char *p;
+    const char *spec;
+    const char *end;
+    arg_type_t type;
+    size_t used;
+
+    xSemaphoreTake(binlog_lock, portMAX_DELAY);
+
+    if ((int32_t)(reader->seq - tail_seq) < 0 || (int32_t)(reader->seq - head_seq) > 0)
+    {
+        reader->missed += tail_seq - reader->seq;
+        reader->seq = tail_seq;
+        reader->position = ring_tail;
+    }
+
+    for (;;)
+    {
+        if (reader->seq == head_seq)
+        {
+            xSemaphoreGive(binlog_lock);
+            return -1;
+        }
+
+        ring_copy_out(reader->position, (uint8_t *)&head, sizeof(head));
+        reader->position += head.length;
+        reader->seq++;
+        if (head.level <= level)
+            break;
+    }
+
+    ring_copy_out(reader->position - head.length, record, head.length);
+
+    xSemaphoreGive(binlog_lock);
+
+    entry->level = head.level;
+    entry->tag = head.tag;
+    entry->time = head.time;
+
+    if (size)
+        text[0] = 0;
+    used = sizeof(head);
+    for (p = head.format; (spec = find_spec(p, &end, &type)); p = end)
+    {
+        put_literal(&w, p, spec);
+        used = put_spec(&w, spec, end, type, record, used, head.length);
+    }
+    put_literal(&w, p, p + strlen(p));
+
+    return w.used;
+}
+
+void binlog_task()
+{
+    static binlog_reader_t serial;
+    char text[256];
+
+    for (;;)
+    {
+        esp_log_level_t level;
+        binlog_entry_t entry;
+        uint32_t count;
+
+        vTaskDelay(BINLOG_DRAIN_DELAY / portTICK_PERIOD_MS);
+
+        level = config_get_int(CONFIG_LOG_SERIAL);
+        while (binlog_read(&serial, level, &entry, text, sizeof(text)) >= 0)
+        {
+            if (serial.missed)
+            {
+                ESP_LOGW(LOG_TAG, "%u records overwritten before the console got them", serial.missed);
+                serial.missed = 0;
+            }
+            // at info, so that the runtime log levels of the tags do not filter them again
+            ESP_LOGI(entry.tag, "%c (%u) %s", "NEWIDV"[entry.level], entry.time, text);
+        }
+
+        xSemaphoreTake(binlog_lock, portMAX_DELAY);
+        count = dropped;
+        dropped = 0;
+        xSemaphoreGive(binlog_lock);
+
+        if (count)
+            ESP_LOGW(LOG_TAG, "%u records dropped, too large or with unsupported conversions", count);
+    }
+}
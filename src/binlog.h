@@ -0,0 +1,70 @@
+#ifndef _BINLOG_H
+#define _BINLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_log.h"
+
+/*
+Deferred logging for the sampling and publishing paths. BLOGD() and
+BLOGV() take ESP_LOGD() arguments but do not format: the record is the
+format string pointer, which stays in flash and serves as its id, the tag
+pointer, a timestamp and the arguments in binary, copied into a RAM ring
+of BINLOG_BUFFER_SIZE bytes. String arguments are copied, up to
+BINLOG_MAX_STRING characters. When the ring is full the oldest records
+are overwritten.
+
+Records are formatted only when they are read: by binlog_task() on the
+serial console, up to the level in the runtime setting "log_serial"
+(config.h, 0 none to 5 verbose), and on request over MQTT, see mqtt.c.
+Each reader has its own position and learns how many records were
+overwritten before it got to them.
+
+Formats are checked like printf(). Conversions with '*' or 'n' are not
+supported.
+*/
+
+#define BINLOG_MAX_RECORD 128 // bytes, header included; larger records are dropped
+#define BINLOG_MAX_STRING 32
+
+#define BLOG_LEVEL_LOCAL(level, tag, format, ...)                  \
+    do                                                             \
+    {                                                              \
+        if (BINLOG_LEVEL >= level)                                 \
+            binlog_write(level, tag, format, ##__VA_ARGS__);       \
+    } while (0)
+
+#define BLOGD(tag, format, ...) BLOG_LEVEL_LOCAL(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+#define BLOGV(tag, format, ...) BLOG_LEVEL_LOCAL(ESP_LOG_VERBOSE, tag, format, ##__VA_ARGS__)
+
+typedef struct
+{
+    uint32_t seq;      // of the next record to read
+    uint32_t position; // of that record in the ring
+    uint32_t missed;   // records overwritten before they were read; the reader resets it
+} binlog_reader_t;
+
+typedef struct
+{
+    esp_log_level_t level;
+    const char *tag;
+    uint32_t time; // milliseconds since boot
+} binlog_entry_t;
+
+void binlog_init(void);
+
+void binlog_write(esp_log_level_t level, const char *tag, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+/*
+Formats the next record of at most `level` for `reader` into `text`, without
+the tag and time, which go to `entry`. Records above `level` are skipped.
+Returns the length like snprintf(), or -1 if there is none.
+*/
+int binlog_read(binlog_reader_t *reader, esp_log_level_t level, binlog_entry_t *entry, char *text, size_t size);
+
+// drains the ring to the serial console every BINLOG_DRAIN_DELAY
+void binlog_task();
+
+#endif // _BINLOG_H
@@ -0,0 +1,424 @@
+#include "esp_log.h"
+#define LOG_TAG "calibration"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_timer.h"
+#include "nvs.h"
+
+#include "dust_sensor.h"
+
+#define CAL_MAX_COMMAND 256
+#define CAL_VERSION 1
+
+// raw values closer than this are one point for the slope
+#define CAL_MIN_SPREAD 1e-6
+
+// what is stored per channel
+typedef struct
+{
+    uint8_t version;
+    uint8_t segments;
+    float breaks[CAL_MAX_SEGMENTS - 1];
+    cal_fit_t fits[CAL_MAX_SEGMENTS];
+} cal_state_t;
+
+typedef struct
+{
+    cal_state_t state;
+    float a[CAL_MAX_SEGMENTS];
+    float b[CAL_MAX_SEGMENTS];
+    float last_raw;
+    int64_t last_time; // esp_timer_get_time() of last_raw, 0 if none
+} cal_channel_state_t;
+
+static const char *const channel_names[CAL_COUNT] = {
+    [CAL_PM25] = "pm25",
+    [CAL_PM100] = "pm100",
+    [CAL_CO2] = "co2",
+    [CAL_TEMP] = "temp",
+    [CAL_PRES] = "pres",
+};
+
+static cal_channel_state_t channels[CAL_COUNT];
+static SemaphoreHandle_t cal_lock;
+
+void cal_fit_add(cal_fit_t *fit, double raw, double ref)
+{
+    double d_raw = raw - fit->mean_raw;
+
+    fit->count++;
+    fit->mean_raw += d_raw / fit->count;
+    fit->mean_ref += (ref - fit->mean_ref) / fit->count;
+    fit->m2_raw += d_raw * (raw - fit->mean_raw);
+    fit->c_raw_ref += d_raw * (ref - fit->mean_ref);
+}
+
+bool cal_fit_line(const cal_fit_t *fit, double *a, double *b)
+{
+    if (!fit->count)
+        return false;
+
+    if (fit->count > 1 && fit->m2_raw / fit->count > CAL_MIN_SPREAD)
+        *a = fit->c_raw_ref / fit->m2_raw;
+    else
+        *a = 1;
+    *b = fit->mean_ref - *a * fit->mean_raw;
+
+    return true;
+}
+
+static uint32_t channel_max_age(cal_channel_t channel)
+{
+    switch (channel)
+    {
+    case CAL_PM25:
+    case CAL_PM100:
+        return DUST_MAX_AGE;
+    case CAL_CO2:
+        return CO2_MAX_AGE;
+    default:
+        return BMP_MAX_AGE;
+    }
+}
+
+static int channel_segment(const cal_state_t *state, float raw)
+{
+    int segment = 0;
+
+    while (segment < state->segments - 1 && raw >= state->breaks[segment])
+        segment++;
+
+    return segment;
+}
+
+// the range itself if it has pairs, the nearest one that has otherwise, -1 if none has
+static int channel_fitted_segment(const cal_state_t *state, int segment)
+{
+    for (int distance = 0; distance < state->segments; distance++)
+    {
+        if (segment - distance >= 0 && state->fits[segment - distance].count)
+            return segment - distance;
+        if (segment + distance < state->segments && state->fits[segment + distance].count)
+            return segment + distance;
+    }
+
+    return -1;
+}
+
+static void channel_update_lines(cal_channel_state_t *channel)
+{
+    for (int i = 0; i < channel->state.segments; i++)
+    {
+        double a = 1, b = 0;
+
+        cal_fit_line(&channel->state.fits[i], &a, &b);
+        channel->a[i] = a;
+        channel->b[i] = b;
+    }
+}
+
+static void channel_clear(cal_state_t *state)
+{
+    memset(state, 0, sizeof(*state));
+    state->version = CAL_VERSION;
+    state->segments = 1;
+}
+
+static esp_err_t channel_store(cal_channel_t channel, const cal_state_t *state)
+{
+    nvs_handle_t nvs;
+    esp_err_t err;
+
+    err = nvs_open(CALIBRATION_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK)
+        return err;
+
+    err = nvs_set_blob(nvs, channel_names[channel], state, sizeof(*state));
+    if (err == ESP_OK)
+        err = nvs_commit(nvs);
+    nvs_close(nvs);
+
+    if (err != ESP_OK)
+        ESP_LOGE(LOG_TAG, "can't store %s (%s)", channel_names[channel], esp_err_to_name(err));
+
+    return err;
+}
+
+void calibration_init(void)
+{
+    nvs_handle_t nvs;
+    bool stored = nvs_open(CALIBRATION_NVS_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK;
+
+    cal_lock = xSemaphoreCreateBinary();
+
+    for (int i = 0; i < CAL_COUNT; i++)
+    {
+        cal_state_t *state = &channels[i].state;
+        size_t length = sizeof(*state);
+        esp_err_t err = stored ? nvs_get_blob(nvs, channel_names[i], state, &length) : ESP_ERR_NVS_NOT_FOUND;
+
+        if (err == ESP_OK && (length != sizeof(*state) || state->version != CAL_VERSION ||
+                              state->segments < 1 || state->segments > CAL_MAX_SEGMENTS))
+            err = ESP_ERR_INVALID_VERSION;
+
+        if (err != ESP_OK)
+        {
+            if (err != ESP_ERR_NVS_NOT_FOUND)
+                ESP_LOGW(LOG_TAG, "stored %s is not usable (%s), uncalibrated", channel_names[i],
+                         esp_err_to_name(err));
+            channel_clear(state);
+        }
+        channel_update_lines(&channels[i]);
+
+        for (int s = 0; s < state->segments; s++)
+        {
+            if (state->fits[s].count)
+                ESP_LOGI(LOG_TAG, "%s range %d: %u pairs, a %f, b %f", channel_names[i], s,
+                         state->fits[s].count, channels[i].a[s], channels[i].b[s]);
+        }
+    }
+
+    if (stored)
+        nvs_close(nvs);
+
+    xSemaphoreGive(cal_lock);
+}
+
+bool calibration_apply(cal_channel_t channel, float raw, float *corrected)
+{
+    cal_channel_state_t *c = &channels[channel];
+    int segment;
+
+    xSemaphoreTake(cal_lock, portMAX_DELAY);
+
+    c->last_raw = raw;
+    c->last_time = esp_timer_get_time();
+
+    segment = channel_fitted_segment(&c->state, channel_segment(&c->state, raw));
+    *corrected = segment < 0 ? raw : c->a[segment] * raw + c->b[segment];
+
+    xSemaphoreGive(cal_lock);
+
+    return segment >= 0;
+}
+
+esp_err_t calibration_add_reference(cal_channel_t channel, float ref)
+{
+    cal_channel_state_t *c = &channels[channel];
+    cal_state_t state;
+    uint32_t max_age = channel_max_age(channel);
+    int segment;
+    float raw;
+
+    if (!isfinite(ref))
+        return ESP_ERR_INVALID_ARG;
+
+    xSemaphoreTake(cal_lock, portMAX_DELAY);
+
+    if (!c->last_time || sample_effective_status(SAMPLE_VALID, c->last_time, max_age) != SAMPLE_VALID)
+    {
+        xSemaphoreGive(cal_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    raw = c->last_raw;
+    segment = channel_segment(&c->state, raw);
+    cal_fit_add(&c->state.fits[segment], raw, ref);
+    channel_update_lines(c);
+    state = c->state;
+
+    xSemaphoreGive(cal_lock);
+
+    ESP_LOGI(LOG_TAG, "%s: raw %f paired with reference %f, range %d: %u pairs, a %f, b %f",
+             channel_names[channel], raw, ref, segment, state.fits[segment].count, c->a[segment],
+             c->b[segment]);
+
+    // the new line is used even if it could not be stored, until the next boot
+    channel_store(channel, &state);
+
+    return ESP_OK;
+}
+
+esp_err_t calibration_set_breaks(cal_channel_t channel, const float *breaks, int count)
+{
+    cal_state_t state;
+
+    if (count < 0 || count > CAL_MAX_SEGMENTS - 1)
+        return ESP_ERR_INVALID_SIZE;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (!isfinite(breaks[i]) || (i && breaks[i] <= breaks[i - 1]))
+            return ESP_ERR_INVALID_ARG;
+    }
+
+    channel_clear(&state);
+    state.segments = count + 1;
+    memcpy(state.breaks, breaks, count * sizeof(float));
+
+    xSemaphoreTake(cal_lock, portMAX_DELAY);
+    channels[channel].state = state;
+    channel_update_lines(&channels[channel]);
+    xSemaphoreGive(cal_lock);
+
+    ESP_LOGI(LOG_TAG, "%s split in %d ranges, pairs dropped", channel_names[channel], state.segments);
+
+    channel_store(channel, &state);
+
+    return ESP_OK;
+}
+
+void calibration_reset(cal_channel_t channel)
+{
+    cal_state_t state;
+
+    xSemaphoreTake(cal_lock, portMAX_DELAY);
+    for (int i = 0; i < CAL_MAX_SEGMENTS; i++)
+        memset(&channels[channel].state.fits[i], 0, sizeof(cal_fit_t));
+    channel_update_lines(&channels[channel]);
+    state = channels[channel].state;
+    xSemaphoreGive(cal_lock);
+
+    ESP_LOGI(LOG_TAG, "%s reset", channel_names[channel]);
+
+    channel_store(channel, &state);
+}
+
+static int channel_find(const char *name)
+{
+    for (int i = 0; i < CAL_COUNT; i++)
+    {
+        if (!strcmp(channel_names[i], name))
+            return i;
+    }
+
+    return -1;
+}
+
+static esp_err_t parse_breaks(cal_channel_t channel, char *list)
+{
+    float breaks[CAL_MAX_SEGMENTS - 1];
+    char *saveptr;
+    int count = 0;
+
+    for (char *item = strtok_r(list, ":", &saveptr); item; item = strtok_r(NULL, ":", &saveptr))
+    {
+        char *end;
+
+        if (count == CAL_MAX_SEGMENTS - 1)
+            return ESP_ERR_INVALID_SIZE;
+        breaks[count++] = strtof(item, &end);
+        if (end == item || *end)
+            return ESP_ERR_INVALID_ARG;
+    }
+
+    return calibration_set_breaks(channel, breaks, count);
+}
+
+static esp_err_t calibration_pair(char *name, char *value)
+{
+    int channel;
+    char *end;
+    float ref;
+
+    if (!strcmp(name, "reset"))
+    {
+        channel = channel_find(value);
+        if (channel < 0)
+            return ESP_ERR_NOT_FOUND;
+        calibration_reset(channel);
+        return ESP_OK;
+    }
+
+    if (!strncmp(name, "breaks.", 7))
+    {
+        channel = channel_find(name + 7);
+        return channel < 0 ? ESP_ERR_NOT_FOUND : parse_breaks(channel, value);
+    }
+
+    channel = channel_find(name);
+    if (channel < 0)
+        return ESP_ERR_NOT_FOUND;
+
+    ref = strtof(value, &end);
+    if (end == value || *end)
+        return ESP_ERR_INVALID_ARG;
+
+    return calibration_add_reference(channel, ref);
+}
+
+int calibration_command(const char *data, int length)
+{
+    char command[CAL_MAX_COMMAND];
+    char *saveptr;
+    int rejected = 0;
+
+    if (length >= (int)sizeof(command))
+    {
+        ESP_LOGW(LOG_TAG, "command of %d bytes is too long", length);
+        return 1;
+    }
+
+    memcpy(command, data, length);
+    command[length] = 0;
+
+    for (char *pair = strtok_r(command, " ,\r\n\t", &saveptr); pair; pair = strtok_r(NULL, " ,\r\n\t", &saveptr))
+    {
+        char *value = strchr(pair, '=');
+        esp_err_t err;
+
+        if (value)
+        {
+            *value++ = 0;
+            err = calibration_pair(pair, value);
+        }
+        else
+            err = ESP_ERR_INVALID_ARG;
+
+        if (err != ESP_OK)
+        {
+            ESP_LOGW(LOG_TAG, "rejected %s%s%s (%s)", pair, value ? "=" : "", value ? value : "",
+                     esp_err_to_name(err));
+            rejected++;
+        }
+    }
+
+    return rejected;
+}
+
+int calibration_format(char *buffer, size_t size)
+{
+    cal_channel_state_t copy[CAL_COUNT];
+    size_t used = 0;
+
+#define APPEND(...) used += snprintf(buffer + (used < size ? used : size), used < size ? size - used : 0, __VA_ARGS__)
+
+    xSemaphoreTake(cal_lock, portMAX_DELAY);
+    memcpy(copy, channels, sizeof(copy));
+    xSemaphoreGive(cal_lock);
+
+    APPEND("{");
+    for (int i = 0; i < CAL_COUNT; i++)
+    {
+        const cal_state_t *state = &copy[i].state;
+
+        APPEND("%s\"%s\":[", i ? "," : "", channel_names[i]);
+        for (int s = 0; s < state->segments; s++)
+        {
+            APPEND("%s{", s ? "," : "");
+            if (s)
+                APPEND("\"from\":%g,", state->breaks[s - 1]);
+            APPEND("\"pairs\":%u,\"a\":%.6g,\"b\":%.6g}", state->fits[s].count, copy[i].a[s], copy[i].b[s]);
+        }
+        APPEND("]");
+    }
+    APPEND("}");
+
+#undef APPEND
+
+    return used;
+}
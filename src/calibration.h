@@ -0,0 +1,106 @@
+#ifndef _CALIBRATION_H
+#define _CALIBRATION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/*
+On-device calibration. Reference readings, from a trusted instrument next to
+the unit, are paired with the unit's latest raw reading of the channel and
+fitted as reference = a * raw + b by least squares. The fit is incremental
+(running means and co-moments), so it takes O(1) memory however many pairs
+are given, and is stored in NVS (namespace CALIBRATION_NVS_NAMESPACE, one
+blob per channel) after every pair.
+
+A channel may be split at breakpoints into up to CAL_MAX_SEGMENTS ranges of
+the raw value, each with its own line, for sensors whose error is not
+linear over the whole range. A range without pairs uses the line of the
+nearest range that has some. One pair gives an offset, two or more spread
+out pairs a slope as well.
+
+Adding a reference is not idempotent. Commands on the calibrate topic must
+never be published retained; retained ones are ignored, since they would
+be paired again with a later raw reading at every reconnect. At QoS 1 the
+broker may deliver a command twice (after a lost PUBACK), which adds the
+pair twice and weighs it double in the fit; check "pairs" in the
+published calibration and reset the channel if it is off.
+*/
+
+#define CALIBRATION_NVS_NAMESPACE "calibration"
+
+#define CAL_MAX_SEGMENTS 4
+
+typedef enum
+{
+    CAL_PM25,
+    CAL_PM100,
+    CAL_CO2,
+    CAL_TEMP,
+    CAL_PRES,
+    CAL_COUNT,
+} cal_channel_t;
+
+/*
+Running least-squares state of one range, Welford's update of the means,
+the variance of raw values and their covariance with the references.
+*/
+typedef struct
+{
+    uint32_t count;
+    double mean_raw;
+    double mean_ref;
+    double m2_raw;
+    double c_raw_ref;
+} cal_fit_t;
+
+void cal_fit_add(cal_fit_t *fit, double raw, double ref);
+
+/*
+Line of the fit. With fewer than two distinct raw values only the offset is
+fitted and `a` is 1. Returns false if the fit has no pairs.
+*/
+bool cal_fit_line(const cal_fit_t *fit, double *a, double *b);
+
+// loads the stored fits, call once after nvs_flash_init()
+void calibration_init(void);
+
+/*
+Corrects a raw reading of `channel` and remembers it for pairing with the
+next reference. Returns false, and `raw` in `corrected`, if the channel has
+no calibration.
+*/
+bool calibration_apply(cal_channel_t channel, float raw, float *corrected);
+
+/*
+Pairs a reference reading with the latest raw reading of `channel`.
+ESP_ERR_INVALID_STATE if there is no recent raw reading.
+*/
+esp_err_t calibration_add_reference(cal_channel_t channel, float ref);
+
+/*
+Splits `channel` at `count` increasing raw values, 0 for a single line. The
+channel's pairs are dropped.
+*/
+esp_err_t calibration_set_breaks(cal_channel_t channel, const float *breaks, int count);
+
+// drops the channel's pairs, it is uncalibrated again
+void calibration_reset(cal_channel_t channel);
+
+/*
+Runs a command received on <prefix>/calibrate, pairs separated by spaces,
+commas or new lines:
+    <channel>=<reference>            a reference reading, e.g. temp=21.4
+    breaks.<channel>=<b1>:<b2>...    breakpoints, empty for a single line
+    reset=<channel>
+Channels are pm25, pm100, co2, temp and pres. Returns the number of rejected
+pairs.
+*/
+int calibration_command(const char *data, int length);
+
+// lines of all channels as a JSON object, returns the length like snprintf()
+int calibration_format(char *buffer, size_t size);
+
+#endif // _CALIBRATION_H
@@ -0,0 +1,169 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "esp_timer.h"
+
+#include "pms7003.h"
+#include "mhz19.h"
+#include "bmp.h"
+
+#include "capture.h"
+
+#define CAPTURE_MAGIC0 'D'
+#define CAPTURE_MAGIC1 'C'
+
+static SemaphoreHandle_t capture_lock;
+static uint8_t *capture_buffer;
+static size_t capture_size;
+static size_t capture_length;
+static uint16_t capture_seq;
+static uint32_t capture_lost;
+
+static void capture_append(uint8_t type, const uint8_t *prefix, uint8_t prefix_length,
+                           const uint8_t *data, uint8_t length)
+{
+    uint32_t now = esp_timer_get_time() / 1000;
+    uint8_t *p;
+
+    if (!capture_buffer)
+        return;
+
+    xSemaphoreTake(capture_lock, portMAX_DELAY);
+
+    if (capture_length + CAPTURE_RECORD_HEADER + prefix_length + length > capture_size)
+    {
+        capture_lost++;
+        xSemaphoreGive(capture_lock);
+        return;
+    }
+
+    p = capture_buffer + capture_length;
+    p[0] = type;
+    p[1] = now & 0xff;
+    p[2] = (now >> 8) & 0xff;
+    p[3] = (now >> 16) & 0xff;
+    p[4] = now >> 24;
+    p[5] = prefix_length + length;
+    memcpy(p + CAPTURE_RECORD_HEADER, prefix, prefix_length);
+    memcpy(p + CAPTURE_RECORD_HEADER + prefix_length, data, length);
+    capture_length += CAPTURE_RECORD_HEADER + prefix_length + length;
+
+    xSemaphoreGive(capture_lock);
+}
+
+void capture_record(uint8_t type, const uint8_t *data, uint8_t length)
+{
+    capture_append(type, NULL, 0, data, length);
+}
+
+static void capture_pms_tap(int tx, const uint8_t *data, int length)
+{
+    capture_record(CAPTURE_PMS7003 | (tx ? CAPTURE_FLAG_TX : 0), data, length);
+}
+
+static void capture_mhz19_tap(int tx, const uint8_t *data, int length)
+{
+    capture_record(CAPTURE_MHZ19 | (tx ? CAPTURE_FLAG_TX : 0), data, length);
+}
+
+static void capture_bmp_tap(int tx, uint8_t reg, const uint8_t *data, int length, int result)
+{
+    uint8_t type = CAPTURE_BMP280 | (tx ? CAPTURE_FLAG_TX : 0) | (result ? CAPTURE_FLAG_ERROR : 0);
+
+    capture_append(type, &reg, 1, data, length);
+}
+
+esp_err_t capture_start(size_t size)
+{
+    uint8_t *buffer;
+
+    if (size <= CAPTURE_CHUNK_HEADER)
+        return ESP_ERR_INVALID_SIZE;
+
+    buffer = malloc(size);
+    if (!buffer)
+        return ESP_ERR_NO_MEM;
+
+    capture_lock = xSemaphoreCreateBinary();
+    xSemaphoreGive(capture_lock);
+
+    // the chunk header is written in front of the records by capture_take()
+    capture_size = size - CAPTURE_CHUNK_HEADER;
+    capture_buffer = buffer;
+
+    pms_set_tap(capture_pms_tap);
+    mhz19_set_tap(capture_mhz19_tap);
+    bmp_set_tap(capture_bmp_tap);
+
+    return ESP_OK;
+}
+
+int capture_take(uint8_t *out, int size)
+{
+    int length = 0;
+
+    if (!capture_buffer)
+        return 0;
+
+    xSemaphoreTake(capture_lock, portMAX_DELAY);
+
+    if (capture_length && CAPTURE_CHUNK_HEADER + capture_length <= size)
+    {
+        out[0] = CAPTURE_MAGIC0;
+        out[1] = CAPTURE_MAGIC1;
+        out[2] = CAPTURE_VERSION;
+        out[3] = capture_seq & 0xff;
+        out[4] = capture_seq >> 8;
+        memcpy(out + CAPTURE_CHUNK_HEADER, capture_buffer, capture_length);
+
+        length = CAPTURE_CHUNK_HEADER + capture_length;
+        capture_length = 0;
+        capture_seq++;
+    }
+
+    xSemaphoreGive(capture_lock);
+
+    return length;
+}
+
+uint32_t capture_dropped()
+{
+    return capture_lost;
+}
+
+int capture_parse(const uint8_t *data, size_t length, size_t *pos, capture_record_t *record)
+{
+    size_t p = *pos;
+
+    // record types never have the value of the first magic byte
+    while (p < length && data[p] == CAPTURE_MAGIC0)
+    {
+        if (length - p < CAPTURE_CHUNK_HEADER || data[p + 1] != CAPTURE_MAGIC1 || data[p + 2] != CAPTURE_VERSION)
+            return -1;
+        p += CAPTURE_CHUNK_HEADER;
+    }
+
+    if (p == length)
+    {
+        *pos = p;
+        return 0;
+    }
+
+    if (length - p < CAPTURE_RECORD_HEADER || length - p - CAPTURE_RECORD_HEADER < data[p + 5])
+        return -1;
+
+    if ((data[p] & CAPTURE_SOURCE_MASK) < CAPTURE_PMS7003 || (data[p] & CAPTURE_SOURCE_MASK) > CAPTURE_BMP280)
+        return -1;
+
+    record->type = data[p];
+    record->time = data[p + 1] | data[p + 2] << 8 | data[p + 3] << 16 | (uint32_t)data[p + 4] << 24;
+    record->length = data[p + 5];
+    record->data = data + p + CAPTURE_RECORD_HEADER;
+
+    *pos = p + CAPTURE_RECORD_HEADER + record->length;
+
+    return 1;
+}
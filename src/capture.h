@@ -0,0 +1,64 @@
+#ifndef _CAPTURE_H
+#define _CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/*
+Field capture of the raw sensor traffic: bytes exchanged with the PMS7003
+and MH-Z19 and BMP280 register reads and writes, with timestamps. Records
+are collected in RAM and published in chunks to MQTT_TOPIC_CAPTURE; the
+host replay tool feeds them back through the drivers.
+
+Chunk: 'D' 'C' version seq_lo seq_hi, then records until the end of the
+payload. Record: type, time in milliseconds since boot (4 bytes, little
+endian), length, data. For the BMP280 the data is the register address
+followed by the register values. Chunks can be concatenated into one file.
+*/
+
+#define CAPTURE_VERSION 1
+#define CAPTURE_CHUNK_HEADER 5
+#define CAPTURE_RECORD_HEADER 6
+
+#define CAPTURE_PMS7003 1
+#define CAPTURE_MHZ19 2
+#define CAPTURE_BMP280 3
+
+#define CAPTURE_SOURCE_MASK 0x3f
+#define CAPTURE_FLAG_ERROR 0x40 // I2C transaction failed
+#define CAPTURE_FLAG_TX 0x80    // sent to the sensor
+
+typedef struct
+{
+    uint8_t type;
+    uint32_t time; // milliseconds
+    uint8_t length;
+    const uint8_t *data;
+} capture_record_t;
+
+/*
+Installs the driver taps and starts recording into a buffer of `size` bytes.
+Records that do not fit until the next capture_take() are dropped. Returns
+ESP_ERR_NO_MEM, and leaves capture off, if the buffer can't be allocated.
+*/
+esp_err_t capture_start(size_t size);
+
+void capture_record(uint8_t type, const uint8_t *data, uint8_t length);
+
+/*
+Moves the buffered records into `out` as one chunk. Returns its length, 0 if
+nothing was recorded.
+*/
+int capture_take(uint8_t *out, int size);
+
+uint32_t capture_dropped();
+
+/*
+Parses the record at `*pos` of a capture, skipping chunk headers. Returns 1
+and advances `*pos`, 0 at the end, -1 if the data is malformed.
+*/
+int capture_parse(const uint8_t *data, size_t length, size_t *pos, capture_record_t *record);
+
+#endif // _CAPTURE_H
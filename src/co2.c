@@ -1,11 +1,80 @@
-#define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
 #include "esp_log.h"
 #define LOG_TAG "TASK: co2"
 
+#include <math.h>
+
+#include "esp_timer.h"
+
 #include "dust_sensor.h"
 
 #define CO2_MAX_FAILS 20
 
+static sample_stats_t co2_stats;
+
+static const filter_config_t co2_filter_config = FILTER_CO2;
+
+static filter_t co2_filter;
+
+static ventilation_t ventilation;
+
+static sample_status_t co2_read_frame(mhz19_values_t *frame)
+{
+    sample_status_t status = sample_status_from_err(mhz19_fill_values(frame));
+
+    if (status == SAMPLE_VALID && (frame->ppm < CO2_MIN_PPM || frame->ppm > CO2_MAX_PPM))
+        status = SAMPLE_OUT_OF_RANGE;
+
+    latency_point(LATENCY_CO2, LATENCY_DECODED);
+    sample_stats_count(&co2_stats, status);
+    stream_co2(status, frame->ppm);
+
+    return status;
+}
+
+static sample_status_t co2_read_frames(mhz19_values_t *result, uint8_t *used, uint8_t frames)
+{
+    /*
+    Read up to `frames` valid frames and aggregate them with
+    SAMPLE_AGGREGATE. Gives up after twice as many attempts as requested and
+    returns the status of the last failed frame.
+    */
+
+    uint16_t ppm[AGGREGATE_MAX_FRAMES];
+    uint8_t valid = 0;
+    uint8_t attempts = 0;
+    sample_status_t status = SAMPLE_TIMEOUT;
+
+    if (frames > AGGREGATE_MAX_FRAMES)
+        frames = AGGREGATE_MAX_FRAMES;
+
+    while (valid < frames && attempts < frames * 2)
+    {
+        mhz19_values_t frame;
+
+        if (attempts > 0)
+            vTaskDelay(CO2_FRAME_DELAY / portTICK_PERIOD_MS);
+        attempts++;
+
+        status = co2_read_frame(&frame);
+        if (status != SAMPLE_VALID)
+        {
+            BLOGD(LOG_TAG, "invalid frame (%s), skipping", sample_status_name(status));
+            continue;
+        }
+
+        ppm[valid++] = frame.ppm;
+    }
+
+    if (!valid)
+        return status;
+
+    result->ppm = aggregate_u16(ppm, valid, SAMPLE_AGGREGATE, used);
+
+    BLOGV(LOG_TAG, "aggregated %i of %i valid frames, %i attempts", *used, valid, attempts);
+
+    return SAMPLE_VALID;
+}
+
 void co2_sensor_task()
 {
     /*
@@ -14,12 +83,33 @@ void co2_sensor_task()
 
     ESP_ERROR_CHECK(mhz19_init(CO2_PIN_TX, CO2_PIN_RX, UART_NUM_1));
 
+    filter_init(&co2_filter, &co2_filter_config);
+    ventilation_init(&ventilation, config_get_float(CONFIG_OUTDOOR_CO2_PPM));
+
     for (;;)
     {
         mhz19_values_t values;
+        uint8_t frames;
         uint8_t fails_count = 0;
+        sample_status_t status;
 
-        ESP_ERROR_CHECK(mhz19_fill_values(&values));
+        status = co2_read_frames(&values, &frames, config_get_int(CONFIG_CO2_OVERSAMPLE));
+
+        if (status == SAMPLE_VALID)
+        {
+            float ppm;
+
+            calibration_apply(CAL_CO2, values.ppm, &ppm);
+            values.ppm = ppm <= 0 ? 0 : ppm >= UINT16_MAX ? UINT16_MAX : lroundf(ppm);
+
+            filter_update(&co2_filter, values.ppm);
+            adaptive_update(ADAPTIVE_CO2_PPM, values.ppm, esp_timer_get_time());
+            alarm_sample(CAL_CO2, values.ppm, esp_timer_get_time());
+            ventilation.outdoor = config_get_float(CONFIG_OUTDOOR_CO2_PPM);
+            ventilation_update(&ventilation, values.ppm, esp_timer_get_time() / 1000000);
+        }
+        else
+            ESP_LOGW(LOG_TAG, "no valid frames from co2 sensor (%s), keeping previous value", sample_status_name(status));
 
         while (xSemaphoreTake(co2_values.lock, 1000 / portTICK_PERIOD_MS) != pdTRUE)
         {
@@ -31,13 +121,24 @@ void co2_sensor_task()
             }
         };
 
-        co2_values.ppm = values.ppm;
-        co2_values.updated = true;
+        co2_values.status = status;
+        co2_values.stats = co2_stats;
+
+        if (status == SAMPLE_VALID)
+        {
+            co2_values.ppm = values.ppm;
+            co2_values.frames = frames;
+            filter_get_output(&co2_filter, &co2_values.ppm_filtered);
+            co2_values.ach = ventilation.ach;
+            co2_values.timestamp = esp_timer_get_time();
+            co2_values.updated = true;
+        }
 
-        ESP_LOGV(LOG_TAG, "updated co2 ppm is %d", co2_values.ppm);
+        BLOGV(LOG_TAG, "updated co2 ppm is %d", co2_values.ppm);
 
         xSemaphoreGive(co2_values.lock);
+        latency_point(LATENCY_CO2, LATENCY_SNAPSHOT);
 
-        vTaskDelay(CO2_TASK_DELAY / portTICK_PERIOD_MS);
+        adaptive_delay(ADAPTIVE_CO2);
     }
 }
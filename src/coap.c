@@ -0,0 +1,385 @@
+#include "esp_log.h"
+#define LOG_TAG "TASK: coap"
+
+#include <math.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "esp_system.h"
+#include "esp_timer.h"
+
+#include "dust_sensor.h"
+#include "coap.h"
+
+#define COAP_VERSION 1
+#define COAP_TYPE_CON 0
+#define COAP_TYPE_NON 1
+#define COAP_TYPE_ACK 2
+#define COAP_TYPE_RST 3
+#define COAP_CODE_POST 0x02
+#define COAP_OPTION_URI_PATH 11
+#define COAP_OPTION_CONTENT_FORMAT 12
+#define COAP_FORMAT_CBOR 60
+#define COAP_PAYLOAD_MARKER 0xff
+
+#define COAP_MAX_MESSAGE 256
+
+#define CBOR_UINT 0
+#define CBOR_NINT 1
+#define CBOR_TEXT 3
+#define CBOR_MAP 5
+
+typedef struct
+{
+    uint8_t *buffer;
+    size_t size;
+    size_t used; // may exceed size
+} coap_writer_t;
+
+static uint32_t sent;
+static uint32_t acknowledged;
+static uint32_t retransmitted;
+static uint32_t lost;
+
+transport_t coap_transport(void)
+{
+    return COAP_HOST[0] ? config_get_int(CONFIG_TRANSPORT) : TRANSPORT_MQTT;
+}
+
+static void put(coap_writer_t *w, const void *data, size_t length)
+{
+    if (w->used + length <= w->size)
+        memcpy(w->buffer + w->used, data, length);
+    w->used += length;
+}
+
+static void put_byte(coap_writer_t *w, uint8_t byte)
+{
+    put(w, &byte, 1);
+}
+
+// CBOR head of major type `major` with argument `value`, big endian
+static void cbor_head(coap_writer_t *w, uint8_t major, uint32_t value)
+{
+    major <<= 5;
+
+    if (value < 24)
+        put_byte(w, major | value);
+    else if (value <= UINT8_MAX)
+    {
+        put_byte(w, major | 24);
+        put_byte(w, value);
+    }
+    else if (value <= UINT16_MAX)
+    {
+        put_byte(w, major | 25);
+        put_byte(w, value >> 8);
+        put_byte(w, value);
+    }
+    else
+    {
+        put_byte(w, major | 26);
+        put_byte(w, value >> 24);
+        put_byte(w, value >> 16);
+        put_byte(w, value >> 8);
+        put_byte(w, value);
+    }
+}
+
+static void cbor_int(coap_writer_t *w, coap_key_t key, int32_t value)
+{
+    cbor_head(w, CBOR_UINT, key);
+    if (value >= 0)
+        cbor_head(w, CBOR_UINT, value);
+    else
+        cbor_head(w, CBOR_NINT, -1 - value);
+}
+
+static void cbor_text(coap_writer_t *w, coap_key_t key, const char *text)
+{
+    cbor_head(w, CBOR_UINT, key);
+    cbor_head(w, CBOR_TEXT, strlen(text));
+    put(w, text, strlen(text));
+}
+
+size_t coap_payload(uint8_t *buffer, size_t size, uint32_t seq)
+{
+    coap_writer_t w = {buffer, size, 0};
+    struct dust_values_s dust;
+    struct co2_values_s co2;
+    struct bmp_values_s bmp;
+    bool dust_valid = false;
+    bool aqi_valid;
+    bool co2_valid = false;
+    bool bmp_valid = false;
+
+    if (xSemaphoreTake(dust_values.lock, SEMAPHORE_TIMEOUT / portTICK_PERIOD_MS) == pdTRUE)
+    {
+        dust = dust_values;
+        xSemaphoreGive(dust_values.lock);
+        dust_valid = sample_effective_status(dust.status, dust.timestamp, DUST_MAX_AGE) == SAMPLE_VALID;
+    }
+    else
+        ESP_LOGW(LOG_TAG, "can't take lock on dust values");
+
+    if (xSemaphoreTake(co2_values.lock, SEMAPHORE_TIMEOUT / portTICK_PERIOD_MS) == pdTRUE)
+    {
+        co2 = co2_values;
+        xSemaphoreGive(co2_values.lock);
+        co2_valid = sample_effective_status(co2.status, co2.timestamp, CO2_MAX_AGE) == SAMPLE_VALID;
+    }
+    else
+        ESP_LOGW(LOG_TAG, "can't take lock on co2 values");
+
+    if (xSemaphoreTake(bmp_values.lock, SEMAPHORE_TIMEOUT / portTICK_PERIOD_MS) == pdTRUE)
+    {
+        bmp = bmp_values;
+        xSemaphoreGive(bmp_values.lock);
+        bmp_valid = sample_effective_status(bmp.status, bmp.timestamp, BMP_MAX_AGE) == SAMPLE_VALID;
+    }
+    else
+        ESP_LOGW(LOG_TAG, "can't take lock on bmp values");
+
+    aqi_valid = dust_valid && dust.aqi_hours >= AQI_MIN_HOURS;
+    cbor_head(&w, CBOR_MAP,
+              4 + (dust_valid ? 2 : 0) + (aqi_valid ? 1 : 0) + (co2_valid ? 1 : 0) + (bmp_valid ? 2 : 0));
+    cbor_int(&w, COAP_KEY_VERSION, COAP_PAYLOAD_VERSION);
+    cbor_text(&w, COAP_KEY_DEVICE, MQTT_TOPIC_PREFIX);
+    cbor_head(&w, CBOR_UINT, COAP_KEY_SEQ);
+    cbor_head(&w, CBOR_UINT, seq);
+    cbor_int(&w, COAP_KEY_UPTIME, esp_timer_get_time() / 1000000);
+
+    if (dust_valid)
+    {
+        cbor_int(&w, COAP_KEY_PM25, dust.pm25);
+        cbor_int(&w, COAP_KEY_PM100, dust.pm100);
+    }
+    if (aqi_valid)
+        cbor_int(&w, COAP_KEY_AQI, dust.aqi);
+    if (co2_valid)
+        cbor_int(&w, COAP_KEY_CO2, co2.ppm);
+    if (bmp_valid)
+    {
+        cbor_int(&w, COAP_KEY_TEMP, lround(bmp.temp * 10));
+        cbor_int(&w, COAP_KEY_PRES, lround(bmp.pres));
+    }
+
+    return w.used <= size ? w.used : 0;
+}
+
+static void coap_option(coap_writer_t *w, int *last, int number, const void *value, size_t length)
+{
+    // deltas and lengths up to 268 are enough here
+    int delta = number - *last;
+    uint8_t head = (delta < 13 ? delta : 13) << 4 | (length < 13 ? length : 13);
+
+    put_byte(w, head);
+    if (delta >= 13)
+        put_byte(w, delta - 13);
+    if (length >= 13)
+        put_byte(w, length - 13);
+    put(w, value, length);
+    *last = number;
+}
+
+static size_t coap_message(uint8_t *buffer, size_t size, int type, uint16_t id, const uint8_t *payload,
+                           size_t length)
+{
+    coap_writer_t w = {buffer, size, 0};
+    const uint8_t format = COAP_FORMAT_CBOR;
+    const char *path = COAP_PATH;
+    int last = 0;
+
+    // no token, the exchange is matched by the message id
+    put_byte(&w, COAP_VERSION << 6 | type << 4);
+    put_byte(&w, COAP_CODE_POST);
+    put_byte(&w, id >> 8);
+    put_byte(&w, id);
+
+    while (*path)
+    {
+        size_t segment = strcspn(path, "/");
+
+        if (segment)
+            coap_option(&w, &last, COAP_OPTION_URI_PATH, path, segment);
+        path += segment;
+        if (*path)
+            path++;
+    }
+    coap_option(&w, &last, COAP_OPTION_CONTENT_FORMAT, &format, 1);
+
+    put_byte(&w, COAP_PAYLOAD_MARKER);
+    put(&w, payload, length);
+
+    return w.used <= size ? w.used : 0;
+}
+
+static int coap_connect(void)
+{
+    const struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_DGRAM};
+    struct addrinfo *address;
+    char port[8];
+    int sock;
+    int err;
+
+    snprintf(port, sizeof(port), "%d", COAP_PORT);
+    err = getaddrinfo(COAP_HOST, port, &hints, &address);
+    if (err || !address)
+    {
+        ESP_LOGW(LOG_TAG, "can't resolve %s (%d)", COAP_HOST, err);
+        return -1;
+    }
+
+    // connected, so the socket only takes replies from the server
+    sock = socket(address->ai_family, address->ai_socktype, 0);
+    if (sock >= 0 && connect(sock, address->ai_addr, address->ai_addrlen))
+    {
+        close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(address);
+
+    if (sock < 0)
+        ESP_LOGW(LOG_TAG, "can't open a socket to %s", COAP_HOST);
+
+    return sock;
+}
+
+// waits up to `timeout` milliseconds for the ACK or RST of message `id`: 1, 0, or -1 for neither
+static int coap_wait(int sock, uint16_t id, uint32_t timeout)
+{
+    int64_t deadline = esp_timer_get_time() + timeout * 1000LL;
+    uint8_t reply[COAP_MAX_MESSAGE];
+
+    for (;;)
+    {
+        int64_t left = deadline - esp_timer_get_time();
+        struct timeval tv = {left / 1000000, left % 1000000};
+        int length;
+
+        if (left <= 0)
+            return -1;
+
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        length = recv(sock, reply, sizeof(reply), 0);
+        if (length < 0)
+            return -1;
+
+        if (length < 4 || reply[0] >> 6 != COAP_VERSION || (reply[2] << 8 | reply[3]) != id)
+            continue;
+        if ((reply[0] >> 4 & 3) == COAP_TYPE_ACK)
+            return 1;
+        if ((reply[0] >> 4 & 3) == COAP_TYPE_RST)
+            return 0;
+    }
+}
+
+// returns false if the socket failed
+static bool coap_send(int sock, const uint8_t *message, size_t length, bool confirmable, uint16_t id)
+{
+    uint32_t timeout = COAP_ACK_TIMEOUT + esp_random() % (COAP_ACK_TIMEOUT / 2 + 1);
+
+    for (int attempt = 0;; attempt++)
+    {
+        int acked;
+
+        if (send(sock, message, length, 0) != (int)length)
+        {
+            ESP_LOGW(LOG_TAG, "send failed");
+            return false;
+        }
+        if (attempt)
+            retransmitted++;
+        else
+            sent++;
+
+        if (!confirmable)
+            return true;
+
+        acked = coap_wait(sock, id, timeout);
+        if (acked >= 0)
+        {
+            if (acked)
+                acknowledged++;
+            else
+                ESP_LOGW(LOG_TAG, "message %u reset by the server", id);
+            return true;
+        }
+
+        if (attempt == COAP_MAX_RETRANSMIT)
+        {
+            lost++;
+            ESP_LOGW(LOG_TAG, "message %u not acknowledged after %d retransmissions", id, attempt);
+            return true;
+        }
+        timeout *= 2;
+    }
+}
+
+void coap_task()
+{
+    uint8_t payload[COAP_MAX_MESSAGE - 32];
+    uint8_t message[COAP_MAX_MESSAGE];
+    uint32_t seq = 0;
+    uint16_t id = esp_random();
+    int sock = -1;
+
+    ESP_LOGI(LOG_TAG, "task started, server %s:%d", COAP_HOST, COAP_PORT);
+
+    for (;;)
+    {
+        transport_t transport;
+        bool confirmable = false;
+        size_t length;
+
+        vTaskDelay(adaptive_mqtt_period() / portTICK_PERIOD_MS);
+
+        transport = coap_transport();
+        if (transport == TRANSPORT_MQTT || !(xEventGroupGetBits(eg_app_status) & WIFI_CONNECTED_BIT))
+        {
+            if (sock >= 0)
+                close(sock);
+            sock = -1;
+            continue;
+        }
+
+        if (sock < 0 && (sock = coap_connect()) < 0)
+            continue;
+
+        length = coap_payload(payload, sizeof(payload), seq);
+        if (!length)
+        {
+            ESP_LOGE(LOG_TAG, "payload does not fit %d bytes", (int)sizeof(payload));
+            continue;
+        }
+
+        if (transport == TRANSPORT_COAP)
+        {
+            confirmable = config_get_int(CONFIG_COAP_CONFIRM);
+            length = coap_message(message, sizeof(message), confirmable ? COAP_TYPE_CON : COAP_TYPE_NON, ++id,
+                                  payload, length);
+            if (!length)
+            {
+                ESP_LOGE(LOG_TAG, "message does not fit %d bytes", (int)sizeof(message));
+                continue;
+            }
+        }
+        else
+            memcpy(message, payload, length);
+
+        if (!coap_send(sock, message, length, confirmable, id))
+        {
+            close(sock);
+            sock = -1;
+            continue;
+        }
+        seq++;
+
+        BLOGD(LOG_TAG, "sample %u, %d bytes; sent %u, acknowledged %u, retransmitted %u, lost %u", seq - 1,
+              (int)length, sent, acknowledged, retransmitted, lost);
+    }
+}
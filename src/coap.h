@@ -0,0 +1,65 @@
+#ifndef _COAP_H
+#define _COAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+Sample publishing over UDP, for networks where a TCP session with MQTT
+keepalives costs too much. The runtime setting "transport" (config.h)
+picks where the samples of every MQTT_DELAY go:
+
+    0  MQTT topics, see mqtt_send_update()
+    1  a CoAP POST to coap://COAP_HOST:COAP_PORT/COAP_PATH (RFC 7252)
+    2  a plain UDP datagram to COAP_HOST:COAP_PORT
+
+Without COAP_HOST it is always MQTT. MQTT stays connected for the commands
+and their state topics; only the periodic samples move.
+
+CoAP messages are non-confirmable. With "coap_confirm=1" they are
+confirmable: retransmitted from COAP_ACK_TIMEOUT (times 1 to 1.5) on, the
+timeout doubling, up to COAP_MAX_RETRANSMIT times or until the server
+acknowledges or resets the message. One is outstanding at a time, the
+next sample waits for it.
+
+Both carry one compact payload with all valid samples, a CBOR map
+(Content-Format 60) with the integer keys below. A sensor without a valid
+sample is left out. The sequence number counts datagrams since boot, so the
+receiver sees lost ones as gaps and a reboot as it starting over.
+*/
+
+typedef enum
+{
+    TRANSPORT_MQTT,
+    TRANSPORT_COAP,
+    TRANSPORT_UDP,
+} transport_t;
+
+#define COAP_PAYLOAD_VERSION 1
+
+typedef enum
+{
+    COAP_KEY_VERSION = 0,  // COAP_PAYLOAD_VERSION
+    COAP_KEY_DEVICE = 1,   // text, MQTT_TOPIC_PREFIX
+    COAP_KEY_SEQ = 2,      // datagrams since boot
+    COAP_KEY_UPTIME = 3,   // seconds
+    COAP_KEY_PM25 = 4,     // ug/m3
+    COAP_KEY_PM100 = 5,    // ug/m3
+    COAP_KEY_AQI = 6,      // US EPA, left out while provisional, see AQI_MIN_HOURS
+    COAP_KEY_CO2 = 7,      // ppm
+    COAP_KEY_TEMP = 8,     // 0.1 degree Celsius
+    COAP_KEY_PRES = 9,     // Pa
+} coap_key_t;
+
+// the transport the samples take now
+transport_t coap_transport(void);
+
+/*
+Builds the payload of the current samples with sequence number `seq`.
+Returns its length, 0 if it does not fit.
+*/
+size_t coap_payload(uint8_t *buffer, size_t size, uint32_t seq);
+
+void coap_task();
+
+#endif // _COAP_H
@@ -0,0 +1,312 @@
+#include "esp_log.h"
+#define LOG_TAG "config"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nvs.h"
+
+#include "dust_sensor.h"
+
+#define CONFIG_MAX_COMMAND 256
+
+typedef struct
+{
+    const char *name; // also the NVS key, up to 15 characters
+    config_type_t type;
+    double min;
+    double max;
+    double fallback;  // compile-time default
+    EventBits_t wake; // tasks sleeping on this setting
+} config_entry_t;
+
+static const config_entry_t entries[CONFIG_COUNT] = {
+    [CONFIG_DUST_TASK_DELAY] = {"dust_delay", CONFIG_INT, 1000, 86400000, DUST_TASK_DELAY, CONFIG_DUST_BIT},
+    [CONFIG_CO2_TASK_DELAY] = {"co2_delay", CONFIG_INT, 1000, 86400000, CO2_TASK_DELAY, CONFIG_CO2_BIT},
+    [CONFIG_BMP_TASK_DELAY] = {"bmp_delay", CONFIG_INT, 1000, 86400000, BMP_TASK_DELAY, CONFIG_BMP_BIT},
+    [CONFIG_MQTT_DELAY] = {"mqtt_delay", CONFIG_INT, 1000, 86400000, MQTT_DELAY, CONFIG_MQTT_BIT},
+    [CONFIG_DUST_DUTY_CYCLE] = {"dust_duty", CONFIG_INT, 0, 1, DUST_DUTY_CYCLE, 0},
+    [CONFIG_DUST_WARMUP_DELAY] = {"dust_warmup", CONFIG_INT, 0, 600000, DUST_WARMUP_DELAY, 0},
+    [CONFIG_DUST_WARMUP_FRAMES] = {"warmup_frames", CONFIG_INT, 0, 100, DUST_WARMUP_FRAMES, 0},
+    [CONFIG_DUST_AVG_FRAMES] = {"avg_frames", CONFIG_INT, 1, AGGREGATE_MAX_FRAMES, DUST_AVG_FRAMES, 0},
+    [CONFIG_DUST_OVERSAMPLE] = {"dust_oversample", CONFIG_INT, 1, AGGREGATE_MAX_FRAMES, DUST_OVERSAMPLE, 0},
+    [CONFIG_CO2_OVERSAMPLE] = {"co2_oversample", CONFIG_INT, 1, AGGREGATE_MAX_FRAMES, CO2_OVERSAMPLE, 0},
+    [CONFIG_TEMP_K_A] = {"temp_k_a", CONFIG_FLOAT, 0.1, 10, TEMP_K_A, 0},
+    [CONFIG_TEMP_K_B] = {"temp_k_b", CONFIG_FLOAT, -50, 50, TEMP_K_B, 0},
+    [CONFIG_SITE_ALTITUDE] = {"altitude", CONFIG_FLOAT, -500, 9000, SITE_ALTITUDE, 0},
+    [CONFIG_OUTDOOR_CO2_PPM] = {"outdoor_co2", CONFIG_FLOAT, 0, 2000, OUTDOOR_CO2_PPM, 0},
+    [CONFIG_TRANSPORT] = {"transport", CONFIG_INT, TRANSPORT_MQTT, TRANSPORT_UDP, TRANSPORT, 0},
+    [CONFIG_COAP_CONFIRM] = {"coap_confirm", CONFIG_INT, 0, 1, COAP_CONFIRMABLE, 0},
+    [CONFIG_LOG_SERIAL] = {"log_serial", CONFIG_INT, ESP_LOG_NONE, ESP_LOG_VERBOSE, BINLOG_SERIAL_LEVEL, 0},
+    [CONFIG_ADAPTIVE] = {"adaptive", CONFIG_INT, 0, 1, ADAPTIVE_ENABLE,
+                         CONFIG_DUST_BIT | CONFIG_CO2_BIT | CONFIG_BMP_BIT | CONFIG_MQTT_BIT},
+    [CONFIG_DUST_MIN_DELAY] = {"dust_min_delay", CONFIG_INT, 1000, 86400000, DUST_MIN_DELAY, CONFIG_DUST_BIT},
+    [CONFIG_CO2_MIN_DELAY] = {"co2_min_delay", CONFIG_INT, 1000, 86400000, CO2_MIN_DELAY, CONFIG_CO2_BIT},
+    [CONFIG_BMP_MIN_DELAY] = {"bmp_min_delay", CONFIG_INT, 1000, 86400000, BMP_MIN_DELAY, CONFIG_BMP_BIT},
+};
+
+static double values[CONFIG_COUNT];
+static SemaphoreHandle_t config_lock;
+
+static double config_get(config_key_t key)
+{
+    double value;
+
+    xSemaphoreTake(config_lock, portMAX_DELAY);
+    value = values[key];
+    xSemaphoreGive(config_lock);
+
+    return value;
+}
+
+int32_t config_get_int(config_key_t key)
+{
+    return config_get(key);
+}
+
+double config_get_float(config_key_t key)
+{
+    return config_get(key);
+}
+
+static esp_err_t config_load(nvs_handle_t nvs, const config_entry_t *entry, double *value)
+{
+    esp_err_t err;
+
+    if (entry->type == CONFIG_INT)
+    {
+        int32_t stored;
+
+        err = nvs_get_i32(nvs, entry->name, &stored);
+        *value = stored;
+    }
+    else
+    {
+        size_t length = sizeof(*value);
+
+        err = nvs_get_blob(nvs, entry->name, value, &length);
+    }
+
+    if (err == ESP_OK && !(*value >= entry->min && *value <= entry->max))
+        err = ESP_ERR_INVALID_ARG;
+
+    return err;
+}
+
+static esp_err_t config_store(const config_entry_t *entry, double value)
+{
+    nvs_handle_t nvs;
+    esp_err_t err;
+
+    err = nvs_open(CONFIG_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK)
+        return err;
+
+    if (entry->type == CONFIG_INT)
+        err = nvs_set_i32(nvs, entry->name, value);
+    else
+        err = nvs_set_blob(nvs, entry->name, &value, sizeof(value));
+
+    if (err == ESP_OK)
+        err = nvs_commit(nvs);
+    nvs_close(nvs);
+
+    return err;
+}
+
+void config_init(void)
+{
+    nvs_handle_t nvs;
+    bool stored = nvs_open(CONFIG_NVS_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK;
+
+    config_lock = xSemaphoreCreateBinary();
+
+    for (int i = 0; i < CONFIG_COUNT; i++)
+    {
+        esp_err_t err = stored ? config_load(nvs, &entries[i], &values[i]) : ESP_ERR_NVS_NOT_FOUND;
+
+        if (err == ESP_OK)
+        {
+            ESP_LOGI(LOG_TAG, "%s is %g", entries[i].name, values[i]);
+            continue;
+        }
+
+        if (err != ESP_ERR_NVS_NOT_FOUND)
+            ESP_LOGW(LOG_TAG, "stored %s is not usable (%s), using the default", entries[i].name,
+                     esp_err_to_name(err));
+        values[i] = entries[i].fallback;
+    }
+
+    if (stored)
+        nvs_close(nvs);
+
+    xSemaphoreGive(config_lock);
+}
+
+static int config_find(const char *name)
+{
+    for (int i = 0; i < CONFIG_COUNT; i++)
+    {
+        if (!strcmp(entries[i].name, name))
+            return i;
+    }
+
+    return -1;
+}
+
+esp_err_t config_set(const char *name, const char *text)
+{
+    int key = config_find(name);
+    const config_entry_t *entry;
+    double value;
+    double previous;
+    char *end;
+    esp_err_t err;
+
+    if (key < 0)
+        return ESP_ERR_NOT_FOUND;
+    entry = &entries[key];
+
+    if (entry->type == CONFIG_INT)
+        value = strtol(text, &end, 10);
+    else
+        value = strtod(text, &end);
+
+    if (end == text || *end || !(value >= entry->min && value <= entry->max))
+        return ESP_ERR_INVALID_ARG;
+
+    xSemaphoreTake(config_lock, portMAX_DELAY);
+    previous = values[key];
+    values[key] = value;
+    xSemaphoreGive(config_lock);
+
+    // the new value is used even if it could not be stored, until the next boot
+    err = config_store(entry, value);
+    if (err != ESP_OK)
+        ESP_LOGE(LOG_TAG, "can't store %s (%s)", name, esp_err_to_name(err));
+
+    ESP_LOGI(LOG_TAG, "%s set to %g, was %g", name, value, previous);
+
+    if (entry->wake && value != previous)
+        xEventGroupSetBits(eg_app_status, entry->wake);
+
+    return ESP_OK;
+}
+
+void config_reset(void)
+{
+    nvs_handle_t nvs;
+    EventBits_t wake = 0;
+
+    if (nvs_open(CONFIG_NVS_NAMESPACE, NVS_READWRITE, &nvs) == ESP_OK)
+    {
+        nvs_erase_all(nvs);
+        nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+
+    xSemaphoreTake(config_lock, portMAX_DELAY);
+    for (int i = 0; i < CONFIG_COUNT; i++)
+    {
+        if (values[i] != entries[i].fallback)
+            wake |= entries[i].wake;
+        values[i] = entries[i].fallback;
+    }
+    xSemaphoreGive(config_lock);
+
+    ESP_LOGI(LOG_TAG, "back to the defaults");
+
+    if (wake)
+        xEventGroupSetBits(eg_app_status, wake);
+}
+
+int config_command(const char *data, int length)
+{
+    char command[CONFIG_MAX_COMMAND];
+    char *saveptr;
+    int rejected = 0;
+
+    if (length >= (int)sizeof(command))
+    {
+        ESP_LOGW(LOG_TAG, "command of %d bytes is too long", length);
+        return 1;
+    }
+
+    memcpy(command, data, length);
+    command[length] = 0;
+
+    for (char *pair = strtok_r(command, " ,\r\n\t", &saveptr); pair; pair = strtok_r(NULL, " ,\r\n\t", &saveptr))
+    {
+        char *value = strchr(pair, '=');
+        esp_err_t err;
+
+        if (!strcmp(pair, "reset"))
+        {
+            config_reset();
+            continue;
+        }
+
+        if (value)
+        {
+            *value++ = 0;
+            err = config_set(pair, value);
+        }
+        else
+            err = ESP_ERR_INVALID_ARG;
+
+        if (err != ESP_OK)
+        {
+            ESP_LOGW(LOG_TAG, "rejected %s%s%s (%s)", pair, value ? "=" : "", value ? value : "",
+                     esp_err_to_name(err));
+            rejected++;
+        }
+    }
+
+    return rejected;
+}
+
+int config_format(char *buffer, size_t size)
+{
+    double copy[CONFIG_COUNT];
+    size_t used = 0;
+
+    xSemaphoreTake(config_lock, portMAX_DELAY);
+    memcpy(copy, values, sizeof(copy));
+    xSemaphoreGive(config_lock);
+
+    for (int i = 0; i < CONFIG_COUNT; i++)
+    {
+        const char *format = entries[i].type == CONFIG_INT ? "%s\"%s\":%.0f" : "%s\"%s\":%.9g";
+
+        used += snprintf(buffer + (used < size ? used : size), used < size ? size - used : 0, format,
+                         i ? "," : "{", entries[i].name, copy[i]);
+    }
+    used += snprintf(buffer + (used < size ? used : size), used < size ? size - used : 0, "}");
+
+    return used;
+}
+
+void config_delay(config_key_t key)
+{
+    EventBits_t wake = entries[key].wake;
+    TickType_t start = xTaskGetTickCount();
+
+    for (;;)
+    {
+        TickType_t period = config_get_int(key) / portTICK_PERIOD_MS;
+        TickType_t elapsed = xTaskGetTickCount() - start;
+
+        if (elapsed >= period)
+            return;
+
+        if (!wake)
+        {
+            vTaskDelay(period - elapsed);
+            return;
+        }
+
+        if (!(xEventGroupWaitBits(eg_app_status, wake, pdTRUE, pdFALSE, period - elapsed) & wake))
+            return;
+    }
+}
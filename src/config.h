@@ -0,0 +1,88 @@
+#ifndef _CONFIG_H
+#define _CONFIG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/*
+Runtime configuration. The defaults are the compile-time settings of
+dust_sensor.h and secrets.h, values changed at runtime are kept in NVS
+(namespace CONFIG_NVS_NAMESPACE, one key per setting) and loaded at boot.
+
+Settings are changed with config_set() or with a command on the MQTT topic
+<prefix>/config/set, see config_command(). They take effect without a
+reboot: tasks read them every cycle, and a task sleeping on a period that
+changed is woken to sleep for the new one, see config_delay().
+*/
+
+#define CONFIG_NVS_NAMESPACE "config"
+
+typedef enum
+{
+    CONFIG_INT,
+    CONFIG_FLOAT,
+} config_type_t;
+
+typedef enum
+{
+    CONFIG_DUST_TASK_DELAY,
+    CONFIG_CO2_TASK_DELAY,
+    CONFIG_BMP_TASK_DELAY,
+    CONFIG_MQTT_DELAY,
+    CONFIG_DUST_DUTY_CYCLE,
+    CONFIG_DUST_WARMUP_DELAY,
+    CONFIG_DUST_WARMUP_FRAMES,
+    CONFIG_DUST_AVG_FRAMES,
+    CONFIG_DUST_OVERSAMPLE,
+    CONFIG_CO2_OVERSAMPLE,
+    CONFIG_TEMP_K_A,
+    CONFIG_TEMP_K_B,
+    CONFIG_SITE_ALTITUDE,
+    CONFIG_OUTDOOR_CO2_PPM,
+    CONFIG_TRANSPORT,
+    CONFIG_COAP_CONFIRM,
+    CONFIG_LOG_SERIAL,
+    CONFIG_ADAPTIVE,
+    CONFIG_DUST_MIN_DELAY,
+    CONFIG_CO2_MIN_DELAY,
+    CONFIG_BMP_MIN_DELAY,
+    CONFIG_COUNT,
+} config_key_t;
+
+// loads the stored values, call once after nvs_flash_init() and before the tasks start
+void config_init(void);
+
+int32_t config_get_int(config_key_t key);
+
+double config_get_float(config_key_t key);
+
+/*
+Sets the setting called `name` (see config.c) from its text form and stores
+it. Returns ESP_ERR_NOT_FOUND for an unknown name, ESP_ERR_INVALID_ARG if
+the value does not parse or is out of range.
+*/
+esp_err_t config_set(const char *name, const char *value);
+
+// back to the compile-time defaults, stored values are erased
+void config_reset(void);
+
+/*
+Runs a command received on <prefix>/config/set: "name=value" pairs
+separated by spaces, commas or new lines, or "reset". Every pair is applied
+on its own. Returns the number of rejected pairs.
+*/
+int config_command(const char *data, int length);
+
+// all settings as a JSON object, returns the length like snprintf()
+int config_format(char *buffer, size_t size);
+
+/*
+Sleeps for the period in milliseconds held by `key`. If the period changes
+meanwhile the sleep is stretched or cut short to the new one, counted from
+the start of the call.
+*/
+void config_delay(config_key_t key);
+
+#endif // _CONFIG_H
@@ -0,0 +1,277 @@
+#include <string.h>
+
+#include "delta.h"
+
+enum
+{
+    DELTA_HEADER,
+    DELTA_COPY_LENGTH,
+    DELTA_SKIP,
+    DELTA_DIFF_COUNT,
+    DELTA_DIFF,
+    DELTA_INSERT_LENGTH,
+    DELTA_INSERT,
+    DELTA_SEEK,
+    DELTA_DONE,
+};
+
+static uint32_t get_u32(const uint8_t *data)
+{
+    return data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+void delta_init(delta_t *delta, const delta_ops_t *ops, void *ctx)
+{
+    memset(delta, 0, sizeof(*delta));
+    delta->ops = ops;
+    delta->ctx = ctx;
+    delta->state = DELTA_HEADER;
+}
+
+static esp_err_t delta_flush(delta_t *delta)
+{
+    esp_err_t err = ESP_OK;
+
+    if (delta->out_length)
+        err = delta->ops->write_new(delta->ctx, delta->out, delta->out_length);
+    delta->out_length = 0;
+
+    return err;
+}
+
+static esp_err_t delta_emit(delta_t *delta, const uint8_t *data, uint32_t length)
+{
+    while (length)
+    {
+        uint32_t chunk = DELTA_BUFFER_SIZE - delta->out_length;
+        esp_err_t err;
+
+        if (chunk > length)
+            chunk = length;
+        memcpy(delta->out + delta->out_length, data, chunk);
+        delta->out_length += chunk;
+        delta->new_position += chunk;
+        data += chunk;
+        length -= chunk;
+
+        if (delta->out_length == DELTA_BUFFER_SIZE && (err = delta_flush(delta)) != ESP_OK)
+            return err;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t delta_read_old(delta_t *delta, uint32_t length)
+{
+    if (length > delta->header.old_size || delta->old_position > delta->header.old_size - length)
+        return ESP_ERR_INVALID_SIZE;
+
+    return delta->ops->read_old(delta->ctx, delta->old_position, delta->old, length);
+}
+
+// copies `length` unchanged bytes of the old image
+static esp_err_t delta_skip(delta_t *delta, uint32_t length)
+{
+    while (length)
+    {
+        uint32_t chunk = length < DELTA_BUFFER_SIZE ? length : DELTA_BUFFER_SIZE;
+        esp_err_t err;
+
+        if ((err = delta_read_old(delta, chunk)) != ESP_OK || (err = delta_emit(delta, delta->old, chunk)) != ESP_OK)
+            return err;
+        delta->old_position += chunk;
+        delta->copy_left -= chunk;
+        length -= chunk;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t delta_header(delta_t *delta)
+{
+    const uint8_t *data = delta->header_data;
+
+    if (memcmp(data, DELTA_MAGIC, 4))
+        return ESP_ERR_INVALID_RESPONSE;
+
+    delta->header.old_size = get_u32(data + 4);
+    delta->header.new_size = get_u32(data + 8);
+    memcpy(delta->header.old_sha256, data + 12, 32);
+    memcpy(delta->header.new_sha256, data + 44, 32);
+
+    return delta->ops->header ? delta->ops->header(delta->ctx, &delta->header) : ESP_OK;
+}
+
+// state after the end of a copy, of an insert or of a record
+static int delta_next(delta_t *delta, int state)
+{
+    if (state == DELTA_COPY_LENGTH && delta->new_position == delta->header.new_size)
+        return DELTA_DONE;
+    if (state == DELTA_SKIP && !delta->copy_left)
+        return DELTA_INSERT_LENGTH;
+
+    return state;
+}
+
+// adds a byte to the varint being read, returns 1 when it is complete
+static int delta_varint(delta_t *delta, uint8_t byte, esp_err_t *err)
+{
+    // at most 5 bytes, 35 bits
+    if (delta->varint_shift == 35)
+    {
+        *err = ESP_ERR_INVALID_RESPONSE;
+        return 0;
+    }
+
+    delta->varint |= (uint64_t)(byte & 0x7f) << delta->varint_shift;
+    delta->varint_shift += 7;
+
+    return !(byte & 0x80);
+}
+
+static esp_err_t delta_value(delta_t *delta, uint64_t value)
+{
+    /*
+    A varint is complete, `value` is its value. Everything that does not
+    need more input is done here, up to the next varint or run of bytes.
+    */
+
+    uint32_t new_left = delta->header.new_size - delta->new_position;
+    esp_err_t err;
+
+    switch (delta->state)
+    {
+    case DELTA_COPY_LENGTH:
+        if (value > new_left)
+            return ESP_ERR_INVALID_SIZE;
+        delta->copy_left = value;
+        delta->state = value ? DELTA_SKIP : DELTA_INSERT_LENGTH;
+        break;
+
+    case DELTA_SKIP:
+        if (value > delta->copy_left)
+            return ESP_ERR_INVALID_SIZE;
+        if ((err = delta_skip(delta, value)) != ESP_OK)
+            return err;
+        delta->state = delta->copy_left ? DELTA_DIFF_COUNT : DELTA_INSERT_LENGTH;
+        break;
+
+    case DELTA_DIFF_COUNT:
+        if (value > delta->copy_left)
+            return ESP_ERR_INVALID_SIZE;
+        delta->run_left = value;
+        delta->state = value ? DELTA_DIFF : delta_next(delta, DELTA_SKIP);
+        break;
+
+    case DELTA_INSERT_LENGTH:
+        if (value > new_left)
+            return ESP_ERR_INVALID_SIZE;
+        delta->run_left = value;
+        delta->state = value ? DELTA_INSERT : DELTA_SEEK;
+        break;
+
+    case DELTA_SEEK:
+    {
+        int64_t seek = (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+        int64_t position = (int64_t)delta->old_position + seek;
+
+        if (position < 0 || position > delta->header.old_size)
+            return ESP_ERR_INVALID_SIZE;
+        delta->old_position = position;
+        delta->state = delta_next(delta, DELTA_COPY_LENGTH);
+        break;
+    }
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t delta_step(delta_t *delta, const uint8_t *data, size_t length, size_t *used)
+{
+    uint32_t chunk = length < DELTA_BUFFER_SIZE ? length : DELTA_BUFFER_SIZE;
+    esp_err_t err = ESP_OK;
+
+    *used = 1;
+
+    switch (delta->state)
+    {
+    case DELTA_HEADER:
+        chunk = DELTA_HEADER_SIZE - delta->header_length;
+        *used = length < chunk ? length : chunk;
+        memcpy(delta->header_data + delta->header_length, data, *used);
+        delta->header_length += *used;
+        if (delta->header_length < DELTA_HEADER_SIZE)
+            return ESP_OK;
+        if ((err = delta_header(delta)) != ESP_OK)
+            return err;
+        delta->state = delta_next(delta, DELTA_COPY_LENGTH);
+        return ESP_OK;
+
+    case DELTA_DIFF:
+        if (chunk > delta->run_left)
+            chunk = delta->run_left;
+        if ((err = delta_read_old(delta, chunk)) != ESP_OK)
+            return err;
+        for (uint32_t i = 0; i < chunk; i++)
+            delta->old[i] += data[i];
+        if ((err = delta_emit(delta, delta->old, chunk)) != ESP_OK)
+            return err;
+        delta->old_position += chunk;
+        delta->copy_left -= chunk;
+        delta->run_left -= chunk;
+        *used = chunk;
+        if (!delta->run_left)
+            delta->state = delta_next(delta, DELTA_SKIP);
+        return ESP_OK;
+
+    case DELTA_INSERT:
+        if (chunk > delta->run_left)
+            chunk = delta->run_left;
+        if ((err = delta_emit(delta, data, chunk)) != ESP_OK)
+            return err;
+        delta->run_left -= chunk;
+        *used = chunk;
+        if (!delta->run_left)
+            delta->state = DELTA_SEEK;
+        return ESP_OK;
+
+    case DELTA_DONE:
+        // trailing garbage
+        return ESP_ERR_INVALID_RESPONSE;
+
+    default:
+        if (!delta_varint(delta, data[0], &err))
+            return err;
+        err = delta_value(delta, delta->varint);
+        delta->varint = 0;
+        delta->varint_shift = 0;
+        return err;
+    }
+}
+
+esp_err_t delta_feed(delta_t *delta, const uint8_t *data, size_t length)
+{
+    while (length && delta->error == ESP_OK)
+    {
+        size_t used;
+
+        delta->error = delta_step(delta, data, length, &used);
+        data += used;
+        length -= used;
+    }
+
+    return delta->error;
+}
+
+esp_err_t delta_finish(delta_t *delta)
+{
+    if (delta->error != ESP_OK)
+        return delta->error;
+
+    if (delta->state != DELTA_DONE)
+        delta->error = ESP_ERR_INVALID_SIZE;
+    else
+        delta->error = delta_flush(delta);
+
+    return delta->error;
+}
@@ -0,0 +1,88 @@
+#ifndef _DELTA_H
+#define _DELTA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/*
+Streaming decoder of binary deltas between firmware images, made by
+host/ota/mkdelta. The patch can be fed in chunks of any size as it is
+downloaded; the new image comes out in order, so it can be written straight
+into a flash partition, and only a few hundred bytes of state are kept.
+
+Format, integers little endian, varints LEB128, svarints zigzag LEB128:
+
+    header   "DSD1", old size u32, new size u32, SHA-256 of the old image,
+             SHA-256 of the new image
+    records  until the new image is complete:
+             copy length varint, then the copied bytes as runs of
+                 skip varint   bytes taken from the old image as they are
+                 count varint  bytes given as differences to the old image,
+                               left out if the skip completes the copy
+                 count bytes   added to the old bytes
+             insert length varint, then as many new bytes
+             seek svarint, moves the position in the old image
+
+The old position starts at 0 and advances with every copied byte, like in
+bsdiff. A patch against nothing (old size 0) carries a full image.
+*/
+
+#define DELTA_MAGIC "DSD1"
+#define DELTA_HEADER_SIZE (4 + 4 + 4 + 32 + 32)
+#define DELTA_BUFFER_SIZE 512
+
+typedef struct
+{
+    uint32_t old_size;
+    uint32_t new_size;
+    uint8_t old_sha256[32];
+    uint8_t new_sha256[32];
+} delta_header_t;
+
+typedef struct
+{
+    // called once the header is in, an error stops the decoder
+    esp_err_t (*header)(void *ctx, const delta_header_t *header);
+    esp_err_t (*read_old)(void *ctx, uint32_t offset, uint8_t *data, size_t length);
+    esp_err_t (*write_new)(void *ctx, const uint8_t *data, size_t length);
+} delta_ops_t;
+
+typedef struct
+{
+    const delta_ops_t *ops;
+    void *ctx;
+    delta_header_t header;
+
+    int state;
+    uint8_t header_data[DELTA_HEADER_SIZE];
+    uint32_t header_length;
+    uint64_t varint;
+    int varint_shift;
+
+    uint32_t old_position;
+    uint32_t new_position; // bytes produced so far
+    uint32_t copy_left;    // of the current copy
+    uint32_t run_left;     // of the current skip, difference or insert run
+
+    uint8_t out[DELTA_BUFFER_SIZE];
+    uint32_t out_length;
+    uint8_t old[DELTA_BUFFER_SIZE];
+    esp_err_t error;
+} delta_t;
+
+void delta_init(delta_t *delta, const delta_ops_t *ops, void *ctx);
+
+/*
+Decodes the next `length` bytes of the patch. Returns ESP_ERR_INVALID_RESPONSE
+for a malformed patch, ESP_ERR_INVALID_SIZE if it reaches outside of the old
+or the new image, or an error of a callback. After an error the decoder
+stays failed.
+*/
+esp_err_t delta_feed(delta_t *delta, const uint8_t *data, size_t length);
+
+// flushes the output, ESP_ERR_INVALID_SIZE if the new image is not complete
+esp_err_t delta_finish(delta_t *delta);
+
+#endif // _DELTA_H
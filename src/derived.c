@@ -0,0 +1,227 @@
+#include <math.h>
+#include <string.h>
+
+#include "derived.h"
+
+#define VENTILATION_MIN_EXCESS 50 // ppm above outdoor, below it the sensor noise dominates
+#define VENTILATION_MIN_INTERVAL 60 // seconds
+#define VENTILATION_ALPHA 0.3
+
+void rolling_average_update(rolling_average_t *avg, float value, uint32_t now)
+{
+    uint32_t minute = now / 60;
+    uint32_t hour = now / 3600;
+
+    // expire buckets that fell out of the windows, at most one full turn
+    for (uint32_t i = 0; avg->minute != minute && i < 60; i++)
+    {
+        uint8_t slot = ++avg->minute % 60;
+
+        avg->hour_total -= avg->minute_sum[slot];
+        avg->hour_samples -= avg->minute_count[slot];
+        avg->minute_sum[slot] = 0;
+        avg->minute_count[slot] = 0;
+    }
+    avg->minute = minute;
+    if (!avg->hour_samples)
+        avg->hour_total = 0;
+
+    for (uint32_t i = 0; avg->hour != hour && i < 24; i++)
+    {
+        uint8_t slot = ++avg->hour % 24;
+
+        avg->day_total -= avg->hour_sum[slot];
+        avg->day_samples -= avg->hour_count[slot];
+        avg->hour_sum[slot] = 0;
+        avg->hour_count[slot] = 0;
+    }
+    avg->hour = hour;
+    if (!avg->day_samples)
+        avg->day_total = 0;
+
+    avg->minute_sum[minute % 60] += value;
+    avg->minute_count[minute % 60]++;
+    avg->hour_total += value;
+    avg->hour_samples++;
+
+    avg->hour_sum[hour % 24] += value;
+    avg->hour_count[hour % 24]++;
+    avg->day_total += value;
+    avg->day_samples++;
+}
+
+float rolling_average_1h(const rolling_average_t *avg)
+{
+    return avg->hour_samples ? avg->hour_total / avg->hour_samples : NAN;
+}
+
+float rolling_average_24h(const rolling_average_t *avg)
+{
+    return avg->day_samples ? avg->day_total / avg->day_samples : NAN;
+}
+
+uint8_t rolling_average_24h_hours(const rolling_average_t *avg)
+{
+    uint8_t hours = 0;
+
+    for (int i = 0; i < 24; i++)
+        hours += avg->hour_count[i] > 0;
+
+    return hours;
+}
+
+typedef struct
+{
+    float c_low;
+    float c_high;
+    uint16_t i_low;
+    uint16_t i_high;
+} breakpoint_t;
+
+static const breakpoint_t aqi_pm25[] = {
+    {0.0, 9.0, 0, 50},
+    {9.1, 35.4, 51, 100},
+    {35.5, 55.4, 101, 150},
+    {55.5, 125.4, 151, 200},
+    {125.5, 225.4, 201, 300},
+    {225.5, 325.4, 301, 500},
+};
+
+static const breakpoint_t aqi_pm100[] = {
+    {0, 54, 0, 50},
+    {55, 154, 51, 100},
+    {155, 254, 101, 150},
+    {255, 354, 151, 200},
+    {355, 424, 201, 300},
+    {425, 604, 301, 500},
+};
+
+static const breakpoint_t caqi_pm25[] = {
+    {0, 15, 0, 25},
+    {15, 30, 25, 50},
+    {30, 55, 50, 75},
+    {55, 110, 75, 100},
+};
+
+static const breakpoint_t caqi_pm100[] = {
+    {0, 25, 0, 25},
+    {25, 50, 25, 50},
+    {50, 90, 50, 75},
+    {90, 180, 75, 100},
+};
+
+static uint16_t interpolate(const breakpoint_t *table, uint8_t size, float c)
+{
+    const breakpoint_t *bp = &table[size - 1];
+
+    for (uint8_t i = 0; i < size; i++)
+    {
+        if (c <= table[i].c_high)
+        {
+            bp = &table[i];
+            break;
+        }
+    }
+
+    // above the last band the index keeps growing with the same slope
+    return lroundf((float)(bp->i_high - bp->i_low) / (bp->c_high - bp->c_low) * (c - bp->c_low) + bp->i_low);
+}
+
+uint16_t aqi_us_epa(float pm25_24h, float pm100_24h)
+{
+    uint16_t aqi = 0;
+    uint16_t sub;
+
+    // concentrations are truncated as the EPA technical assistance document says
+    if (!isnan(pm25_24h))
+        aqi = interpolate(aqi_pm25, sizeof(aqi_pm25) / sizeof(breakpoint_t), floorf(pm25_24h * 10) / 10);
+
+    if (!isnan(pm100_24h))
+    {
+        sub = interpolate(aqi_pm100, sizeof(aqi_pm100) / sizeof(breakpoint_t), floorf(pm100_24h));
+        if (sub > aqi)
+            aqi = sub;
+    }
+
+    return aqi;
+}
+
+aqi_category_t aqi_category(uint16_t aqi)
+{
+    if (aqi <= 50)
+        return AQI_GOOD;
+    if (aqi <= 100)
+        return AQI_MODERATE;
+    if (aqi <= 150)
+        return AQI_UNHEALTHY_SENSITIVE;
+    if (aqi <= 200)
+        return AQI_UNHEALTHY;
+    if (aqi <= 300)
+        return AQI_VERY_UNHEALTHY;
+    return AQI_HAZARDOUS;
+}
+
+const char *aqi_category_name(aqi_category_t category)
+{
+    static const char *names[] = {
+        [AQI_GOOD] = "good",
+        [AQI_MODERATE] = "moderate",
+        [AQI_UNHEALTHY_SENSITIVE] = "unhealthy_sensitive",
+        [AQI_UNHEALTHY] = "unhealthy",
+        [AQI_VERY_UNHEALTHY] = "very_unhealthy",
+        [AQI_HAZARDOUS] = "hazardous",
+    };
+
+    return names[category];
+}
+
+uint16_t caqi_hourly(float pm25_1h, float pm100_1h)
+{
+    uint16_t caqi = 0;
+    uint16_t sub;
+
+    if (!isnan(pm25_1h))
+        caqi = interpolate(caqi_pm25, sizeof(caqi_pm25) / sizeof(breakpoint_t), pm25_1h);
+
+    if (!isnan(pm100_1h))
+    {
+        sub = interpolate(caqi_pm100, sizeof(caqi_pm100) / sizeof(breakpoint_t), pm100_1h);
+        if (sub > caqi)
+            caqi = sub;
+    }
+
+    return caqi;
+}
+
+double sea_level_pressure(double pres, double temp, double altitude)
+{
+    return pres * pow(1 - 0.0065 * altitude / (temp + 0.0065 * altitude + 273.15), -5.257);
+}
+
+void ventilation_init(ventilation_t *vent, float outdoor_ppm)
+{
+    memset(vent, 0, sizeof(ventilation_t));
+    vent->outdoor = outdoor_ppm;
+    vent->ach = NAN;
+}
+
+void ventilation_update(ventilation_t *vent, float ppm, uint32_t now)
+{
+    float excess = ppm - vent->outdoor;
+    float last_excess = vent->last_ppm - vent->outdoor;
+    uint32_t elapsed = now - vent->last_time;
+    float ach;
+
+    if (vent->last_time && elapsed < VENTILATION_MIN_INTERVAL)
+        return;
+
+    if (vent->last_time && excess > VENTILATION_MIN_EXCESS && excess < last_excess)
+    {
+        // C(t) - Cout = (C0 - Cout) * exp(-ACH * t)
+        ach = logf(last_excess / excess) * 3600 / elapsed;
+        vent->ach = isnan(vent->ach) ? ach : vent->ach + VENTILATION_ALPHA * (ach - vent->ach);
+    }
+
+    vent->last_ppm = ppm;
+    vent->last_time = now;
+}
@@ -0,0 +1,89 @@
+#ifndef _DERIVED_H
+#define _DERIVED_H
+
+#include <stdint.h>
+
+#define PA_PER_MMHG 133.322
+
+/*
+Rolling averages of a channel over the last hour (1 minute buckets) and the
+last 24 hours (1 hour buckets). Running totals are kept, so both update and
+query are O(1).
+*/
+typedef struct
+{
+    uint32_t minute;
+    float minute_sum[60];
+    uint16_t minute_count[60];
+    double hour_total;
+    uint32_t hour_samples;
+
+    uint32_t hour;
+    float hour_sum[24];
+    uint16_t hour_count[24];
+    double day_total;
+    uint32_t day_samples;
+} rolling_average_t;
+
+void rolling_average_update(rolling_average_t *avg, float value, uint32_t now);
+
+// averages over the last hour and the last 24 hours, NAN if there is no data
+float rolling_average_1h(const rolling_average_t *avg);
+float rolling_average_24h(const rolling_average_t *avg);
+
+// hours of the last 24 with samples, as of the last update
+uint8_t rolling_average_24h_hours(const rolling_average_t *avg);
+
+typedef enum
+{
+    AQI_GOOD = 0,
+    AQI_MODERATE,
+    AQI_UNHEALTHY_SENSITIVE,
+    AQI_UNHEALTHY,
+    AQI_VERY_UNHEALTHY,
+    AQI_HAZARDOUS,
+} aqi_category_t;
+
+/*
+US EPA AQI (2024 breakpoints) from 24 hour PM2.5 and PM10 averages, the
+larger of the two sub-indices. The EPA counts a daily average only with 75 %
+of the hours covered; with samples in fewer than AQI_MIN_HOURS hours the
+index is provisional.
+*/
+uint16_t aqi_us_epa(float pm25_24h, float pm100_24h);
+
+#define AQI_MIN_HOURS 18 // 75 % of 24
+
+aqi_category_t aqi_category(uint16_t aqi);
+
+const char *aqi_category_name(aqi_category_t category);
+
+/*
+EU CAQI hourly background index from 1 hour PM2.5 and PM10 averages.
+*/
+uint16_t caqi_hourly(float pm25_1h, float pm100_1h);
+
+/*
+Reduces station pressure (Pa) to sea level for a station at `altitude`
+meters with air temperature `temp` C, hypsometric formula.
+*/
+double sea_level_pressure(double pres, double temp, double altitude);
+
+/*
+Air change rate estimated from the exponential decay of indoor CO2 towards
+the outdoor level. The estimate is refreshed only while the concentration
+decays, between decays the last one is kept.
+*/
+typedef struct
+{
+    float outdoor;
+    float last_ppm;
+    uint32_t last_time;
+    float ach; // air changes per hour, NAN until the first decay
+} ventilation_t;
+
+void ventilation_init(ventilation_t *vent, float outdoor_ppm);
+
+void ventilation_update(ventilation_t *vent, float ppm, uint32_t now);
+
+#endif // _DERIVED_H
@@ -1,13 +1,118 @@
-#define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
 #include "esp_log.h"
 #define LOG_TAG "TASK: dust"
 
+#include <math.h>
+
+#include "esp_timer.h"
+
 #include "pms7003.h"
 
 #include "dust_sensor.h"
 
 #define DUST_MAX_FAILS 20
 
+typedef struct
+{
+    uint16_t pm25;
+    uint16_t pm100;
+    uint8_t frames;
+} dust_frames_t;
+
+static sample_stats_t dust_stats;
+
+static const filter_config_t pm25_filter_config = FILTER_PM25;
+static const filter_config_t pm100_filter_config = FILTER_PM100;
+
+static filter_t pm25_filter;
+static filter_t pm100_filter;
+
+static rolling_average_t pm25_avg;
+static rolling_average_t pm100_avg;
+
+static uint16_t dust_calibrate(cal_channel_t channel, uint16_t raw)
+{
+    float value;
+
+    calibration_apply(channel, raw, &value);
+
+    return value <= 0 ? 0 : value >= UINT16_MAX ? UINT16_MAX : lroundf(value);
+}
+
+static sample_status_t dust_read_frame(pms_values_t *frame)
+{
+    sample_status_t status = sample_status_from_err(pms_fill_values(frame));
+
+    if (status == SAMPLE_VALID && (frame->pm25 > DUST_MAX_VALUE || frame->pm100 > DUST_MAX_VALUE))
+        status = SAMPLE_OUT_OF_RANGE;
+
+    latency_point(LATENCY_DUST, LATENCY_DECODED);
+    sample_stats_count(&dust_stats, status);
+    stream_dust(status, frame->pm25, frame->pm100);
+
+    return status;
+}
+
+static sample_status_t dust_read_frames(dust_frames_t *result, uint8_t discard, uint8_t frames)
+{
+    /*
+    Drop the first `discard` frames, then read up to `frames` valid frames
+    and aggregate them with SAMPLE_AGGREGATE. Gives up after twice as many
+    attempts as requested and returns the status of the last failed frame.
+    */
+
+    uint16_t pm25[AGGREGATE_MAX_FRAMES];
+    uint16_t pm100[AGGREGATE_MAX_FRAMES];
+    uint8_t valid = 0;
+    uint8_t attempts = 0;
+    uint8_t used_pm100;
+    sample_status_t status = SAMPLE_TIMEOUT;
+
+    if (frames > AGGREGATE_MAX_FRAMES)
+        frames = AGGREGATE_MAX_FRAMES;
+
+    for (uint8_t i = 0; i < discard; i++)
+    {
+        pms_values_t frame;
+
+        pms_fill_values(&frame);
+        BLOGV(LOG_TAG, "dropped warm-up frame %i, pm25 is %d", i, frame.pm25);
+        vTaskDelay(DUST_FRAME_DELAY / portTICK_PERIOD_MS);
+    }
+
+    while (valid < frames && attempts < frames * 2)
+    {
+        pms_values_t frame;
+
+        if (attempts > 0)
+            vTaskDelay(DUST_FRAME_DELAY / portTICK_PERIOD_MS);
+        attempts++;
+
+        status = dust_read_frame(&frame);
+        if (status != SAMPLE_VALID)
+        {
+            BLOGD(LOG_TAG, "invalid frame (%s), skipping", sample_status_name(status));
+            continue;
+        }
+
+        pm25[valid] = frame.pm25;
+        pm100[valid] = frame.pm100;
+        valid++;
+    }
+
+    if (!valid)
+        return status;
+
+    result->pm25 = aggregate_u16(pm25, valid, SAMPLE_AGGREGATE, &result->frames);
+    result->pm100 = aggregate_u16(pm100, valid, SAMPLE_AGGREGATE, &used_pm100);
+
+    if (used_pm100 < result->frames)
+        result->frames = used_pm100;
+
+    BLOGV(LOG_TAG, "aggregated %i of %i valid frames, %i attempts", result->frames, valid, attempts);
+
+    return SAMPLE_VALID;
+}
+
 void dust_sensor_task()
 {
 
@@ -15,13 +120,50 @@ void dust_sensor_task()
 
     pms_set_passive_mode();
 
+    filter_init(&pm25_filter, &pm25_filter_config);
+    filter_init(&pm100_filter, &pm100_filter_config);
+
     for (;;)
     {
         uint8_t fails_count = 0;
+        sample_status_t status;
+
+        dust_frames_t sample;
+
+        if (config_get_int(CONFIG_DUST_DUTY_CYCLE))
+        {
+            pms_wakeup();
+            vTaskDelay(config_get_int(CONFIG_DUST_WARMUP_DELAY) / portTICK_PERIOD_MS);
+            pms_set_passive_mode();
+
+            status = dust_read_frames(&sample, config_get_int(CONFIG_DUST_WARMUP_FRAMES),
+                                      config_get_int(CONFIG_DUST_AVG_FRAMES));
 
-        pms_values_t pms_values;
+            pms_sleep();
+        }
+        else
+        {
+            status = dust_read_frames(&sample, 0, config_get_int(CONFIG_DUST_OVERSAMPLE));
+        }
+
+        if (status == SAMPLE_VALID)
+        {
+            int64_t time = esp_timer_get_time();
+            uint32_t now = time / 1000000;
 
-        ESP_ERROR_CHECK(pms_fill_values(&pms_values));
+            sample.pm25 = dust_calibrate(CAL_PM25, sample.pm25);
+            sample.pm100 = dust_calibrate(CAL_PM100, sample.pm100);
+            filter_update(&pm25_filter, sample.pm25);
+            filter_update(&pm100_filter, sample.pm100);
+            rolling_average_update(&pm25_avg, sample.pm25, now);
+            rolling_average_update(&pm100_avg, sample.pm100, now);
+            adaptive_update(ADAPTIVE_PM25, sample.pm25, time);
+            adaptive_update(ADAPTIVE_PM100, sample.pm100, time);
+            alarm_sample(CAL_PM25, sample.pm25, time);
+            alarm_sample(CAL_PM100, sample.pm100, time);
+        }
+        else
+            ESP_LOGW(LOG_TAG, "no valid frames from dust sensor (%s), keeping previous values", sample_status_name(status));
 
         while (xSemaphoreTake(dust_values.lock, 1000 / portTICK_PERIOD_MS) != pdTRUE)
         {
@@ -33,16 +175,35 @@ void dust_sensor_task()
             }
         };
 
-        dust_values.pm100 = pms_values.pm100;
-        dust_values.pm25 = pms_values.pm25;
+        dust_values.status = status;
+        dust_values.stats = dust_stats;
+
+        if (status == SAMPLE_VALID)
+        {
+            dust_values.pm100 = sample.pm100;
+            dust_values.pm25 = sample.pm25;
+            dust_values.frames = sample.frames;
+            filter_get_output(&pm25_filter, &dust_values.pm25_filtered);
+            filter_get_output(&pm100_filter, &dust_values.pm100_filtered);
+
+            dust_values.pm25_1h = rolling_average_1h(&pm25_avg);
+            dust_values.pm25_24h = rolling_average_24h(&pm25_avg);
+            dust_values.pm100_1h = rolling_average_1h(&pm100_avg);
+            dust_values.pm100_24h = rolling_average_24h(&pm100_avg);
+            dust_values.aqi = aqi_us_epa(dust_values.pm25_24h, dust_values.pm100_24h);
+            dust_values.aqi_hours = rolling_average_24h_hours(&pm25_avg);
+            dust_values.caqi = caqi_hourly(dust_values.pm25_1h, dust_values.pm100_1h);
+            dust_values.timestamp = esp_timer_get_time();
 
-        dust_values.updated = true;
+            dust_values.updated = true;
+        }
 
         xSemaphoreGive(dust_values.lock);
+        latency_point(LATENCY_DUST, LATENCY_SNAPSHOT);
 
-        ESP_LOGV(LOG_TAG, "updated pm25 is %d", dust_values.pm25);
-        ESP_LOGV(LOG_TAG, "updated pm100 is %d", dust_values.pm100);
+        BLOGV(LOG_TAG, "updated pm25 is %d", dust_values.pm25);
+        BLOGV(LOG_TAG, "updated pm100 is %d", dust_values.pm100);
 
-        vTaskDelay(DUST_TASK_DELAY / portTICK_PERIOD_MS);
+        adaptive_delay(ADAPTIVE_DUST);
     }
 }
@@ -12,39 +12,494 @@
 #include "bmp.h"
 #include "mhz19.h"
 
+#include "mqtt_client.h"
+
 #include "secrets.h"
 
+#include "aggregate.h"
+#include "sample.h"
+#include "filter.h"
+#include "derived.h"
+#include "capture.h"
+#include "config.h"
+#include "calibration.h"
+#include "ota.h"
+#include "stream.h"
+#include "coap.h"
+#include "binlog.h"
+#include "latency.h"
+#include "adaptive.h"
+#include "alarm.h"
+#include "request.h"
+
+#ifndef MQTT_TOPIC_PM_FRAMES
+#define MQTT_TOPIC_PM_FRAMES "pm_frames"
+#endif
+
+#ifndef MQTT_TOPIC_CO2_FRAMES
+#define MQTT_TOPIC_CO2_FRAMES "co2_frames"
+#endif
+
+#ifndef MQTT_TOPIC_STATUS
+#define MQTT_TOPIC_STATUS "status"
+#endif
+
+#ifndef MQTT_TOPIC_FILTERED
+#define MQTT_TOPIC_FILTERED "filtered"
+#endif
+
+#ifndef MQTT_TOPIC_AQI
+#define MQTT_TOPIC_AQI "aqi"
+#endif
+
+#ifndef MQTT_TOPIC_PRES_SEA
+#define MQTT_TOPIC_PRES_SEA "pres_sea"
+#endif
+
+#ifndef MQTT_TOPIC_VENTILATION
+#define MQTT_TOPIC_VENTILATION "ventilation"
+#endif
+
+#ifndef MQTT_TOPIC_CAPTURE
+#define MQTT_TOPIC_CAPTURE "capture"
+#endif
+
+/*
+Runtime configuration, see config.h: commands are taken on
+<prefix>/<MQTT_TOPIC_CONFIG>/set and, if set, on MQTT_TOPIC_CONFIG_FLEET
+which all units of a fleet can share. The current settings are published,
+retained, on <prefix>/<MQTT_TOPIC_CONFIG> after every command.
+*/
+#ifndef MQTT_TOPIC_CONFIG
+#define MQTT_TOPIC_CONFIG "config"
+#endif
+
+#ifndef MQTT_TOPIC_CONFIG_FLEET
+#define MQTT_TOPIC_CONFIG_FLEET ""
+#endif
+
+/*
+Calibration, see calibration.h: reference readings are taken on
+<prefix>/<MQTT_TOPIC_CALIBRATE>, not retained, the fitted lines are published, retained,
+on <prefix>/<MQTT_TOPIC_CALIBRATION> after every command.
+*/
+#ifndef MQTT_TOPIC_CALIBRATE
+#define MQTT_TOPIC_CALIBRATE "calibrate"
+#endif
+
+#ifndef MQTT_TOPIC_CALIBRATION
+#define MQTT_TOPIC_CALIBRATION "calibration"
+#endif
+
+/*
+Updates, see ota.h: the URL of a patch made by host/ota/mkdelta and the
+SHA-256 of the new image, "url sha256hex", are taken on
+<prefix>/<MQTT_TOPIC_OTA>/set, the running partition and the progress of the
+update are published, retained, on <prefix>/<MQTT_TOPIC_OTA>.
+*/
+#ifndef MQTT_TOPIC_OTA
+#define MQTT_TOPIC_OTA "ota"
+#endif
+
+/*
+Deferred logs, see binlog.h: a message on <prefix>/<MQTT_TOPIC_LOG>/get,
+optionally with the highest level as a letter (E, W, I, D, V) or number,
+publishes the records recorded since the previous one on
+<prefix>/<MQTT_TOPIC_LOG>, a line each, in messages of up to
+BINLOG_MQTT_CHUNK bytes.
+*/
+#ifndef MQTT_TOPIC_LOG
+#define MQTT_TOPIC_LOG "log"
+#endif
+
+/*
+Threshold alarms, see alarm.h: events on <prefix>/<MQTT_TOPIC_ALARM>, rules
+set on <prefix>/<MQTT_TOPIC_ALARM_RULES>/set and published, retained, on
+<prefix>/<MQTT_TOPIC_ALARM_RULES>. ALARM_RULES is used until rules are
+stored, e.g. "co2.above=1500:100".
+*/
+#ifndef MQTT_TOPIC_ALARM
+#define MQTT_TOPIC_ALARM "alarm"
+#endif
+
+#ifndef MQTT_TOPIC_ALARM_RULES
+#define MQTT_TOPIC_ALARM_RULES "alarm/rules"
+#endif
+
+#ifndef ALARM_RULES
+#define ALARM_RULES ""
+#endif
+
+#ifndef ALARM_QUEUE_LENGTH
+#define ALARM_QUEUE_LENGTH 8 // events waiting for MQTT
+#endif
+
+#define ALARM_RETRY_DELAY 1000
+
+/*
+Samples on demand, see request.h: a message on <prefix>/<MQTT_TOPIC_SAMPLE>/get
+is answered on <prefix>/<MQTT_TOPIC_SAMPLE>.
+*/
+#ifndef MQTT_TOPIC_SAMPLE
+#define MQTT_TOPIC_SAMPLE "sample"
+#endif
+
+#ifndef REQUEST_QUEUE_LENGTH
+#define REQUEST_QUEUE_LENGTH 4 // requests waiting for their samples
+#endif
+
+#ifndef REQUEST_TIMEOUT
+#define REQUEST_TIMEOUT 60000 // milliseconds, covers DUST_WARMUP_DELAY
+#endif
+
+#ifndef OTA_MAX_RETRIES
+#define OTA_MAX_RETRIES 5 // resumed downloads per update
+#endif
+
+#ifndef OTA_RETRY_DELAY
+#define OTA_RETRY_DELAY 5000 // milliseconds, times the attempt
+#endif
+
+#ifndef OTA_HTTP_TIMEOUT
+#define OTA_HTTP_TIMEOUT 10000 // milliseconds
+#endif
+
+#ifndef OTA_RESTART_DELAY
+#define OTA_RESTART_DELAY 2000 // milliseconds between the last status and the restart
+#endif
+
+#ifndef OTA_HEALTH_TIMEOUT
+#define OTA_HEALTH_TIMEOUT 300000 // milliseconds for a new image to confirm itself
+#endif
+
+/*
+HTTP server, see http.h, and the Prometheus endpoint /metrics on it, see
+metrics.h. Off by default.
+*/
+#ifndef METRICS_ENABLE
+#define METRICS_ENABLE 0
+#endif
+
+#ifndef HTTP_SERVER_PORT
+#define HTTP_SERVER_PORT 80
+#endif
+
+#define HTTP_SERVER_PRIORITY 5 // below the sensor and MQTT tasks
+
+#ifndef METRICS_BUFFER_SIZE
+#define METRICS_BUFFER_SIZE 6144
+#endif
+
+#define METRICS_LOCK_TIMEOUT 10 // milliseconds a scrape waits for the values of a sensor
+
+/*
+Live sample stream /stream on the HTTP server, see stream.h. Off by default.
+*/
+#ifndef STREAM_ENABLE
+#define STREAM_ENABLE 0
+#endif
+
+#ifndef STREAM_MAX_CLIENTS
+#define STREAM_MAX_CLIENTS 2
+#endif
+
+#ifndef STREAM_BUFFER_SIZE
+#define STREAM_BUFFER_SIZE 4096 // bytes of events shared by all clients
+#endif
+
+#define STREAM_CLIENT_BUFFER 512 // bytes being sent to one client
+#ifndef STREAM_STALL_TIMEOUT
+#define STREAM_STALL_TIMEOUT 10000 // milliseconds a client may take nothing before it is dropped
+#endif
+
+#define STREAM_RETRY_DELAY 100 // milliseconds between sends to a blocked client
+#define STREAM_PRIORITY 4 // below the HTTP server
+
+/*
+Samples over CoAP or plain UDP instead of MQTT, see coap.h. Without
+COAP_HOST the runtime setting "transport" has no effect. TRANSPORT and
+COAP_CONFIRMABLE are defaults of the runtime configuration.
+*/
+#ifndef COAP_HOST
+#define COAP_HOST "" // name or IPv4 address of the CoAP server or UDP receiver
+#endif
+
+#ifndef COAP_PORT
+#define COAP_PORT 5683
+#endif
+
+#ifndef COAP_PATH
+#define COAP_PATH "dust" // segments separated by '/'
+#endif
+
+#ifndef TRANSPORT
+#define TRANSPORT TRANSPORT_MQTT
+#endif
+
+#ifndef COAP_CONFIRMABLE
+#define COAP_CONFIRMABLE 0
+#endif
+
+#define COAP_ACK_TIMEOUT 2000 // milliseconds, RFC 7252 defaults
+#define COAP_MAX_RETRANSMIT 4
+
+/*
+Deferred debug and verbose logging, see binlog.h. BINLOG_LEVEL is the
+highest level recorded, lower it to ESP_LOG_INFO to compile the records
+out. BINLOG_SERIAL_LEVEL is the default of the runtime setting "log_serial".
+*/
+#ifndef BINLOG_LEVEL
+#define BINLOG_LEVEL ESP_LOG_VERBOSE
+#endif
+
+#ifndef BINLOG_BUFFER_SIZE
+#define BINLOG_BUFFER_SIZE 4096
+#endif
+
+#ifndef BINLOG_SERIAL_LEVEL
+#define BINLOG_SERIAL_LEVEL ESP_LOG_NONE
+#endif
+
+#define BINLOG_DRAIN_DELAY 1000 // milliseconds between drains to the serial console
+#define BINLOG_MQTT_CHUNK 1024 // bytes of text per message on <prefix>/log
+
+/*
+Field capture of raw sensor traffic, see capture.h. Off by default: a chunk
+of up to CAPTURE_BUFFER_SIZE bytes is published every MQTT_DELAY.
+*/
+#ifndef CAPTURE_ENABLE
+#define CAPTURE_ENABLE 0
+#endif
+
+#ifndef CAPTURE_BUFFER_SIZE
+#define CAPTURE_BUFFER_SIZE 2048
+#endif
+
+/*
+Latency histograms of the sample path, see latency.h. Off by default: the
+status messages then go at QoS 1 and the histograms are published on
+<prefix>/<MQTT_TOPIC_LATENCY>/<sensor> every MQTT_DELAY.
+*/
+#ifndef LATENCY_ENABLE
+#define LATENCY_ENABLE 0
+#endif
+
+#ifndef MQTT_TOPIC_LATENCY
+#define MQTT_TOPIC_LATENCY "latency"
+#endif
+
+/*
+Site parameters for derived metrics, see derived.h.
+*/
+#ifndef SITE_ALTITUDE
+#define SITE_ALTITUDE 0.0 // meters above sea level
+#endif
+
+#ifndef OUTDOOR_CO2_PPM
+#define OUTDOOR_CO2_PPM 420.0
+#endif
+
 /* FreeRTOS event group to signal when we are connected*/
 extern EventGroupHandle_t eg_app_status;
 
+extern esp_mqtt_client_handle_t mqtt_client;
+
 #define WIFI_CONNECTED_BIT BIT0
 #define WIFI_FAIL_BIT BIT1
 #define MQTT_CONNECTED_BIT BIT2
 #define MQTT_MUST_DISCONNECT_BIT BIT3
+
+// a runtime setting of the task changed, see config_delay()
+#define CONFIG_DUST_BIT BIT4
+#define CONFIG_CO2_BIT BIT5
+#define CONFIG_BMP_BIT BIT6
+#define CONFIG_MQTT_BIT BIT7
+
+// the running image reached the broker, see ota_confirm()
+#define OTA_CONFIRMED_BIT BIT8
+
+// a sample was requested from the task, and it was taken; see request.h
+#define REQUEST_DUST_BIT BIT9
+#define REQUEST_CO2_BIT BIT10
+#define REQUEST_BMP_BIT BIT11
+#define SAMPLED_DUST_BIT BIT12
+#define SAMPLED_CO2_BIT BIT13
+#define SAMPLED_BMP_BIT BIT14
+
+/*
+Task periods, dust duty cycling, oversampling, the site parameters and
+TEMP_K_A/TEMP_K_B are defaults of the runtime configuration, see config.h.
+*/
+#ifndef MQTT_DELAY
 #define MQTT_DELAY 10000 //microseconds
+#endif
 
 #define SEMAPHORE_TIMEOUT 2000 // microseconds
 
 #define DUST_PIN_RX GPIO_NUM_16
 #define DUST_PIN_TX GPIO_NUM_17
 
+#ifndef DUST_TASK_DELAY
 #define DUST_TASK_DELAY 10000 //microseconds
+#endif
+
+/*
+Duty cycling of the dust sensor. When enabled, the fan is stopped between
+measurements: every DUST_TASK_DELAY the sensor is woken up, given
+DUST_WARMUP_DELAY to settle, the first DUST_WARMUP_FRAMES frames are dropped
+and DUST_AVG_FRAMES valid frames are averaged before it is put to sleep again.
+Can be overridden per deployment in secrets.h.
+*/
+#ifndef DUST_DUTY_CYCLE
+#define DUST_DUTY_CYCLE 0
+#endif
+
+#ifndef DUST_WARMUP_DELAY
+#define DUST_WARMUP_DELAY PMS_WARMUP_DELAY // milliseconds
+#endif
+
+#ifndef DUST_WARMUP_FRAMES
+#define DUST_WARMUP_FRAMES 3
+#endif
+
+#ifndef DUST_AVG_FRAMES
+#define DUST_AVG_FRAMES 5
+#endif
+
+#define DUST_FRAME_DELAY 1000 // milliseconds
+
+/*
+Oversampling: number of frames read and aggregated per cycle when the dust
+sensor runs continuously (DUST_AVG_FRAMES is used when duty cycling) and for
+the CO2 sensor. Checksum failures and outliers are rejected, the rest is
+reduced with SAMPLE_AGGREGATE (AGGREGATE_MEDIAN or AGGREGATE_TRIMMED_MEAN).
+*/
+#ifndef DUST_OVERSAMPLE
+#define DUST_OVERSAMPLE 1
+#endif
+
+#ifndef CO2_OVERSAMPLE
+#define CO2_OVERSAMPLE 1
+#endif
+
+#define CO2_FRAME_DELAY 1000 // milliseconds
+
+#ifndef SAMPLE_AGGREGATE
+#define SAMPLE_AGGREGATE AGGREGATE_MEDIAN
+#endif
+
+/*
+Smoothing per channel, see filter.h. Smoothed values are published next to
+the raw ones on <topic>/filtered.
+*/
+#ifndef FILTER_PM25
+#define FILTER_PM25 {.alpha = 0.3, .median = 5, .window = 30}
+#endif
+
+#ifndef FILTER_PM100
+#define FILTER_PM100 {.alpha = 0.3, .median = 5, .window = 30}
+#endif
+
+#ifndef FILTER_CO2
+#define FILTER_CO2 {.alpha = 0.2, .median = 3, .window = 30}
+#endif
+
+#ifndef FILTER_TEMP
+#define FILTER_TEMP {.alpha = 0.1, .median = 0, .window = 30}
+#endif
+
+#ifndef FILTER_PRES
+#define FILTER_PRES {.alpha = 0.1, .median = 0, .window = 30}
+#endif
+
+/*
+Plausible ranges, frames outside are rejected as SAMPLE_OUT_OF_RANGE.
+*/
+#define DUST_MAX_VALUE 1000 // ug/m3, PMS7003 maximum range
+#define CO2_MIN_PPM 300
+#define CO2_MAX_PPM 10000
+#define BMP_MIN_TEMP -40.0 // C
+#define BMP_MAX_TEMP 85.0
+#define BMP_MIN_PRES 30000.0 // Pa
+#define BMP_MAX_PRES 110000.0
+
+/*
+A valid sample older than this (milliseconds) is reported as SAMPLE_STALE.
+*/
+#define DUST_MAX_AGE (3 * (config_get_int(CONFIG_DUST_TASK_DELAY) + \
+                           (config_get_int(CONFIG_DUST_DUTY_CYCLE) ? config_get_int(CONFIG_DUST_WARMUP_DELAY) : 0)))
+#define CO2_MAX_AGE (3 * config_get_int(CONFIG_CO2_TASK_DELAY))
+#define BMP_MAX_AGE (3 * config_get_int(CONFIG_BMP_TASK_DELAY))
 
 #define BMP_SDA_PIN GPIO_NUM_33
 #define BMP_SCL_PIN GPIO_NUM_32
 
+#ifndef BMP_TASK_DELAY
 #define BMP_TASK_DELAY 10000 //microseconds
+#endif
 
 #define CO2_PIN_RX GPIO_NUM_21
 #define CO2_PIN_TX GPIO_NUM_19
 
+#ifndef CO2_TASK_DELAY
 #define CO2_TASK_DELAY 10000 //microseconds
+#endif
+
+/*
+Adaptive sampling, see adaptive.h. ADAPTIVE_ENABLE and the *_MIN_DELAY
+periods (milliseconds) are defaults of the runtime configuration, the
+*_TASK_DELAY periods are then the slowest. A channel moves when it changes
+faster than its *_RATE per minute, by more than its *_SD, or when its
+standard deviation exceeds *_SD.
+*/
+#ifndef ADAPTIVE_ENABLE
+#define ADAPTIVE_ENABLE 0
+#endif
+
+#ifndef DUST_MIN_DELAY
+#define DUST_MIN_DELAY 2000
+#endif
+
+#ifndef CO2_MIN_DELAY
+#define CO2_MIN_DELAY 5000 // the MH-Z19 measures every 5 s
+#endif
+
+#ifndef BMP_MIN_DELAY
+#define BMP_MIN_DELAY 2000
+#endif
+
+#define ADAPTIVE_ALPHA 0.3f
+#define ADAPTIVE_BACKOFF 1.25f
+
+#define ADAPTIVE_PM25_RATE 5.0f // ug/m3 per minute
+#define ADAPTIVE_PM25_SD 3.0f
+#define ADAPTIVE_PM100_RATE 8.0f
+#define ADAPTIVE_PM100_SD 5.0f
+#define ADAPTIVE_CO2_RATE 50.0f // ppm per minute
+#define ADAPTIVE_CO2_SD 20.0f
+#define ADAPTIVE_TEMP_RATE 0.5f // C per minute
+#define ADAPTIVE_TEMP_SD 0.2f
+#define ADAPTIVE_PRES_RATE 20.0f // Pa per minute
+#define ADAPTIVE_PRES_SD 10.0f
 
 struct dust_values_s
 {
     uint16_t pm25;
     uint16_t pm100;
+    uint8_t frames;
+    filter_output_t pm25_filtered;
+    filter_output_t pm100_filtered;
+    float pm25_1h;
+    float pm25_24h;
+    float pm100_1h;
+    float pm100_24h;
+    uint16_t aqi;  // US EPA, from 24 hour averages
+    uint16_t caqi; // EU CAQI hourly
+    uint8_t aqi_hours; // hours of the 24 with samples, the AQI is provisional below AQI_MIN_HOURS
     uint8_t updated;
+    sample_status_t status;
+    int64_t timestamp; // esp_timer_get_time() of the last valid sample
+    sample_stats_t stats;
     SemaphoreHandle_t lock;
 } dust_values;
 
@@ -54,12 +509,25 @@ void bmp_task();
 void network_task();
 void mqtt_task();
 
+/*
+Publishes the current values and their status with `client` under `prefix`.
+sendMQTTupdate() does it for the device's own client and MQTT_TOPIC_PREFIX.
+*/
+void mqtt_send_update(esp_mqtt_client_handle_t client, const char *prefix);
+void sendMQTTupdate();
+
 void start_network();
 
 struct co2_values_s
 {
     uint16_t ppm;
+    uint8_t frames;
+    filter_output_t ppm_filtered;
+    float ach; // estimated air changes per hour, NAN if unknown
     uint8_t updated;
+    sample_status_t status;
+    int64_t timestamp;
+    sample_stats_t stats;
     SemaphoreHandle_t lock;
 } co2_values;
 
@@ -67,7 +535,13 @@ struct bmp_values_s
 {
     double pres;
     double temp;
+    filter_output_t pres_filtered;
+    filter_output_t temp_filtered;
+    double pres_sea; // reduced to sea level for SITE_ALTITUDE
     uint8_t updated;
+    sample_status_t status;
+    int64_t timestamp;
+    sample_stats_t stats;
     SemaphoreHandle_t lock;
 } bmp_values;
 
@@ -0,0 +1,163 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "filter.h"
+
+void filter_init(filter_t *filter, const filter_config_t *config)
+{
+    memset(filter, 0, sizeof(filter_t));
+    filter->config = *config;
+
+    if (filter->config.median > FILTER_MAX_MEDIAN)
+        filter->config.median = FILTER_MAX_MEDIAN;
+    if (filter->config.window > FILTER_MAX_WINDOW)
+        filter->config.window = FILTER_MAX_WINDOW;
+}
+
+static void median_update(filter_t *filter, float value)
+{
+    uint8_t n = filter->config.median;
+    uint8_t i;
+
+    if (filter->median_len == n)
+    {
+        // drop the oldest sample from the sorted copy
+        float oldest = filter->median_ring[filter->median_pos];
+
+        for (i = 0; i < n && filter->median_sorted[i] != oldest; i++)
+            ;
+        for (; i + 1 < n; i++)
+            filter->median_sorted[i] = filter->median_sorted[i + 1];
+        filter->median_len--;
+    }
+
+    filter->median_ring[filter->median_pos] = value;
+    filter->median_pos = (filter->median_pos + 1) % n;
+
+    for (i = filter->median_len; i > 0 && filter->median_sorted[i - 1] > value; i--)
+        filter->median_sorted[i] = filter->median_sorted[i - 1];
+    filter->median_sorted[i] = value;
+    filter->median_len++;
+}
+
+static void minmax_push(uint8_t *queue, uint8_t *head, uint8_t *len, const float *window,
+                        uint8_t n, uint8_t slot, int is_min)
+{
+    // the slot is about to be overwritten, so it can only be at the front
+    if (*len && queue[*head] == slot)
+    {
+        *head = (*head + 1) % n;
+        (*len)--;
+    }
+
+    while (*len)
+    {
+        float last = window[queue[(*head + *len - 1) % n]];
+
+        if (is_min ? last < window[slot] : last > window[slot])
+            break;
+        (*len)--;
+    }
+
+    queue[(*head + *len) % n] = slot;
+    (*len)++;
+}
+
+static void window_update(filter_t *filter, float value)
+{
+    uint8_t n = filter->config.window;
+    uint8_t slot = filter->window_pos;
+    float delta;
+
+    if (filter->window_len < n)
+    {
+        filter->window_len++;
+        delta = value - filter->mean;
+        filter->mean += delta / filter->window_len;
+        filter->m2 += delta * (value - filter->mean);
+    }
+    else
+    {
+        float oldest = filter->window[slot];
+        float old_mean = filter->mean;
+
+        filter->mean += (value - oldest) / n;
+        filter->m2 += (value - oldest) * (value - filter->mean + oldest - old_mean);
+        if (filter->m2 < 0)
+            filter->m2 = 0;
+    }
+
+    filter->window[slot] = value;
+    filter->window_pos = (slot + 1) % n;
+
+    minmax_push(filter->min_q, &filter->min_head, &filter->min_len, filter->window, n, slot, 1);
+    minmax_push(filter->max_q, &filter->max_head, &filter->max_len, filter->window, n, slot, 0);
+}
+
+void filter_update(filter_t *filter, float value)
+{
+    if (filter->config.alpha > 0)
+    {
+        if (filter->count == 0)
+            filter->ema = value;
+        else
+            filter->ema += filter->config.alpha * (value - filter->ema);
+    }
+
+    if (filter->config.median)
+        median_update(filter, value);
+
+    if (filter->config.window)
+        window_update(filter, value);
+
+    filter->count++;
+}
+
+void filter_get_output(const filter_t *filter, filter_output_t *output)
+{
+    memset(output, 0, sizeof(filter_output_t));
+    output->config = filter->config;
+    output->count = filter->count;
+    output->ema = filter->ema;
+
+    if (filter->median_len)
+    {
+        uint8_t n = filter->median_len;
+
+        if (n % 2)
+            output->median = filter->median_sorted[n / 2];
+        else
+            output->median = (filter->median_sorted[n / 2 - 1] + filter->median_sorted[n / 2]) / 2;
+    }
+
+    if (filter->window_len)
+    {
+        output->mean = filter->mean;
+        output->stddev = filter->window_len > 1 ? sqrtf(filter->m2 / (filter->window_len - 1)) : 0;
+        output->min = filter->window[filter->min_q[filter->min_head]];
+        output->max = filter->window[filter->max_q[filter->max_head]];
+    }
+}
+
+int filter_format(const filter_output_t *output, char *buf, int size)
+{
+    int len;
+
+    len = snprintf(buf, size, "{\"n\":%u", output->count);
+
+    if (output->config.alpha > 0 && len < size)
+        len += snprintf(buf + len, size - len, ",\"ema\":%.2f", output->ema);
+
+    if (output->config.median && len < size)
+        len += snprintf(buf + len, size - len, ",\"median\":%.2f", output->median);
+
+    if (output->config.window && len < size)
+        len += snprintf(buf + len, size - len, ",\"mean\":%.2f,\"sd\":%.2f,\"min\":%.2f,\"max\":%.2f",
+                        output->mean, output->stddev, output->min, output->max);
+
+    if (len < size)
+        len += snprintf(buf + len, size - len, "}");
+
+    return len;
+}
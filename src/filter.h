@@ -0,0 +1,81 @@
+#ifndef _FILTER_H
+#define _FILTER_H
+
+#include <stdint.h>
+
+#define FILTER_MAX_MEDIAN 9
+#define FILTER_MAX_WINDOW 64
+
+/*
+Smoothing of one channel. Every stage can be disabled with 0.
+*/
+typedef struct
+{
+    float alpha;    // EMA weight of a new sample, 0..1
+    uint8_t median; // median of the last N samples, N <= FILTER_MAX_MEDIAN
+    uint8_t window; // rolling mean/variance/min/max over N samples, N <= FILTER_MAX_WINDOW
+} filter_config_t;
+
+/*
+Current smoothed values of a channel, small enough to be copied into the
+shared sensor state.
+*/
+typedef struct
+{
+    filter_config_t config;
+    uint32_t count; // samples seen since boot
+    float ema;
+    float median;
+    float mean;
+    float stddev;
+    float min;
+    float max;
+} filter_output_t;
+
+typedef struct
+{
+    filter_config_t config;
+    uint32_t count;
+
+    float ema;
+
+    float median_ring[FILTER_MAX_MEDIAN];
+    float median_sorted[FILTER_MAX_MEDIAN];
+    uint8_t median_pos;
+    uint8_t median_len;
+
+    /*
+    Welford running mean and sum of squared deviations over the window,
+    updated in place when the oldest sample leaves it.
+    */
+    float window[FILTER_MAX_WINDOW];
+    uint8_t window_pos;
+    uint8_t window_len;
+    float mean;
+    float m2;
+
+    /*
+    Monotonic queues of window slots, front holds the current min/max.
+    */
+    uint8_t min_q[FILTER_MAX_WINDOW];
+    uint8_t max_q[FILTER_MAX_WINDOW];
+    uint8_t min_head, min_len;
+    uint8_t max_head, max_len;
+} filter_t;
+
+void filter_init(filter_t *filter, const filter_config_t *config);
+
+/*
+Feeds one valid sample. O(1) for EMA and window statistics (amortized for
+min/max), O(N) with N <= FILTER_MAX_MEDIAN for the median.
+*/
+void filter_update(filter_t *filter, float value);
+
+void filter_get_output(const filter_t *filter, filter_output_t *output);
+
+/*
+Renders enabled outputs as a JSON object, returns the length written.
+*/
+int filter_format(const filter_output_t *output, char *buf, int size);
+
+#endif // _FILTER_H
@@ -0,0 +1,37 @@
+#include "esp_log.h"
+#define LOG_TAG "http"
+
+#include "esp_http_server.h"
+
+#include "dust_sensor.h"
+#include "http.h"
+#include "metrics.h"
+#include "stream.h"
+
+void http_start(void)
+{
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    httpd_handle_t server;
+    esp_err_t err;
+
+    if (!METRICS_ENABLE && !STREAM_ENABLE)
+        return;
+
+    config.server_port = HTTP_SERVER_PORT;
+    // below the sensor tasks, a scrape waits for them and not the other way round
+    config.task_priority = HTTP_SERVER_PRIORITY;
+
+    err = httpd_start(&server, &config);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(LOG_TAG, "can't start the server on port %d (%s)", HTTP_SERVER_PORT, esp_err_to_name(err));
+        return;
+    }
+
+    if (METRICS_ENABLE && (err = metrics_register(server)) != ESP_OK)
+        ESP_LOGE(LOG_TAG, "can't register /metrics (%s)", esp_err_to_name(err));
+    if (STREAM_ENABLE && (err = stream_register(server)) != ESP_OK)
+        ESP_LOGE(LOG_TAG, "can't register /stream (%s)", esp_err_to_name(err));
+
+    ESP_LOGI(LOG_TAG, "serving on port %d", HTTP_SERVER_PORT);
+}
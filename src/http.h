@@ -0,0 +1,12 @@
+#ifndef _HTTP_H
+#define _HTTP_H
+
+/*
+On-device HTTP server on HTTP_SERVER_PORT, started with the network if one
+of its endpoints is enabled: /metrics (METRICS_ENABLE, see metrics.h) and
+/stream (STREAM_ENABLE, see stream.h).
+*/
+
+void http_start(void);
+
+#endif // _HTTP_H
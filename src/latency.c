@@ -0,0 +1,187 @@
+#include "esp_log.h"
+#define LOG_TAG "latency"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_timer.h"
+
+#include "dust_sensor.h"
+#include "latency.h"
+
+typedef struct
+{
+    uint32_t count;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t buckets[LATENCY_BUCKETS];
+} latency_histogram_t;
+
+typedef struct
+{
+    int64_t reached[LATENCY_POINT_COUNT]; // microseconds, 0 once used
+    int msg_id;                           // of the enqueued status message, -1 for none
+    latency_histogram_t stages[LATENCY_POINT_COUNT]; // by the point that ends the stage, the first is unused
+} latency_trace_t;
+
+// name of the stage that ends at each point
+static const char *stage_names[LATENCY_POINT_COUNT] = {
+    [LATENCY_FIRST_BYTE] = "response",
+    [LATENCY_FRAME] = "transfer",
+    [LATENCY_DECODED] = "decode",
+    [LATENCY_SNAPSHOT] = "process",
+    [LATENCY_ENQUEUED] = "queue",
+    [LATENCY_ACKED] = "ack",
+};
+
+static SemaphoreHandle_t latency_lock;
+static latency_trace_t traces[LATENCY_SOURCE_COUNT];
+
+const char *latency_source_name(latency_source_t source)
+{
+    return source == LATENCY_DUST ? "dust" : "co2";
+}
+
+static void histogram_add(latency_histogram_t *h, uint32_t us)
+{
+    int bucket = 0;
+
+    while (bucket < LATENCY_BUCKETS - 1 && us > 1u << (bucket + LATENCY_MIN_SHIFT))
+        bucket++;
+
+    h->buckets[bucket]++;
+    h->count++;
+    h->sum += us;
+    if (us > h->max)
+        h->max = us;
+}
+
+// call with the lock held
+static void reach(latency_trace_t *trace, latency_point_t point, int64_t now)
+{
+    if (point > LATENCY_COMMAND && trace->reached[point - 1])
+    {
+        int64_t elapsed = now - trace->reached[point - 1];
+
+        histogram_add(&trace->stages[point], elapsed < UINT32_MAX ? elapsed : UINT32_MAX);
+        trace->reached[point - 1] = 0;
+    }
+
+    trace->reached[point] = point < LATENCY_ACKED ? now : 0;
+}
+
+void latency_point(latency_source_t source, latency_point_t point)
+{
+    int64_t now = esp_timer_get_time();
+
+    if (!latency_lock)
+        return;
+
+    xSemaphoreTake(latency_lock, portMAX_DELAY);
+    reach(&traces[source], point, now);
+    xSemaphoreGive(latency_lock);
+}
+
+void latency_enqueued(latency_source_t source, int msg_id)
+{
+    int64_t now = esp_timer_get_time();
+
+    if (!latency_lock)
+        return;
+
+    xSemaphoreTake(latency_lock, portMAX_DELAY);
+    reach(&traces[source], LATENCY_ENQUEUED, now);
+    traces[source].msg_id = msg_id > 0 ? msg_id : -1;
+    xSemaphoreGive(latency_lock);
+}
+
+void latency_acked(int msg_id)
+{
+    int64_t now = esp_timer_get_time();
+
+    if (!latency_lock || msg_id <= 0)
+        return;
+
+    xSemaphoreTake(latency_lock, portMAX_DELAY);
+    for (int i = 0; i < LATENCY_SOURCE_COUNT; i++)
+    {
+        if (traces[i].msg_id != msg_id)
+            continue;
+        reach(&traces[i], LATENCY_ACKED, now);
+        traces[i].msg_id = -1;
+    }
+    xSemaphoreGive(latency_lock);
+}
+
+static void put(char *buffer, size_t size, size_t *used, const char *format, ...)
+{
+    va_list args;
+    int length;
+
+    va_start(args, format);
+    length = vsnprintf(buffer + (*used < size ? *used : size), *used < size ? size - *used : 0, format, args);
+    va_end(args);
+
+    if (length > 0)
+        *used += length;
+}
+
+int latency_format(latency_source_t source, char *buffer, size_t size)
+{
+    latency_histogram_t stages[LATENCY_POINT_COUNT];
+    size_t used = 0;
+
+    if (size)
+        buffer[0] = 0;
+    if (!latency_lock)
+        return 0;
+
+    xSemaphoreTake(latency_lock, portMAX_DELAY);
+    memcpy(stages, traces[source].stages, sizeof(stages));
+    xSemaphoreGive(latency_lock);
+
+    put(buffer, size, &used, "{");
+    for (int point = LATENCY_FIRST_BYTE; point < LATENCY_POINT_COUNT; point++)
+    {
+        const latency_histogram_t *h = &stages[point];
+
+        put(buffer, size, &used, "%s\"%s\":{\"n\":%u,\"sum_us\":%llu,\"max_us\":%u,\"buckets\":[",
+            point > LATENCY_FIRST_BYTE ? "," : "", stage_names[point], h->count, (unsigned long long)h->sum,
+            h->max);
+        for (int i = 0; i < LATENCY_BUCKETS; i++)
+            put(buffer, size, &used, "%s%u", i ? "," : "", h->buckets[i]);
+        put(buffer, size, &used, "]}");
+    }
+    put(buffer, size, &used, "}");
+
+    return used;
+}
+
+// the driver hooks report the first three points, in the same order
+static void latency_pms(pms_trace_point_t point)
+{
+    latency_point(LATENCY_DUST, LATENCY_COMMAND + point);
+}
+
+static void latency_mhz19(mhz19_trace_point_t point)
+{
+    latency_point(LATENCY_CO2, LATENCY_COMMAND + point);
+}
+
+void latency_init(void)
+{
+    if (!LATENCY_ENABLE)
+        return;
+
+    for (int i = 0; i < LATENCY_SOURCE_COUNT; i++)
+        traces[i].msg_id = -1;
+
+    latency_lock = xSemaphoreCreateBinary();
+    xSemaphoreGive(latency_lock);
+
+    pms_set_trace(latency_pms);
+    mhz19_set_trace(latency_mhz19);
+
+    ESP_LOGI(LOG_TAG, "tracing the sample path of the dust and co2 sensors");
+}
@@ -0,0 +1,72 @@
+#ifndef _LATENCY_H
+#define _LATENCY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+Per-stage latency of the way from a sensor frame to the broker, for the
+PMS7003 and MH-Z19, when LATENCY_ENABLE is set. Tracepoints take the time
+in microseconds:
+
+    COMMAND     read command written to the UART       (driver hook)
+    FIRST_BYTE  first byte of the answer received       (driver hook)
+    FRAME       frame complete                          (driver hook)
+    DECODED     frame decoded and range checked         dust.c, co2.c
+    SNAPSHOT    sample handed to the other tasks        dust.c, co2.c
+    ENQUEUED    status message handed to the client     mqtt.c
+    ACKED       MQTT_EVENT_PUBLISHED for that message   mqtt.c
+
+and every point adds the time since the one before it, if that was
+reached, to the histogram of its stage; a point counts once, so a sample
+published twice is measured on its first publication. Oversampled frames
+are measured one by one up to DECODED, the sample from its last frame on.
+The status message of each sensor goes at QoS 1 while this is enabled, so
+that the broker acknowledges it.
+
+Histograms are cumulative since boot and are published as JSON on
+<prefix>/<MQTT_TOPIC_LATENCY>/<sensor> with every update: per stage the
+count, sum and maximum in microseconds and the counts in buckets
+LATENCY_BUCKETS wide, bucket i for up to 2^(i + LATENCY_MIN_SHIFT)
+microseconds, the last one for everything longer.
+*/
+
+#define LATENCY_BUCKETS 20
+#define LATENCY_MIN_SHIFT 7 // 128 us, the last bucket starts at 33.5 s
+
+typedef enum
+{
+    LATENCY_DUST,
+    LATENCY_CO2,
+    LATENCY_SOURCE_COUNT,
+} latency_source_t;
+
+typedef enum
+{
+    LATENCY_COMMAND,
+    LATENCY_FIRST_BYTE,
+    LATENCY_FRAME,
+    LATENCY_DECODED,
+    LATENCY_SNAPSHOT,
+    LATENCY_ENQUEUED,
+    LATENCY_ACKED,
+    LATENCY_POINT_COUNT,
+} latency_point_t;
+
+// installs the driver hooks, does nothing without LATENCY_ENABLE
+void latency_init(void);
+
+void latency_point(latency_source_t source, latency_point_t point);
+
+// the status message of `source` was handed to the MQTT client as `msg_id`
+void latency_enqueued(latency_source_t source, int msg_id);
+
+// MQTT_EVENT_PUBLISHED for `msg_id`
+void latency_acked(int msg_id);
+
+// the histograms of `source` as JSON, returns the length like snprintf()
+int latency_format(latency_source_t source, char *buffer, size_t size);
+
+const char *latency_source_name(latency_source_t source);
+
+#endif // _LATENCY_H
@@ -4,8 +4,8 @@
 #include "dust_sensor.h"
 
 #include "esp_heap_task_info.h"
+#include "nvs_flash.h"
 
-#define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
 #include "esp_log.h"
 #include "esp_event.h"
 
@@ -21,21 +21,29 @@ char *get_uniq_id()
 void app_main()
 {
     esp_log_level_set("*", ESP_LOG_INFO);
-    esp_log_level_set("MQTT_CLIENT", ESP_LOG_VERBOSE);
-    esp_log_level_set("TRANSPORT_TCP", ESP_LOG_VERBOSE);
-    esp_log_level_set("TRANSPORT_SSL", ESP_LOG_VERBOSE);
-    esp_log_level_set("TRANSPORT", ESP_LOG_VERBOSE);
-    esp_log_level_set("OUTBOX", ESP_LOG_VERBOSE);
-    esp_log_level_set("TASK: dust", ESP_LOG_INFO);
-    esp_log_level_set("TASK: mqtt", ESP_LOG_VERBOSE);
-    esp_log_level_set("TASK: pressure", ESP_LOG_INFO);
-    esp_log_level_set(LOG_TAG, ESP_LOG_DEBUG);
+    // debug and verbose records of the firmware go to the ring in binlog.c
+    binlog_init();
 
     ESP_ERROR_CHECK(esp_event_loop_create_default());
 
     eg_app_status = xEventGroupCreate();
     xEventGroupClearBits(eg_app_status, 0xff);
 
+    // holds the runtime configuration, and WiFi data
+    esp_err_t ret = nvs_flash_init();
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND)
+    {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        ret = nvs_flash_init();
+    }
+    ESP_ERROR_CHECK(ret);
+
+    config_init();
+    calibration_init();
+    alarm_init();
+    request_init();
+    ota_init();
+
     dust_values.lock = xSemaphoreCreateBinary();
     co2_values.lock = xSemaphoreCreateBinary();
     bmp_values.lock = xSemaphoreCreateBinary();
@@ -44,10 +52,19 @@ void app_main()
     xSemaphoreGive(co2_values.lock);
     xSemaphoreGive(bmp_values.lock);
 
+    if (CAPTURE_ENABLE && capture_start(CAPTURE_BUFFER_SIZE) != ESP_OK)
+        ESP_LOGE(LOG_TAG, "can't start capture of %d bytes", CAPTURE_BUFFER_SIZE);
+    latency_init();
+
     xTaskCreate(dust_sensor_task, "dust_sensor_task", 4096, NULL, 10, NULL);
     xTaskCreate(co2_sensor_task, "co2_sensor_task", 4096, NULL, 10, NULL);
     xTaskCreate(bmp_task, "bmp280_sensor_task", 4096, NULL, 10, NULL);
+    xTaskCreate(alarm_task, "alarm_task", 4096, NULL, 11, NULL);
+    xTaskCreate(request_task, "request_task", 4096, NULL, 10, NULL);
 
+    xTaskCreate(binlog_task, "binlog_task", 3072, NULL, 1, NULL);
     xTaskCreate(network_task, "network_task", 4096, NULL, 10, NULL);
     xTaskCreate(mqtt_task, "mqtt_task", 4096, NULL, 10, NULL);
+    if (COAP_HOST[0])
+        xTaskCreate(coap_task, "coap_task", 4096, NULL, 10, NULL);
 }
\ No newline at end of file
@@ -0,0 +1,243 @@
+#include "esp_log.h"
+#define LOG_TAG "metrics"
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "esp_timer.h"
+
+#include "dust_sensor.h"
+#include "metrics.h"
+
+#define METRICS_CONTENT_TYPE "text/plain; version=0.0.4; charset=utf-8"
+
+typedef struct
+{
+    char *buffer;
+    size_t size;
+    size_t used; // may exceed size, like snprintf()
+} metrics_writer_t;
+
+// only the server task renders, one scrape at a time
+static char metrics_buffer[METRICS_BUFFER_SIZE];
+
+static uint32_t scrapes;
+static uint32_t lock_misses;
+
+static void put(metrics_writer_t *w, const char *format, ...)
+{
+    va_list args;
+    int length;
+
+    va_start(args, format);
+    length = vsnprintf(w->buffer + (w->used < w->size ? w->used : w->size), w->used < w->size ? w->size - w->used : 0,
+                       format, args);
+    va_end(args);
+
+    if (length > 0)
+        w->used += length;
+}
+
+static void family(metrics_writer_t *w, const char *name, const char *type, const char *help)
+{
+    put(w, "# HELP dustsensor_%s %s\n# TYPE dustsensor_%s %s\n", name, help, name, type);
+}
+
+static void sample(metrics_writer_t *w, const char *name, const char *labels, double value)
+{
+    put(w, "dustsensor_%s%s%s%s %.9g\n", name, labels ? "{" : "", labels ? labels : "", labels ? "}" : "", value);
+}
+
+typedef struct
+{
+    const char *name;
+    sample_status_t status; // effective
+    int64_t timestamp;
+    sample_stats_t stats;
+    bool copied;
+} metrics_sensor_t;
+
+static bool take(SemaphoreHandle_t lock)
+{
+    if (xSemaphoreTake(lock, METRICS_LOCK_TIMEOUT / portTICK_PERIOD_MS) == pdTRUE)
+        return true;
+
+    lock_misses++;
+
+    return false;
+}
+
+static void sensor_health(metrics_writer_t *w, const metrics_sensor_t *sensors, int count)
+{
+    char labels[64];
+
+    family(w, "sample_status", "gauge", "Status of the last sample of the sensor, 1 for the current one.");
+    for (int i = 0; i < count; i++)
+    {
+        if (!sensors[i].copied)
+            continue;
+        for (sample_status_t status = SAMPLE_NONE; status <= SAMPLE_OUT_OF_RANGE; status++)
+        {
+            snprintf(labels, sizeof(labels), "sensor=\"%s\",status=\"%s\"", sensors[i].name,
+                     sample_status_name(status));
+            sample(w, "sample_status", labels, sensors[i].status == status);
+        }
+    }
+
+    family(w, "sample_age_seconds", "gauge", "Age of the last valid sample.");
+    for (int i = 0; i < count; i++)
+    {
+        if (!sensors[i].copied || !sensors[i].timestamp)
+            continue;
+        snprintf(labels, sizeof(labels), "sensor=\"%s\"", sensors[i].name);
+        sample(w, "sample_age_seconds", labels, sample_age(sensors[i].timestamp));
+    }
+
+    family(w, "sensor_reads_total", "counter", "Frames read from the sensor.");
+    for (int i = 0; i < count; i++)
+    {
+        if (!sensors[i].copied)
+            continue;
+        snprintf(labels, sizeof(labels), "sensor=\"%s\"", sensors[i].name);
+        sample(w, "sensor_reads_total", labels, sensors[i].stats.reads);
+    }
+
+    family(w, "sensor_errors_total", "counter", "Failed reads of the sensor by kind.");
+    for (int i = 0; i < count; i++)
+    {
+        static const char *kinds[] = {"checksum", "timeout", "range"};
+        const uint32_t errors[] = {sensors[i].stats.checksum_errors, sensors[i].stats.timeouts,
+                                   sensors[i].stats.out_of_range};
+
+        if (!sensors[i].copied)
+            continue;
+        for (int k = 0; k < 3; k++)
+        {
+            snprintf(labels, sizeof(labels), "sensor=\"%s\",kind=\"%s\"", sensors[i].name, kinds[k]);
+            sample(w, "sensor_errors_total", labels, errors[k]);
+        }
+    }
+}
+
+int metrics_render(char *buffer, size_t size)
+{
+    metrics_writer_t w = {buffer, size, 0};
+    metrics_sensor_t sensors[3] = {{"dust"}, {"co2"}, {"bmp"}};
+    struct dust_values_s dust;
+    struct co2_values_s co2;
+    struct bmp_values_s bmp;
+    EventBits_t bits = xEventGroupGetBits(eg_app_status);
+
+    // copies first, formatting happens with no lock held
+    if ((sensors[0].copied = take(dust_values.lock)))
+    {
+        dust = dust_values;
+        xSemaphoreGive(dust_values.lock);
+        sensors[0].status = sample_effective_status(dust.status, dust.timestamp, DUST_MAX_AGE);
+        sensors[0].timestamp = dust.timestamp;
+        sensors[0].stats = dust.stats;
+    }
+    if ((sensors[1].copied = take(co2_values.lock)))
+    {
+        co2 = co2_values;
+        xSemaphoreGive(co2_values.lock);
+        sensors[1].status = sample_effective_status(co2.status, co2.timestamp, CO2_MAX_AGE);
+        sensors[1].timestamp = co2.timestamp;
+        sensors[1].stats = co2.stats;
+    }
+    if ((sensors[2].copied = take(bmp_values.lock)))
+    {
+        bmp = bmp_values;
+        xSemaphoreGive(bmp_values.lock);
+        sensors[2].status = sample_effective_status(bmp.status, bmp.timestamp, BMP_MAX_AGE);
+        sensors[2].timestamp = bmp.timestamp;
+        sensors[2].stats = bmp.stats;
+    }
+
+    if (sensors[0].copied && sensors[0].status == SAMPLE_VALID)
+    {
+        family(&w, "pm25_ug_m3", "gauge", "PM2.5 mass concentration.");
+        sample(&w, "pm25_ug_m3", NULL, dust.pm25);
+        family(&w, "pm10_ug_m3", "gauge", "PM10 mass concentration.");
+        sample(&w, "pm10_ug_m3", NULL, dust.pm100);
+        family(&w, "pm_average_ug_m3", "gauge", "Rolling averages of the PM concentrations.");
+        sample(&w, "pm_average_ug_m3", "size=\"pm25\",window=\"1h\"", dust.pm25_1h);
+        sample(&w, "pm_average_ug_m3", "size=\"pm25\",window=\"24h\"", dust.pm25_24h);
+        sample(&w, "pm_average_ug_m3", "size=\"pm10\",window=\"1h\"", dust.pm100_1h);
+        sample(&w, "pm_average_ug_m3", "size=\"pm10\",window=\"24h\"", dust.pm100_24h);
+        if (dust.aqi_hours >= AQI_MIN_HOURS)
+        {
+            family(&w, "aqi", "gauge", "US EPA air quality index from the 24 hour averages.");
+            sample(&w, "aqi", NULL, dust.aqi);
+        }
+        family(&w, "aqi_coverage_hours", "gauge", "Hours of the last 24 with PM samples, the AQI needs 18.");
+        sample(&w, "aqi_coverage_hours", NULL, dust.aqi_hours);
+        family(&w, "caqi", "gauge", "EU common air quality index, hourly.");
+        sample(&w, "caqi", NULL, dust.caqi);
+    }
+
+    if (sensors[1].copied && sensors[1].status == SAMPLE_VALID)
+    {
+        family(&w, "co2_ppm", "gauge", "CO2 concentration.");
+        sample(&w, "co2_ppm", NULL, co2.ppm);
+        if (!isnan(co2.ach))
+        {
+            family(&w, "air_changes_per_hour", "gauge", "Ventilation estimated from the CO2 decay.");
+            sample(&w, "air_changes_per_hour", NULL, co2.ach);
+        }
+    }
+
+    if (sensors[2].copied && sensors[2].status == SAMPLE_VALID)
+    {
+        family(&w, "temperature_celsius", "gauge", "Air temperature.");
+        sample(&w, "temperature_celsius", NULL, bmp.temp);
+        family(&w, "pressure_pascals", "gauge", "Air pressure.");
+        sample(&w, "pressure_pascals", NULL, bmp.pres);
+        family(&w, "pressure_sea_level_pascals", "gauge", "Air pressure reduced to sea level.");
+        sample(&w, "pressure_sea_level_pascals", NULL, bmp.pres_sea);
+    }
+
+    sensor_health(&w, sensors, 3);
+
+    family(&w, "wifi_connected", "gauge", "1 if the station has an IP address.");
+    sample(&w, "wifi_connected", NULL, !!(bits & WIFI_CONNECTED_BIT));
+    family(&w, "mqtt_connected", "gauge", "1 if the MQTT client is connected.");
+    sample(&w, "mqtt_connected", NULL, !!(bits & MQTT_CONNECTED_BIT));
+    family(&w, "uptime_seconds", "counter", "Time since boot.");
+    sample(&w, "uptime_seconds", NULL, esp_timer_get_time() / 1000000);
+    family(&w, "metrics_scrapes_total", "counter", "Scrapes of this endpoint.");
+    sample(&w, "metrics_scrapes_total", NULL, scrapes);
+    family(&w, "metrics_lock_misses_total", "counter", "Sensors left out of a scrape as their values were busy.");
+    sample(&w, "metrics_lock_misses_total", NULL, lock_misses);
+
+    return w.used;
+}
+
+static esp_err_t metrics_handler(httpd_req_t *req)
+{
+    int length;
+
+    scrapes++;
+    length = metrics_render(metrics_buffer, sizeof(metrics_buffer));
+    if (length >= (int)sizeof(metrics_buffer))
+    {
+        ESP_LOGE(LOG_TAG, "%d bytes of metrics do not fit METRICS_BUFFER_SIZE", length);
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "METRICS_BUFFER_SIZE is too small");
+    }
+
+    httpd_resp_set_type(req, METRICS_CONTENT_TYPE);
+
+    return httpd_resp_send(req, metrics_buffer, length);
+}
+
+esp_err_t metrics_register(httpd_handle_t server)
+{
+    static const httpd_uri_t uri = {
+        .uri = "/metrics",
+        .method = HTTP_GET,
+        .handler = metrics_handler,
+    };
+
+    return httpd_register_uri_handler(server, &uri);
+}
@@ -0,0 +1,23 @@
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#include <stddef.h>
+
+#include "esp_http_server.h"
+
+/*
+Prometheus metrics in the text exposition format, served on /metrics when
+METRICS_ENABLE is set. A scrape renders the latest samples, their status
+and the health counters into a static buffer of METRICS_BUFFER_SIZE bytes,
+so it allocates nothing. The values of a sensor are copied under its lock
+and formatted after it is given back; a sensor whose lock is not free
+within METRICS_LOCK_TIMEOUT is left out of that scrape rather than waited
+for. Like on MQTT, only valid samples are exported as values.
+*/
+
+// renders all metrics, returns the length like snprintf()
+int metrics_render(char *buffer, size_t size);
+
+esp_err_t metrics_register(httpd_handle_t server);
+
+#endif // _METRICS_H
@@ -1,4 +1,3 @@
-#define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
 #include "esp_log.h"
 #define LOG_TAG "TASK: mqtt"
 
@@ -6,11 +5,165 @@
 
 #include "mqtt_client.h"
 
+#include <math.h>
+#include <stdarg.h>
+#include <string.h>
+
 esp_mqtt_client_handle_t mqtt_client;
 
+static void publish_command_state(esp_mqtt_client_handle_t client, const char *name, const char *value,
+                                  int length, int rejected)
+{
+    /*
+    State behind a command topic goes to <prefix>/<name>, retained so that
+    it can be read at any time, and if it follows a command the number of
+    rejected parts of it to <prefix>/<name>/result.
+    */
+
+    char topic[128];
+    char result[32];
+
+    snprintf(topic, sizeof(topic), "%s/%s", MQTT_TOPIC_PREFIX, name);
+    esp_mqtt_client_publish(client, topic, value, length, 1, 1);
+
+    if (rejected >= 0)
+    {
+        snprintf(topic, sizeof(topic), "%s/%s/result", MQTT_TOPIC_PREFIX, name);
+        snprintf(result, sizeof(result), "{\"rejected\":%d}", rejected);
+        esp_mqtt_client_publish(client, topic, result, 0, 1, 0);
+    }
+}
+
+static void publish_config(esp_mqtt_client_handle_t client, int rejected)
+{
+    char value[512];
+    int length = config_format(value, sizeof(value));
+
+    publish_command_state(client, MQTT_TOPIC_CONFIG, value, length < sizeof(value) ? length : sizeof(value) - 1,
+                          rejected);
+}
+
+static void publish_calibration(esp_mqtt_client_handle_t client, int rejected)
+{
+    char value[1024];
+    int length = calibration_format(value, sizeof(value));
+
+    publish_command_state(client, MQTT_TOPIC_CALIBRATION, value,
+                          length < sizeof(value) ? length : sizeof(value) - 1, rejected);
+}
+
+static void publish_alarm_rules(esp_mqtt_client_handle_t client, int rejected)
+{
+    char value[1024];
+    int length = alarm_format(value, sizeof(value));
+
+    publish_command_state(client, MQTT_TOPIC_ALARM_RULES, value,
+                          length < sizeof(value) ? length : sizeof(value) - 1, rejected);
+}
+
+static void publish_ota(esp_mqtt_client_handle_t client, int rejected)
+{
+    char value[256];
+    int length = ota_format(value, sizeof(value));
+
+    publish_command_state(client, MQTT_TOPIC_OTA, value, length < sizeof(value) ? length : sizeof(value) - 1,
+                          rejected);
+}
+
+// progress of an update, from the OTA task
+static void report_ota(void)
+{
+    publish_ota(mqtt_client, -1);
+}
+
+// debug records since the previous request, up to the level in `data`
+static void publish_log(esp_mqtt_client_handle_t client, const char *data, int length)
+{
+    static binlog_reader_t reader;
+    static char chunk[BINLOG_MQTT_CHUNK]; // off the stack of the MQTT task
+    esp_log_level_t level = ESP_LOG_VERBOSE;
+    char topic[128];
+    char text[256];
+    binlog_entry_t entry;
+    int used = 0;
+
+    if (length > 0 && data[0] && strchr("NEWIDV", data[0]))
+        level = strchr("NEWIDV", data[0]) - "NEWIDV";
+    else if (length > 0 && data[0] >= '0' && data[0] <= '5')
+        level = data[0] - '0';
+
+    snprintf(topic, sizeof(topic), "%s/%s", MQTT_TOPIC_PREFIX, MQTT_TOPIC_LOG);
+
+    while (binlog_read(&reader, level, &entry, text, sizeof(text)) >= 0)
+    {
+        char line[320];
+        int n = 0;
+
+        if (reader.missed)
+        {
+            n = snprintf(line, sizeof(line), "%u records overwritten\n", reader.missed);
+            reader.missed = 0;
+        }
+        n += snprintf(line + n, sizeof(line) - n, "%c (%u) %s: %s\n", "NEWIDV"[entry.level], entry.time, entry.tag,
+                      text);
+        if (n >= sizeof(line))
+            n = sizeof(line) - 1;
+
+        if (used + n > sizeof(chunk))
+        {
+            esp_mqtt_client_publish(client, topic, chunk, used, 0, 0);
+            used = 0;
+        }
+        memcpy(chunk + used, line, n);
+        used += n;
+    }
+
+    if (used)
+        esp_mqtt_client_publish(client, topic, chunk, used, 0, 0);
+}
+
+static void subscribe_commands(esp_mqtt_client_handle_t client)
+{
+    char topic[128];
+
+    snprintf(topic, sizeof(topic), "%s/%s/set", MQTT_TOPIC_PREFIX, MQTT_TOPIC_CONFIG);
+    esp_mqtt_client_subscribe(client, topic, 1);
+
+    if (MQTT_TOPIC_CONFIG_FLEET[0])
+        esp_mqtt_client_subscribe(client, MQTT_TOPIC_CONFIG_FLEET, 1);
+
+    snprintf(topic, sizeof(topic), "%s/%s", MQTT_TOPIC_PREFIX, MQTT_TOPIC_CALIBRATE);
+    esp_mqtt_client_subscribe(client, topic, 1);
+
+    snprintf(topic, sizeof(topic), "%s/%s/set", MQTT_TOPIC_PREFIX, MQTT_TOPIC_OTA);
+    esp_mqtt_client_subscribe(client, topic, 1);
+
+    snprintf(topic, sizeof(topic), "%s/%s/get", MQTT_TOPIC_PREFIX, MQTT_TOPIC_LOG);
+    esp_mqtt_client_subscribe(client, topic, 1);
+
+    snprintf(topic, sizeof(topic), "%s/%s/set", MQTT_TOPIC_PREFIX, MQTT_TOPIC_ALARM_RULES);
+    esp_mqtt_client_subscribe(client, topic, 1);
+
+    snprintf(topic, sizeof(topic), "%s/%s/get", MQTT_TOPIC_PREFIX, MQTT_TOPIC_SAMPLE);
+    esp_mqtt_client_subscribe(client, topic, 1);
+}
+
+// `topic` is not terminated, `format` and the arguments give the topic it is compared with
+static bool topic_is(const char *topic, int length, const char *format, ...)
+{
+    char expected[128];
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(expected, sizeof(expected), format, args);
+    va_end(args);
+
+    return length == strlen(expected) && !strncmp(topic, expected, length);
+}
+
 static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
 {
-    ESP_LOGD(LOG_TAG, "Event dispatched from event loop base=%s, event_id=%d", base, event_id);
+    BLOGD(LOG_TAG, "Event dispatched from event loop base=%s, event_id=%d", base, event_id);
 
     esp_mqtt_event_handle_t event = (esp_mqtt_event_handle_t)event_data;
 
@@ -20,6 +173,12 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
     case MQTT_EVENT_CONNECTED:
         ESP_LOGI(LOG_TAG, "MQTT_EVENT_CONNECTED");
         xEventGroupSetBits(eg_app_status, MQTT_CONNECTED_BIT);
+        subscribe_commands(event->client);
+        publish_config(event->client, -1);
+        publish_calibration(event->client, -1);
+        publish_alarm_rules(event->client, -1);
+        publish_ota(event->client, -1);
+        ota_confirm();
         break;
 
     case MQTT_EVENT_DISCONNECTED:
@@ -28,7 +187,46 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
         break;
 
     case MQTT_EVENT_PUBLISHED:
-        ESP_LOGI(LOG_TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+        BLOGD(LOG_TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+        latency_acked(event->msg_id);
+        break;
+    case MQTT_EVENT_DATA:
+        if (topic_is(event->topic, event->topic_len, "%s/%s/set", MQTT_TOPIC_PREFIX, MQTT_TOPIC_CONFIG) ||
+            (MQTT_TOPIC_CONFIG_FLEET[0] && topic_is(event->topic, event->topic_len, "%s", MQTT_TOPIC_CONFIG_FLEET)))
+        {
+            ESP_LOGI(LOG_TAG, "config command: %.*s", event->data_len, event->data);
+            publish_config(event->client, config_command(event->data, event->data_len));
+        }
+        else if (topic_is(event->topic, event->topic_len, "%s/%s", MQTT_TOPIC_PREFIX, MQTT_TOPIC_CALIBRATE))
+        {
+            // a retained reference would be paired again with every new raw reading at each connect
+            if (event->retain)
+                ESP_LOGW(LOG_TAG, "ignoring retained calibration command: %.*s", event->data_len, event->data);
+            else
+            {
+                ESP_LOGI(LOG_TAG, "calibration command: %.*s", event->data_len, event->data);
+                publish_calibration(event->client, calibration_command(event->data, event->data_len));
+            }
+        }
+        else if (topic_is(event->topic, event->topic_len, "%s/%s/set", MQTT_TOPIC_PREFIX, MQTT_TOPIC_OTA))
+        {
+            esp_err_t err = ota_start(event->data, event->data_len, report_ota);
+
+            ESP_LOGI(LOG_TAG, "update from %.*s: %s", event->data_len, event->data, esp_err_to_name(err));
+            publish_ota(event->client, err != ESP_OK);
+        }
+        else if (topic_is(event->topic, event->topic_len, "%s/%s/get", MQTT_TOPIC_PREFIX, MQTT_TOPIC_LOG))
+            publish_log(event->client, event->data, event->data_len);
+        else if (topic_is(event->topic, event->topic_len, "%s/%s/set", MQTT_TOPIC_PREFIX, MQTT_TOPIC_ALARM_RULES))
+        {
+            ESP_LOGI(LOG_TAG, "alarm command: %.*s", event->data_len, event->data);
+            publish_alarm_rules(event->client, alarm_command(event->data, event->data_len));
+        }
+        else if (topic_is(event->topic, event->topic_len, "%s/%s/get", MQTT_TOPIC_PREFIX, MQTT_TOPIC_SAMPLE))
+        {
+            ESP_LOGI(LOG_TAG, "sample request: %.*s", event->data_len, event->data);
+            request_command(event->data, event->data_len);
+        }
         break;
     case MQTT_EVENT_ERROR:
         ESP_LOGE(LOG_TAG, "MQTT_EVENT_ERROR");
@@ -43,61 +241,221 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
 
 void start_mqtt_client()
 {
-    ESP_LOGV(LOG_TAG, "starting mqtt client");
+    BLOGV(LOG_TAG, "starting mqtt client");
 
     esp_mqtt_client_start(mqtt_client);
 }
 
 void stop_mqtt_client()
 {
-    ESP_LOGV(LOG_TAG, "stopping mqtt client");
+    BLOGV(LOG_TAG, "stopping mqtt client");
     if (!mqtt_client)
         return;
     esp_mqtt_client_stop(mqtt_client);
 }
 
-void sendMQTTupdate()
+static int publish_value_qos(esp_mqtt_client_handle_t client, const char *prefix, const char *name,
+                             const char *value, int qos)
 {
-    char value[64];
     char topic[128];
     int msg_id;
 
-    ESP_LOGD(LOG_TAG, "sending updates via mqtt");
-
-    xSemaphoreTake(dust_values.lock, SEMAPHORE_TIMEOUT / portTICK_PERIOD_MS);
-    sprintf(value, "%d", dust_values.pm25);
-    xSemaphoreGive(dust_values.lock);
-    sprintf(topic, "%s/%s", MQTT_TOPIC_PREFIX, MQTT_TOPIC_PM25);
-    msg_id = esp_mqtt_client_publish(mqtt_client, topic, value, 0, 0, 0);
-    ESP_LOGD(LOG_TAG, "published pm25 value=%s, msg_id=%d", value, msg_id);
-
-    xSemaphoreTake(dust_values.lock, SEMAPHORE_TIMEOUT / portTICK_PERIOD_MS);
-    sprintf(value, "%d", dust_values.pm100);
-    xSemaphoreGive(dust_values.lock);
-    sprintf(topic, "%s/%s", MQTT_TOPIC_PREFIX, MQTT_TOPIC_PM100);
-    msg_id = esp_mqtt_client_publish(mqtt_client, topic, value, 0, 0, 0);
-    ESP_LOGD(LOG_TAG, "published pm100 value=%s, msg_id=%d", value, msg_id);
-
-    xSemaphoreTake(co2_values.lock, SEMAPHORE_TIMEOUT / portTICK_PERIOD_MS);
-    sprintf(value, "%d", co2_values.ppm);
-    xSemaphoreGive(co2_values.lock);
-    sprintf(topic, "%s/%s", MQTT_TOPIC_PREFIX, MQTT_TOPIC_CO2);
-    msg_id = esp_mqtt_client_publish(mqtt_client, topic, value, 0, 0, 0);
-    ESP_LOGD(LOG_TAG, "published co2 value=%s, msg_id=%d", value, msg_id);
-
-    xSemaphoreTake(bmp_values.lock, SEMAPHORE_TIMEOUT / portTICK_PERIOD_MS);
-    sprintf(value, "%0.0f", bmp_values.pres / 133.322);
-    xSemaphoreGive(bmp_values.lock);
-    sprintf(topic, "%s/%s", MQTT_TOPIC_PREFIX, MQTT_TOPIC_PRES);
-    msg_id = esp_mqtt_client_publish(mqtt_client, topic, value, 0, 0, 0);
-    ESP_LOGD(LOG_TAG, "published pressure value=%s, msg_id=%d", value, msg_id);
-
-    xSemaphoreTake(bmp_values.lock, SEMAPHORE_TIMEOUT / portTICK_PERIOD_MS);
-    sprintf(value, "%0.1f", bmp_values.temp);
-    xSemaphoreGive(bmp_values.lock);
-    sprintf(topic, "%s/%s", MQTT_TOPIC_PREFIX, MQTT_TOPIC_TEMP);
-    msg_id = esp_mqtt_client_publish(mqtt_client, topic, value, 0, 0, 0);
-    ESP_LOGD(LOG_TAG, "published temperature value=%s, msg_id=%d", value, msg_id);
+    snprintf(topic, sizeof(topic), "%s/%s", prefix, name);
+    msg_id = esp_mqtt_client_publish(client, topic, value, 0, qos, 0);
+    BLOGD(LOG_TAG, "published %s value=%s, msg_id=%d", name, value, msg_id);
+
+    return msg_id;
+}
+
+static void publish_value(esp_mqtt_client_handle_t client, const char *prefix, const char *name,
+                          const char *value)
+{
+    publish_value_qos(client, prefix, name, value, 0);
+}
+
+static sample_status_t publish_status(esp_mqtt_client_handle_t client, const char *prefix, const char *sensor,
+                                      sample_status_t status, int64_t timestamp, uint32_t max_age,
+                                      const sample_stats_t *stats, int source)
+{
+    /*
+    Status of the last sample, its age in seconds and error counters of the
+    sensor go to <prefix>/status/<sensor>. Returns the effective status,
+    values are published only if it is SAMPLE_VALID. With LATENCY_ENABLE
+    the message ends the latency trace of `source` (-1 for none), see
+    latency.h.
+    */
+
+    char name[64];
+    char value[160];
+
+    status = sample_effective_status(status, timestamp, max_age);
+
+    sprintf(name, "%s/%s", MQTT_TOPIC_STATUS, sensor);
+    snprintf(value, sizeof(value),
+             "{\"status\":\"%s\",\"age\":%u,\"reads\":%u,\"checksum\":%u,\"timeout\":%u,\"range\":%u}",
+             sample_status_name(status), sample_age(timestamp), stats->reads,
+             stats->checksum_errors, stats->timeouts, stats->out_of_range);
+    if (LATENCY_ENABLE && source >= 0 && client == mqtt_client)
+        latency_enqueued(source, publish_value_qos(client, prefix, name, value, 1));
+    else
+        publish_value(client, prefix, name, value);
+
+    return status;
+}
+
+static void publish_filtered(esp_mqtt_client_handle_t client, const char *prefix, const char *name,
+                             const filter_output_t *output)
+{
+    char topic[64];
+    char value[160];
+
+    if (!output->count)
+        return;
+
+    sprintf(topic, "%s/%s", name, MQTT_TOPIC_FILTERED);
+    filter_format(output, value, sizeof(value));
+    publish_value(client, prefix, topic, value);
+}
+
+static void publish_capture()
+{
+    static uint8_t chunk[CAPTURE_BUFFER_SIZE];
+    char topic[128];
+    int length;
+    int msg_id;
+
+    length = capture_take(chunk, sizeof(chunk));
+    if (!length)
+        return;
+
+    sprintf(topic, "%s/%s", MQTT_TOPIC_PREFIX, MQTT_TOPIC_CAPTURE);
+    msg_id = esp_mqtt_client_publish(mqtt_client, topic, (const char *)chunk, length, 0, 0);
+    BLOGD(LOG_TAG, "published capture chunk of %d bytes, %u records dropped, msg_id=%d", length,
+          capture_dropped(), msg_id);
+}
+
+static void publish_latency()
+{
+    static char value[1536]; // off the stack of the MQTT task
+    char topic[128];
+
+    for (int source = 0; source < LATENCY_SOURCE_COUNT; source++)
+    {
+        int length = latency_format(source, value, sizeof(value));
+
+        if (length >= sizeof(value))
+        {
+            ESP_LOGE(LOG_TAG, "%d bytes of latency histograms do not fit", length);
+            continue;
+        }
+        snprintf(topic, sizeof(topic), "%s/%s/%s", MQTT_TOPIC_PREFIX, MQTT_TOPIC_LATENCY, latency_source_name(source));
+        esp_mqtt_client_publish(mqtt_client, topic, value, length, 0, 0);
+    }
+}
+
+void mqtt_send_update(esp_mqtt_client_handle_t client, const char *prefix)
+{
+    char value[256];
+    char aqi[64];
+    struct dust_values_s dust;
+    struct co2_values_s co2;
+    struct bmp_values_s bmp;
+
+    BLOGD(LOG_TAG, "sending updates via mqtt");
+
+    if (xSemaphoreTake(dust_values.lock, SEMAPHORE_TIMEOUT / portTICK_PERIOD_MS) == pdTRUE)
+    {
+        dust = dust_values;
+        xSemaphoreGive(dust_values.lock);
+
+        if (publish_status(client, prefix, "dust", dust.status, dust.timestamp, DUST_MAX_AGE, &dust.stats,
+                           LATENCY_DUST) == SAMPLE_VALID)
+        {
+            sprintf(value, "%d", dust.pm25);
+            publish_value(client, prefix, MQTT_TOPIC_PM25, value);
+            publish_filtered(client, prefix, MQTT_TOPIC_PM25, &dust.pm25_filtered);
+
+            sprintf(value, "%d", dust.pm100);
+            publish_value(client, prefix, MQTT_TOPIC_PM100, value);
+            publish_filtered(client, prefix, MQTT_TOPIC_PM100, &dust.pm100_filtered);
+
+            sprintf(value, "%d", dust.frames);
+            publish_value(client, prefix, MQTT_TOPIC_PM_FRAMES, value);
+
+            // a provisional AQI, from less than AQI_MIN_HOURS of the day, is null
+            if (dust.aqi_hours >= AQI_MIN_HOURS)
+                sprintf(aqi, "\"aqi\":%u,\"category\":\"%s\"", dust.aqi, aqi_category_name(aqi_category(dust.aqi)));
+            else
+                strcpy(aqi, "\"aqi\":null,\"category\":null");
+            sprintf(value, "{%s,\"aqi_hours\":%u,\"caqi\":%u,"
+                           "\"pm25_1h\":%.1f,\"pm25_24h\":%.1f,\"pm100_1h\":%.1f,\"pm100_24h\":%.1f}",
+                    aqi, dust.aqi_hours, dust.caqi, dust.pm25_1h, dust.pm25_24h, dust.pm100_1h, dust.pm100_24h);
+            publish_value(client, prefix, MQTT_TOPIC_AQI, value);
+        }
+    }
+    else
+        ESP_LOGW(LOG_TAG, "can't take lock on dust values");
+
+    if (xSemaphoreTake(co2_values.lock, SEMAPHORE_TIMEOUT / portTICK_PERIOD_MS) == pdTRUE)
+    {
+        co2 = co2_values;
+        xSemaphoreGive(co2_values.lock);
+
+        if (publish_status(client, prefix, "co2", co2.status, co2.timestamp, CO2_MAX_AGE, &co2.stats,
+                           LATENCY_CO2) == SAMPLE_VALID)
+        {
+            sprintf(value, "%d", co2.ppm);
+            publish_value(client, prefix, MQTT_TOPIC_CO2, value);
+            publish_filtered(client, prefix, MQTT_TOPIC_CO2, &co2.ppm_filtered);
+
+            sprintf(value, "%d", co2.frames);
+            publish_value(client, prefix, MQTT_TOPIC_CO2_FRAMES, value);
+
+            if (!isnan(co2.ach))
+            {
+                sprintf(value, "%.2f", co2.ach);
+                publish_value(client, prefix, MQTT_TOPIC_VENTILATION, value);
+            }
+        }
+    }
+    else
+        ESP_LOGW(LOG_TAG, "can't take lock on co2 values");
+
+    if (xSemaphoreTake(bmp_values.lock, SEMAPHORE_TIMEOUT / portTICK_PERIOD_MS) == pdTRUE)
+    {
+        bmp = bmp_values;
+        xSemaphoreGive(bmp_values.lock);
+
+        if (publish_status(client, prefix, "bmp", bmp.status, bmp.timestamp, BMP_MAX_AGE, &bmp.stats,
+                           -1) == SAMPLE_VALID)
+        {
+            sprintf(value, "%0.0f", bmp.pres / PA_PER_MMHG);
+            publish_value(client, prefix, MQTT_TOPIC_PRES, value);
+            publish_filtered(client, prefix, MQTT_TOPIC_PRES, &bmp.pres_filtered);
+
+            sprintf(value, "%0.0f", bmp.pres_sea / PA_PER_MMHG);
+            publish_value(client, prefix, MQTT_TOPIC_PRES_SEA, value);
+
+            sprintf(value, "%0.1f", bmp.temp);
+            publish_value(client, prefix, MQTT_TOPIC_TEMP, value);
+            publish_filtered(client, prefix, MQTT_TOPIC_TEMP, &bmp.temp_filtered);
+        }
+    }
+    else
+        ESP_LOGW(LOG_TAG, "can't take lock on bmp values");
+}
+
+void sendMQTTupdate()
+{
+    // the samples may go over CoAP/UDP instead, see coap.h
+    if (coap_transport() == TRANSPORT_MQTT)
+        mqtt_send_update(mqtt_client, MQTT_TOPIC_PREFIX);
+
+    if (CAPTURE_ENABLE)
+        publish_capture();
+
+    if (LATENCY_ENABLE)
+        publish_latency();
 }
 
 #define statusMQTT_MUST_DISCONNECT(a) (a & MQTT_MUST_DISCONNECT_BIT)
@@ -120,17 +478,28 @@ void mqtt_task()
 
     esp_mqtt_client_register_event(mqtt_client, ESP_EVENT_ANY_ID, mqtt_event_handler, mqtt_client);
 
+    TickType_t start = xTaskGetTickCount();
+
     for (;;)
     {
+        TickType_t period = adaptive_mqtt_period() / portTICK_PERIOD_MS;
+        TickType_t elapsed = xTaskGetTickCount() - start;
 
-        ESP_LOGD(LOG_TAG, "cycle");
+        BLOGD(LOG_TAG, "cycle");
 
-        bits = xEventGroupWaitBits(eg_app_status, MQTT_MUST_DISCONNECT_BIT,
+        bits = xEventGroupWaitBits(eg_app_status, MQTT_MUST_DISCONNECT_BIT | CONFIG_MQTT_BIT,
                                    pdFALSE,
                                    pdFALSE,
-                                   MQTT_DELAY / portTICK_PERIOD_MS);
+                                   elapsed < period ? period - elapsed : 0);
+
+        BLOGD(LOG_TAG, "eg_ap_status event group value: %i", bits);
 
-        ESP_LOGD(LOG_TAG, "eg_ap_status event group value: %i", bits);
+        if (bits & CONFIG_MQTT_BIT)
+        {
+            // the period changed, wait for the rest of the new one, counted from the same start
+            xEventGroupClearBits(eg_app_status, CONFIG_MQTT_BIT);
+            continue;
+        }
 
         if ((statusMQTT_MUST_DISCONNECT(bits) && statusMQTT_CONNECTED(bits)) ||
             (!statusWIFI_CONNECTED(bits) && statusMQTT_CONNECTED(bits)))
@@ -152,5 +521,6 @@ void mqtt_task()
             sendMQTTupdate();
         }
         xEventGroupClearBits(eg_app_status, MQTT_MUST_DISCONNECT_BIT);
+        start = xTaskGetTickCount();
     }
 }
\ No newline at end of file
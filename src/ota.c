@@ -0,0 +1,465 @@
+#include "esp_log.h"
+#define LOG_TAG "ota"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_http_client.h"
+#include "esp_ota_ops.h"
+#include "esp_system.h"
+#include "mbedtls/sha256.h"
+
+#include "dust_sensor.h"
+#include "delta.h"
+
+#define OTA_MAX_URL 256
+#define OTA_BUFFER_SIZE 1024
+#define OTA_REPORT_BYTES 65536 // progress is reported every this many patch bytes
+
+typedef enum
+{
+    OTA_IDLE,
+    OTA_DOWNLOADING,
+    OTA_FAILED,
+    OTA_REBOOTING,
+} ota_phase_t;
+
+static const char *phase_names[] = {"idle", "downloading", "failed", "rebooting"};
+
+// the update in progress, there is only ever one
+static struct
+{
+    char url[OTA_MAX_URL];
+    uint8_t new_sha256[32]; // of the image the sender expects
+    ota_report_t report;
+    const esp_partition_t *running;
+    const esp_partition_t *target;
+    esp_ota_handle_t handle;
+    bool begun;
+    mbedtls_sha256_context sha;
+    delta_t delta;
+    uint8_t buffer[OTA_BUFFER_SIZE];
+} update;
+
+// what ota_format() reports, under `lock`
+static struct
+{
+    ota_phase_t phase;
+    uint32_t received; // patch bytes applied
+    int32_t size;      // of the patch, -1 if not known yet
+    int attempts;
+    esp_err_t error;
+} status = {.size = -1};
+
+static SemaphoreHandle_t lock;
+
+static void set_status(ota_phase_t phase, esp_err_t error)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    status.phase = phase;
+    status.error = error;
+    xSemaphoreGive(lock);
+
+    if (update.report)
+        update.report();
+}
+
+static esp_err_t ota_header(void *ctx, const delta_header_t *header)
+{
+    uint8_t sha256[32];
+    uint8_t chunk[256];
+    mbedtls_sha256_context sha;
+    esp_err_t err = ESP_OK;
+
+    if (header->old_size > update.running->size || header->new_size > update.target->size)
+    {
+        ESP_LOGE(LOG_TAG, "patch from %u to %u bytes does not fit the partitions", header->old_size,
+                 header->new_size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // the patch must lead to the image named in the command, not just to one it describes itself
+    if (memcmp(header->new_sha256, update.new_sha256, sizeof(update.new_sha256)))
+    {
+        ESP_LOGE(LOG_TAG, "patch is not for the expected image");
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    // the patch must be made against the running image
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts_ret(&sha, 0);
+    for (uint32_t offset = 0; offset < header->old_size && err == ESP_OK; offset += sizeof(chunk))
+    {
+        size_t length = header->old_size - offset < sizeof(chunk) ? header->old_size - offset : sizeof(chunk);
+
+        err = esp_partition_read(update.running, offset, chunk, length);
+        mbedtls_sha256_update_ret(&sha, chunk, length);
+    }
+    mbedtls_sha256_finish_ret(&sha, sha256);
+    mbedtls_sha256_free(&sha);
+
+    if (err != ESP_OK)
+        return err;
+    if (memcmp(sha256, header->old_sha256, sizeof(sha256)))
+    {
+        ESP_LOGE(LOG_TAG, "patch is not for the running image");
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    ESP_LOGI(LOG_TAG, "patching %u bytes of %s into %u bytes of %s", header->old_size, update.running->label,
+             header->new_size, update.target->label);
+
+    err = esp_ota_begin(update.target, header->new_size, &update.handle);
+    update.begun = err == ESP_OK;
+
+    return err;
+}
+
+static esp_err_t ota_read_old(void *ctx, uint32_t offset, uint8_t *data, size_t length)
+{
+    return esp_partition_read(update.running, offset, data, length);
+}
+
+static esp_err_t ota_write_new(void *ctx, const uint8_t *data, size_t length)
+{
+    mbedtls_sha256_update_ret(&update.sha, data, length);
+
+    return esp_ota_write(update.handle, data, length);
+}
+
+static const delta_ops_t ota_ops = {
+    .header = ota_header,
+    .read_old = ota_read_old,
+    .write_new = ota_write_new,
+};
+
+/*
+One download attempt, from where the previous one stopped. Sets `*fatal` if
+the patch itself is bad and trying again would not help.
+*/
+static esp_err_t ota_download(bool *fatal)
+{
+    esp_http_client_config_t config = {
+        .url = update.url,
+        .timeout_ms = OTA_HTTP_TIMEOUT,
+    };
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    uint32_t received = status.received;
+    uint32_t skip = 0;
+    int32_t size;
+    int length;
+    int code;
+    esp_err_t err;
+
+    *fatal = false;
+    if (!client)
+    {
+        *fatal = true;
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (received)
+    {
+        char range[32];
+
+        snprintf(range, sizeof(range), "bytes=%u-", received);
+        esp_http_client_set_header(client, "Range", range);
+    }
+
+    err = esp_http_client_open(client, 0);
+    if (err != ESP_OK)
+        goto done;
+
+    length = esp_http_client_fetch_headers(client);
+    code = esp_http_client_get_status_code(client);
+    if (code == 200)
+    {
+        // the whole patch again, what was applied already is skipped
+        skip = received;
+        size = length;
+    }
+    else if (code == 206 && received)
+        size = length < 0 ? -1 : (int32_t)(received + length);
+    else
+    {
+        ESP_LOGE(LOG_TAG, "HTTP status %d", code);
+        err = ESP_ERR_INVALID_RESPONSE;
+        *fatal = code >= 400 && code < 500;
+        goto done;
+    }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    status.size = size;
+    xSemaphoreGive(lock);
+
+    for (;;)
+    {
+        int n = esp_http_client_read(client, (char *)update.buffer, sizeof(update.buffer));
+        int used = 0;
+
+        if (n < 0)
+        {
+            err = ESP_FAIL;
+            break;
+        }
+        if (n == 0)
+        {
+            if (size >= 0 && received < size)
+                err = ESP_FAIL; // closed early
+            break;
+        }
+
+        if (skip)
+        {
+            used = (uint32_t)n < skip ? n : skip;
+            skip -= used;
+        }
+        if (n > used && (err = delta_feed(&update.delta, update.buffer + used, n - used)) != ESP_OK)
+        {
+            *fatal = true;
+            break;
+        }
+
+        if ((received + n - used) / OTA_REPORT_BYTES != received / OTA_REPORT_BYTES && update.report)
+            update.report();
+        received += n - used;
+
+        xSemaphoreTake(lock, portMAX_DELAY);
+        status.received = received;
+        xSemaphoreGive(lock);
+    }
+
+done:
+    esp_http_client_close(client);
+    esp_http_client_cleanup(client);
+
+    return err;
+}
+
+static esp_err_t ota_apply(void)
+{
+    uint8_t sha256[32];
+    bool fatal = false;
+    esp_err_t err = ESP_FAIL;
+
+    update.running = esp_ota_get_running_partition();
+    update.target = esp_ota_get_next_update_partition(NULL);
+    if (!update.running || !update.target)
+        return ESP_ERR_NOT_FOUND;
+
+    update.begun = false;
+    mbedtls_sha256_init(&update.sha);
+    mbedtls_sha256_starts_ret(&update.sha, 0);
+    delta_init(&update.delta, &ota_ops, NULL);
+
+    for (int attempt = 0; attempt <= OTA_MAX_RETRIES && !fatal; attempt++)
+    {
+        if (attempt)
+        {
+            ESP_LOGW(LOG_TAG, "download failed (%s), retrying", esp_err_to_name(err));
+            vTaskDelay(attempt * OTA_RETRY_DELAY / portTICK_PERIOD_MS);
+        }
+
+        xSemaphoreTake(lock, portMAX_DELAY);
+        status.attempts = attempt + 1;
+        xSemaphoreGive(lock);
+
+        err = ota_download(&fatal);
+        if (err == ESP_OK)
+            break;
+    }
+
+    if (err == ESP_OK)
+        err = delta_finish(&update.delta);
+
+    mbedtls_sha256_finish_ret(&update.sha, sha256);
+    mbedtls_sha256_free(&update.sha);
+
+    if (err == ESP_OK && memcmp(sha256, update.new_sha256, sizeof(sha256)))
+    {
+        ESP_LOGE(LOG_TAG, "new image does not match the expected SHA-256");
+        err = ESP_ERR_INVALID_CRC;
+    }
+
+    if (update.begun)
+    {
+        // frees the handle in any case
+        esp_err_t end = esp_ota_end(update.handle);
+
+        if (err == ESP_OK)
+            err = end;
+    }
+
+    if (err == ESP_OK)
+        err = esp_ota_set_boot_partition(update.target);
+
+    return err;
+}
+
+static void ota_task(void *arg)
+{
+    esp_err_t err;
+
+    ESP_LOGI(LOG_TAG, "update from %s", update.url);
+
+    err = ota_apply();
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(LOG_TAG, "update failed (%s)", esp_err_to_name(err));
+        set_status(OTA_FAILED, err);
+        vTaskDelete(NULL);
+        return;
+    }
+
+    ESP_LOGI(LOG_TAG, "%s is the boot partition, restarting", update.target->label);
+    set_status(OTA_REBOOTING, ESP_OK);
+
+    // time for the status to get out
+    vTaskDelay(OTA_RESTART_DELAY / portTICK_PERIOD_MS);
+    esp_restart();
+}
+
+// "url sha256", the SHA-256 as 64 hex digits, surrounding whitespace is ignored
+static bool ota_parse(const char *command, int length, char *url, uint8_t *sha256)
+{
+    int start = 0, end, digits;
+
+    while (length && isspace((unsigned char)command[length - 1]))
+        length--;
+    while (start < length && isspace((unsigned char)command[start]))
+        start++;
+
+    for (end = start; end < length && !isspace((unsigned char)command[end]); end++)
+        ;
+    if (end == start || end - start >= OTA_MAX_URL)
+        return false;
+
+    memcpy(url, command + start, end - start);
+    url[end - start] = 0;
+
+    while (end < length && isspace((unsigned char)command[end]))
+        end++;
+    if (length - end != 64)
+        return false;
+
+    for (digits = 0; digits < 64; digits++)
+    {
+        char c = tolower((unsigned char)command[end + digits]);
+        int nibble = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+
+        if (nibble < 0)
+            return false;
+        sha256[digits / 2] = digits % 2 ? sha256[digits / 2] << 4 | nibble : nibble;
+    }
+
+    return true;
+}
+
+esp_err_t ota_start(const char *command, int length, ota_report_t report)
+{
+    char url[OTA_MAX_URL];
+    uint8_t sha256[32];
+
+    if (!ota_parse(command, length, url, sha256))
+        return ESP_ERR_INVALID_ARG;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (status.phase == OTA_DOWNLOADING || status.phase == OTA_REBOOTING)
+    {
+        xSemaphoreGive(lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    strcpy(update.url, url);
+    memcpy(update.new_sha256, sha256, sizeof(sha256));
+    update.report = report;
+    status.phase = OTA_DOWNLOADING;
+    status.received = 0;
+    status.size = -1;
+    status.attempts = 0;
+    status.error = ESP_OK;
+    xSemaphoreGive(lock);
+
+    xTaskCreate(ota_task, "ota_task", 4096, NULL, 5, NULL);
+
+    return ESP_OK;
+}
+
+static void ota_verify_task(void *arg)
+{
+    EventBits_t bits = xEventGroupWaitBits(eg_app_status, OTA_CONFIRMED_BIT, pdFALSE, pdFALSE,
+                                           OTA_HEALTH_TIMEOUT / portTICK_PERIOD_MS);
+
+    if (bits & OTA_CONFIRMED_BIT)
+    {
+        ESP_LOGI(LOG_TAG, "new image confirmed");
+        esp_ota_mark_app_valid_cancel_rollback();
+    }
+    else
+    {
+        ESP_LOGE(LOG_TAG, "new image not confirmed in %d ms, rolling back", OTA_HEALTH_TIMEOUT);
+        esp_ota_mark_app_invalid_rollback_and_reboot();
+        // no image to go back to
+        ESP_LOGE(LOG_TAG, "rollback failed, keeping the new image");
+    }
+
+    vTaskDelete(NULL);
+}
+
+void ota_init(void)
+{
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    esp_ota_img_states_t state;
+
+    lock = xSemaphoreCreateBinary();
+    xSemaphoreGive(lock);
+
+    if (esp_ota_get_state_partition(running, &state) == ESP_OK && state == ESP_OTA_IMG_PENDING_VERIFY)
+    {
+        ESP_LOGW(LOG_TAG, "running a new image from %s, waiting for it to get online", running->label);
+        xTaskCreate(ota_verify_task, "ota_verify_task", 2048, NULL, 5, NULL);
+    }
+}
+
+void ota_confirm(void)
+{
+    xEventGroupSetBits(eg_app_status, OTA_CONFIRMED_BIT);
+}
+
+static const char *state_name(esp_ota_img_states_t state)
+{
+    switch (state)
+    {
+    case ESP_OTA_IMG_NEW:
+        return "new";
+    case ESP_OTA_IMG_PENDING_VERIFY:
+        return "pending_verify";
+    case ESP_OTA_IMG_VALID:
+        return "valid";
+    case ESP_OTA_IMG_INVALID:
+        return "invalid";
+    case ESP_OTA_IMG_ABORTED:
+        return "aborted";
+    default:
+        return "undefined";
+    }
+}
+
+int ota_format(char *buffer, size_t size)
+{
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    esp_ota_img_states_t state = ESP_OTA_IMG_UNDEFINED;
+
+    esp_ota_get_state_partition(running, &state);
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    int length = snprintf(buffer, size,
+                          "{\"partition\":\"%s\",\"image\":\"%s\",\"update\":\"%s\",\"received\":%u,\"size\":%d,"
+                          "\"attempts\":%d,\"error\":\"%s\"}",
+                          running->label, state_name(state), phase_names[status.phase], status.received,
+                          status.size, status.attempts, status.error == ESP_OK ? "" : esp_err_to_name(status.error));
+    xSemaphoreGive(lock);
+
+    return length;
+}
@@ -0,0 +1,48 @@
+#ifndef _OTA_H
+#define _OTA_H
+
+#include <stddef.h>
+
+#include "esp_err.h"
+
+/*
+Over-the-air updates from binary deltas (delta.h) into the inactive one of
+the ota_0/ota_1 partitions. The patch is downloaded over HTTP and applied as
+it comes in, against the running image, so neither the patch nor the new
+image is ever held in RAM. A dropped download resumes where it stopped with
+a Range request (or by skipping what was already applied if the server
+ignores it), up to OTA_MAX_RETRIES times.
+
+The command names the new image by its SHA-256 as well as the patch by its
+URL. Before anything is written the patch must lead to that image and the
+running image must have the SHA-256 the patch was made against; the new
+image must have that SHA-256 before it is made the boot partition, so a
+patch swapped on the server is refused even though it is consistent with
+itself. After the restart the new image runs pending
+verification: it is confirmed once it reaches the MQTT broker, otherwise
+after OTA_HEALTH_TIMEOUT it is marked invalid and the device goes back to
+the previous image. The bootloader does the same if it restarts before that
+(CONFIG_BOOTLOADER_APP_ROLLBACK_ENABLE).
+*/
+
+// called from the OTA task when the status changed, see ota_format()
+typedef void (*ota_report_t)(void);
+
+// starts the health check of a new image, call once after eg_app_status is created
+void ota_init(void);
+
+/*
+Starts an update in a task of its own. `command`, `length` characters not
+terminated, is "url sha256": the URL of the patch and the SHA-256 of the new
+image in hex, separated by whitespace. ESP_ERR_INVALID_ARG if it is not
+that, ESP_ERR_INVALID_STATE if an update is already running.
+*/
+esp_err_t ota_start(const char *command, int length, ota_report_t report);
+
+// the running image works, call when the device is back online
+void ota_confirm(void);
+
+// running partition, its state and the last update as a JSON object, like snprintf()
+int ota_format(char *buffer, size_t size);
+
+#endif // _OTA_H
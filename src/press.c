@@ -1,22 +1,79 @@
-#define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
 #include "esp_log.h"
 #define LOG_TAG "TASK: pressure"
 
+#include "esp_timer.h"
+
 #include "dust_sensor.h"
 
 #define BMP_MAX_FAILS 20
 
+static const filter_config_t temp_filter_config = FILTER_TEMP;
+static const filter_config_t pres_filter_config = FILTER_PRES;
+
+static filter_t temp_filter;
+static filter_t pres_filter;
+
 void bmp_task()
 {
+    sample_stats_t stats = {0};
 
     ESP_ERROR_CHECK(bmp_init(BMP_SDA_PIN, BMP_SCL_PIN, I2C_NUM_0));
 
+    filter_init(&temp_filter, &temp_filter_config);
+    filter_init(&pres_filter, &pres_filter_config);
+
     for (;;)
     {
 
         bmp_values_t values;
+        sample_status_t status;
+
+        status = sample_status_from_err(bmp_fill_values(&values));
+
+        if (status == SAMPLE_VALID &&
+            (values.temp < BMP_MIN_TEMP || values.temp > BMP_MAX_TEMP ||
+             values.pres < BMP_MIN_PRES || values.pres > BMP_MAX_PRES))
+            status = SAMPLE_OUT_OF_RANGE;
+
+        sample_stats_count(&stats, status);
+        stream_bmp(status, values.temp, values.pres);
+
+        float temp;
+        float pres;
+        double pres_sea;
+        int64_t now = esp_timer_get_time();
 
-        ESP_ERROR_CHECK(bmp_fill_values(&values));
+        if (status == SAMPLE_VALID)
+        {
+            /*
+            Adjust temperature.
+            Use Less Squares method for a series of real measurements
+            Approximate result with the line: Treal = A * Tmeasured + B
+            The line is fitted on the device from reference readings, see
+            calibration.h. Until then constants A & B are in the runtime
+            configuration, defaults in the config header file
+            */
+
+            if (!calibration_apply(CAL_TEMP, values.temp, &temp))
+                temp = config_get_float(CONFIG_TEMP_K_A) * values.temp + config_get_float(CONFIG_TEMP_K_B);
+            calibration_apply(CAL_PRES, values.pres, &pres);
+            pres_sea = sea_level_pressure(pres, temp, config_get_float(CONFIG_SITE_ALTITUDE));
+
+            // pressure is smoothed in the published unit, mmHg
+            filter_update(&temp_filter, temp);
+            filter_update(&pres_filter, pres / PA_PER_MMHG);
+            adaptive_update(ADAPTIVE_TEMP, temp, now);
+            adaptive_update(ADAPTIVE_PRES, pres, now);
+            alarm_sample(CAL_TEMP, temp, now);
+            alarm_sample(CAL_PRES, pres / PA_PER_MMHG, now);
+
+            BLOGV(LOG_TAG, "T float: %f", values.temp);
+            BLOGV(LOG_TAG, "T float adjusted: %f", temp);
+
+            BLOGV(LOG_TAG, "P float: %f", values.pres);
+        }
+        else
+            ESP_LOGW(LOG_TAG, "invalid sample from bmp280 (%s), keeping previous values", sample_status_name(status));
 
         int fails_count = 0;
 
@@ -30,24 +87,22 @@ void bmp_task()
             }
         };
 
-        /*
-        Adjust temperature.
-        Use Less Squares method for a series of real measurements
-        Approximate result with the line: Treal = A * Tmeasured + B
-        Constants A & B are in config header file
-        */
-
-        bmp_values.temp = TEMP_K_A * values.temp + TEMP_K_B;
-        bmp_values.pres = values.pres;
-        bmp_values.updated = true;
+        bmp_values.status = status;
+        bmp_values.stats = stats;
 
-        ESP_LOGV(LOG_TAG, "T float: %f", values.temp);
-        ESP_LOGV(LOG_TAG, "T float adjusted: %f", bmp_values.temp);
-
-        ESP_LOGV(LOG_TAG, "P float: %f", values.pres);
+        if (status == SAMPLE_VALID)
+        {
+            bmp_values.temp = temp;
+            bmp_values.pres = pres;
+            bmp_values.pres_sea = pres_sea;
+            filter_get_output(&temp_filter, &bmp_values.temp_filtered);
+            filter_get_output(&pres_filter, &bmp_values.pres_filtered);
+            bmp_values.timestamp = now;
+            bmp_values.updated = true;
+        }
 
         xSemaphoreGive(bmp_values.lock);
 
-        vTaskDelay(BMP_TASK_DELAY / portTICK_PERIOD_MS);
+        adaptive_delay(ADAPTIVE_BMP);
     }
 }
@@ -0,0 +1,255 @@
+#include "esp_log.h"
+#define LOG_TAG "request"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_timer.h"
+#include "freertos/queue.h"
+
+#include "dust_sensor.h"
+#include "request.h"
+
+#define REQUEST_MAX_COMMAND 128
+
+typedef struct
+{
+    char id[REQUEST_MAX_ID + 1];
+    uint8_t sensors; // bits by adaptive_sensor_t
+} request_t;
+
+static const char *const sensor_names[ADAPTIVE_SENSOR_COUNT] = {
+    [ADAPTIVE_DUST] = "dust",
+    [ADAPTIVE_CO2] = "co2",
+    [ADAPTIVE_BMP] = "bmp",
+};
+
+static const config_key_t min_delays[ADAPTIVE_SENSOR_COUNT] = {
+    [ADAPTIVE_DUST] = CONFIG_DUST_MIN_DELAY,
+    [ADAPTIVE_CO2] = CONFIG_CO2_MIN_DELAY,
+    [ADAPTIVE_BMP] = CONFIG_BMP_MIN_DELAY,
+};
+
+static const EventBits_t request_bits[ADAPTIVE_SENSOR_COUNT] = {
+    [ADAPTIVE_DUST] = REQUEST_DUST_BIT,
+    [ADAPTIVE_CO2] = REQUEST_CO2_BIT,
+    [ADAPTIVE_BMP] = REQUEST_BMP_BIT,
+};
+
+static const EventBits_t sampled_bits[ADAPTIVE_SENSOR_COUNT] = {
+    [ADAPTIVE_DUST] = SAMPLED_DUST_BIT,
+    [ADAPTIVE_CO2] = SAMPLED_CO2_BIT,
+    [ADAPTIVE_BMP] = SAMPLED_BMP_BIT,
+};
+
+static QueueHandle_t request_queue;
+
+static void put(char *buffer, size_t size, size_t *used, const char *format, ...)
+{
+    va_list args;
+    int length;
+
+    va_start(args, format);
+    length = vsnprintf(buffer + (*used < size ? *used : size), *used < size ? size - *used : 0, format, args);
+    va_end(args);
+
+    if (length > 0)
+        *used += length;
+}
+
+static void publish_reply(const char *value)
+{
+    char topic[128];
+
+    snprintf(topic, sizeof(topic), "%s/%s", MQTT_TOPIC_PREFIX, MQTT_TOPIC_SAMPLE);
+    if (esp_mqtt_client_publish(mqtt_client, topic, value, 0, 1, 0) < 0)
+        ESP_LOGW(LOG_TAG, "can't publish %s", value);
+}
+
+static void publish_error(const char *id, const char *error)
+{
+    char value[96];
+
+    snprintf(value, sizeof(value), "{\"id\":\"%s\",\"error\":\"%s\"}", id, error);
+    publish_reply(value);
+}
+
+// the ID goes into the JSON reply as it is
+static bool id_valid(const char *id)
+{
+    if (strlen(id) > REQUEST_MAX_ID)
+        return false;
+
+    for (; *id; id++)
+    {
+        if (*id < ' ' || *id == '"' || *id == '\\')
+            return false;
+    }
+
+    return true;
+}
+
+int request_command(const char *data, int length)
+{
+    char command[REQUEST_MAX_COMMAND];
+    request_t request = {"", 0};
+    const char *error = NULL;
+    char *saveptr;
+
+    if (length >= (int)sizeof(command))
+    {
+        ESP_LOGW(LOG_TAG, "request of %d bytes is too long", length);
+        publish_error("", "too long");
+        return 1;
+    }
+
+    memcpy(command, data, length);
+    command[length] = 0;
+
+    for (char *word = strtok_r(command, " ,\r\n\t", &saveptr); word; word = strtok_r(NULL, " ,\r\n\t", &saveptr))
+    {
+        int sensor;
+
+        if (!strncmp(word, "id=", 3))
+        {
+            if (id_valid(word + 3))
+                strcpy(request.id, word + 3);
+            else
+                error = "bad id";
+            continue;
+        }
+
+        for (sensor = 0; sensor < ADAPTIVE_SENSOR_COUNT; sensor++)
+        {
+            if (!strcmp(word, sensor_names[sensor]))
+                break;
+        }
+
+        if (sensor < ADAPTIVE_SENSOR_COUNT)
+            request.sensors |= 1 << sensor;
+        else
+        {
+            ESP_LOGW(LOG_TAG, "rejected %s (unknown sensor)", word);
+            error = "unknown sensor";
+        }
+    }
+
+    if (!request.sensors)
+        request.sensors = (1 << ADAPTIVE_SENSOR_COUNT) - 1;
+
+    if (!error && xQueueSend(request_queue, &request, 0) != pdTRUE)
+        error = "busy";
+
+    if (error)
+    {
+        publish_error(request.id, error);
+        return 1;
+    }
+
+    return 0;
+}
+
+static void format_sensor(adaptive_sensor_t sensor, char *buffer, size_t size, size_t *used)
+{
+    sample_status_t status = SAMPLE_NONE;
+    int64_t timestamp = 0;
+    char values[64] = "";
+
+    switch (sensor)
+    {
+    case ADAPTIVE_DUST:
+        if (xSemaphoreTake(dust_values.lock, SEMAPHORE_TIMEOUT / portTICK_PERIOD_MS) != pdTRUE)
+            break;
+        status = dust_values.status;
+        timestamp = dust_values.timestamp;
+        snprintf(values, sizeof(values), ",\"pm25\":%d,\"pm100\":%d", dust_values.pm25, dust_values.pm100);
+        xSemaphoreGive(dust_values.lock);
+        break;
+    case ADAPTIVE_CO2:
+        if (xSemaphoreTake(co2_values.lock, SEMAPHORE_TIMEOUT / portTICK_PERIOD_MS) != pdTRUE)
+            break;
+        status = co2_values.status;
+        timestamp = co2_values.timestamp;
+        snprintf(values, sizeof(values), ",\"ppm\":%d", co2_values.ppm);
+        xSemaphoreGive(co2_values.lock);
+        break;
+    default:
+        if (xSemaphoreTake(bmp_values.lock, SEMAPHORE_TIMEOUT / portTICK_PERIOD_MS) != pdTRUE)
+            break;
+        status = bmp_values.status;
+        timestamp = bmp_values.timestamp;
+        snprintf(values, sizeof(values), ",\"temp\":%0.1f,\"pres\":%0.0f", bmp_values.temp,
+                 bmp_values.pres / PA_PER_MMHG);
+        xSemaphoreGive(bmp_values.lock);
+        break;
+    }
+
+    put(buffer, size, used, ",\"%s\":{\"status\":\"%s\"", sensor_names[sensor], sample_status_name(status));
+    if (timestamp)
+        put(buffer, size, used, ",\"time\":%lld", (long long)(timestamp / 1000));
+    put(buffer, size, used, "%s}", status == SAMPLE_VALID ? values : "");
+}
+
+void request_init(void)
+{
+    request_queue = xQueueCreate(REQUEST_QUEUE_LENGTH, sizeof(request_t));
+}
+
+void request_task()
+{
+    char value[384];
+
+    ESP_LOGI(LOG_TAG, "task started");
+
+    for (;;)
+    {
+        request_t request;
+        EventBits_t wake = 0;
+        EventBits_t wait = 0;
+        uint32_t now;
+        size_t used = 0;
+
+        if (xQueueReceive(request_queue, &request, portMAX_DELAY) != pdTRUE)
+            continue;
+
+        now = esp_timer_get_time() / 1000;
+        for (int sensor = 0; sensor < ADAPTIVE_SENSOR_COUNT; sensor++)
+        {
+            uint32_t read = adaptive_last_read(sensor);
+
+            if (!(request.sensors & 1 << sensor))
+                continue;
+
+            /*
+            Within the minimum period of the last read, valid or failed, the
+            sensor is not read again; the request gets the last sample.
+            */
+            if (read && now - read < (uint32_t)config_get_int(min_delays[sensor]))
+                continue;
+
+            wake |= request_bits[sensor];
+            wait |= sampled_bits[sensor];
+        }
+
+        if (wait)
+        {
+            BLOGD(LOG_TAG, "request %s wakes 0x%x", request.id, (unsigned)wake);
+            xEventGroupClearBits(eg_app_status, wait);
+            xEventGroupSetBits(eg_app_status, wake);
+            if ((xEventGroupWaitBits(eg_app_status, wait, pdTRUE, pdTRUE, REQUEST_TIMEOUT / portTICK_PERIOD_MS) &
+                 wait) != wait)
+                ESP_LOGW(LOG_TAG, "request %s timed out", request.id);
+        }
+
+        put(value, sizeof(value), &used, "{\"id\":\"%s\"", request.id);
+        for (int sensor = 0; sensor < ADAPTIVE_SENSOR_COUNT; sensor++)
+        {
+            if (request.sensors & 1 << sensor)
+                format_sensor(sensor, value, sizeof(value), &used);
+        }
+        put(value, sizeof(value), &used, "}");
+
+        publish_reply(value);
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef _REQUEST_H
+#define _REQUEST_H
+
+#include "adaptive.h"
+
+/*
+Samples on demand. A message on <prefix>/<MQTT_TOPIC_SAMPLE>/get names the
+sensors (dust, co2, bmp; all if none) and optionally a correlation ID,
+separated by spaces or commas, e.g. "id=fan2 co2 dust". request_task()
+answers it on <prefix>/<MQTT_TOPIC_SAMPLE>, at QoS 1:
+
+    {"id":"fan2","co2":{"status":"valid","time":123456,"ppm":812},
+     "dust":{"status":"valid","time":120950,"pm25":7,"pm100":11}}
+
+with "temp" and "pres" (mmHg) for bmp, "time" when the sample was taken,
+in milliseconds since boot, and the values only if "status" is "valid".
+
+The sensor tasks take the samples, out of their cycle, so the drivers keep
+a single user: a sensor read, successfully or not, within its
+"<sensor>_min_delay" setting is answered with its last sample, others are
+woken with their REQUEST_*_BIT and answered with the first sample started
+after the request, or their last one after REQUEST_TIMEOUT. The sensor
+task itself also keeps "<sensor>_min_delay" between a read and a requested
+one, see adaptive_delay(), so a sensor is never read more often than its
+minimum period, however many requests come and whether its reads fail.
+Requests are answered in order; with REQUEST_QUEUE_LENGTH waiting a
+further one is refused at once with {"id":..,"error":"busy"}.
+*/
+
+#define REQUEST_MAX_ID 32
+
+void request_init(void);
+
+// queues a request, returns 0, or 1 if it was refused
+int request_command(const char *data, int length);
+
+void request_task();
+
+#endif // _REQUEST_H
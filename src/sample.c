@@ -0,0 +1,69 @@
+#include "esp_err.h"
+#include "esp_timer.h"
+
+#include "sample.h"
+
+static const char *sample_status_names[] = {
+    [SAMPLE_NONE] = "none",
+    [SAMPLE_VALID] = "valid",
+    [SAMPLE_STALE] = "stale",
+    [SAMPLE_CHECKSUM_ERROR] = "checksum",
+    [SAMPLE_TIMEOUT] = "timeout",
+    [SAMPLE_OUT_OF_RANGE] = "range",
+};
+
+const char *sample_status_name(sample_status_t status)
+{
+    if (status > SAMPLE_OUT_OF_RANGE)
+        return "unknown";
+
+    return sample_status_names[status];
+}
+
+sample_status_t sample_status_from_err(int err)
+{
+    switch (err)
+    {
+    case ESP_OK:
+        return SAMPLE_VALID;
+    case ESP_ERR_INVALID_CRC:
+        return SAMPLE_CHECKSUM_ERROR;
+    case ESP_ERR_INVALID_RESPONSE:
+        return SAMPLE_OUT_OF_RANGE;
+    default:
+        return SAMPLE_TIMEOUT;
+    }
+}
+
+void sample_stats_count(sample_stats_t *stats, sample_status_t status)
+{
+    stats->reads++;
+
+    switch (status)
+    {
+    case SAMPLE_CHECKSUM_ERROR:
+        stats->checksum_errors++;
+        break;
+    case SAMPLE_TIMEOUT:
+        stats->timeouts++;
+        break;
+    case SAMPLE_OUT_OF_RANGE:
+        stats->out_of_range++;
+        break;
+    default:
+        break;
+    }
+}
+
+sample_status_t sample_effective_status(sample_status_t status, int64_t timestamp, uint32_t max_age)
+{
+    if (status == SAMPLE_VALID && esp_timer_get_time() - timestamp > (int64_t)max_age * 1000)
+        return SAMPLE_STALE;
+
+    return status;
+}
+
+uint32_t sample_age(int64_t timestamp)
+{
+    return (esp_timer_get_time() - timestamp) / 1000000;
+}
@@ -0,0 +1,54 @@
+#ifndef _SAMPLE_H
+#define _SAMPLE_H
+
+#include <stdint.h>
+
+/*
+Quality of the last sample of a sensor. Only SAMPLE_VALID values are
+published as numbers.
+*/
+typedef enum
+{
+    SAMPLE_NONE = 0, // nothing read since boot
+    SAMPLE_VALID,
+    SAMPLE_STALE,
+    SAMPLE_CHECKSUM_ERROR,
+    SAMPLE_TIMEOUT,
+    SAMPLE_OUT_OF_RANGE,
+} sample_status_t;
+
+/*
+Per-sensor counters of frame reads and failures since boot.
+*/
+typedef struct
+{
+    uint32_t reads;
+    uint32_t checksum_errors;
+    uint32_t timeouts;
+    uint32_t out_of_range;
+} sample_stats_t;
+
+const char *sample_status_name(sample_status_t status);
+
+/*
+Maps an error returned by a driver *_fill_values() to a sample status.
+*/
+sample_status_t sample_status_from_err(int err);
+
+/*
+Counts one read with the given outcome.
+*/
+void sample_stats_count(sample_stats_t *stats, sample_status_t status);
+
+/*
+SAMPLE_STALE if a valid sample taken at `timestamp` (esp_timer_get_time())
+is older than `max_age` milliseconds, `status` otherwise.
+*/
+sample_status_t sample_effective_status(sample_status_t status, int64_t timestamp, uint32_t max_age);
+
+/*
+Age of a sample in seconds.
+*/
+uint32_t sample_age(int64_t timestamp);
+
+#endif // _SAMPLE_H
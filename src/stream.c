@@ -0,0 +1,309 @@
+#include "esp_log.h"
+#define LOG_TAG "stream"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "esp_timer.h"
+
+#include "dust_sensor.h"
+#include "stream.h"
+
+#define STREAM_HEAD "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\n\r\n"
+#define STREAM_EVENT_MAX 192 // longest event, fits a client buffer with a dropped notice
+
+typedef struct
+{
+    int fd;          // -1 for a free slot
+    uint32_t head;   // ring position of the next event to send
+    uint32_t events; // events up to head
+    uint32_t dropped; // events skipped and not reported yet
+    char buffer[STREAM_CLIENT_BUFFER]; // whole events, being sent
+    int length;
+    int sent;
+    int64_t progress; // last time the client took data or had none waiting
+    bool closing;     // until the server calls stream_closed()
+} stream_client_t;
+
+static httpd_handle_t stream_server;
+
+// the ring, written by the sensor tasks
+static SemaphoreHandle_t ring_lock;
+static char ring[STREAM_BUFFER_SIZE];
+static uint32_t ring_head; // bytes ever written
+static uint32_t ring_events;
+
+// the clients, serviced by the stream task
+static SemaphoreHandle_t clients_lock;
+static stream_client_t clients[STREAM_MAX_CLIENTS];
+static atomic_int client_count;
+
+static SemaphoreHandle_t stream_data; // given on new events and clients
+
+static void ring_put(const char *data, int length)
+{
+    uint32_t at = ring_head % STREAM_BUFFER_SIZE;
+
+    if (at + length <= STREAM_BUFFER_SIZE)
+        memcpy(ring + at, data, length);
+    else
+    {
+        memcpy(ring + at, data, STREAM_BUFFER_SIZE - at);
+        memcpy(ring, data + STREAM_BUFFER_SIZE - at, length - (STREAM_BUFFER_SIZE - at));
+    }
+    ring_head += length;
+}
+
+static void stream_event(const char *name, const char *format, ...)
+{
+    char data[STREAM_EVENT_MAX];
+    char head[48];
+    va_list args;
+    int length;
+    int head_length;
+
+    // the data is formatted before the lock is tried, the short head with the id under it
+    length = snprintf(data, sizeof(data), "{\"t\":%u,", (uint32_t)(esp_timer_get_time() / 1000));
+    va_start(args, format);
+    length += vsnprintf(data + length, sizeof(data) - length, format, args);
+    va_end(args);
+    if (length + 3 >= (int)sizeof(data))
+        return;
+    memcpy(data + length, "}\n\n", 3);
+    length += 3;
+
+    // busy only while the stream task copies out, the event is lost for every client
+    if (xSemaphoreTake(ring_lock, 0) != pdTRUE)
+        return;
+
+    head_length = snprintf(head, sizeof(head), "id: %u\nevent: %s\ndata: ", ring_events, name);
+    ring_put(head, head_length);
+    ring_put(data, length);
+    ring_events++;
+
+    xSemaphoreGive(ring_lock);
+    xSemaphoreGive(stream_data);
+}
+
+static bool stream_idle(void)
+{
+    return !STREAM_ENABLE || !atomic_load(&client_count);
+}
+
+void stream_dust(sample_status_t status, uint16_t pm25, uint16_t pm100)
+{
+    if (stream_idle())
+        return;
+
+    if (status == SAMPLE_VALID || status == SAMPLE_OUT_OF_RANGE)
+        stream_event("dust", "\"status\":\"%s\",\"pm25\":%u,\"pm10\":%u", sample_status_name(status), pm25, pm100);
+    else
+        stream_event("dust", "\"status\":\"%s\"", sample_status_name(status));
+}
+
+void stream_co2(sample_status_t status, uint16_t ppm)
+{
+    if (stream_idle())
+        return;
+
+    if (status == SAMPLE_VALID || status == SAMPLE_OUT_OF_RANGE)
+        stream_event("co2", "\"status\":\"%s\",\"ppm\":%u", sample_status_name(status), ppm);
+    else
+        stream_event("co2", "\"status\":\"%s\"", sample_status_name(status));
+}
+
+void stream_bmp(sample_status_t status, double temp, double pres)
+{
+    if (stream_idle())
+        return;
+
+    if (status == SAMPLE_VALID || status == SAMPLE_OUT_OF_RANGE)
+        stream_event("bmp", "\"status\":\"%s\",\"temp\":%.2f,\"pres\":%.1f", sample_status_name(status), temp, pres);
+    else
+        stream_event("bmp", "\"status\":\"%s\"", sample_status_name(status));
+}
+
+// copies whole events from the ring into the empty buffer of the client
+static void stream_fill(stream_client_t *client)
+{
+    uint32_t available;
+    int copied = 0;
+    int end = 0;
+    uint32_t events = 0;
+
+    client->length = client->sent = 0;
+
+    xSemaphoreTake(ring_lock, portMAX_DELAY);
+
+    if (ring_head - client->head > STREAM_BUFFER_SIZE)
+    {
+        client->dropped += ring_events - client->events;
+        client->head = ring_head;
+        client->events = ring_events;
+    }
+
+    if (client->dropped)
+    {
+        client->length = snprintf(client->buffer, sizeof(client->buffer), "event: dropped\ndata: {\"events\":%u}\n\n",
+                                  client->dropped);
+        client->dropped = 0;
+    }
+
+    available = ring_head - client->head;
+    while (copied < (int)available && client->length + copied < (int)sizeof(client->buffer))
+    {
+        char c = ring[(client->head + copied) % STREAM_BUFFER_SIZE];
+
+        client->buffer[client->length + copied++] = c;
+        if (c == '\n' && copied > 1 && client->buffer[client->length + copied - 2] == '\n')
+        {
+            end = copied;
+            events++;
+        }
+    }
+
+    xSemaphoreGive(ring_lock);
+
+    client->head += end;
+    client->events += events;
+    client->length += end;
+}
+
+// sends what the client takes, returns true if it has data waiting
+static bool stream_send(stream_client_t *client, int64_t now)
+{
+    for (;;)
+    {
+        int n;
+
+        if (client->sent == client->length)
+        {
+            stream_fill(client);
+            if (!client->length)
+            {
+                client->progress = now;
+                return false;
+            }
+        }
+
+        n = httpd_socket_send(stream_server, client->fd, client->buffer + client->sent, client->length - client->sent,
+                              MSG_DONTWAIT);
+        if (n > 0)
+        {
+            client->sent += n;
+            client->progress = now;
+            continue;
+        }
+
+        if (n == HTTPD_SOCK_ERR_TIMEOUT && now - client->progress < STREAM_STALL_TIMEOUT * 1000LL)
+            return true;
+
+        ESP_LOGI(LOG_TAG, "closing client %d, %s", client->fd, n == HTTPD_SOCK_ERR_TIMEOUT ? "stalled" : "send failed");
+        httpd_sess_trigger_close(stream_server, client->fd);
+        client->closing = true;
+
+        return false;
+    }
+}
+
+static void stream_task(void *arg)
+{
+    for (;;)
+    {
+        bool waiting = false;
+        int64_t now = esp_timer_get_time();
+
+        xSemaphoreTake(clients_lock, portMAX_DELAY);
+        for (int i = 0; i < STREAM_MAX_CLIENTS; i++)
+        {
+            if (clients[i].fd >= 0 && !clients[i].closing)
+                waiting |= stream_send(&clients[i], now);
+        }
+        xSemaphoreGive(clients_lock);
+
+        // blocked clients are retried, otherwise only new events wake the task
+        xSemaphoreTake(stream_data, waiting ? STREAM_RETRY_DELAY / portTICK_PERIOD_MS : portMAX_DELAY);
+    }
+}
+
+static void stream_closed(void *ctx)
+{
+    stream_client_t *client = ctx;
+
+    xSemaphoreTake(clients_lock, portMAX_DELAY);
+    ESP_LOGI(LOG_TAG, "client %d gone", client->fd);
+    client->fd = -1;
+    atomic_fetch_sub(&client_count, 1);
+    xSemaphoreGive(clients_lock);
+}
+
+static esp_err_t stream_handler(httpd_req_t *req)
+{
+    stream_client_t *client = NULL;
+
+    xSemaphoreTake(clients_lock, portMAX_DELAY);
+    for (int i = 0; i < STREAM_MAX_CLIENTS && !client; i++)
+    {
+        if (clients[i].fd < 0)
+            client = &clients[i];
+    }
+    xSemaphoreGive(clients_lock);
+
+    if (!client)
+    {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_type(req, "text/plain");
+        return httpd_resp_send(req, "too many stream clients", HTTPD_RESP_USE_STRLEN);
+    }
+
+    if (httpd_send(req, STREAM_HEAD, sizeof(STREAM_HEAD) - 1) != (int)sizeof(STREAM_HEAD) - 1)
+        return ESP_FAIL;
+
+    xSemaphoreTake(clients_lock, portMAX_DELAY);
+    xSemaphoreTake(ring_lock, portMAX_DELAY);
+    client->head = ring_head;
+    client->events = ring_events;
+    xSemaphoreGive(ring_lock);
+    client->dropped = 0;
+    client->closing = false;
+    client->length = client->sent = 0;
+    client->progress = esp_timer_get_time();
+    client->fd = httpd_req_to_sockfd(req);
+    atomic_fetch_add(&client_count, 1);
+    xSemaphoreGive(clients_lock);
+
+    req->sess_ctx = client;
+    req->free_ctx = stream_closed;
+
+    ESP_LOGI(LOG_TAG, "client %d connected", client->fd);
+    xSemaphoreGive(stream_data);
+
+    return ESP_OK;
+}
+
+esp_err_t stream_register(httpd_handle_t server)
+{
+    static const httpd_uri_t uri = {
+        .uri = "/stream",
+        .method = HTTP_GET,
+        .handler = stream_handler,
+    };
+
+    stream_server = server;
+
+    ring_lock = xSemaphoreCreateBinary();
+    clients_lock = xSemaphoreCreateBinary();
+    stream_data = xSemaphoreCreateBinary();
+    xSemaphoreGive(ring_lock);
+    xSemaphoreGive(clients_lock);
+
+    for (int i = 0; i < STREAM_MAX_CLIENTS; i++)
+        clients[i].fd = -1;
+
+    if (xTaskCreate(stream_task, "stream_task", 4096, NULL, STREAM_PRIORITY, NULL) != pdPASS)
+        return ESP_ERR_NO_MEM;
+
+    return httpd_register_uri_handler(server, &uri);
+}
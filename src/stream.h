@@ -0,0 +1,43 @@
+#ifndef _STREAM_H
+#define _STREAM_H
+
+#include <stdint.h>
+
+#include "esp_http_server.h"
+
+#include "sample.h"
+
+/*
+Live samples for diagnostics as Server-Sent Events on /stream, when
+STREAM_ENABLE is set. Every frame the dust, CO2 and pressure paths read is
+pushed as it is produced, before aggregation, calibration and filtering,
+failed ones included:
+
+    id: 42
+    event: dust
+    data: {"t":123456,"status":"valid","pm25":12,"pm10":20}
+
+`t` is milliseconds since boot, ids count the events since boot. For a
+higher rate shorten dust_delay and the others in the runtime configuration
+(config.h) while watching.
+
+Producers never wait: with no client they return at once, otherwise they
+append the event to a ring of STREAM_BUFFER_SIZE bytes under a lock they
+only try, and drop it if the stream task holds it. The stream task sends
+the ring to up to STREAM_MAX_CLIENTS clients over non-blocking sockets, a
+whole event at a time. A client that falls more than the ring behind skips
+to the newest events and gets an "event: dropped" with the number it
+missed; one that accepts nothing for STREAM_STALL_TIMEOUT is disconnected.
+*/
+
+// values are only sent for valid and out of range frames
+void stream_dust(sample_status_t status, uint16_t pm25, uint16_t pm100);
+
+void stream_co2(sample_status_t status, uint16_t ppm);
+
+void stream_bmp(sample_status_t status, double temp, double pres);
+
+// registers /stream and starts the stream task
+esp_err_t stream_register(httpd_handle_t server);
+
+#endif // _STREAM_H
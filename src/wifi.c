@@ -1,12 +1,11 @@
-#define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
 #include "esp_log.h"
 #define LOG_TAG "TASK: wifi"
 
-#include "nvs_flash.h"
 #include "esp_wifi.h"
 #include "freertos/event_groups.h"
 
 #include "dust_sensor.h"
+#include "http.h"
 
 #define WIFI_CONNECT_MAXIMUM_RETRY 100
 
@@ -57,7 +56,6 @@ static void wifi_event_handler(void *arg, esp_event_base_t event_base,
             ESP_LOGI(LOG_TAG, "got ip:%s",
                      ip4addr_ntoa((ip4_addr_t *)&event->ip_info.ip));
             wifi_connect_retry_counter = 0;
-            ESP_LOGD(LOG_TAG, "set bits 2");
             if (!eg_app_status)
             {
                 ESP_LOGE(LOG_TAG, "esp_app_status is NULL!");
@@ -77,15 +75,7 @@ static void wifi_event_handler(void *arg, esp_event_base_t event_base,
 void network_task()
 {
 
-    //Initialize NVS for internal use of WiFi
-    esp_err_t ret = nvs_flash_init();
-    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND)
-    {
-        ESP_ERROR_CHECK(nvs_flash_erase());
-        ret = nvs_flash_init();
-    }
-    ESP_ERROR_CHECK(ret);
-
+    // NVS, which WiFi needs, is initialized in app_main()
     ESP_LOGI(LOG_TAG, "starting WiFi in station mode");
 
     tcpip_adapter_init();
@@ -109,6 +99,8 @@ void network_task()
 
     ESP_LOGI(LOG_TAG, "wifi in station mode started");
 
+    http_start();
+
     for (;;)
     {
         vTaskDelay(1000 / portTICK_PERIOD_MS);